@@ -0,0 +1,192 @@
+#include "bandwidth_estimator.h"
+#include <algorithm>
+#include <cstdlib>
+
+namespace
+{
+    // One probe up, one drain of what it queued, then cruise at the estimate
+    const double kProbeGains[] = {1.25, 0.75, 1.0, 1.0, 1.0, 1.0, 1.0, 1.0};
+    const size_t kProbeCycle = sizeof(kProbeGains) / sizeof(kProbeGains[0]);
+    const size_t kFirstCruisePhase = 2;
+}
+
+const char *BandwidthEstimator::modeName(Mode mode)
+{
+    switch (mode)
+    {
+    case Mode::Startup:
+        return "启动";
+    case Mode::Drain:
+        return "排空";
+    case Mode::ProbeRtt:
+        return "测延迟";
+    default:
+        return "探测";
+    }
+}
+
+bool BandwidthEstimator::update(const SteamNetConnectionRealTimeStatus_t &status, Clock::time_point now)
+{
+    if (status.m_eState != k_ESteamNetworkingConnectionState_Connected)
+    {
+        return false;
+    }
+    // Remote quality is the share of our packets the peer received
+    float quality = status.m_flConnectionQualityRemote >= 0.0f ? status.m_flConnectionQualityRemote : 1.0f;
+    state_.loss = state_.loss * 0.7f + (1.0f - quality) * 0.3f;
+    // Delivered = sent minus what joined the unacknowledged flight; the send
+    // rate alone would count bytes still sitting in a queue on the path
+    double sent = std::max(0.0f, status.m_flOutBytesPerSec);
+    if (lastSample_ != Clock::time_point())
+    {
+        double seconds = std::chrono::duration<double>(now - lastSample_).count();
+        if (seconds > 0.0)
+        {
+            sent -= (status.m_cbSentUnackedReliable - lastUnacked_) / seconds;
+        }
+    }
+    lastSample_ = now;
+    lastUnacked_ = status.m_cbSentUnackedReliable;
+    state_.delivery = std::max(0.0, sent) * quality;
+    state_.appLimited = status.m_cbPendingReliable + status.m_cbPendingUnreliable < kBacklogBytes;
+    state_.rttMs = status.m_nPing;
+
+    if (state_.mode == Mode::ProbeBandwidth && !rtt_.empty() && now - rtt_.front().at > kWindow)
+    {
+        // A standing queue would hide the real minimum: drain it and measure again
+        rtt_.clear();
+        state_.mode = Mode::ProbeRtt;
+        state_.gain = kProbeRttGain;
+        probeRttEnd_ = now + kProbeRttDuration;
+    }
+    addRttSample(status.m_nPing, now);
+    addBandwidthSample(state_.delivery, state_.appLimited, now);
+
+    bool queueing = queueBuilt();
+    if (queueing && state_.loss > kLossThreshold && !state_.appLimited && state_.mode != Mode::Startup)
+    {
+        // A queue that overflows at the estimate: the path carries less now.
+        // Loss alone may be random (Wi-Fi) and does not lower the estimate.
+        bandwidth_.clear();
+        bandwidth_.push_back(RateSample{now, state_.delivery});
+        state_.bottleneck = state_.delivery;
+        state_.mode = Mode::Drain;
+        state_.gain = kDrainGain;
+    }
+    advanceMode(queueing, now);
+
+    double rate = state_.bottleneck > 0.0 ? state_.bottleneck * state_.gain : kDefaultSendRate;
+    if (state_.mode == Mode::Startup)
+    {
+        rate = std::max(rate, static_cast<double>(kDefaultSendRate));
+    }
+    state_.sendRate = static_cast<int>(std::min(std::max(rate, static_cast<double>(kMinSendRate)),
+                                                static_cast<double>(kMaxSendRate)));
+
+    if (std::abs(state_.sendRate - appliedRate_) < appliedRate_ * kApplyThreshold)
+    {
+        return false;
+    }
+    appliedRate_ = state_.sendRate;
+    return true;
+}
+
+void BandwidthEstimator::addBandwidthSample(double rate, bool appLimited, Clock::time_point now)
+{
+    // A sample with nothing queued only says the path carried at least that much
+    if (appLimited && rate <= state_.bottleneck)
+    {
+        return;
+    }
+    while (!bandwidth_.empty() && now - bandwidth_.front().at > kWindow)
+    {
+        bandwidth_.pop_front();
+    }
+    while (!bandwidth_.empty() && bandwidth_.back().rate <= rate)
+    {
+        bandwidth_.pop_back();
+    }
+    bandwidth_.push_back(RateSample{now, rate});
+    state_.bottleneck = bandwidth_.front().rate;
+}
+
+void BandwidthEstimator::addRttSample(int ms, Clock::time_point now)
+{
+    if (ms < 0)
+    {
+        return;
+    }
+    while (!rtt_.empty() && now - rtt_.front().at > kWindow)
+    {
+        rtt_.pop_front();
+    }
+    while (!rtt_.empty() && rtt_.back().ms >= ms)
+    {
+        rtt_.pop_back();
+    }
+    rtt_.push_back(RttSample{now, ms});
+    state_.minRttMs = rtt_.front().ms;
+}
+
+bool BandwidthEstimator::queueBuilt() const
+{
+    // Ping above the floor is time spent in a queue somewhere on the path
+    return state_.minRttMs >= 0 && state_.rttMs > state_.minRttMs + std::max(kQueueDelayMs, state_.minRttMs / 2);
+}
+
+void BandwidthEstimator::advanceMode(bool queueing, Clock::time_point now)
+{
+    switch (state_.mode)
+    {
+    case Mode::Startup:
+        if (!state_.appLimited)
+        {
+            if (state_.bottleneck >= fullBandwidth_ * kFullBandwidthGrowth)
+            {
+                fullBandwidth_ = state_.bottleneck;
+                fullBandwidthRounds_ = 0;
+            }
+            else
+            {
+                fullBandwidthRounds_++;
+            }
+        }
+        if (fullBandwidthRounds_ >= kFullBandwidthRounds ||
+            (!state_.appLimited && state_.loss > kLossThreshold))
+        {
+            state_.mode = Mode::Drain;
+            state_.gain = kDrainGain;
+        }
+        break;
+    case Mode::Drain:
+        if (!queueing)
+        {
+            state_.mode = Mode::ProbeBandwidth;
+            cycleIndex_ = kFirstCruisePhase;
+            cycleStart_ = now;
+            state_.gain = kProbeGains[cycleIndex_];
+        }
+        break;
+    case Mode::ProbeBandwidth:
+    {
+        auto phase = std::max<Clock::duration>(kSampleInterval, std::chrono::milliseconds(std::max(0, state_.minRttMs)));
+        // A probe that builds a queue ends early
+        if (now - cycleStart_ >= phase || (state_.gain > 1.0 && queueing))
+        {
+            cycleIndex_ = (cycleIndex_ + 1) % kProbeCycle;
+            cycleStart_ = now;
+        }
+        state_.gain = kProbeGains[cycleIndex_];
+        break;
+    }
+    case Mode::ProbeRtt:
+        if (now >= probeRttEnd_)
+        {
+            state_.mode = Mode::ProbeBandwidth;
+            cycleIndex_ = kFirstCruisePhase;
+            cycleStart_ = now;
+            state_.gain = kProbeGains[cycleIndex_];
+        }
+        break;
+    }
+}
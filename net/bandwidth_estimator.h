@@ -0,0 +1,95 @@
+#pragma once
+
+#include <chrono>
+#include <deque>
+#include <steamnetworkingtypes.h>
+
+// BBR-style model of one connection's path, fed from real-time status
+// samples. Steam sends at a fixed rate clamped to SendRateMin/Max (256 KB/s by
+// default, the SDK suggests setting both to the same value), so the estimator
+// acts as the congestion controller: it tracks the bottleneck bandwidth (max
+// delivery rate over a window) and the minimum RTT, and sets the pacing rate
+// to bottleneck x gain. Startup doubles the rate until delivery stops growing,
+// Drain empties the queue that built up, then ProbeBandwidth cycles the gain
+// to look for more capacity. When the minimum RTT has not been seen for a
+// window, ProbeRtt halves the rate briefly to empty any standing queue and
+// measure it again. Loss together with queueing delay above the minimum RTT
+// cuts the estimate, so a weak relay is not overdriven.
+class BandwidthEstimator
+{
+public:
+    using Clock = std::chrono::steady_clock;
+
+    enum class Mode
+    {
+        Startup,
+        Drain,
+        ProbeBandwidth,
+        ProbeRtt,
+    };
+
+    struct State
+    {
+        Mode mode = Mode::Startup;
+        double bottleneck = 0.0; // bytes per second, windowed max delivery rate
+        double delivery = 0.0;   // latest sample
+        int minRttMs = -1;
+        int rttMs = -1;
+        float loss = 0.0f;
+        bool appLimited = true;  // latest sample had nothing queued
+        double gain = kStartupGain;
+        int sendRate = kDefaultSendRate; // what SendRateMin/Max should be
+    };
+
+    // Take one sample. Returns true when sendRate moved enough to re-apply.
+    bool update(const SteamNetConnectionRealTimeStatus_t &status, Clock::time_point now);
+
+    const State &state() const { return state_; }
+    static const char *modeName(Mode mode);
+
+    static constexpr std::chrono::milliseconds kSampleInterval{250};
+    static constexpr std::chrono::seconds kWindow{10};
+    static constexpr int kDefaultSendRate = 256 * 1024;
+    static constexpr int kMinSendRate = 64 * 1024;
+    static constexpr int kMaxSendRate = 128 * 1024 * 1024;
+    static constexpr double kStartupGain = 2.0;
+    static constexpr double kDrainGain = 0.75;
+    static constexpr double kProbeRttGain = 0.5;
+    static constexpr std::chrono::milliseconds kProbeRttDuration{500};
+    // Less queued than this and the sample shows what we had to send, not what the path carries
+    static constexpr int kBacklogBytes = 16 * 1024;
+    static constexpr int kFullBandwidthRounds = 3;
+    static constexpr double kFullBandwidthGrowth = 1.25;
+    static constexpr float kLossThreshold = 0.02f;
+    static constexpr int kQueueDelayMs = 25;
+    static constexpr double kApplyThreshold = 0.1;
+
+private:
+    struct RateSample
+    {
+        Clock::time_point at;
+        double rate;
+    };
+    struct RttSample
+    {
+        Clock::time_point at;
+        int ms;
+    };
+
+    void addBandwidthSample(double rate, bool appLimited, Clock::time_point now);
+    void addRttSample(int ms, Clock::time_point now);
+    bool queueBuilt() const;
+    void advanceMode(bool queueing, Clock::time_point now);
+
+    State state_;
+    std::deque<RateSample> bandwidth_; // decreasing rates, max in front
+    std::deque<RttSample> rtt_;        // increasing pings, min in front
+    double fullBandwidth_ = 0.0;
+    int fullBandwidthRounds_ = 0;
+    size_t cycleIndex_ = 0;
+    Clock::time_point cycleStart_;
+    Clock::time_point probeRttEnd_;
+    int appliedRate_ = kDefaultSendRate;
+    Clock::time_point lastSample_;
+    int lastUnacked_ = 0;
+};
@@ -0,0 +1,365 @@
+#include "delta_codec.h"
+#include "tunnel_protocol.h"
+#include <algorithm>
+#include <cstring>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define DELTA_SSE2 1
+#elif defined(__ARM_NEON) || defined(__aarch64__)
+#include <arm_neon.h>
+#define DELTA_NEON 1
+#endif
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+namespace delta
+{
+    namespace
+    {
+        constexpr size_t kBlock = 16;
+
+        inline unsigned lowestBit(uint32_t mask)
+        {
+#if defined(_MSC_VER)
+            unsigned long index;
+            _BitScanForward(&index, mask);
+            return static_cast<unsigned>(index);
+#else
+            return static_cast<unsigned>(__builtin_ctz(mask));
+#endif
+        }
+
+        // One bit per byte of a 16-byte block: set where a and b are equal
+        inline uint32_t equalMask(const char *a, const char *b)
+        {
+#if defined(DELTA_SSE2)
+            __m128i x = _mm_loadu_si128(reinterpret_cast<const __m128i *>(a));
+            __m128i y = _mm_loadu_si128(reinterpret_cast<const __m128i *>(b));
+            return static_cast<uint32_t>(_mm_movemask_epi8(_mm_cmpeq_epi8(x, y)));
+#elif defined(DELTA_NEON)
+            uint8x16_t eq = vceqq_u8(vld1q_u8(reinterpret_cast<const uint8_t *>(a)),
+                                     vld1q_u8(reinterpret_cast<const uint8_t *>(b)));
+            // Narrow to one nibble per byte, then fold to one bit per byte
+            uint64_t nibbles = vget_lane_u64(vreinterpret_u64_u8(vshrn_n_u16(vreinterpretq_u16_u8(eq), 4)), 0);
+            uint32_t mask = 0;
+            for (unsigned i = 0; i < kBlock; ++i)
+            {
+                mask |= static_cast<uint32_t>((nibbles >> (i * 4)) & 1) << i;
+            }
+            return mask;
+#else
+            uint32_t mask = 0;
+            for (unsigned i = 0; i < kBlock; ++i)
+            {
+                mask |= static_cast<uint32_t>(a[i] == b[i]) << i;
+            }
+            return mask;
+#endif
+        }
+
+        // dst = a ^ b
+        void xorBytes(char *dst, const char *a, const char *b, size_t n)
+        {
+            size_t i = 0;
+#if defined(DELTA_SSE2)
+            for (; i + kBlock <= n; i += kBlock)
+            {
+                __m128i x = _mm_loadu_si128(reinterpret_cast<const __m128i *>(a + i));
+                __m128i y = _mm_loadu_si128(reinterpret_cast<const __m128i *>(b + i));
+                _mm_storeu_si128(reinterpret_cast<__m128i *>(dst + i), _mm_xor_si128(x, y));
+            }
+#elif defined(DELTA_NEON)
+            for (; i + kBlock <= n; i += kBlock)
+            {
+                uint8x16_t x = vld1q_u8(reinterpret_cast<const uint8_t *>(a + i));
+                uint8x16_t y = vld1q_u8(reinterpret_cast<const uint8_t *>(b + i));
+                vst1q_u8(reinterpret_cast<uint8_t *>(dst + i), veorq_u8(x, y));
+            }
+#endif
+            for (; i < n; ++i)
+            {
+                dst[i] = static_cast<char>(a[i] ^ b[i]);
+            }
+        }
+
+        // Byte i of the XOR is data[i] ^ ref[i] inside the reference, data[i] past it
+        struct XorView
+        {
+            const char *data;
+            size_t len;
+            const char *ref;
+            size_t common; // min(len, reference length)
+
+            bool differs(size_t i) const { return i < common ? data[i] != ref[i] : data[i] != 0; }
+
+            // First i >= from where the XOR is non-zero, or len
+            size_t nextDiff(size_t i) const
+            {
+                for (; i + kBlock <= common; i += kBlock)
+                {
+                    uint32_t diff = ~equalMask(data + i, ref + i) & 0xFFFF;
+                    if (diff)
+                    {
+                        return i + lowestBit(diff);
+                    }
+                }
+                while (i < len && !differs(i))
+                {
+                    ++i;
+                }
+                return i;
+            }
+
+            // First i >= from where the XOR is zero, or len
+            size_t nextSame(size_t i) const
+            {
+                for (; i + kBlock <= common; i += kBlock)
+                {
+                    uint32_t same = equalMask(data + i, ref + i);
+                    if (same)
+                    {
+                        return i + lowestBit(same);
+                    }
+                }
+                while (i < len && differs(i))
+                {
+                    ++i;
+                }
+                return i;
+            }
+        };
+
+        void putVarint(std::vector<char> &out, size_t value)
+        {
+            while (value >= 0x80)
+            {
+                out.push_back(static_cast<char>((value & 0x7F) | 0x80));
+                value >>= 7;
+            }
+            out.push_back(static_cast<char>(value));
+        }
+
+        bool getVarint(const char *&p, const char *end, size_t &value)
+        {
+            value = 0;
+            for (unsigned shift = 0; p < end && shift < 64; shift += 7)
+            {
+                uint8_t byte = static_cast<uint8_t>(*p++);
+                value |= static_cast<size_t>(byte & 0x7F) << shift;
+                if (!(byte & 0x80))
+                {
+                    return true;
+                }
+            }
+            return false;
+        }
+    }
+
+    void History::push(const char *data, size_t len)
+    {
+        // Entries keep their capacity, so a steady stream stops allocating
+        entries_[next_].assign(data, data + len);
+        next_ = (next_ + 1) % kHistory;
+        count_ = std::min(count_ + 1, kHistory);
+    }
+
+    const std::vector<char> *History::at(size_t age) const
+    {
+        if (age >= count_)
+        {
+            return nullptr;
+        }
+        return &entries_[(next_ + kHistory - 1 - age) % kHistory];
+    }
+
+    size_t encodeXor(const char *data, size_t len, const std::vector<char> &ref, std::vector<char> &out)
+    {
+        out.clear();
+        putVarint(out, len);
+        XorView view{data, len, ref.data(), std::min(len, ref.size())};
+        size_t pos = 0;
+        while (pos < len)
+        {
+            size_t start = view.nextDiff(pos);
+            if (start == len)
+            {
+                break;
+            }
+            // Extend the literal over zero runs too short to be worth a skip
+            size_t end = start;
+            while (end < len)
+            {
+                size_t zero = view.nextSame(end);
+                if (zero == len)
+                {
+                    end = len;
+                    break;
+                }
+                size_t next = view.nextDiff(zero);
+                if (next - zero >= kMinSkip || next == len)
+                {
+                    end = zero;
+                    break;
+                }
+                end = next;
+            }
+            putVarint(out, start - pos);
+            putVarint(out, end - start);
+            size_t at = out.size();
+            out.resize(at + (end - start));
+            size_t overlap = start < view.common ? std::min(end, view.common) - start : 0;
+            xorBytes(out.data() + at, data + start, ref.data() + start, overlap);
+            std::memcpy(out.data() + at + overlap, data + start + overlap, end - start - overlap);
+            pos = end;
+        }
+        return out.size();
+    }
+
+    bool decodeXor(const char *runs, size_t len, const std::vector<char> &ref, size_t outLen, std::vector<char> &out)
+    {
+        out.assign(ref.begin(), ref.begin() + std::min(ref.size(), outLen));
+        out.resize(outLen, 0);
+        const char *p = runs;
+        const char *end = runs + len;
+        size_t pos = 0;
+        while (p < end)
+        {
+            size_t skip, count;
+            if (!getVarint(p, end, skip) || !getVarint(p, end, count) ||
+                skip > outLen - pos || count > outLen - pos - skip || count > static_cast<size_t>(end - p))
+            {
+                return false;
+            }
+            pos += skip;
+            xorBytes(out.data() + pos, out.data() + pos, p, count);
+            p += count;
+            pos += count;
+        }
+        return true;
+    }
+}
+
+void DeltaEncoder::apply(const std::string &, std::vector<char> &frame)
+{
+    size_t len = frame.size() - tunnel::kHeaderSize;
+    const char *payload = frame.data() + tunnel::kHeaderSize;
+    uint8_t mode = delta::kModeRaw;
+    uint8_t age = 0;
+    if (len <= delta::kMaxHistoryPayload)
+    {
+        size_t bestSize = len;
+        for (size_t i = 0; i < history_.size(); ++i)
+        {
+            const std::vector<char> &ref = *history_.at(i);
+            if (ref.size() == len && std::memcmp(ref.data(), payload, len) == 0)
+            {
+                mode = delta::kModeSame;
+                age = static_cast<uint8_t>(i);
+                break;
+            }
+            // Sizes far apart leave little to share
+            if (ref.size() < len / 2 || ref.size() > len * 2)
+            {
+                continue;
+            }
+            // One byte for the age on top of the mode byte both forms carry
+            if (delta::encodeXor(payload, len, ref, scratch_) + 1 < bestSize)
+            {
+                bestSize = scratch_.size() + 1;
+                best_.swap(scratch_);
+                mode = delta::kModeXor;
+                age = static_cast<uint8_t>(i);
+            }
+        }
+        history_.push(payload, len);
+    }
+
+    frames_.fetch_add(1, std::memory_order_relaxed);
+    rawBytes_.fetch_add(len, std::memory_order_relaxed);
+    if (mode == delta::kModeRaw)
+    {
+        frame.insert(frame.begin() + tunnel::kHeaderSize, static_cast<char>(mode));
+    }
+    else
+    {
+        frame.resize(tunnel::kHeaderSize);
+        frame.push_back(static_cast<char>(mode));
+        frame.push_back(static_cast<char>(age));
+        if (mode == delta::kModeXor)
+        {
+            frame.insert(frame.end(), best_.begin(), best_.end());
+            xorFrames_.fetch_add(1, std::memory_order_relaxed);
+        }
+        else
+        {
+            same_.fetch_add(1, std::memory_order_relaxed);
+        }
+    }
+    uint32_t type = tunnel::kFrameDelta;
+    std::memcpy(frame.data() + tunnel::kIdFieldSize, &type, sizeof(type));
+    encodedBytes_.fetch_add(frame.size() - tunnel::kHeaderSize, std::memory_order_relaxed);
+}
+
+DeltaEncoder::Stats DeltaEncoder::stats() const
+{
+    Stats s;
+    s.frames = frames_.load(std::memory_order_relaxed);
+    s.rawBytes = rawBytes_.load(std::memory_order_relaxed);
+    s.encodedBytes = encodedBytes_.load(std::memory_order_relaxed);
+    s.same = same_.load(std::memory_order_relaxed);
+    s.xorFrames = xorFrames_.load(std::memory_order_relaxed);
+    return s;
+}
+
+bool DeltaDecoder::decode(const char *payload, size_t len, std::vector<char> &out)
+{
+    if (len < 1)
+    {
+        return false;
+    }
+    uint8_t mode = static_cast<uint8_t>(payload[0]);
+    if (mode == delta::kModeRaw)
+    {
+        out.assign(payload + 1, payload + len);
+    }
+    else
+    {
+        if (len < 2)
+        {
+            return false;
+        }
+        const std::vector<char> *ref = history_.at(static_cast<uint8_t>(payload[1]));
+        if (!ref)
+        {
+            return false;
+        }
+        if (mode == delta::kModeSame)
+        {
+            out = *ref;
+        }
+        else if (mode == delta::kModeXor)
+        {
+            const char *p = payload + 2;
+            const char *end = payload + len;
+            size_t outLen = 0;
+            // Reject lengths the encoder never produces before allocating for them
+            if (!delta::getVarint(p, end, outLen) || outLen > delta::kMaxHistoryPayload ||
+                !delta::decodeXor(p, static_cast<size_t>(end - p), *ref, outLen, out))
+            {
+                return false;
+            }
+        }
+        else
+        {
+            return false;
+        }
+    }
+    if (out.size() <= delta::kMaxHistoryPayload)
+    {
+        history_.push(out.data(), out.size());
+    }
+    return true;
+}
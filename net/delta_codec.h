@@ -0,0 +1,99 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "stream_pipeline.h"
+
+// Opt-in coding for streams that repeat themselves, such as periodic world
+// snapshots that differ from the previous one in a few bytes. Every payload of
+// a coded stream travels as a DELTA frame (tunnel_protocol.h) in one of three
+// forms: the same bytes as an earlier payload (a one-byte reference), the XOR
+// against an earlier payload with its zero runs skipped, or raw when neither
+// is smaller. Sender and receiver keep the same history of the last kHistory
+// payloads, because frames of a stream arrive exactly once and in order (a
+// resume resends from where the peer stopped counting).
+//
+// DELTA payload: uint8 mode, then
+//   kModeRaw:  the payload
+//   kModeSame: uint8 age (0 = the latest payload)
+//   kModeXor:  uint8 age, varint length, then (varint skip, varint count,
+//              count XOR bytes) runs; bytes past the reference are XORed with 0
+namespace delta
+{
+    enum Mode : uint8_t
+    {
+        kModeRaw = 0,
+        kModeSame = 1,
+        kModeXor = 2,
+    };
+
+    constexpr size_t kHistory = 4;
+    // Larger payloads are bulk data: sent raw and kept out of the history
+    constexpr size_t kMaxHistoryPayload = 16 * 1024;
+    // Zero runs shorter than this stay inside a literal run
+    constexpr size_t kMinSkip = 4;
+
+    // The last kHistory payloads, newest first by age
+    class History
+    {
+    public:
+        void push(const char *data, size_t len);
+        // nullptr if there is no payload that old
+        const std::vector<char> *at(size_t age) const;
+        size_t size() const { return count_; }
+
+    private:
+        std::vector<char> entries_[kHistory];
+        size_t next_ = 0;
+        size_t count_ = 0;
+    };
+
+    // XOR-codes `data` against `ref` into out (cleared first); returns out.size()
+    size_t encodeXor(const char *data, size_t len, const std::vector<char> &ref, std::vector<char> &out);
+    // Applies XOR runs to a copy of ref; false on malformed input
+    bool decodeXor(const char *runs, size_t len, const std::vector<char> &ref, size_t outLen, std::vector<char> &out);
+}
+
+// Sending side, installed as the pipeline's transform: rewrites each DATA
+// frame of the stream as a DELTA frame. Runs on the stream's executor.
+class DeltaEncoder : public StreamTransform
+{
+public:
+    struct Stats
+    {
+        uint64_t frames = 0;
+        uint64_t rawBytes = 0;     // payload bytes read from the local socket
+        uint64_t encodedBytes = 0; // DELTA payload bytes sent for them
+        uint64_t same = 0;
+        uint64_t xorFrames = 0;
+    };
+
+    void apply(const std::string &id, std::vector<char> &frame) override;
+    // Any thread
+    Stats stats() const;
+
+private:
+    delta::History history_;
+    std::vector<char> best_;
+    std::vector<char> scratch_;
+    std::atomic<uint64_t> frames_{0};
+    std::atomic<uint64_t> rawBytes_{0};
+    std::atomic<uint64_t> encodedBytes_{0};
+    std::atomic<uint64_t> same_{0};
+    std::atomic<uint64_t> xorFrames_{0};
+};
+
+// Receiving side of one stream; used on the poll thread only
+class DeltaDecoder
+{
+public:
+    // DELTA payload to the original bytes; false if it does not decode
+    // against our history (the stream cannot continue)
+    bool decode(const char *payload, size_t len, std::vector<char> &out);
+
+private:
+    delta::History history_;
+};
@@ -0,0 +1,192 @@
+#include "emulated_transport.h"
+#include <algorithm>
+#include <cstring>
+
+std::pair<std::unique_ptr<EmulatedTransport>, std::unique_ptr<EmulatedTransport>>
+EmulatedTransport::createPair(const LinkConditions &aToB, const LinkConditions &bToA, unsigned seed,
+                              HSteamNetConnection firstConn)
+{
+    std::unique_ptr<EmulatedTransport> a(new EmulatedTransport(firstConn, aToB, seed));
+    std::unique_ptr<EmulatedTransport> b(new EmulatedTransport(firstConn + 1, bToA, seed + 1));
+    a->peer_ = b.get();
+    b->peer_ = a.get();
+    return {std::move(a), std::move(b)};
+}
+
+EmulatedTransport::EmulatedTransport(HSteamNetConnection conn, const LinkConditions &outbound, unsigned seed)
+    : conn_(conn), outbound_(outbound), peer_(nullptr), up_(true), rng_(seed),
+      nextDeparture_(Clock::now()), lastReliableArrival_(Clock::now()), rateWindowStart_(Clock::now()),
+      rateWindowBytes_(0), rateWindowPending_(0), outBytesPerSec_(0.0f), inboxSequence_(0) {}
+
+EmulatedTransport::Clock::duration EmulatedTransport::randomJitter()
+{
+    if (outbound_.jitterMs <= 0)
+    {
+        return Clock::duration::zero();
+    }
+    std::uniform_int_distribution<int> dist(0, outbound_.jitterMs * 1000);
+    return std::chrono::microseconds(dist(rng_));
+}
+
+EmulatedTransport::Clock::duration EmulatedTransport::retransmitTimeout() const
+{
+    // Roughly what a reliable sender waits before resending: one RTT plus margin
+    int rttMs = outbound_.latencyMs + (peer_ ? peer_->outbound_.latencyMs : outbound_.latencyMs);
+    return std::chrono::milliseconds(std::max(20, rttMs + 4 * outbound_.jitterMs + 10));
+}
+
+int EmulatedTransport::pendingBytes(Clock::time_point now) const
+{
+    if (outbound_.bandwidthBytesPerSec <= 0 || nextDeparture_ <= now)
+    {
+        return 0;
+    }
+    double seconds = std::chrono::duration<double>(nextDeparture_ - now).count();
+    return static_cast<int>(seconds * outbound_.bandwidthBytesPerSec);
+}
+
+EResult EmulatedTransport::sendMessage(HSteamNetConnection conn, const void *data, uint32 len, int sendFlags)
+{
+    if (conn != conn_ || !peer_ || !up_)
+    {
+        return k_EResultNoConnection;
+    }
+    bool reliable = (sendFlags & k_nSteamNetworkingSend_Reliable) != 0;
+    Clock::time_point arrival;
+    {
+        std::lock_guard<std::mutex> lock(sendMutex_);
+        auto now = Clock::now();
+        if (pendingBytes(now) + static_cast<int>(len) > kSendBufferLimit)
+        {
+            return k_EResultLimitExceeded;
+        }
+
+        // Serialization at the bandwidth cap
+        Clock::time_point departure = std::max(now, nextDeparture_);
+        if (outbound_.bandwidthBytesPerSec > 0)
+        {
+            departure += std::chrono::microseconds(static_cast<int64_t>(len) * 1000000 / outbound_.bandwidthBytesPerSec);
+        }
+        nextDeparture_ = departure;
+        arrival = departure + std::chrono::milliseconds(outbound_.latencyMs) + randomJitter();
+
+        std::uniform_real_distribution<double> chance(0.0, 100.0);
+        if (reliable)
+        {
+            // Every lost copy costs a retransmission timeout
+            for (int attempt = 0; attempt < 10 && chance(rng_) < outbound_.lossPercent; ++attempt)
+            {
+                arrival += retransmitTimeout();
+                stats_.retransmissions++;
+            }
+            // Reliable messages are delivered in order
+            arrival = std::max(arrival, lastReliableArrival_);
+            lastReliableArrival_ = arrival;
+        }
+        else
+        {
+            if (chance(rng_) < outbound_.lossPercent)
+            {
+                stats_.dropped++;
+                return k_EResultOK;
+            }
+            if (chance(rng_) < outbound_.reorderPercent)
+            {
+                arrival += std::chrono::milliseconds(outbound_.latencyMs / 2 + outbound_.jitterMs + 1);
+            }
+        }
+        stats_.messagesSent++;
+        stats_.bytesSent += len;
+    }
+    peer_->deliver(arrival, data, len);
+    return k_EResultOK;
+}
+
+void EmulatedTransport::deliver(Clock::time_point arrival, const void *data, uint32 len)
+{
+    const char *bytes = static_cast<const char *>(data);
+    std::lock_guard<std::mutex> lock(inboxMutex_);
+    inbox_.emplace(std::make_pair(arrival, inboxSequence_++), std::vector<char>(bytes, bytes + len));
+}
+
+int EmulatedTransport::receiveMessages(HSteamNetConnection conn, int maxMessages, const MessageHandler &handler)
+{
+    if (conn != conn_)
+    {
+        return 0;
+    }
+    std::vector<std::pair<Clock::time_point, std::vector<char>>> ready;
+    auto now = Clock::now();
+    {
+        std::lock_guard<std::mutex> lock(inboxMutex_);
+        while (!inbox_.empty() && static_cast<int>(ready.size()) < maxMessages && inbox_.begin()->first.first <= now)
+        {
+            ready.emplace_back(inbox_.begin()->first.first, std::move(inbox_.begin()->second));
+            inbox_.erase(inbox_.begin());
+        }
+    }
+    for (const auto &message : ready)
+    {
+        receivedAgeUs_ = std::chrono::duration_cast<std::chrono::microseconds>(now - message.first).count();
+        handler(message.second.data(), message.second.size());
+    }
+    receivedAgeUs_ = -1;
+    return static_cast<int>(ready.size());
+}
+
+bool EmulatedTransport::getRealTimeStatus(HSteamNetConnection conn, SteamNetConnectionRealTimeStatus_t &status)
+{
+    if (conn != conn_)
+    {
+        return false;
+    }
+    std::lock_guard<std::mutex> lock(sendMutex_);
+    std::memset(&status, 0, sizeof(status));
+    status.m_eState = k_ESteamNetworkingConnectionState_Connected;
+    status.m_nPing = outbound_.latencyMs + (peer_ ? peer_->outbound_.latencyMs : 0);
+    status.m_flConnectionQualityLocal = static_cast<float>(1.0 - outbound_.lossPercent / 100.0);
+    status.m_flConnectionQualityRemote = status.m_flConnectionQualityLocal;
+    status.m_nSendRateBytesPerSecond = outbound_.bandwidthBytesPerSec > 0
+                                           ? static_cast<int>(outbound_.bandwidthBytesPerSec)
+                                           : 100 * 1024 * 1024;
+    auto now = Clock::now();
+    status.m_cbPendingReliable = pendingBytes(now);
+    if (outbound_.bandwidthBytesPerSec > 0)
+    {
+        // Backlog ahead of a message sent now, at the bandwidth cap
+        status.m_usecQueueTime = status.m_cbPendingReliable * 1000000LL / outbound_.bandwidthBytesPerSec;
+    }
+    double window = std::chrono::duration<double>(now - rateWindowStart_).count();
+    if (window >= 0.1)
+    {
+        // Bytes accepted minus the growth of the backlog: what left for the wire
+        int64_t departed = static_cast<int64_t>(stats_.bytesSent - rateWindowBytes_) -
+                           (status.m_cbPendingReliable - rateWindowPending_);
+        outBytesPerSec_ = static_cast<float>(std::max<int64_t>(0, departed) / window);
+        rateWindowStart_ = now;
+        rateWindowBytes_ = stats_.bytesSent;
+        rateWindowPending_ = status.m_cbPendingReliable;
+    }
+    status.m_flOutBytesPerSec = outBytesPerSec_;
+    return true;
+}
+
+void EmulatedTransport::setLinkUp(bool up)
+{
+    for (EmulatedTransport *end : {this, peer_})
+    {
+        if (!end)
+        {
+            continue;
+        }
+        end->up_ = up;
+        std::lock_guard<std::mutex> lock(end->inboxMutex_);
+        end->inbox_.clear();
+    }
+}
+
+EmulatedTransport::Stats EmulatedTransport::getStats()
+{
+    std::lock_guard<std::mutex> lock(sendMutex_);
+    return stats_;
+}
@@ -0,0 +1,96 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <utility>
+#include <vector>
+#include "tunnel_transport.h"
+
+// Conditions for one direction of an emulated link
+struct LinkConditions
+{
+    int latencyMs = 0;             // one-way base delay
+    int jitterMs = 0;              // extra uniform delay in [0, jitter]
+    double lossPercent = 0.0;      // per transmission; reliable messages are resent
+    double reorderPercent = 0.0;   // unreliable messages held back past later ones
+    int64_t bandwidthBytesPerSec = 0; // 0 = unlimited
+};
+
+// Headless stand-in for a Steam P2P connection. Each EmulatedTransport is one
+// end of a link created by createPair(); messages sent on one end show up on the
+// other after serialization at the bandwidth cap, latency, jitter and, for
+// reliable messages, retransmission delays for every lost copy. Reliable
+// messages keep their order as Steam's do, so loss shows up as head-of-line
+// blocking rather than missing data.
+class EmulatedTransport : public TunnelTransport
+{
+public:
+    struct Stats
+    {
+        uint64_t messagesSent = 0;
+        uint64_t bytesSent = 0;
+        uint64_t retransmissions = 0;
+        uint64_t dropped = 0;
+    };
+
+    // The ends get connection handles firstConn and firstConn + 1, so several
+    // links can sit behind one transport
+    static std::pair<std::unique_ptr<EmulatedTransport>, std::unique_ptr<EmulatedTransport>>
+    createPair(const LinkConditions &aToB, const LinkConditions &bToA, unsigned seed = 1,
+               HSteamNetConnection firstConn = 1);
+
+    // Handle this end uses for its connection
+    HSteamNetConnection connection() const { return conn_; }
+
+    EResult sendMessage(HSteamNetConnection conn, const void *data, uint32 len, int sendFlags) override;
+    int receiveMessages(HSteamNetConnection conn, int maxMessages, const MessageHandler &handler) override;
+    bool getRealTimeStatus(HSteamNetConnection conn, SteamNetConnectionRealTimeStatus_t &status) override;
+    int64_t receivedAgeUs() const override { return receivedAgeUs_; }
+
+    Stats getStats();
+
+    // Cut or restore the link in both directions. While it is cut sends fail
+    // and everything in flight is lost, like a dropped Steam connection.
+    void setLinkUp(bool up);
+
+    // Same limit as Steam's default send buffer
+    static constexpr int kSendBufferLimit = 512 * 1024;
+
+private:
+    using Clock = std::chrono::steady_clock;
+
+    EmulatedTransport(HSteamNetConnection conn, const LinkConditions &outbound, unsigned seed);
+
+    void deliver(Clock::time_point arrival, const void *data, uint32 len);
+    Clock::duration randomJitter();
+    Clock::duration retransmitTimeout() const;
+    int pendingBytes(Clock::time_point now) const;
+
+    HSteamNetConnection conn_;
+    LinkConditions outbound_;
+    EmulatedTransport *peer_;
+    std::atomic<bool> up_;
+
+    // Sending side
+    std::mutex sendMutex_;
+    std::mt19937 rng_;
+    Clock::time_point nextDeparture_;
+    Clock::time_point lastReliableArrival_;
+    Stats stats_;
+    // Send rate over the last status window, like Steam's m_flOutBytesPerSec
+    Clock::time_point rateWindowStart_;
+    uint64_t rateWindowBytes_;
+    int rateWindowPending_;
+    float outBytesPerSec_;
+
+    // Receiving side: ordered by arrival time, then send order
+    std::mutex inboxMutex_;
+    std::map<std::pair<Clock::time_point, uint64_t>, std::vector<char>> inbox_;
+    uint64_t inboxSequence_;
+    int64_t receivedAgeUs_ = -1; // receiving thread only
+};
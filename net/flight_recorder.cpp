@@ -0,0 +1,306 @@
+#include "flight_recorder.h"
+#include "mapped_file.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <iostream>
+#include <mutex>
+#include <vector>
+
+namespace flight
+{
+    namespace
+    {
+        constexpr size_t kMetricCount = static_cast<size_t>(Metric::Count);
+        const char *const kMetricNames[kMetricCount] = {"ping_ms",      "queue_time_us",    "pending_reliable_bytes",
+                                                        "poll_gap_us",  "poll_messages",    "write_backlog_bytes",
+                                                        "frame_time_us"};
+
+        // Seqlock per slot: seq is 2 * index + 1 while the writer that claimed
+        // index fills the slot, 2 * index + 2 once it is complete, so a reader
+        // detects both torn slots and slots already reused by a later lap
+        struct Slot
+        {
+            std::atomic<uint64_t> seq{0};
+            std::atomic<int64_t> timeUs{0};
+            std::atomic<uint64_t> source{0};
+            std::atomic<int64_t> value{0};
+            std::atomic<uint32_t> metric{0};
+        };
+
+        const std::chrono::steady_clock::time_point g_epoch = std::chrono::steady_clock::now();
+        const int64_t g_epochUnixUs =
+            std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::system_clock::now().time_since_epoch())
+                .count();
+
+        std::vector<Slot> g_ring(kRingSize);
+        std::atomic<uint64_t> g_next{0};
+
+        // Limits in each metric's own unit; 0 = no threshold
+        std::atomic<int64_t> g_limits[kMetricCount];
+        std::atomic<bool> g_autoDump{true};
+
+        // Recorder time of the pending trigger, -1 if none
+        std::atomic<int64_t> g_triggerUs{-1};
+        std::atomic<uint32_t> g_triggerMetric{0};
+        std::atomic<uint64_t> g_triggerSource{0};
+        std::atomic<int64_t> g_triggerValue{0};
+        // No new trigger before this recorder time
+        std::atomic<int64_t> g_quietUntil{0};
+        std::atomic<int> g_autoDumps{0};
+
+        std::mutex g_statusMutex;
+        int g_dumps = 0;
+        std::string g_lastFile;
+        std::string g_lastReason;
+
+        int64_t limitFor(Metric metric, const Thresholds &t)
+        {
+            switch (metric)
+            {
+            case Metric::Ping:
+                return t.pingMs;
+            case Metric::QueueTime:
+                return static_cast<int64_t>(t.queueTimeMs) * 1000;
+            case Metric::PollGap:
+                return static_cast<int64_t>(t.pollGapMs) * 1000;
+            case Metric::FrameTime:
+                return static_cast<int64_t>(t.frameTimeMs) * 1000;
+            case Metric::WriteBacklog:
+                return static_cast<int64_t>(t.writeBacklogKB) * 1024;
+            default:
+                return 0;
+            }
+        }
+
+        Thresholds g_thresholds;
+
+        struct LimitsInit
+        {
+            LimitsInit()
+            {
+                for (size_t i = 0; i < kMetricCount; ++i)
+                {
+                    g_limits[i].store(limitFor(static_cast<Metric>(i), g_thresholds), std::memory_order_relaxed);
+                }
+            }
+        } g_limitsInit;
+
+        void trigger(Metric metric, uint64_t source, int64_t value, int64_t at)
+        {
+            if (!g_autoDump.load(std::memory_order_relaxed) ||
+                g_autoDumps.load(std::memory_order_relaxed) >= kMaxAutoDumps ||
+                at < g_quietUntil.load(std::memory_order_relaxed))
+            {
+                return;
+            }
+            int64_t none = -1;
+            if (g_triggerUs.compare_exchange_strong(none, at, std::memory_order_acq_rel))
+            {
+                g_triggerMetric.store(static_cast<uint32_t>(metric), std::memory_order_relaxed);
+                g_triggerSource.store(source, std::memory_order_relaxed);
+                g_triggerValue.store(value, std::memory_order_relaxed);
+            }
+        }
+
+        // Complete samples at or after fromUs, oldest first
+        std::vector<Record> collect(int64_t fromUs)
+        {
+            std::vector<Record> out;
+            uint64_t end = g_next.load(std::memory_order_acquire);
+            uint64_t begin = end > kRingSize ? end - kRingSize : 0;
+            out.reserve(static_cast<size_t>(end - begin));
+            for (uint64_t i = begin; i < end; ++i)
+            {
+                Slot &slot = g_ring[i % kRingSize];
+                uint64_t seq = slot.seq.load(std::memory_order_acquire);
+                if (seq != 2 * i + 2)
+                {
+                    continue;
+                }
+                Record r{};
+                r.timeUs = slot.timeUs.load(std::memory_order_relaxed);
+                r.source = slot.source.load(std::memory_order_relaxed);
+                r.value = slot.value.load(std::memory_order_relaxed);
+                r.metric = slot.metric.load(std::memory_order_relaxed);
+                std::atomic_thread_fence(std::memory_order_acquire);
+                if (slot.seq.load(std::memory_order_relaxed) != seq || r.timeUs < fromUs)
+                {
+                    continue;
+                }
+                out.push_back(r);
+            }
+            // Writers claim indices in order but may finish out of order
+            std::stable_sort(out.begin(), out.end(),
+                             [](const Record &a, const Record &b)
+                             { return a.timeUs < b.timeUs; });
+            return out;
+        }
+
+        bool writeDump(const std::string &reason, int64_t triggerUs, uint32_t metric, uint64_t source, int64_t value)
+        {
+            int64_t at = now();
+            std::vector<Record> records = collect((triggerUs >= 0 ? triggerUs : at) - kDumpSeconds * 1000000LL);
+
+            // Milliseconds too: a manual save can land in the same second as a spike
+            auto wallNow = std::chrono::system_clock::now();
+            std::time_t wall = std::chrono::system_clock::to_time_t(wallNow);
+            int millis = static_cast<int>(std::chrono::duration_cast<std::chrono::milliseconds>(
+                                              wallNow.time_since_epoch())
+                                              .count() %
+                                          1000);
+            char stamp[32];
+            std::strftime(stamp, sizeof(stamp), "%Y%m%d-%H%M%S", std::localtime(&wall));
+            char name[64];
+            std::snprintf(name, sizeof(name), "connecttool-spike-%s-%03d.ctfr", stamp, millis);
+
+            size_t size = sizeof(FileHeader) + records.size() * sizeof(Record);
+            MappedFile file;
+            if (!file.create(name, size))
+            {
+                std::cerr << "Flight recorder: cannot write " << name << std::endl;
+                return false;
+            }
+            FileHeader header{};
+            std::memcpy(header.magic, kMagic, sizeof(header.magic));
+            header.version = kVersion;
+            header.recordSize = sizeof(Record);
+            header.count = static_cast<uint32_t>(records.size());
+            header.startUnixUs = g_epochUnixUs;
+            header.triggerUs = triggerUs;
+            header.triggerMetric = metric;
+            header.triggerSource = source;
+            header.triggerValue = value;
+            std::snprintf(header.reason, sizeof(header.reason), "%s", reason.c_str());
+            std::memcpy(file.data(), &header, sizeof(header));
+            if (!records.empty())
+            {
+                std::memcpy(file.data() + sizeof(header), records.data(), records.size() * sizeof(Record));
+            }
+            file.close(size);
+
+            std::cout << "Flight recorder: " << reason << ", wrote " << records.size() << " samples to " << name
+                      << std::endl;
+            std::lock_guard<std::mutex> lock(g_statusMutex);
+            g_dumps++;
+            g_lastFile = name;
+            g_lastReason = reason;
+            return true;
+        }
+    }
+
+    const char *metricName(Metric metric)
+    {
+        size_t index = static_cast<size_t>(metric);
+        return index < kMetricCount ? kMetricNames[index] : "?";
+    }
+
+    int64_t now()
+    {
+        return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - g_epoch).count();
+    }
+
+    void record(Metric metric, uint64_t source, int64_t value)
+    {
+        int64_t at = now();
+        uint64_t index = g_next.fetch_add(1, std::memory_order_relaxed);
+        Slot &slot = g_ring[index % kRingSize];
+        slot.seq.store(2 * index + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        slot.timeUs.store(at, std::memory_order_relaxed);
+        slot.source.store(source, std::memory_order_relaxed);
+        slot.value.store(value, std::memory_order_relaxed);
+        slot.metric.store(static_cast<uint32_t>(metric), std::memory_order_relaxed);
+        slot.seq.store(2 * index + 2, std::memory_order_release);
+
+        int64_t limit = g_limits[static_cast<size_t>(metric)].load(std::memory_order_relaxed);
+        if (limit > 0 && value > limit)
+        {
+            trigger(metric, source, value, at);
+        }
+    }
+
+    uint64_t streamSource(const std::string &id)
+    {
+        uint64_t source = 0;
+        std::memcpy(&source, id.data(), std::min(id.size(), sizeof(source)));
+        return source;
+    }
+
+    std::string streamName(uint64_t source)
+    {
+        char text[sizeof(source) + 1] = {};
+        std::memcpy(text, &source, sizeof(source));
+        return text;
+    }
+
+    void setThresholds(const Thresholds &thresholds)
+    {
+        std::lock_guard<std::mutex> lock(g_statusMutex);
+        g_thresholds = thresholds;
+        for (size_t i = 0; i < kMetricCount; ++i)
+        {
+            g_limits[i].store(limitFor(static_cast<Metric>(i), thresholds), std::memory_order_relaxed);
+        }
+    }
+
+    Thresholds thresholds()
+    {
+        std::lock_guard<std::mutex> lock(g_statusMutex);
+        return g_thresholds;
+    }
+
+    void setAutoDump(bool on)
+    {
+        g_autoDump.store(on, std::memory_order_relaxed);
+        if (!on)
+        {
+            g_triggerUs.store(-1, std::memory_order_relaxed);
+        }
+    }
+
+    void tick()
+    {
+        int64_t triggerUs = g_triggerUs.load(std::memory_order_acquire);
+        if (triggerUs < 0 || now() - triggerUs < kPostTriggerMs * 1000LL)
+        {
+            return;
+        }
+        Metric metric = static_cast<Metric>(g_triggerMetric.load(std::memory_order_relaxed));
+        uint64_t source = g_triggerSource.load(std::memory_order_relaxed);
+        int64_t value = g_triggerValue.load(std::memory_order_relaxed);
+        std::string reason = std::string(metricName(metric)) + " = " + std::to_string(value);
+        if (metric == Metric::WriteBacklog)
+        {
+            reason += " (stream " + streamName(source) + ")";
+        }
+        else if (source != 0)
+        {
+            reason += " (connection " + std::to_string(source) + ")";
+        }
+        writeDump(reason, triggerUs, static_cast<uint32_t>(metric), source, value);
+        g_autoDumps.fetch_add(1, std::memory_order_relaxed);
+        g_quietUntil.store(now() + kMinDumpIntervalSec * 1000000LL, std::memory_order_relaxed);
+        g_triggerUs.store(-1, std::memory_order_release);
+    }
+
+    bool dumpNow(const std::string &reason)
+    {
+        return writeDump(reason, -1, static_cast<uint32_t>(Metric::Count), 0, 0);
+    }
+
+    Status status()
+    {
+        Status s;
+        s.autoDump = g_autoDump.load(std::memory_order_relaxed);
+        s.samples = g_next.load(std::memory_order_relaxed);
+        std::lock_guard<std::mutex> lock(g_statusMutex);
+        s.dumps = g_dumps;
+        s.lastFile = g_lastFile;
+        s.lastReason = g_lastReason;
+        return s;
+    }
+}
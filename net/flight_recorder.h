@@ -0,0 +1,106 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+// Always-on recorder for lag spikes that are reported after the fact. The
+// network thread and the poll loop sample connection and stream metrics every
+// few milliseconds into one fixed-size ring (lock-free, a few MB, nothing is
+// allocated after start). When a sample crosses its threshold the recorder
+// waits kPostTriggerMs for the aftermath and then writes the last kDumpSeconds
+// of samples to a .ctfr file in the working directory; tools/flight_dump.cpp
+// turns it into a summary, CSV, or a trace for ui.perfetto.dev.
+namespace flight
+{
+    enum class Metric : uint8_t
+    {
+        Ping = 0,        // per connection, ms
+        QueueTime,       // per connection, time a message waits in Steam's send queue, us
+        PendingReliable, // per connection, bytes
+        PollGap,         // poll loop, longest gap between two polls, us
+        PollMessages,    // poll loop, messages received in the sample interval
+        WriteBacklog,    // per stream, bytes delivered but not yet written to the socket
+        FrameTime,       // render thread, us
+        Count,
+    };
+
+    const char *metricName(Metric metric);
+
+    // Spike thresholds; 0 disables one
+    struct Thresholds
+    {
+        int pingMs = 250;
+        int queueTimeMs = 200;
+        int pollGapMs = 50;
+        int frameTimeMs = 100;
+        int writeBacklogKB = 4096;
+    };
+
+    struct Status
+    {
+        bool autoDump = true;
+        uint64_t samples = 0; // recorded since start
+        int dumps = 0;
+        std::string lastFile;
+        std::string lastReason;
+    };
+
+    // Any thread; source tells samples of one metric apart (a connection
+    // handle, streamSource() of a stream id, 0 for process-wide metrics)
+    void record(Metric metric, uint64_t source, int64_t value);
+    uint64_t streamSource(const std::string &id);
+    // Inverse of streamSource() for the tools
+    std::string streamName(uint64_t source);
+
+    void setThresholds(const Thresholds &thresholds);
+    Thresholds thresholds();
+    void setAutoDump(bool on);
+
+    // Call periodically (the network thread does): writes a pending dump once
+    // its post-trigger window has passed
+    void tick();
+    // Writes the last kDumpSeconds now; false if the file could not be written
+    bool dumpNow(const std::string &reason);
+    Status status();
+
+    // Microseconds since the recorder's clock started
+    int64_t now();
+
+    constexpr int kSampleIntervalMs = 10;
+    constexpr size_t kRingSize = 128 * 1024;
+    constexpr int kDumpSeconds = 10;
+    constexpr int kPostTriggerMs = 2000;
+    // A spike that lasts keeps crossing its threshold; one dump covers it
+    constexpr int kMinDumpIntervalSec = 30;
+    constexpr int kMaxAutoDumps = 20;
+
+    // Dump file: FileHeader, then count Records oldest first, little endian
+    constexpr char kMagic[4] = {'C', 'T', 'F', 'R'};
+    constexpr uint32_t kVersion = 1;
+
+    struct FileHeader
+    {
+        char magic[4];
+        uint32_t version;
+        uint32_t recordSize;
+        uint32_t count;
+        int64_t startUnixUs; // wall clock at the recorder's time 0
+        int64_t triggerUs;   // recorder time of the trigger, -1 for a manual dump
+        uint32_t triggerMetric;
+        uint32_t reserved;
+        uint64_t triggerSource;
+        int64_t triggerValue;
+        char reason[96];
+    };
+
+    struct Record
+    {
+        int64_t timeUs;
+        uint64_t source;
+        int64_t value;
+        uint32_t metric;
+        uint32_t reserved;
+    };
+    static_assert(sizeof(Record) == 32, "dump records are 32 bytes");
+}
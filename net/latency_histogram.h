@@ -0,0 +1,94 @@
+#pragma once
+
+#include <array>
+#include <cmath>
+#include <cstdint>
+
+// Fixed-size log-scale histogram of durations in microseconds. Each power of
+// two is split into four buckets, so percentiles are accurate to ~20%.
+class LatencyHistogram
+{
+public:
+    static constexpr int kBuckets = 128;
+
+    LatencyHistogram() { reset(); }
+
+    void reset()
+    {
+        counts_.fill(0);
+        total_ = 0;
+        max_ = 0;
+        sum_ = 0;
+    }
+
+    void record(uint64_t usec)
+    {
+        counts_[bucketFor(usec)]++;
+        total_++;
+        sum_ += usec;
+        if (usec > max_)
+        {
+            max_ = usec;
+        }
+    }
+
+    void merge(const LatencyHistogram &other)
+    {
+        for (int i = 0; i < kBuckets; ++i)
+        {
+            counts_[i] += other.counts_[i];
+        }
+        total_ += other.total_;
+        sum_ += other.sum_;
+        if (other.max_ > max_)
+        {
+            max_ = other.max_;
+        }
+    }
+
+    // Upper bound of the bucket holding the given percentile (0-100)
+    uint64_t percentile(double p) const
+    {
+        if (total_ == 0)
+        {
+            return 0;
+        }
+        uint64_t target = static_cast<uint64_t>(std::ceil(total_ * p / 100.0));
+        if (target == 0)
+        {
+            target = 1;
+        }
+        uint64_t seen = 0;
+        for (int i = 0; i < kBuckets; ++i)
+        {
+            seen += counts_[i];
+            if (seen >= target)
+            {
+                uint64_t upper = bucketUpper(i);
+                return upper < max_ ? upper : max_;
+            }
+        }
+        return max_;
+    }
+
+    uint64_t count() const { return total_; }
+    uint64_t max() const { return max_; }
+    uint64_t mean() const { return total_ ? sum_ / total_ : 0; }
+
+private:
+    static int bucketFor(uint64_t usec)
+    {
+        int b = static_cast<int>(4.0 * std::log2(static_cast<double>(usec) + 1.0));
+        return b < kBuckets ? b : kBuckets - 1;
+    }
+
+    static uint64_t bucketUpper(int bucket)
+    {
+        return static_cast<uint64_t>(std::exp2((bucket + 1) / 4.0));
+    }
+
+    std::array<uint64_t, kBuckets> counts_;
+    uint64_t total_;
+    uint64_t max_;
+    uint64_t sum_;
+};
@@ -0,0 +1,238 @@
+#include "local_bridge.h"
+#include <iostream>
+#ifdef __linux__
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#endif
+
+LocalBridge::LocalBridge(std::shared_ptr<tcp::socket> client, std::shared_ptr<Stats> stats)
+    : client_(std::move(client)), server_(client_->get_executor()), stats_(std::move(stats))
+{
+    stats_->opened++;
+    stats_->active++;
+}
+
+LocalBridge::~LocalBridge()
+{
+#ifdef __linux__
+    for (Direction *d : {&up_, &down_})
+    {
+        for (int fd : d->pipe)
+        {
+            if (fd >= 0)
+            {
+                ::close(fd);
+            }
+        }
+    }
+#endif
+    stats_->active--;
+}
+
+const char *LocalBridge::mechanism()
+{
+#ifdef __linux__
+    return "splice";
+#else
+    return "relay";
+#endif
+}
+
+void LocalBridge::start(const tcp::endpoint &target)
+{
+    auto self = shared_from_this();
+    server_.async_connect(target, [self](const boost::system::error_code &ec)
+                          {
+        if (ec)
+        {
+            std::cerr << "Host-local connect failed: " << ec.message() << std::endl;
+            self->fail();
+            return;
+        }
+        boost::system::error_code ignored;
+        self->client_->set_option(tcp::no_delay(true), ignored);
+        self->server_.set_option(tcp::no_delay(true), ignored);
+        if (!self->setup(self->up_, self->client_.get(), &self->server_) ||
+            !self->setup(self->down_, &self->server_, self->client_.get()))
+        {
+            self->fail();
+            return;
+        }
+        self->pump(self->up_);
+        self->pump(self->down_); });
+}
+
+bool LocalBridge::setup(Direction &d, tcp::socket *from, tcp::socket *to)
+{
+    d.from = from;
+    d.to = to;
+#ifdef __linux__
+    if (::pipe2(d.pipe, O_NONBLOCK | O_CLOEXEC) != 0)
+    {
+        std::cerr << "Host-local pipe failed: " << std::strerror(errno) << std::endl;
+        return false;
+    }
+    // splice() does the socket I/O itself, so the sockets must not block either
+    boost::system::error_code ec;
+    from->native_non_blocking(true, ec);
+    to->native_non_blocking(true, ec);
+    return !ec;
+#else
+    d.buffer.resize(kChunk);
+    return true;
+#endif
+}
+
+void LocalBridge::pump(Direction &d)
+{
+    if (closed_ || d.done)
+    {
+        return;
+    }
+#ifdef __linux__
+    for (int round = 0; round < kMaxRounds; ++round)
+    {
+        if (d.inPipe > 0)
+        {
+            ssize_t n = ::splice(d.pipe[0], nullptr, d.to->native_handle(), nullptr, d.inPipe,
+                                 SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+            if (n < 0)
+            {
+                if (errno == EINTR)
+                {
+                    continue;
+                }
+                if (errno == EAGAIN)
+                {
+                    waitWrite(d);
+                }
+                else
+                {
+                    fail();
+                }
+                return;
+            }
+            d.inPipe -= static_cast<size_t>(n);
+            stats_->bytes += static_cast<uint64_t>(n);
+            continue;
+        }
+        if (d.eof)
+        {
+            finishDirection(d);
+            return;
+        }
+        ssize_t n = ::splice(d.from->native_handle(), nullptr, d.pipe[1], nullptr, kChunk,
+                             SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+        if (n < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            if (errno == EAGAIN)
+            {
+                waitRead(d);
+            }
+            else
+            {
+                fail();
+            }
+            return;
+        }
+        if (n == 0)
+        {
+            d.eof = true;
+        }
+        d.inPipe += static_cast<size_t>(n);
+    }
+    // Busy stream: let the other sockets on this thread run first
+    auto self = shared_from_this();
+    boost::asio::post(server_.get_executor(), [self, &d]()
+                      { self->pump(d); });
+#else
+    waitRead(d);
+#endif
+}
+
+void LocalBridge::waitRead(Direction &d)
+{
+    auto self = shared_from_this();
+#ifdef __linux__
+    d.from->async_wait(tcp::socket::wait_read, [self, &d](const boost::system::error_code &ec)
+                       {
+        if (ec)
+        {
+            self->fail();
+            return;
+        }
+        self->pump(d); });
+#else
+    d.from->async_read_some(boost::asio::buffer(d.buffer), [self, &d](const boost::system::error_code &ec, std::size_t bytes)
+                            {
+        if (ec == boost::asio::error::eof)
+        {
+            self->finishDirection(d);
+            return;
+        }
+        if (ec)
+        {
+            self->fail();
+            return;
+        }
+        boost::asio::async_write(*d.to, boost::asio::buffer(d.buffer.data(), bytes),
+                                 [self, &d](const boost::system::error_code &ec, std::size_t written)
+                                 {
+            if (ec)
+            {
+                self->fail();
+                return;
+            }
+            self->stats_->bytes += written;
+            self->pump(d); }); });
+#endif
+}
+
+void LocalBridge::waitWrite(Direction &d)
+{
+    auto self = shared_from_this();
+    d.to->async_wait(tcp::socket::wait_write, [self, &d](const boost::system::error_code &ec)
+                     {
+        if (ec)
+        {
+            self->fail();
+            return;
+        }
+        self->pump(d); });
+}
+
+void LocalBridge::finishDirection(Direction &d)
+{
+    if (closed_)
+    {
+        return;
+    }
+    boost::system::error_code ignored;
+    d.to->shutdown(tcp::socket::shutdown_send, ignored);
+    d.done = true;
+    if (up_.done && down_.done)
+    {
+        closed_ = true;
+        client_->close(ignored);
+        server_.close(ignored);
+    }
+}
+
+void LocalBridge::fail()
+{
+    if (closed_)
+    {
+        return;
+    }
+    closed_ = true;
+    boost::system::error_code ignored;
+    client_->close(ignored);
+    server_.close(ignored);
+}
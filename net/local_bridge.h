@@ -0,0 +1,64 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <vector>
+#include <boost/asio.hpp>
+
+using boost::asio::ip::tcp;
+
+// Host-local shortcut: when the host's own game client connects to the
+// listener, the connection goes straight to the game server on this machine
+// instead of through the tunnel. On Linux the bytes move socket -> pipe ->
+// socket with splice() and never reach user space; elsewhere a plain relay
+// copies them. A half-close is passed on like a FIN through the tunnel.
+class LocalBridge : public std::enable_shared_from_this<LocalBridge>
+{
+public:
+    // Shared by every bridge of one listener
+    struct Stats
+    {
+        std::atomic<uint64_t> opened{0};
+        std::atomic<int> active{0};
+        std::atomic<uint64_t> bytes{0};
+    };
+
+    LocalBridge(std::shared_ptr<tcp::socket> client, std::shared_ptr<Stats> stats);
+    ~LocalBridge();
+
+    // Connect to the game server and start relaying both ways
+    void start(const tcp::endpoint &target);
+
+    static const char *mechanism();
+
+private:
+    struct Direction
+    {
+        tcp::socket *from = nullptr;
+        tcp::socket *to = nullptr;
+        int pipe[2] = {-1, -1};
+        size_t inPipe = 0;        // spliced in, not yet out
+        std::vector<char> buffer; // relay without splice
+        bool eof = false;
+        bool done = false;
+    };
+
+    bool setup(Direction &d, tcp::socket *from, tcp::socket *to);
+    void pump(Direction &d);
+    void waitRead(Direction &d);
+    void waitWrite(Direction &d);
+    void finishDirection(Direction &d);
+    void fail();
+
+    static constexpr size_t kChunk = 64 * 1024;
+    // Splice rounds per wakeup before yielding to other sockets
+    static constexpr int kMaxRounds = 16;
+
+    std::shared_ptr<tcp::socket> client_;
+    tcp::socket server_;
+    std::shared_ptr<Stats> stats_;
+    Direction up_;   // game client -> game server
+    Direction down_; // game server -> game client
+    bool closed_ = false;
+};
@@ -0,0 +1,166 @@
+#include "mapped_file.h"
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+MappedFile::~MappedFile()
+{
+    close(size_);
+}
+
+#ifdef _WIN32
+bool MappedFile::create(const std::string &path, size_t size)
+{
+    close(size_);
+    HANDLE file = CreateFileA(path.c_str(), GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ, nullptr,
+                              CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (file == INVALID_HANDLE_VALUE)
+    {
+        return false;
+    }
+    ULARGE_INTEGER length;
+    length.QuadPart = size;
+    HANDLE mapping = CreateFileMappingA(file, nullptr, PAGE_READWRITE, length.HighPart, length.LowPart, nullptr);
+    void *view = mapping ? MapViewOfFile(mapping, FILE_MAP_WRITE, 0, 0, size) : nullptr;
+    if (!view)
+    {
+        if (mapping)
+        {
+            CloseHandle(mapping);
+        }
+        CloseHandle(file);
+        return false;
+    }
+    file_ = file;
+    mapping_ = mapping;
+    data_ = static_cast<char *>(view);
+    size_ = size;
+    return true;
+}
+
+bool MappedFile::grow(size_t size)
+{
+    if (!data_ || size <= size_)
+    {
+        return data_ != nullptr;
+    }
+    ULARGE_INTEGER length;
+    length.QuadPart = size;
+    HANDLE mapping = CreateFileMappingA(file_, nullptr, PAGE_READWRITE, length.HighPart, length.LowPart, nullptr);
+    void *view = mapping ? MapViewOfFile(mapping, FILE_MAP_WRITE, 0, 0, size) : nullptr;
+    if (!view)
+    {
+        if (mapping)
+        {
+            CloseHandle(mapping);
+        }
+        return false;
+    }
+    unmap();
+    mapping_ = mapping;
+    data_ = static_cast<char *>(view);
+    size_ = size;
+    return true;
+}
+
+void MappedFile::unmap()
+{
+    UnmapViewOfFile(data_);
+    CloseHandle(mapping_);
+    data_ = nullptr;
+    mapping_ = nullptr;
+}
+
+void MappedFile::close(size_t used)
+{
+    if (!data_)
+    {
+        return;
+    }
+    FlushViewOfFile(data_, 0);
+    unmap();
+    LARGE_INTEGER end;
+    end.QuadPart = static_cast<LONGLONG>(used < size_ ? used : size_);
+    SetFilePointerEx(file_, end, nullptr, FILE_BEGIN);
+    SetEndOfFile(file_);
+    CloseHandle(file_);
+    file_ = nullptr;
+    size_ = 0;
+}
+#else
+bool MappedFile::create(const std::string &path, size_t size)
+{
+    close(size_);
+    int fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0)
+    {
+        return false;
+    }
+    if (ftruncate(fd, static_cast<off_t>(size)) != 0)
+    {
+        ::close(fd);
+        return false;
+    }
+    void *view = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (view == MAP_FAILED)
+    {
+        ::close(fd);
+        return false;
+    }
+    fd_ = fd;
+    data_ = static_cast<char *>(view);
+    size_ = size;
+    return true;
+}
+
+bool MappedFile::grow(size_t size)
+{
+    if (!data_ || size <= size_)
+    {
+        return data_ != nullptr;
+    }
+    if (ftruncate(fd_, static_cast<off_t>(size)) != 0)
+    {
+        return false;
+    }
+    void *view = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd_, 0);
+    if (view == MAP_FAILED)
+    {
+        return false;
+    }
+    unmap();
+    data_ = static_cast<char *>(view);
+    size_ = size;
+    return true;
+}
+
+void MappedFile::unmap()
+{
+    munmap(data_, size_);
+    data_ = nullptr;
+}
+
+void MappedFile::close(size_t used)
+{
+    if (!data_)
+    {
+        return;
+    }
+    unmap();
+    if (ftruncate(fd_, static_cast<off_t>(used < size_ ? used : size_)) != 0)
+    {
+        // The file keeps its full size; readers go by the header's counts
+    }
+    ::close(fd_);
+    fd_ = -1;
+    size_ = 0;
+}
+#endif
@@ -0,0 +1,42 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+
+// A file written through a shared memory mapping: create() sizes the file and
+// maps it, the caller fills data(), close() trims the file to the bytes used.
+// Writers that stream an unknown amount grow() the file as they go.
+// Writes land in the page cache without a syscall each, and the kernel keeps
+// them even if the process dies before close().
+class MappedFile
+{
+public:
+    MappedFile() = default;
+    ~MappedFile();
+    MappedFile(const MappedFile &) = delete;
+    MappedFile &operator=(const MappedFile &) = delete;
+
+    // Creates or truncates path and maps size bytes of it; false on failure
+    bool create(const std::string &path, size_t size);
+    // Extends the file to size bytes and maps all of it again; data() moves.
+    // On failure the file stays open at its old size.
+    bool grow(size_t size);
+    // Unmaps and truncates the file to used bytes
+    void close(size_t used);
+
+    bool isOpen() const { return data_ != nullptr; }
+    char *data() const { return data_; }
+    size_t size() const { return size_; }
+
+private:
+    void unmap();
+
+    char *data_ = nullptr;
+    size_t size_ = 0;
+#ifdef _WIN32
+    void *file_ = nullptr;
+    void *mapping_ = nullptr;
+#else
+    int fd_ = -1;
+#endif
+};
@@ -0,0 +1,303 @@
+#include "mem_tracker.h"
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <ctime>
+#include <fstream>
+#include <mutex>
+#include <new>
+
+namespace memtrack
+{
+    namespace
+    {
+        constexpr size_t kTagCount = static_cast<size_t>(Tag::Count);
+        const char *const kTagNames[kTagCount] = {"other", "MultiplexManager", "TCPServer", "SteamMessageHandler", "UI"};
+
+        thread_local Tag t_tag = Tag::Other;
+
+#ifdef CONNECTTOOL_MEMTRACK
+        struct Counters
+        {
+            std::atomic<int64_t> live{0};
+            std::atomic<int64_t> peak{0};
+            std::atomic<uint64_t> allocs{0};
+            std::atomic<uint64_t> frees{0};
+            std::atomic<uint64_t> bytes{0};
+        };
+        Counters g_counters[kTagCount];
+
+        // Right in front of every block we hand out; offset leads back to
+        // what malloc returned (more than the header for over-aligned types)
+        struct alignas(16) Header
+        {
+            uint64_t size;
+            uint32_t offset;
+            uint8_t tag;
+        };
+        static_assert(sizeof(Header) == 16, "header keeps malloc's 16-byte alignment");
+
+        void charge(Tag tag, size_t size)
+        {
+            Counters &c = g_counters[static_cast<size_t>(tag)];
+            int64_t live = c.live.fetch_add(static_cast<int64_t>(size), std::memory_order_relaxed) + static_cast<int64_t>(size);
+            c.allocs.fetch_add(1, std::memory_order_relaxed);
+            c.bytes.fetch_add(size, std::memory_order_relaxed);
+            int64_t peak = c.peak.load(std::memory_order_relaxed);
+            while (live > peak && !c.peak.compare_exchange_weak(peak, live, std::memory_order_relaxed))
+            {
+            }
+        }
+
+        void *trackedAlloc(size_t size, size_t align, Tag tag)
+        {
+            // malloc's own alignment covers the header case; over-aligned
+            // types get slack to round up into
+            bool overAligned = align > alignof(Header);
+            char *base = static_cast<char *>(std::malloc(size + sizeof(Header) + (overAligned ? align - 1 : 0)));
+            if (!base)
+            {
+                return nullptr;
+            }
+            char *user = base + sizeof(Header);
+            if (overAligned)
+            {
+                uintptr_t address = reinterpret_cast<uintptr_t>(user);
+                user += (align - address % align) % align;
+            }
+            size_t offset = static_cast<size_t>(user - base);
+            Header *h = reinterpret_cast<Header *>(user) - 1;
+            h->size = size;
+            h->offset = static_cast<uint32_t>(offset);
+            h->tag = static_cast<uint8_t>(tag);
+            charge(tag, size);
+            return user;
+        }
+
+        void trackedFree(void *ptr)
+        {
+            if (!ptr)
+            {
+                return;
+            }
+            Header *h = static_cast<Header *>(ptr) - 1;
+            Counters &c = g_counters[h->tag];
+            c.live.fetch_sub(static_cast<int64_t>(h->size), std::memory_order_relaxed);
+            c.frees.fetch_add(1, std::memory_order_relaxed);
+            std::free(static_cast<char *>(ptr) - h->offset);
+        }
+
+        void *newOrThrow(size_t size, size_t align)
+        {
+            void *p = trackedAlloc(size ? size : 1, align, t_tag);
+            if (!p)
+            {
+                throw std::bad_alloc();
+            }
+            return p;
+        }
+
+        struct Sample
+        {
+            std::chrono::steady_clock::time_point at;
+            std::array<uint64_t, kTagCount> allocs{};
+            std::array<uint64_t, kTagCount> bytes{};
+        };
+
+        struct HistoryPoint
+        {
+            std::time_t at;
+            std::array<int64_t, kTagCount> live;
+        };
+
+        std::mutex g_mutex;
+        Sample g_lastSample;
+        std::array<double, kTagCount> g_allocRate{};
+        std::array<double, kTagCount> g_byteRate{};
+        std::vector<HistoryPoint> g_history; // ring of kHistorySize
+        size_t g_historyNext = 0;
+        std::chrono::steady_clock::time_point g_lastHistory;
+#endif
+    }
+
+#ifdef CONNECTTOOL_MEMTRACK
+    bool available() { return true; }
+#else
+    bool available() { return false; }
+#endif
+
+    const char *tagName(Tag tag)
+    {
+        size_t index = static_cast<size_t>(tag);
+        return index < kTagCount ? kTagNames[index] : "?";
+    }
+
+    Tag currentTag() { return t_tag; }
+
+    void setThreadTag(Tag tag) { t_tag = tag; }
+
+#ifdef CONNECTTOOL_MEMTRACK
+    void *allocate(size_t size, Tag tag) { return trackedAlloc(size, 0, tag); }
+
+    void release(void *ptr) { trackedFree(ptr); }
+
+    std::vector<TagStats> stats()
+    {
+        std::lock_guard<std::mutex> lock(g_mutex);
+        std::vector<TagStats> out;
+        for (size_t i = 0; i < kTagCount; ++i)
+        {
+            const Counters &c = g_counters[i];
+            TagStats s;
+            s.tag = static_cast<Tag>(i);
+            s.liveBytes = c.live.load(std::memory_order_relaxed);
+            s.peakBytes = c.peak.load(std::memory_order_relaxed);
+            s.allocs = c.allocs.load(std::memory_order_relaxed);
+            s.frees = c.frees.load(std::memory_order_relaxed);
+            s.bytesAllocated = c.bytes.load(std::memory_order_relaxed);
+            s.allocsPerSec = g_allocRate[i];
+            s.bytesPerSec = g_byteRate[i];
+            out.push_back(s);
+        }
+        return out;
+    }
+
+    void resetPeaks()
+    {
+        for (auto &c : g_counters)
+        {
+            c.peak.store(c.live.load(std::memory_order_relaxed), std::memory_order_relaxed);
+        }
+    }
+
+    void tick()
+    {
+        auto now = std::chrono::steady_clock::now();
+        std::lock_guard<std::mutex> lock(g_mutex);
+        auto elapsed = now - g_lastSample.at;
+        if (elapsed >= std::chrono::milliseconds(kRateIntervalMs))
+        {
+            double seconds = std::chrono::duration<double>(elapsed).count();
+            bool first = g_lastSample.at == std::chrono::steady_clock::time_point();
+            for (size_t i = 0; i < kTagCount; ++i)
+            {
+                uint64_t allocs = g_counters[i].allocs.load(std::memory_order_relaxed);
+                uint64_t bytes = g_counters[i].bytes.load(std::memory_order_relaxed);
+                if (!first)
+                {
+                    g_allocRate[i] = (allocs - g_lastSample.allocs[i]) / seconds;
+                    g_byteRate[i] = (bytes - g_lastSample.bytes[i]) / seconds;
+                }
+                g_lastSample.allocs[i] = allocs;
+                g_lastSample.bytes[i] = bytes;
+            }
+            g_lastSample.at = now;
+        }
+        if (g_history.empty() || now - g_lastHistory >= std::chrono::seconds(kHistoryIntervalSec))
+        {
+            HistoryPoint point;
+            point.at = std::time(nullptr);
+            for (size_t i = 0; i < kTagCount; ++i)
+            {
+                point.live[i] = g_counters[i].live.load(std::memory_order_relaxed);
+            }
+            if (g_history.size() < kHistorySize)
+            {
+                g_history.push_back(point);
+            }
+            else
+            {
+                g_history[g_historyNext] = point;
+            }
+            g_historyNext = (g_historyNext + 1) % kHistorySize;
+            g_lastHistory = now;
+        }
+    }
+
+    bool writeReport(const std::string &path)
+    {
+        std::vector<TagStats> current = stats();
+        std::vector<HistoryPoint> history;
+        {
+            std::lock_guard<std::mutex> lock(g_mutex);
+            // Oldest first
+            size_t start = g_history.size() < kHistorySize ? 0 : g_historyNext;
+            for (size_t i = 0; i < g_history.size(); ++i)
+            {
+                history.push_back(g_history[(start + i) % g_history.size()]);
+            }
+        }
+
+        std::ofstream out(path, std::ios::trunc);
+        if (!out)
+        {
+            return false;
+        }
+        out << "# subsystem,live_bytes,peak_bytes,allocs,frees,bytes_allocated,allocs_per_sec,bytes_per_sec\n";
+        for (const TagStats &s : current)
+        {
+            out << tagName(s.tag) << ',' << s.liveBytes << ',' << s.peakBytes << ',' << s.allocs << ','
+                << s.frees << ',' << s.bytesAllocated << ',' << s.allocsPerSec << ',' << s.bytesPerSec << '\n';
+        }
+        out << "\n# live bytes, one row per " << kHistoryIntervalSec << " s\n# unix_time";
+        for (size_t i = 0; i < kTagCount; ++i)
+        {
+            out << ',' << kTagNames[i];
+        }
+        out << '\n';
+        for (const HistoryPoint &point : history)
+        {
+            out << point.at;
+            for (int64_t live : point.live)
+            {
+                out << ',' << live;
+            }
+            out << '\n';
+        }
+        return static_cast<bool>(out);
+    }
+#else
+    void *allocate(size_t size, Tag) { return std::malloc(size); }
+
+    void release(void *ptr) { std::free(ptr); }
+
+    std::vector<TagStats> stats() { return {}; }
+
+    void resetPeaks() {}
+
+    void tick() {}
+
+    bool writeReport(const std::string &) { return false; }
+#endif
+}
+
+#ifdef CONNECTTOOL_MEMTRACK
+void *operator new(std::size_t size) { return memtrack::newOrThrow(size, 0); }
+void *operator new[](std::size_t size) { return memtrack::newOrThrow(size, 0); }
+void *operator new(std::size_t size, std::align_val_t align) { return memtrack::newOrThrow(size, static_cast<size_t>(align)); }
+void *operator new[](std::size_t size, std::align_val_t align) { return memtrack::newOrThrow(size, static_cast<size_t>(align)); }
+void *operator new(std::size_t size, const std::nothrow_t &) noexcept { return memtrack::trackedAlloc(size ? size : 1, 0, memtrack::t_tag); }
+void *operator new[](std::size_t size, const std::nothrow_t &) noexcept { return memtrack::trackedAlloc(size ? size : 1, 0, memtrack::t_tag); }
+void *operator new(std::size_t size, std::align_val_t align, const std::nothrow_t &) noexcept
+{
+    return memtrack::trackedAlloc(size ? size : 1, static_cast<size_t>(align), memtrack::t_tag);
+}
+void *operator new[](std::size_t size, std::align_val_t align, const std::nothrow_t &) noexcept
+{
+    return memtrack::trackedAlloc(size ? size : 1, static_cast<size_t>(align), memtrack::t_tag);
+}
+
+void operator delete(void *ptr) noexcept { memtrack::trackedFree(ptr); }
+void operator delete[](void *ptr) noexcept { memtrack::trackedFree(ptr); }
+void operator delete(void *ptr, std::size_t) noexcept { memtrack::trackedFree(ptr); }
+void operator delete[](void *ptr, std::size_t) noexcept { memtrack::trackedFree(ptr); }
+void operator delete(void *ptr, std::align_val_t) noexcept { memtrack::trackedFree(ptr); }
+void operator delete[](void *ptr, std::align_val_t) noexcept { memtrack::trackedFree(ptr); }
+void operator delete(void *ptr, std::size_t, std::align_val_t) noexcept { memtrack::trackedFree(ptr); }
+void operator delete[](void *ptr, std::size_t, std::align_val_t) noexcept { memtrack::trackedFree(ptr); }
+void operator delete(void *ptr, const std::nothrow_t &) noexcept { memtrack::trackedFree(ptr); }
+void operator delete[](void *ptr, const std::nothrow_t &) noexcept { memtrack::trackedFree(ptr); }
+void operator delete(void *ptr, std::align_val_t, const std::nothrow_t &) noexcept { memtrack::trackedFree(ptr); }
+void operator delete[](void *ptr, std::align_val_t, const std::nothrow_t &) noexcept { memtrack::trackedFree(ptr); }
+#endif
@@ -0,0 +1,92 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Opt-in allocation accounting per subsystem, built with CONNECTTOOL_MEMTRACK.
+// The global operator new/delete are replaced: every block carries a small
+// header with its size and the tag that was current when it was allocated, so
+// a free is charged to the subsystem that allocated it whichever thread
+// releases it. The current tag is per thread: a thread default (the TCP
+// server thread is TCPServer, the render thread UI) overridden by
+// MEMTRACK_SCOPE at subsystem entry points. Memory the Steam client library
+// allocates itself (received messages) is not seen. Without the build flag
+// MEMTRACK_SCOPE compiles to nothing and stats() is empty.
+namespace memtrack
+{
+    enum class Tag : uint8_t
+    {
+        Other = 0,
+        Multiplex,      // MultiplexManager and its stream pipelines
+        TcpServer,
+        MessageHandler, // SteamMessageHandler's poll loop
+        Ui,             // render thread and ImGui
+        Count,
+    };
+
+    struct TagStats
+    {
+        Tag tag = Tag::Other;
+        int64_t liveBytes = 0;
+        int64_t peakBytes = 0;
+        uint64_t allocs = 0;
+        uint64_t frees = 0;
+        uint64_t bytesAllocated = 0;
+        // Over the last rate interval
+        double allocsPerSec = 0.0;
+        double bytesPerSec = 0.0;
+    };
+
+    // Whether the build tracks allocations at all
+    bool available();
+    const char *tagName(Tag tag);
+
+    Tag currentTag();
+    // Tag of the calling thread until changed; threads that belong to one
+    // subsystem set it once at start
+    void setThreadTag(Tag tag);
+
+    // For allocators outside operator new (ImGui); release() any pointer
+    // allocate() returned
+    void *allocate(size_t size, Tag tag);
+    void release(void *ptr);
+
+    std::vector<TagStats> stats();
+    void resetPeaks();
+    // Call periodically (the network thread does): updates rates and, once a
+    // minute, the live-bytes history kept for the report
+    void tick();
+    // Current stats and the live-bytes history as text; false if the file
+    // could not be written
+    bool writeReport(const std::string &path);
+
+    constexpr int kRateIntervalMs = 1000;
+    // One sample a minute, a day of history
+    constexpr int kHistoryIntervalSec = 60;
+    constexpr size_t kHistorySize = 24 * 60;
+
+    class Scope
+    {
+    public:
+        explicit Scope(Tag tag) : previous_(currentTag()) { setThreadTag(tag); }
+        ~Scope() { setThreadTag(previous_); }
+        Scope(const Scope &) = delete;
+        Scope &operator=(const Scope &) = delete;
+
+    private:
+        Tag previous_;
+    };
+}
+
+#ifdef CONNECTTOOL_MEMTRACK
+#define MEMTRACK_CONCAT_INNER(a, b) a##b
+#define MEMTRACK_CONCAT(a, b) MEMTRACK_CONCAT_INNER(a, b)
+#define MEMTRACK_SCOPE(tag) memtrack::Scope MEMTRACK_CONCAT(memtrackScope_, __LINE__)(tag)
+#else
+#define MEMTRACK_SCOPE(tag) \
+    do                      \
+    {                       \
+    } while (0)
+#endif
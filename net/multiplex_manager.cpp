@@ -1,15 +1,59 @@
 #include "multiplex_manager.h"
+#include "tunnel_protocol.h"
+#include "trace.h"
+#include "mem_tracker.h"
+#include "tunnel_capture.h"
 #include "nanoid/nanoid.h"
 #include <iostream>
 #include <cstring>
+#include <algorithm>
 
-MultiplexManager::MultiplexManager(ISteamNetworkingSockets *steamInterface, HSteamNetConnection steamConn,
+MultiplexManager::MultiplexManager(TunnelTransport *transport, HSteamNetConnection steamConn,
                                    boost::asio::io_context &io_context, bool &isHost, int &localPort)
-    : steamInterface_(steamInterface), steamConn_(steamConn),
-      io_context_(io_context), isHost_(isHost), localPort_(localPort) {}
+    : transport_(transport), steamConn_(steamConn),
+      io_context_(io_context), isHost_(isHost), localPort_(localPort),
+      scheduler_([this](const char *frame, size_t len, const SendScheduler::FrameTimes &times)
+                 { return sendFrame(frame, len, times); },
+                 [this]()
+                 { return linkState(); },
+                 [this](const std::string &id)
+                 {
+                     if (id == tunnel::kSpeedTestId)
+                     {
+                         speedTest_->onWritable();
+                         return;
+                     }
+                     auto pipeline = getClient(id);
+                     if (pipeline)
+                     {
+                         pipeline->resumeRead();
+                     }
+                 }),
+      mappings_(nullptr), backupConn_(k_HSteamNetConnection_Invalid), backupActive_(false), timingEnabled_(false),
+      stampUntilUs_(0), linkUp_(true), retaining_(false), resumable_(false), peerOpens_(false), peerDelta_(false),
+      helloSent_(Clock::time_point())
+{
+    speedTest_ = std::make_shared<SpeedTest>(
+        io_context_,
+        [this](uint32_t type, const void *payload, size_t len)
+        { sendControl(tunnel::kSpeedTestId, type, payload, len); },
+        [this](uint32_t type, const void *payload, size_t len)
+        {
+            // Unreliable so a lost ping shows as loss, not as a late answer
+            sendDirect(tunnel::kSpeedTestId, type, payload, len, k_nSteamNetworkingSend_UnreliableNoNagle);
+        },
+        [this](const char *frame, size_t len)
+        {
+            bool more = scheduler_.enqueue(tunnel::kSpeedTestId, frame, len);
+            scheduler_.flush();
+            return more;
+        });
+    scheduler_.setStreamClass(tunnel::kSpeedTestId, TrafficClass::Bulk);
+}
 
 MultiplexManager::~MultiplexManager()
 {
+    speedTest_->shutdown();
     // Close all sockets
     std::lock_guard<std::mutex> lock(mapMutex_);
     for (auto &pair : clientMap_)
@@ -19,35 +63,272 @@ MultiplexManager::~MultiplexManager()
     clientMap_.clear();
 }
 
-std::string MultiplexManager::addClient(std::shared_ptr<tcp::socket> socket)
+std::shared_ptr<StreamPipeline> MultiplexManager::createPipeline(const std::string &id, std::shared_ptr<tcp::socket> socket)
+{
+    return std::make_shared<StreamPipeline>(
+        id, std::move(socket),
+        [this](const std::string &streamId, const char *frame, size_t len, StreamPipeline::Clock::time_point readAt)
+        {
+            bool keepReading = scheduler_.enqueue(streamId, frame, len, readAt);
+            scheduler_.flush();
+            return keepReading;
+        },
+        [this](const std::string &streamId)
+        { onStreamFinished(streamId); },
+        [this](const std::string &streamId, bool reset)
+        { onStreamClosed(streamId, reset); });
+}
+
+int MultiplexManager::resolveTarget(int targetPort, PortMapping &mapping)
+{
+    const PortMappingTable *table = mappings_;
+    bool listed = table && table->findTarget(targetPort, mapping);
+    if (targetPort == 0)
+    {
+        return localPort_ > 0 ? localPort_ : 0;
+    }
+    // Only ports the host forwards; a client cannot reach anything else here
+    return listed ? targetPort : 0;
+}
+
+std::shared_ptr<StreamPipeline> MultiplexManager::openLocalStream(const std::string &id, int targetPort)
+{
+    PortMapping mapping;
+    int port = resolveTarget(targetPort, mapping);
+    if (port <= 0)
+    {
+        std::cerr << "Refusing stream " << id << " to unmapped port " << targetPort << std::endl;
+        return nullptr;
+    }
+    std::shared_ptr<StreamPipeline> pipeline;
+    {
+        std::lock_guard<std::mutex> lock(mapMutex_);
+        auto it = clientMap_.find(id);
+        if (it != clientMap_.end())
+        {
+            return it->second;
+        }
+        pipeline = createPipeline(id, std::make_shared<tcp::socket>(io_context_));
+        clientMap_[id] = pipeline;
+        streamStats_.opened++;
+    }
+    trackStream(id, targetPort);
+    if (mapping.trafficClass != TrafficClass::Auto || mapping.weight > 1)
+    {
+        scheduler_.setStreamClass(id, mapping.trafficClass, mapping.weight);
+    }
+    resumeLog_.open(id);
+    // DELTA frames would be dropped as unknown by a client that cannot decode them
+    if (mapping.delta && peerDelta_)
+    {
+        enableDelta(id, pipeline);
+    }
+    if (mapping.trafficClass == TrafficClass::Interactive)
+    {
+        markCritical(id);
+    }
+    // 如果是主持，连接到本地端口；期间收到的数据先排队
+    std::cout << "Creating new TCP client for id " << id << " connecting to localhost:" << port << std::endl;
+    tcp::endpoint target(boost::asio::ip::address_v4::loopback(), static_cast<unsigned short>(port));
+    pipeline->connect(target, [this](const std::string &streamId, bool connected)
+                      { onLocalConnected(streamId, connected); });
+    return pipeline;
+}
+
+void MultiplexManager::sendOpen(const std::string &id, int targetPort)
+{
+    if (targetPort == 0)
+    {
+        // Default port: the plain OPEN every host version understands
+        sendTunnelPacket(id, nullptr, 0, tunnel::kFrameOpen);
+        return;
+    }
+    uint32_t port = static_cast<uint32_t>(targetPort);
+    std::vector<char> packet(tunnel::kHeaderSize + sizeof(port));
+    tunnel::writeHeader(packet.data(), id, tunnel::kFrameOpen);
+    std::memcpy(&packet[tunnel::kHeaderSize], &port, sizeof(port));
+    scheduler_.enqueueControl(id, packet.data(), packet.size());
+    scheduler_.flush();
+}
+
+void MultiplexManager::trackStream(const std::string &id, int targetPort)
+{
+    std::lock_guard<std::mutex> lock(mapMutex_);
+    streamPorts_[id] = targetPort;
+    portStats_[targetPort].opened++;
+}
+
+void MultiplexManager::retireStream(const std::string &id, const std::shared_ptr<StreamPipeline> &pipeline)
+{
+    // Caller holds mapMutex_
+    auto it = streamPorts_.find(id);
+    if (it == streamPorts_.end())
+    {
+        return;
+    }
+    PortStats &stats = portStats_[it->second];
+    stats.bytesSent += pipeline->bytesRead();
+    stats.bytesReceived += pipeline->bytesWritten();
+    auto encoder = deltaEncoders_.find(id);
+    if (encoder != deltaEncoders_.end())
+    {
+        DeltaEncoder::Stats coded = encoder->second->stats();
+        stats.deltaRawBytes += coded.rawBytes;
+        stats.deltaSentBytes += coded.encodedBytes;
+        deltaEncoders_.erase(encoder);
+    }
+    deltaDecoders_.erase(id);
+    backupDelivered_.erase(id);
+    {
+        std::lock_guard<std::mutex> backupLock(backupMutex_);
+        backupSent_.erase(id);
+    }
+    {
+        std::lock_guard<std::mutex> timingLock(timingMutex_);
+        retireTiming(id);
+    }
+    streamPorts_.erase(it);
+}
+
+void MultiplexManager::enableDelta(const std::string &id, const std::shared_ptr<StreamPipeline> &pipeline)
+{
+    auto encoder = std::make_shared<DeltaEncoder>();
+    {
+        std::lock_guard<std::mutex> lock(mapMutex_);
+        deltaEncoders_[id] = encoder;
+    }
+    // Frames read before the transform is in place go out as plain DATA,
+    // which leaves both histories alike
+    pipeline->setTransform(encoder);
+}
+
+const std::vector<char> *MultiplexManager::decodeDelta(const std::string &id, const char *payload, size_t len)
+{
+    std::shared_ptr<DeltaDecoder> decoder;
+    {
+        std::lock_guard<std::mutex> lock(mapMutex_);
+        if (!clientMap_.count(id))
+        {
+            return nullptr;
+        }
+        auto &slot = deltaDecoders_[id];
+        if (!slot)
+        {
+            slot = std::make_shared<DeltaDecoder>();
+        }
+        decoder = slot;
+    }
+    if (!decoder->decode(payload, len, deltaPayload_))
+    {
+        return nullptr;
+    }
+    return &deltaPayload_;
+}
+
+std::map<int, PortStats> MultiplexManager::getPortStats()
+{
+    std::lock_guard<std::mutex> lock(mapMutex_);
+    std::map<int, PortStats> stats = portStats_;
+    for (const auto &pair : streamPorts_)
+    {
+        auto it = clientMap_.find(pair.first);
+        if (it == clientMap_.end())
+        {
+            continue;
+        }
+        PortStats &port = stats[pair.second];
+        port.active++;
+        port.bytesSent += it->second->bytesRead();
+        port.bytesReceived += it->second->bytesWritten();
+        auto encoder = deltaEncoders_.find(pair.first);
+        if (encoder != deltaEncoders_.end())
+        {
+            DeltaEncoder::Stats coded = encoder->second->stats();
+            port.deltaRawBytes += coded.rawBytes;
+            port.deltaSentBytes += coded.encodedBytes;
+        }
+    }
+    return stats;
+}
+
+void MultiplexManager::onLocalConnected(const std::string &id, bool connected)
+{
+    capture::event(capture::Kind::StreamConnected, steamConn_, id, connected ? 1 : 0);
+    if (connected)
+    {
+        std::cout << "Successfully created TCP client for id " << id << std::endl;
+        sendTunnelPacket(id, nullptr, 0, tunnel::kFrameOpenAck);
+        return;
+    }
+    std::cerr << "Failed to create TCP client for id " << id << std::endl;
+    onStreamClosed(id, true);
+}
+
+std::string MultiplexManager::addClient(std::shared_ptr<tcp::socket> socket, const PortMapping *mapping)
 {
+    MEMTRACK_SCOPE(memtrack::Tag::Multiplex);
+    int targetPort = mapping ? mapping->targetPort : 0;
     std::string id;
+    std::shared_ptr<StreamPipeline> pipeline;
     {
         std::lock_guard<std::mutex> lock(mapMutex_);
-        id = nanoid::generate(6);
-        clientMap_[id] = socket;
-        readBuffers_[id].resize(1024);
+        id = nanoid::generate(tunnel::kIdLength);
+        pipeline = createPipeline(id, socket);
+        clientMap_[id] = pipeline;
+        auto now = Clock::now();
+        awaitingAck_[id] = now;
+        awaitingFirstByte_[id] = now;
+        streamStats_.opened++;
+    }
+    trackStream(id, targetPort);
+    if (mapping && (mapping->trafficClass != TrafficClass::Auto || mapping->weight > 1))
+    {
+        scheduler_.setStreamClass(id, mapping->trafficClass, mapping->weight);
+    }
+    resumeLog_.open(id);
+    // Only a version 6+ host's table has the setting, so the host decodes it
+    if (mapping && mapping->delta)
+    {
+        enableDelta(id, pipeline);
+    }
+    if (mapping && mapping->trafficClass == TrafficClass::Interactive)
+    {
+        markCritical(id);
     }
-    startAsyncRead(id);
+    capture::event(capture::Kind::StreamAccepted, steamConn_, id, static_cast<uint32_t>(targetPort));
+    // Announce the stream before its first data so the host can connect in parallel
+    sendOpen(id, targetPort);
+    pipeline->start();
     std::cout << "Added client with id " << id << std::endl;
     return id;
 }
 
 void MultiplexManager::removeClient(const std::string &id)
 {
-    std::lock_guard<std::mutex> lock(mapMutex_);
-    auto it = clientMap_.find(id);
-    if (it != clientMap_.end())
+    std::shared_ptr<StreamPipeline> pipeline;
+    {
+        std::lock_guard<std::mutex> lock(mapMutex_);
+        auto it = clientMap_.find(id);
+        if (it != clientMap_.end())
+        {
+            pipeline = it->second;
+            retireStream(id, pipeline);
+            clientMap_.erase(it);
+        }
+        awaitingAck_.erase(id);
+        awaitingFirstByte_.erase(id);
+    }
+    if (pipeline)
     {
-        it->second->close();
-        clientMap_.erase(it);
+        capture::event(capture::Kind::StreamClosed, steamConn_, id, 1);
+        pipeline->close();
     }
-    readBuffers_.erase(id);
+    scheduler_.removeStream(id);
 
     std::cout << "Removed client with id " << id << std::endl;
 }
 
-std::shared_ptr<tcp::socket> MultiplexManager::getClient(const std::string &id)
+std::shared_ptr<StreamPipeline> MultiplexManager::getClient(const std::string &id)
 {
     std::lock_guard<std::mutex> lock(mapMutex_);
     auto it = clientMap_.find(id);
@@ -58,109 +339,1030 @@ std::shared_ptr<tcp::socket> MultiplexManager::getClient(const std::string &id)
     return nullptr;
 }
 
-void MultiplexManager::sendTunnelPacket(const std::string &id, const char *data, size_t len, int type)
+int MultiplexManager::getClientCount()
+{
+    std::lock_guard<std::mutex> lock(mapMutex_);
+    return static_cast<int>(clientMap_.size());
+}
+
+void MultiplexManager::onStreamFinished(const std::string &id)
 {
-    // Packet format: string id (6 chars + null), uint32_t type, then data if type==0
-    size_t idLen = id.size() + 1; // include null terminator
-    size_t packetSize = idLen + sizeof(uint32_t) + (type == 0 ? len : 0);
-    std::vector<char> packet(packetSize);
-    std::memcpy(&packet[0], id.c_str(), idLen);
-    uint32_t *pType = reinterpret_cast<uint32_t *>(&packet[idLen]);
-    *pType = type;
-    if (type == 0 && data)
+    // Queued behind the stream's data, so the peer sees every byte before EOF
+    sendTunnelPacket(id, nullptr, 0, tunnel::kFrameFin);
+}
+
+void MultiplexManager::onStreamClosed(const std::string &id, bool reset)
+{
+    // Stream ended locally: drop it, and on errors tell the peer to abort its
+    // side too. Streams removed through removeClient are already gone from the
+    // map and stay silent.
+    bool known = false;
+    {
+        std::lock_guard<std::mutex> lock(mapMutex_);
+        auto it = clientMap_.find(id);
+        if (it != clientMap_.end())
+        {
+            retireStream(id, it->second);
+            clientMap_.erase(it);
+            known = true;
+        }
+        awaitingAck_.erase(id);
+        awaitingFirstByte_.erase(id);
+        if (known && reset)
+        {
+            streamStats_.reset++;
+        }
+        else if (known)
+        {
+            streamStats_.finished++;
+        }
+    }
+    if (known)
     {
-        std::memcpy(&packet[idLen + sizeof(uint32_t)], data, len);
+        capture::event(capture::Kind::StreamClosed, steamConn_, id, reset ? 1 : 0);
+        if (reset)
+        {
+            sendTunnelPacket(id, nullptr, 0, tunnel::kFrameReset);
+        }
+        resumeLog_.close(id);
+        scheduler_.removeStream(id);
+        std::cout << "Client " << id << (reset ? " reset locally" : " finished") << std::endl;
     }
-    steamInterface_->SendMessageToConnection(steamConn_, packet.data(), packet.size(), k_nSteamNetworkingSend_Reliable, nullptr);
 }
 
-void MultiplexManager::handleTunnelPacket(const char *data, size_t len)
+void MultiplexManager::recordFirstByte(const std::string &id)
 {
-    size_t idLen = 7; // 6 + null
-    if (len < idLen + sizeof(uint32_t))
+    std::lock_guard<std::mutex> lock(mapMutex_);
+    auto it = awaitingFirstByte_.find(id);
+    if (it != awaitingFirstByte_.end())
+    {
+        streamStats_.firstByte.record(std::chrono::duration_cast<std::chrono::microseconds>(Clock::now() - it->second).count());
+        awaitingFirstByte_.erase(it);
+    }
+}
+
+MultiplexManager::StreamStats MultiplexManager::getStreamStats()
+{
+    std::lock_guard<std::mutex> lock(mapMutex_);
+    return streamStats_;
+}
+
+std::vector<std::pair<std::string, uint64_t>> MultiplexManager::getWriteBacklogs()
+{
+    std::vector<std::pair<std::string, uint64_t>> backlogs;
+    std::lock_guard<std::mutex> lock(mapMutex_);
+    for (const auto &entry : clientMap_)
+    {
+        uint64_t backlog = entry.second->writeBacklog();
+        if (backlog > 0)
+        {
+            backlogs.emplace_back(entry.first, backlog);
+        }
+    }
+    return backlogs;
+}
+
+bool MultiplexManager::sendFrame(const char *frame, size_t len, const SendScheduler::FrameTimes &times)
+{
+    if (!linkUp_)
+    {
+        // Suspended or resuming: frames wait in the scheduler
+        return false;
+    }
+    uint32_t type = tunnel::readType(frame);
+    bool retain = retaining_ && tunnel::isCountedFrame(type);
+    if (retain && tunnel::isDataFrame(type) && resumeLog_.retainedBytes() >= ResumeLog::kMaxRetainedBytes)
+    {
+        if (resumable_ || Clock::now() - helloSent_.load() < tunnel::kSessionAnswerTimeout)
+        {
+            // Window full until the peer acknowledges more. On a fast link
+            // the window also fills before the answer to our hello is back.
+            return false;
+        }
+        // The peer never confirmed the session, so it cannot resume it either
+        std::cout << "Peer does not support session resumption" << std::endl;
+        retaining_ = false;
+        resumeLog_.clear();
+        retain = false;
+    }
+    EResult result = sendMessage(steamConn_, frame, len, k_nSteamNetworkingSend_Reliable);
+    // LimitExceeded means Steam's send buffer is full: keep the frame queued
+    if (result == k_EResultLimitExceeded)
+    {
+        return false;
+    }
+    if (retain)
+    {
+        // Kept even if the send failed: the connection is going away and the
+        // frame goes out again after a resume
+        resumeLog_.sent(tunnel::readId(frame), frame, len);
+    }
+    copyToBackup(frame, len);
+    if (tunnel::isDataFrame(type))
+    {
+        stampFrame(frame, times);
+    }
+    return true;
+}
+
+void MultiplexManager::markCritical(const std::string &id)
+{
+    std::lock_guard<std::mutex> lock(backupMutex_);
+    backupSent_.emplace(id, 0);
+}
+
+void MultiplexManager::copyToBackup(const char *frame, size_t len)
+{
+    std::lock_guard<std::mutex> lock(backupMutex_);
+    backupStats_.mainBytesSent += len;
+    uint32_t type = tunnel::readType(frame);
+    if (backupSent_.empty() || !tunnel::isCountedFrame(type))
+    {
+        return;
+    }
+    // Every counted frame moves the position, copied or not
+    auto it = backupSent_.find(tunnel::readId(frame));
+    if (it == backupSent_.end())
+    {
+        return;
+    }
+    uint64_t position = it->second++;
+    HSteamNetConnection conn = backupConn_;
+    if (!backupActive_ || conn == k_HSteamNetConnection_Invalid || !tunnel::isDataFrame(type) ||
+        len > tunnel::kHeaderSize + kBackupFrameMax)
     {
-        std::cerr << "Invalid tunnel packet size" << std::endl;
         return;
     }
-    std::string id(data, 6);
-    uint32_t type = *reinterpret_cast<const uint32_t *>(data + idLen);
-    if (type == 0)
+    backupFrame_.resize(tunnel::kHeaderSize + sizeof(position) + len);
+    tunnel::writeHeader(backupFrame_.data(), it->first, tunnel::kFrameDuplicate);
+    std::memcpy(backupFrame_.data() + tunnel::kHeaderSize, &position, sizeof(position));
+    std::memcpy(backupFrame_.data() + tunnel::kHeaderSize + sizeof(position), frame, len);
+    // Unreliable: a lost copy is covered by the main connection, and a resent
+    // one would only queue behind newer frames
+    EResult result = sendMessage(conn, backupFrame_.data(), backupFrame_.size(), k_nSteamNetworkingSend_UnreliableNoNagle);
+    if (result == k_EResultOK)
+    {
+        backupStats_.framesSent++;
+        backupStats_.bytesSent += backupFrame_.size();
+    }
+}
+
+bool MultiplexManager::deliveredByBackup(const std::string &id)
+{
+    uint64_t next;
     {
-        // Data packet
-        size_t dataLen = len - idLen - sizeof(uint32_t);
-        const char *packetData = data + idLen + sizeof(uint32_t);
-        auto socket = getClient(id);
-        if (!socket && isHost_ && localPort_ > 0)
+        std::lock_guard<std::mutex> lock(mapMutex_);
+        if (backupDelivered_.empty())
         {
-            // 如果是主持且没有对应的 TCP Client，创建一个连接到本地端口
-            std::cout << "Creating new TCP client for id " << id << " connecting to localhost:" << localPort_ << std::endl;
-            try
-            {
-                auto newSocket = std::make_shared<tcp::socket>(io_context_);
-                tcp::resolver resolver(io_context_);
-                auto endpoints = resolver.resolve("127.0.0.1", std::to_string(localPort_));
-                boost::asio::connect(*newSocket, endpoints);
+            return false;
+        }
+        auto it = backupDelivered_.find(id);
+        if (it == backupDelivered_.end())
+        {
+            return false;
+        }
+        next = it->second;
+    }
+    // countReceived() has counted this frame already, so it sits at count - 1
+    return resumeLog_.receivedCount(id) <= next;
+}
 
-                std::string tempId = id;
-                {
-                    std::lock_guard<std::mutex> lock(mapMutex_);
-                    clientMap_[id] = newSocket;
-                    readBuffers_[id].resize(1024);
-                    socket = newSocket;
-                }
-                std::cout << "Successfully created TCP client for id " << id << std::endl;
-                startAsyncRead(tempId);
-            }
-            catch (const std::exception &e)
+void MultiplexManager::pairBackupLink(HSteamNetConnection conn)
+{
+    backupActive_ = false;
+    backupConn_ = conn;
+    std::string session = getSessionId();
+    std::vector<char> packet(tunnel::kHeaderSize + sizeof(uint32_t));
+    tunnel::writeHeader(packet.data(), session, tunnel::kFrameSession);
+    uint32_t kind = tunnel::kSessionPair;
+    std::memcpy(&packet[tunnel::kHeaderSize], &kind, sizeof(kind));
+    sendMessage(conn, packet.data(), packet.size(), k_nSteamNetworkingSend_Reliable);
+    std::cout << "Pairing backup connection " << conn << " with session " << session << std::endl;
+}
+
+void MultiplexManager::acceptBackupLink(HSteamNetConnection conn)
+{
+    backupConn_ = conn;
+    backupActive_ = true;
+    std::string session = getSessionId();
+    std::vector<char> packet(tunnel::kHeaderSize + sizeof(uint32_t));
+    tunnel::writeHeader(packet.data(), session, tunnel::kFrameSession);
+    uint32_t kind = tunnel::kSessionPaired;
+    std::memcpy(&packet[tunnel::kHeaderSize], &kind, sizeof(kind));
+    sendMessage(conn, packet.data(), packet.size(), k_nSteamNetworkingSend_Reliable);
+    std::cout << "Connection " << conn << " is the backup path of session " << session << std::endl;
+}
+
+void MultiplexManager::dropBackupLink(HSteamNetConnection conn)
+{
+    HSteamNetConnection expected = conn;
+    if (backupConn_.compare_exchange_strong(expected, k_HSteamNetConnection_Invalid))
+    {
+        backupActive_ = false;
+        std::cout << "Backup connection " << conn << " closed" << std::endl;
+    }
+}
+
+void MultiplexManager::handleBackupPacket(const char *data, size_t len)
+{
+    MEMTRACK_SCOPE(memtrack::Tag::Multiplex);
+    if (len < tunnel::kHeaderSize)
+    {
+        std::cerr << "Invalid backup packet size" << std::endl;
+        return;
+    }
+    uint32_t type = tunnel::readType(data);
+    if (type == tunnel::kFrameSession)
+    {
+        uint32_t kind;
+        if (tunnel::readPayload(data, len, kind) && kind == tunnel::kSessionPaired && !isHost_)
+        {
+            backupActive_ = true;
+            std::cout << "Backup path ready" << std::endl;
+        }
+        return;
+    }
+    uint64_t position;
+    size_t frameOffset = tunnel::kHeaderSize + sizeof(position);
+    if (type != tunnel::kFrameDuplicate || !tunnel::readPayload(data, len, position) ||
+        len < frameOffset + tunnel::kHeaderSize)
+    {
+        std::cerr << "Unexpected packet type " << type << " on the backup path" << std::endl;
+        return;
+    }
+    const char *frame = data + frameOffset;
+    size_t frameLen = len - frameOffset;
+    std::string id = tunnel::readId(data);
+    uint32_t frameType = tunnel::readType(frame);
+    if (!tunnel::isDataFrame(frameType) || tunnel::readId(frame) != id)
+    {
+        std::cerr << "Invalid duplicate frame for id " << id << std::endl;
+        return;
+    }
+
+    // Deliverable only as the next frame of the stream; the main connection
+    // has brought everything before it, or their copies did
+    uint64_t received = resumeLog_.receivedCount(id);
+    bool deliver = false;
+    bool late = true;
+    {
+        std::lock_guard<std::mutex> lock(mapMutex_);
+        if (clientMap_.count(id))
+        {
+            uint64_t &next = backupDelivered_[id];
+            next = std::max(next, received);
+            if (position == next)
             {
-                std::cerr << "Failed to create TCP client for id " << id << ": " << e.what() << std::endl;
-                return;
+                next++;
+                deliver = true;
             }
+            late = position < next;
+        }
+    }
+    {
+        std::lock_guard<std::mutex> lock(backupMutex_);
+        backupStats_.framesReceived++;
+        if (deliver)
+        {
+            backupStats_.usedFirst++;
         }
-        if (socket)
+        else if (late)
         {
-            boost::asio::async_write(*socket, boost::asio::buffer(packetData, dataLen), [](const boost::system::error_code &, std::size_t) {});
+            backupStats_.late++;
         }
         else
         {
-            std::cerr << "No client found for id " << id << std::endl;
+            backupStats_.ahead++;
         }
     }
-    else if (type == 1)
+    if (deliver)
     {
-        // Disconnect packet
-        removeClient(id);
-        std::cout << "Client " << id << " disconnected" << std::endl;
+        deliverData(id, frameType, frame + tunnel::kHeaderSize, frameLen - tunnel::kHeaderSize);
     }
-    else
+}
+
+MultiplexManager::BackupStats MultiplexManager::getBackupStats()
+{
+    std::lock_guard<std::mutex> lock(backupMutex_);
+    BackupStats stats = backupStats_;
+    stats.active = backupActive_;
+    return stats;
+}
+
+void MultiplexManager::setTimingEnabled(bool enabled)
+{
+    std::vector<std::string> ids;
     {
-        std::cerr << "Unknown packet type " << type << std::endl;
+        std::lock_guard<std::mutex> lock(timingMutex_);
+        if (timingEnabled_ == enabled)
+        {
+            return;
+        }
+        timingEnabled_ = enabled;
+        clock_.reset();
+        unansweredRequests_ = 0;
+        clockReplies_ = 0;
+        nextClockRequest_ = Clock::time_point();
+        lastArrival_.clear();
+        for (const auto &entry : timings_)
+        {
+            ids.push_back(entry.first);
+        }
+        for (const auto &id : ids)
+        {
+            retireTiming(id);
+        }
+    }
+    // Without CLOCK requests the peer stops stamping once its lease runs out
+    for (const auto &id : ids)
+    {
+        if (auto pipeline = getClient(id))
+        {
+            pipeline->setTiming(nullptr);
+        }
     }
 }
 
-void MultiplexManager::startAsyncRead(const std::string &id)
+void MultiplexManager::resetTimingStats()
 {
-    auto socket = getClient(id);
-    if (!socket)
+    std::vector<std::pair<std::string, std::shared_ptr<StreamTiming>>> fresh;
     {
-        std::cout << "Error: Socket is null for id " << id << std::endl;
-        return;
+        std::lock_guard<std::mutex> lock(timingMutex_);
+        retiredTiming_ = StreamTiming::Snapshot();
+        for (auto &entry : timings_)
+        {
+            entry.second = std::make_shared<StreamTiming>();
+            fresh.emplace_back(entry.first, entry.second);
+        }
     }
-    socket->async_read_some(boost::asio::buffer(readBuffers_[id]),
-    [this, id](const boost::system::error_code &ec, std::size_t bytes_transferred)
+    for (const auto &entry : fresh)
     {
-        if (!ec)
+        if (auto pipeline = getClient(entry.first))
         {
-            if (bytes_transferred > 0)
-            {
-                sendTunnelPacket(id, readBuffers_[id].data(), bytes_transferred, 0);
-            }
-            startAsyncRead(id);
+            pipeline->setTiming(entry.second);
         }
-        else
+    }
+}
+
+MultiplexManager::TimingStats MultiplexManager::getTimingStats()
+{
+    TimingStats stats;
+    std::lock_guard<std::mutex> lock(timingMutex_);
+    stats.enabled = timingEnabled_;
+    stats.clockSynced = clock_.valid();
+    stats.peerSilent = clockReplies_ == 0 && unansweredRequests_ >= timing::kMaxUnansweredRequests;
+    stats.clockOffsetUs = clock_.offsetUs();
+    stats.clockRttUs = clock_.rttUs();
+    stats.total = retiredTiming_;
+    for (const auto &entry : timings_)
+    {
+        StreamTiming::Snapshot snapshot = entry.second->snapshot();
+        for (int hop = 0; hop < timing::kHopCount; ++hop)
         {
-            std::cout << "Error reading from TCP client " << id << ": " << ec.message() << std::endl;
-            removeClient(id);
+            stats.total.hops[hop].merge(snapshot.hops[hop]);
         }
-    });
-}
\ No newline at end of file
+        stats.total.samples += snapshot.samples;
+        stats.streams.emplace_back(entry.first, std::move(snapshot));
+    }
+    std::sort(stats.streams.begin(), stats.streams.end(),
+              [](const auto &a, const auto &b)
+              { return a.first < b.first; });
+    return stats;
+}
+
+void MultiplexManager::retireTiming(const std::string &id)
+{
+    lastArrival_.erase(id);
+    auto it = timings_.find(id);
+    if (it == timings_.end())
+    {
+        return;
+    }
+    StreamTiming::Snapshot snapshot = it->second->snapshot();
+    for (int hop = 0; hop < timing::kHopCount; ++hop)
+    {
+        retiredTiming_.hops[hop].merge(snapshot.hops[hop]);
+    }
+    retiredTiming_.samples += snapshot.samples;
+    timings_.erase(it);
+}
+
+void MultiplexManager::updateTiming()
+{
+    if (!timingEnabled_ || !linkUp_)
+    {
+        return;
+    }
+    auto now = Clock::now();
+    {
+        std::lock_guard<std::mutex> lock(timingMutex_);
+        if (now < nextClockRequest_)
+        {
+            return;
+        }
+        nextClockRequest_ = now + timing::kRequestInterval;
+        // A peer that never answered is older and would only log the frames
+        if (clockReplies_ == 0 && unansweredRequests_ >= timing::kMaxUnansweredRequests)
+        {
+            return;
+        }
+        unansweredRequests_++;
+    }
+    tunnel::ClockSync sync = {tunnel::kClockRequest, 0, timing::nowUs(), 0, 0};
+    // Unreliable: a retransmitted request would only skew the estimate
+    sendDirect(tunnel::kClockId, tunnel::kFrameClock, &sync, sizeof(sync), k_nSteamNetworkingSend_UnreliableNoNagle);
+}
+
+void MultiplexManager::handleClock(const char *data, size_t len)
+{
+    int64_t receivedUs = timing::nowUs();
+    tunnel::ClockSync sync;
+    if (!tunnel::readPayload(data, len, sync))
+    {
+        return;
+    }
+    if (sync.kind == tunnel::kClockRequest)
+    {
+        stampUntilUs_ = receivedUs + std::chrono::duration_cast<std::chrono::microseconds>(timing::kLease).count();
+        sync.kind = tunnel::kClockReply;
+        sync.receiveUs = receivedUs;
+        sync.replyUs = timing::nowUs();
+        sendDirect(tunnel::kClockId, tunnel::kFrameClock, &sync, sizeof(sync), k_nSteamNetworkingSend_UnreliableNoNagle);
+    }
+    else if (sync.kind == tunnel::kClockReply)
+    {
+        std::lock_guard<std::mutex> lock(timingMutex_);
+        if (timingEnabled_)
+        {
+            clock_.addSample(sync.originUs, sync.receiveUs, sync.replyUs, receivedUs);
+            unansweredRequests_ = 0;
+            clockReplies_++;
+        }
+    }
+}
+
+void MultiplexManager::stampFrame(const char *frame, const SendScheduler::FrameTimes &times)
+{
+    // Only frames read from a socket; resends and control frames have no readAt
+    if (times.readAt == Clock::time_point() || timing::nowUs() >= stampUntilUs_)
+    {
+        return;
+    }
+    auto now = Clock::now();
+    std::string id = tunnel::readId(frame);
+    Clock::time_point &last = lastStamp_[id];
+    if (now - last < timing::kStampInterval)
+    {
+        return;
+    }
+    last = now;
+    if (lastStamp_.size() > 1024)
+    {
+        // Ids of ended streams; the next stamps start over
+        lastStamp_.clear();
+    }
+    tunnel::TimingStamp stamp = {timing::toUs(times.readAt), timing::toUs(times.queuedAt), timing::toUs(now), 0};
+    SteamNetConnectionRealTimeStatus_t status;
+    if (transport_->getRealTimeStatus(steamConn_, status))
+    {
+        stamp.steamQueueUs = status.m_usecQueueTime;
+    }
+    // Reliable like the data frame, so it arrives right behind it
+    sendDirect(id, tunnel::kFrameTiming, &stamp, sizeof(stamp));
+}
+
+void MultiplexManager::noteArrival(const std::string &id, int64_t handledUs)
+{
+    Arrival arrival{handledUs, transport_->receivedAgeUs()};
+    {
+        std::lock_guard<std::mutex> lock(timingMutex_);
+        auto it = timings_.find(id);
+        if (it != timings_.end())
+        {
+            lastArrival_[id] = arrival;
+            return;
+        }
+    }
+    // First data of the stream since timing was enabled: start its histograms
+    auto pipeline = getClient(id);
+    if (!pipeline)
+    {
+        return;
+    }
+    auto stats = std::make_shared<StreamTiming>();
+    std::lock_guard<std::mutex> lock(timingMutex_);
+    if (timingEnabled_ && timings_.emplace(id, stats).second)
+    {
+        pipeline->setTiming(stats);
+        lastArrival_[id] = arrival;
+    }
+}
+
+void MultiplexManager::handleTiming(const std::string &id, const char *data, size_t len)
+{
+    tunnel::TimingStamp stamp;
+    if (!tunnel::readPayload(data, len, stamp))
+    {
+        return;
+    }
+    std::lock_guard<std::mutex> lock(timingMutex_);
+    auto arrival = lastArrival_.find(id);
+    auto entry = timings_.find(id);
+    if (!timingEnabled_ || !clock_.valid() || arrival == lastArrival_.end() || entry == timings_.end())
+    {
+        return;
+    }
+    Arrival at = arrival->second;
+    lastArrival_.erase(arrival);
+    StreamTiming &stats = *entry->second;
+    // Everything up to the receiving Steam client, on our clock
+    int64_t arrivedUs = at.handledUs - std::max<int64_t>(at.ageUs, 0);
+    int64_t transitUs = arrivedUs - (stamp.sentUs - clock_.offsetUs());
+    stats.record(timing::kRead, stamp.queuedUs - stamp.readUs);
+    stats.record(timing::kSchedule, stamp.sentUs - stamp.queuedUs);
+    stats.record(timing::kSteamQueue, stamp.steamQueueUs);
+    stats.record(timing::kWire, transitUs - stamp.steamQueueUs);
+    if (at.ageUs >= 0)
+    {
+        stats.record(timing::kPoll, at.ageUs);
+    }
+    stats.countSample();
+}
+
+void MultiplexManager::sendDirect(const std::string &id, uint32_t type, const void *payload, size_t len, int sendFlags)
+{
+    std::vector<char> packet(tunnel::kHeaderSize + len);
+    tunnel::writeHeader(packet.data(), id, type);
+    if (len > 0)
+    {
+        std::memcpy(&packet[tunnel::kHeaderSize], payload, len);
+    }
+    sendMessage(steamConn_, packet.data(), packet.size(), sendFlags);
+}
+
+EResult MultiplexManager::sendMessage(HSteamNetConnection conn, const char *data, size_t len, int sendFlags)
+{
+    EResult result = transport_->sendMessage(conn, data, static_cast<uint32>(len), sendFlags);
+    // A frame Steam refused stays queued and is recorded when it goes out
+    if (capture::active() && result != k_EResultLimitExceeded)
+    {
+        capture::frame(capture::Kind::FrameOut, conn, data, len);
+    }
+    return result;
+}
+
+void MultiplexManager::sendControl(const std::string &id, uint32_t type, const void *payload, size_t len)
+{
+    std::vector<char> packet(tunnel::kHeaderSize + len);
+    tunnel::writeHeader(packet.data(), id, type);
+    if (len > 0)
+    {
+        std::memcpy(&packet[tunnel::kHeaderSize], payload, len);
+    }
+    scheduler_.enqueueControl(id, packet.data(), packet.size());
+    scheduler_.flush();
+}
+
+bool MultiplexManager::startSpeedTest(int phaseSeconds)
+{
+    return speedTest_->start(phaseSeconds);
+}
+
+SpeedTest::Result MultiplexManager::getSpeedTestResult()
+{
+    return speedTest_->result();
+}
+
+void MultiplexManager::countReceived(const std::string &id, bool urgent)
+{
+    uint64_t count = 0;
+    if (resumeLog_.received(id, urgent, count) && resumable_)
+    {
+        sendDirect(id, tunnel::kFrameAck, &count, sizeof(count));
+    }
+}
+
+std::string MultiplexManager::getSessionId()
+{
+    std::lock_guard<std::mutex> lock(mapMutex_);
+    return sessionId_;
+}
+
+void MultiplexManager::startSession()
+{
+    std::string id = nanoid::generate(tunnel::kIdLength);
+    {
+        std::lock_guard<std::mutex> lock(mapMutex_);
+        sessionId_ = id;
+    }
+    // Frames are kept from the start; if the host has not confirmed by the
+    // time the log reaches its limit, the log is dropped
+    retaining_ = true;
+    resumable_ = false;
+    helloSent_ = Clock::now();
+    linkUp_ = true;
+    tunnel::SessionHello hello{tunnel::kSessionHello, tunnel::kFeatureDelta};
+    sendDirect(id, tunnel::kFrameSession, &hello, sizeof(hello));
+}
+
+void MultiplexManager::suspend()
+{
+    linkUp_ = false;
+    capture::event(capture::Kind::LinkDown, steamConn_, std::string());
+    std::cout << "Session " << getSessionId() << " suspended with " << getClientCount() << " streams" << std::endl;
+}
+
+void MultiplexManager::attach(HSteamNetConnection steamConn)
+{
+    capture::event(capture::Kind::LinkUp, steamConn_, std::string(), steamConn);
+    steamConn_ = steamConn;
+}
+
+void MultiplexManager::requestResume()
+{
+    linkUp_ = false;
+    std::string session = getSessionId();
+    uint32_t kind = tunnel::kSessionResume;
+    sendDirect(session, tunnel::kFrameSession, &kind, sizeof(kind));
+    for (const auto &stream : resumeLog_.receivedCounts())
+    {
+        sendDirect(stream.first, tunnel::kFrameResume, &stream.second, sizeof(stream.second));
+    }
+    sendDirect(session, tunnel::kFrameResumeDone, nullptr, 0);
+    std::cout << "Requested resume of session " << session << std::endl;
+}
+
+void MultiplexManager::handleSessionFrame(const std::string &id, const char *data, size_t len)
+{
+    // Sessions came with version 3, after OPEN
+    peerOpens_ = true;
+    uint32_t kind;
+    if (!tunnel::readPayload(data, len, kind))
+    {
+        std::cerr << "Invalid session frame" << std::endl;
+        return;
+    }
+    if (kind == tunnel::kSessionHello && isHost_)
+    {
+        tunnel::SessionHello hello;
+        peerDelta_ = tunnel::readPayload(data, len, hello) && (hello.features & tunnel::kFeatureDelta) != 0;
+        {
+            std::lock_guard<std::mutex> lock(mapMutex_);
+            sessionId_ = id;
+        }
+        retaining_ = true;
+        resumable_ = true;
+        uint32_t reply = tunnel::kSessionHelloAck;
+        sendDirect(id, tunnel::kFrameSession, &reply, sizeof(reply));
+        std::cout << "Session " << id << " started" << std::endl;
+    }
+    else if (kind == tunnel::kSessionHelloAck && id == getSessionId())
+    {
+        resumable_ = true;
+        std::cout << "Session " << id << " can be resumed" << std::endl;
+    }
+    else if (kind == tunnel::kSessionResume && isHost_)
+    {
+        uint32_t reply = tunnel::kSessionUnknown;
+        if (resumable_ && id == getSessionId())
+        {
+            std::lock_guard<std::mutex> lock(mapMutex_);
+            resumeMentioned_.clear();
+            linkUp_ = false;
+            reply = tunnel::kSessionResumed;
+        }
+        sendDirect(id, tunnel::kFrameSession, &reply, sizeof(reply));
+        std::cout << "Resume of session " << id << (reply == tunnel::kSessionResumed ? " accepted" : " refused, unknown session") << std::endl;
+    }
+    else if (kind == tunnel::kSessionUnknown && !isHost_)
+    {
+        // Host restarted or the grace period ran out: start over
+        std::cout << "Host no longer has session " << id << ", resetting all streams" << std::endl;
+        resetAllStreams();
+        startSession();
+    }
+}
+
+void MultiplexManager::handleResume(const std::string &id, uint64_t peerCount)
+{
+    if (isHost_)
+    {
+        {
+            std::lock_guard<std::mutex> lock(mapMutex_);
+            resumeMentioned_.insert(id);
+        }
+        if (!resumeLog_.contains(id))
+        {
+            // Ended here, or its OPEN was lost with the old connection
+            sendDirect(id, tunnel::kFrameReset, nullptr, 0);
+            return;
+        }
+        uint64_t ours = resumeLog_.receivedCount(id);
+        sendDirect(id, tunnel::kFrameResume, &ours, sizeof(ours));
+    }
+    else if (!resumeLog_.contains(id))
+    {
+        return;
+    }
+    auto frames = resumeLog_.rewind(id, peerCount);
+    {
+        // The resent frames take their old positions again
+        std::lock_guard<std::mutex> lock(backupMutex_);
+        auto it = backupSent_.find(id);
+        if (it != backupSent_.end())
+        {
+            it->second = peerCount;
+        }
+    }
+    if (!frames.empty())
+    {
+        std::cout << "Resending " << frames.size() << " frames of stream " << id << std::endl;
+    }
+    scheduler_.requeue(id, std::move(frames));
+    if (!getClient(id))
+    {
+        // Closed locally; only its last frames were left to deliver
+        scheduler_.removeStream(id);
+    }
+}
+
+void MultiplexManager::finishResume(const std::string &id)
+{
+    if (isHost_)
+    {
+        // Streams the client did not mention are gone on its side
+        std::vector<std::string> dropped;
+        {
+            std::lock_guard<std::mutex> lock(mapMutex_);
+            for (const auto &stream : resumeLog_.receivedCounts())
+            {
+                if (!resumeMentioned_.count(stream.first))
+                {
+                    dropped.push_back(stream.first);
+                }
+            }
+            resumeMentioned_.clear();
+        }
+        for (const auto &streamId : dropped)
+        {
+            removeClient(streamId);
+            scheduler_.discardStream(streamId);
+            resumeLog_.forget(streamId);
+        }
+        sendDirect(id, tunnel::kFrameResumeDone, nullptr, 0);
+    }
+    int streams = getClientCount();
+    {
+        std::lock_guard<std::mutex> lock(mapMutex_);
+        streamStats_.resumed += static_cast<uint64_t>(streams);
+    }
+    linkUp_ = true;
+    std::cout << "Session " << id << " resumed with " << streams << " streams" << std::endl;
+    scheduler_.flush();
+}
+
+void MultiplexManager::resetAllStreams()
+{
+    std::vector<std::string> ids;
+    {
+        std::lock_guard<std::mutex> lock(mapMutex_);
+        for (const auto &pair : clientMap_)
+        {
+            ids.push_back(pair.first);
+        }
+        streamStats_.reset += ids.size();
+    }
+    for (const auto &id : ids)
+    {
+        removeClient(id);
+    }
+    // Nothing queued for the old session may reach the new one
+    scheduler_.clear();
+    resumeLog_.clear();
+}
+
+SendScheduler::LinkState MultiplexManager::linkState()
+{
+    SendScheduler::LinkState state;
+    SteamNetConnectionRealTimeStatus_t status;
+    if (transport_->getRealTimeStatus(steamConn_, status))
+    {
+        state.pendingBytes = status.m_cbPendingReliable + status.m_cbPendingUnreliable;
+        state.sendRate = status.m_nSendRateBytesPerSecond;
+        TRACE_COUNTER("link.pendingBytes", state.pendingBytes);
+    }
+    return state;
+}
+
+bool MultiplexManager::flushSendQueue()
+{
+    MEMTRACK_SCOPE(memtrack::Tag::Multiplex);
+    flushDelayedAcks();
+    updateTiming();
+    return scheduler_.flush();
+}
+
+void MultiplexManager::flushDelayedAcks()
+{
+    // Streams below kAckEvery frames would stay unacknowledged, and with many
+    // streams those remainders alone can fill the peer's retention window
+    auto now = Clock::now();
+    if (!resumable_ || !linkUp_ || now - lastAckFlush_ < ResumeLog::kAckDelay)
+    {
+        return;
+    }
+    lastAckFlush_ = now;
+    for (const auto &pair : resumeLog_.takePendingAcks())
+    {
+        sendDirect(pair.first, tunnel::kFrameAck, &pair.second, sizeof(pair.second));
+    }
+}
+
+void MultiplexManager::setStreamClass(const std::string &id, TrafficClass cls, int weight)
+{
+    scheduler_.setStreamClass(id, cls, weight);
+}
+
+SendScheduler::Stats MultiplexManager::getSchedulerStats()
+{
+    return scheduler_.getStats();
+}
+
+void MultiplexManager::sendTunnelPacket(const std::string &id, const char *data, size_t len, int type)
+{
+    TRACE_SPAN("sendTunnelPacket");
+    MEMTRACK_SCOPE(memtrack::Tag::Multiplex);
+    size_t payloadLen = (type == tunnel::kFrameData && data) ? len : 0;
+    std::vector<char> packet(tunnel::kHeaderSize);
+    tunnel::writeHeader(packet.data(), id, type);
+    packet.insert(packet.end(), data, data + payloadLen);
+    // Everything goes through the scheduler so control frames stay ordered behind the stream's data
+    if (type == tunnel::kFrameData)
+    {
+        scheduler_.enqueue(id, packet.data(), packet.size());
+    }
+    else
+    {
+        scheduler_.enqueueControl(id, packet.data(), packet.size());
+    }
+    scheduler_.flush();
+}
+
+void MultiplexManager::deliverData(const std::string &id, uint32_t type, const char *payload, size_t len)
+{
+    if (type == tunnel::kFrameDelta)
+    {
+        const std::vector<char> *decoded = decodeDelta(id, payload, len);
+        if (!decoded)
+        {
+            // Unknown stream, or our history no longer matches the sender's
+            std::cerr << "Cannot decode delta frame for id " << id << std::endl;
+            if (getClient(id))
+            {
+                removeClient(id);
+                sendTunnelPacket(id, nullptr, 0, tunnel::kFrameReset);
+            }
+            return;
+        }
+        payload = decoded->data();
+        len = decoded->size();
+    }
+    auto pipeline = getClient(id);
+    if (pipeline)
+    {
+        recordFirstByte(id);
+        // The message buffer is released after this call, so the pipeline copies it
+        pipeline->deliver(payload, len);
+    }
+    else
+    {
+        std::cerr << "No client found for id " << id << std::endl;
+    }
+}
+
+void MultiplexManager::handleTunnelPacket(const char *data, size_t len)
+{
+    TRACE_SPAN("handleTunnelPacket");
+    MEMTRACK_SCOPE(memtrack::Tag::Multiplex);
+    if (len < tunnel::kHeaderSize)
+    {
+        std::cerr << "Invalid tunnel packet size" << std::endl;
+        return;
+    }
+    std::string id = tunnel::readId(data);
+    uint32_t type = tunnel::readType(data);
+    if (tunnel::isDataFrame(type) && isHost_ && localPort_ > 0 && !peerOpens_ && !getClient(id))
+    {
+        // Version 1 peers send no OPEN: the first data frame opens the stream,
+        // before it is counted so the count includes it. Anyone else's data
+        // for an unknown id is late data of a stream we reset or closed, and
+        // must not become a new connection to the game.
+        openLocalStream(id, 0);
+    }
+    if (tunnel::isCountedFrame(type) && type != tunnel::kFrameOpen)
+    {
+        // Lifecycle frames are acknowledged right away, before the stream
+        // state they carry can go away
+        countReceived(id, !tunnel::isDataFrame(type));
+    }
+    if (tunnel::isDataFrame(type))
+    {
+        // Data packet, unless its copy on the backup path was faster
+        int64_t handledUs = timingEnabled_ ? timing::nowUs() : 0;
+        if (!deliveredByBackup(id))
+        {
+            deliverData(id, type, data + tunnel::kHeaderSize, len - tunnel::kHeaderSize);
+        }
+        if (timingEnabled_)
+        {
+            noteArrival(id, handledUs);
+        }
+    }
+    else if (type == tunnel::kFrameOpen)
+    {
+        peerOpens_ = true;
+        uint32_t targetPort = 0;
+        tunnel::readPayload(data, len, targetPort);
+        if (isHost_ && openLocalStream(id, static_cast<int>(targetPort)))
+        {
+            countReceived(id, true);
+        }
+        else
+        {
+            sendTunnelPacket(id, nullptr, 0, tunnel::kFrameReset);
+        }
+    }
+    else if (type == tunnel::kFrameOpenAck)
+    {
+        std::lock_guard<std::mutex> lock(mapMutex_);
+        auto it = awaitingAck_.find(id);
+        if (it != awaitingAck_.end())
+        {
+            streamStats_.openAck.record(std::chrono::duration_cast<std::chrono::microseconds>(Clock::now() - it->second).count());
+            awaitingAck_.erase(it);
+        }
+    }
+    else if (type == tunnel::kFrameFin)
+    {
+        // Peer is done sending; our socket gets EOF after the queued data
+        auto pipeline = getClient(id);
+        if (pipeline)
+        {
+            pipeline->finishWrite();
+        }
+    }
+    else if (type == tunnel::kFrameReset)
+    {
+        // Abort both directions
+        {
+            std::lock_guard<std::mutex> lock(mapMutex_);
+            if (clientMap_.count(id))
+            {
+                streamStats_.reset++;
+            }
+        }
+        removeClient(id);
+        resumeLog_.forget(id);
+        std::cout << "Client " << id << " disconnected" << std::endl;
+    }
+    else if (type == tunnel::kFrameAck)
+    {
+        uint64_t count;
+        if (tunnel::readPayload(data, len, count))
+        {
+            resumeLog_.acknowledge(id, count);
+        }
+    }
+    else if (type == tunnel::kFrameSession)
+    {
+        handleSessionFrame(id, data, len);
+    }
+    else if (type == tunnel::kFrameResume)
+    {
+        uint64_t count;
+        if (tunnel::readPayload(data, len, count))
+        {
+            handleResume(id, count);
+        }
+    }
+    else if (type == tunnel::kFrameResumeDone)
+    {
+        finishResume(id);
+    }
+    else if (type >= tunnel::kFrameSpeedControl && type <= tunnel::kFramePong)
+    {
+        speedTest_->handleFrame(type, data, len);
+    }
+    else if (type == tunnel::kFrameTiming)
+    {
+        handleTiming(id, data, len);
+    }
+    else if (type == tunnel::kFrameClock)
+    {
+        handleClock(data, len);
+    }
+    else
+    {
+        std::cerr << "Unknown packet type " << type << std::endl;
+    }
+}
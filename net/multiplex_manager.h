@@ -1,40 +1,249 @@
 #pragma once
 
+#include <map>
 #include <unordered_map>
+#include <unordered_set>
+#include <atomic>
+#include <chrono>
 #include <memory>
 #include <mutex>
 #include <vector>
 #include <string>
 #include <boost/asio.hpp>
-#include <steam_api.h>
-#include <isteamnetworkingsockets.h>
 #include <steamnetworkingtypes.h>
+#include "tunnel_transport.h"
+#include "stream_pipeline.h"
+#include "send_scheduler.h"
+#include "resume_log.h"
+#include "port_mapping.h"
+#include "speed_test.h"
+#include "delta_codec.h"
+#include "stream_timing.h"
 
 using boost::asio::ip::tcp;
 
 class MultiplexManager {
 public:
-    MultiplexManager(ISteamNetworkingSockets* steamInterface, HSteamNetConnection steamConn, 
+    MultiplexManager(TunnelTransport* transport, HSteamNetConnection steamConn, 
                      boost::asio::io_context& io_context, bool& isHost, int& localPort);
     ~MultiplexManager();
 
-    std::string addClient(std::shared_ptr<tcp::socket> socket);
+    // Takes ownership of the socket; its pipeline becomes the socket's only reader.
+    // The mapping names the host's target port and the stream's traffic class;
+    // without one the stream goes to the host's default port.
+    std::string addClient(std::shared_ptr<tcp::socket> socket, const PortMapping* mapping = nullptr);
     void removeClient(const std::string& id);
-    std::shared_ptr<tcp::socket> getClient(const std::string& id);
+    std::shared_ptr<StreamPipeline> getClient(const std::string& id);
+    int getClientCount();
 
     void sendTunnelPacket(const std::string& id, const char* data, size_t len, int type);
 
     void handleTunnelPacket(const char* data, size_t len);
 
+    // Push queued frames into the Steam connection; returns true while frames are waiting
+    bool flushSendQueue();
+    void setStreamClass(const std::string& id, TrafficClass cls, int weight = 1);
+    SendScheduler::Stats getSchedulerStats();
+
+    // Session resumption (see tunnel_protocol.h). The client calls
+    // startSession() on a new connection; when the connection drops both sides
+    // suspend(), and after the client reconnects it calls attach() and
+    // requestResume(), while the host attach()es the manager whose session
+    // the client names. Sending stays paused until the RESUME exchange is done.
+    void startSession();
+    void suspend();
+    void attach(HSteamNetConnection steamConn);
+    void requestResume();
+    bool isResumable() const { return resumable_; }
+    std::string getSessionId();
+    // Host: SteamID of the peer the session started with; only connections
+    // from that peer may resume it or pair with it
+    void setOwner(uint64 peer) { owner_ = peer; }
+    uint64 getOwner() const { return owner_; }
+
+    // Stream lifecycle counters; timings are measured on the accepting side
+    struct StreamStats {
+        LatencyHistogram openAck;   // OPEN sent -> OPEN_ACK received
+        LatencyHistogram firstByte; // accepted -> first byte from the peer
+        uint64_t opened = 0;
+        uint64_t finished = 0;      // both directions closed with FIN
+        uint64_t reset = 0;
+        uint64_t resumed = 0;       // streams carried over a reconnect
+    };
+    StreamStats getStreamStats();
+    // Streams with data waiting for the local socket, and how many bytes
+    std::vector<std::pair<std::string, uint64_t>> getWriteBacklogs();
+
+    // Host: OPENs may only name target ports in this table. Without a table
+    // only the default port is served.
+    void setPortMappings(const PortMappingTable* mappings) { mappings_ = mappings; }
+    // Per target port (0 = default), finished streams included
+    std::map<int, PortStats> getPortStats();
+
+    // Speed test against the peer (speed_test.h); false while one is running
+    bool startSpeedTest(int phaseSeconds = SpeedTest::kDefaultPhaseSeconds);
+    SpeedTest::Result getSpeedTestResult();
+
+    // Backup path (tunnel_protocol.h, version 7): a second connection to the
+    // same peer, ideally over another route, that carries copies of the small
+    // frames of latency-critical streams (mappings of the Interactive class).
+    // A loss or stall on the main connection then costs the stream nothing as
+    // long as the copy gets through. The client pairs a connection and starts
+    // copying once the host confirms; the host accepts the connection a SESSION
+    // pair frame names this manager's session on. Frames from the backup
+    // connection go to handleBackupPacket().
+    void pairBackupLink(HSteamNetConnection conn);
+    void acceptBackupLink(HSteamNetConnection conn);
+    void dropBackupLink(HSteamNetConnection conn);
+    void handleBackupPacket(const char* data, size_t len);
+
+    struct BackupStats {
+        bool active = false;
+        uint64_t framesSent = 0;     // copies sent on the backup
+        uint64_t bytesSent = 0;      // their size on the backup connection
+        uint64_t mainBytesSent = 0;  // all frames on the main connection, for the overhead
+        uint64_t framesReceived = 0;
+        uint64_t usedFirst = 0;      // copies that beat the main connection
+        uint64_t late = 0;           // the main connection's frame came first
+        uint64_t ahead = 0;          // dropped: an earlier frame was still missing
+    };
+    BackupStats getBackupStats();
+
+    // Copies only for frames up to this size, the payload of one packet
+    static constexpr size_t kBackupFrameMax = 1024;
+
+    // Latency decomposition of inbound data (tunnel_protocol.h, version 8):
+    // while enabled, asks the peer for TIMING frames and splits the time of
+    // each stamped frame into the hops of stream_timing.h. Streams that ended
+    // are folded into the total.
+    void setTimingEnabled(bool enabled);
+    bool isTimingEnabled() const { return timingEnabled_; }
+    void resetTimingStats();
+
+    struct TimingStats {
+        bool enabled = false;
+        bool clockSynced = false;
+        bool peerSilent = false;   // no answer to CLOCK: the peer predates version 8
+        int64_t clockOffsetUs = 0; // peer clock minus ours
+        int64_t clockRttUs = 0;    // round trip the offset was measured with
+        StreamTiming::Snapshot total;
+        std::vector<std::pair<std::string, StreamTiming::Snapshot>> streams; // by id
+    };
+    TimingStats getTimingStats();
+
 private:
-    ISteamNetworkingSockets* steamInterface_;
-    HSteamNetConnection steamConn_;
-    std::unordered_map<std::string, std::shared_ptr<tcp::socket>> clientMap_;
+    TunnelTransport* transport_;
+    std::atomic<HSteamNetConnection> steamConn_;
+    std::unordered_map<std::string, std::shared_ptr<StreamPipeline>> clientMap_;
     std::mutex mapMutex_;
     boost::asio::io_context& io_context_;
     bool& isHost_;
     int& localPort_;
-    std::unordered_map<std::string, std::vector<char>> readBuffers_;
 
-    void startAsyncRead(const std::string& id);
-};
\ No newline at end of file
+    SendScheduler scheduler_;
+
+    using Clock = std::chrono::steady_clock;
+    // Guarded by mapMutex_
+    std::unordered_map<std::string, Clock::time_point> awaitingAck_;
+    std::unordered_map<std::string, Clock::time_point> awaitingFirstByte_;
+    StreamStats streamStats_;
+    std::string sessionId_;
+    std::unordered_set<std::string> resumeMentioned_; // host, during a resume
+    std::unordered_map<std::string, int> streamPorts_; // stream -> target port
+    std::map<int, PortStats> portStats_;                // bytes of finished streams
+    std::atomic<const PortMappingTable*> mappings_;
+    // Delta-coded streams (delta_codec.h); guarded by mapMutex_
+    std::unordered_map<std::string, std::shared_ptr<DeltaEncoder>> deltaEncoders_;
+    std::unordered_map<std::string, std::shared_ptr<DeltaDecoder>> deltaDecoders_;
+    std::vector<char> deltaPayload_; // poll thread only
+
+    // Backup path. Streams that get copies count their sent frames, so a copy
+    // names its position; guarded by backupMutex_, which sendFrame() takes
+    // under the scheduler's lock
+    std::mutex backupMutex_;
+    std::atomic<HSteamNetConnection> backupConn_;
+    std::atomic<bool> backupActive_; // peer confirmed the pairing
+    std::unordered_map<std::string, uint64_t> backupSent_; // critical stream -> frames sent
+    std::vector<char> backupFrame_;
+    BackupStats backupStats_;
+    // Received side, guarded by mapMutex_: streams a copy was delivered on
+    // and the position the next frame must have
+    std::unordered_map<std::string, uint64_t> backupDelivered_;
+
+    // Latency decomposition. Receiving side guarded by timingMutex_;
+    // stampUntilUs_ and lastStamp_ belong to sendFrame() (scheduler's lock)
+    struct Arrival {
+        int64_t handledUs; // our clock
+        int64_t ageUs;     // waited for the poll loop; -1 if unknown
+    };
+    std::mutex timingMutex_;
+    std::atomic<bool> timingEnabled_;
+    ClockEstimator clock_;
+    int unansweredRequests_ = 0;
+    uint64_t clockReplies_ = 0;
+    Clock::time_point nextClockRequest_;
+    std::unordered_map<std::string, Arrival> lastArrival_; // stream's last data frame
+    std::unordered_map<std::string, std::shared_ptr<StreamTiming>> timings_;
+    StreamTiming::Snapshot retiredTiming_;
+    std::atomic<int64_t> stampUntilUs_; // peer asked for TIMING frames until then
+    std::unordered_map<std::string, Clock::time_point> lastStamp_;
+
+    ResumeLog resumeLog_;
+    std::shared_ptr<SpeedTest> speedTest_;
+    std::atomic<bool> linkUp_;     // false while suspended or resuming
+    std::atomic<bool> retaining_;  // keeping sent frames for a resume
+    std::atomic<bool> resumable_;  // peer confirmed the session
+    std::atomic<uint64> owner_{0};
+    std::atomic<bool> peerOpens_;  // peer sends OPEN (version 2+): data never opens a stream
+    std::atomic<bool> peerDelta_;  // host: the client's hello offered kFeatureDelta
+    Clock::time_point lastAckFlush_; // poll thread only
+    std::atomic<Clock::time_point> helloSent_; // client: when startSession() asked
+
+    std::shared_ptr<StreamPipeline> createPipeline(const std::string& id, std::shared_ptr<tcp::socket> socket);
+    std::shared_ptr<StreamPipeline> openLocalStream(const std::string& id, int targetPort);
+    // Host: the local port for an OPEN's target, or 0 if it is not served
+    int resolveTarget(int targetPort, PortMapping& mapping);
+    void sendOpen(const std::string& id, int targetPort);
+    void trackStream(const std::string& id, int targetPort);
+    // Sending side of delta coding for a stream whose mapping asks for it
+    void enableDelta(const std::string& id, const std::shared_ptr<StreamPipeline>& pipeline);
+    // Original bytes of a DELTA payload; nullptr if it does not decode
+    const std::vector<char>* decodeDelta(const std::string& id, const char* payload, size_t len);
+    void retireStream(const std::string& id, const std::shared_ptr<StreamPipeline>& pipeline);
+    // Decode if needed and hand a stream's payload to its pipeline
+    void deliverData(const std::string& id, uint32_t type, const char* payload, size_t len);
+    void markCritical(const std::string& id);
+    // After sendFrame() put a counted frame on the main connection
+    void copyToBackup(const char* frame, size_t len);
+    // The frame at this position of the stream already came over the backup
+    bool deliveredByBackup(const std::string& id);
+    bool sendFrame(const char* frame, size_t len, const SendScheduler::FrameTimes& times);
+    // After sendFrame() put a data frame on the main connection: follow it
+    // with a TIMING frame if the peer asked for them and the stream is due
+    void stampFrame(const char* frame, const SendScheduler::FrameTimes& times);
+    // Poll thread: CLOCK requests while enabled
+    void updateTiming();
+    void handleClock(const char* data, size_t len);
+    void handleTiming(const std::string& id, const char* data, size_t len);
+    void noteArrival(const std::string& id, int64_t handledUs);
+    // Folds a stream's histograms into the total; caller holds timingMutex_
+    void retireTiming(const std::string& id);
+    SendScheduler::LinkState linkState();
+    void onStreamFinished(const std::string& id);
+    void onStreamClosed(const std::string& id, bool reset);
+    void onLocalConnected(const std::string& id, bool connected);
+    void recordFirstByte(const std::string& id);
+    // Every frame leaves through here; recorded while a capture runs (tunnel_capture.h)
+    EResult sendMessage(HSteamNetConnection conn, const char* data, size_t len, int sendFlags);
+    // Uncounted frames that bypass the scheduler (ACK, SESSION, RESUME, PING)
+    void sendDirect(const std::string& id, uint32_t type, const void* payload, size_t len,
+                    int sendFlags = k_nSteamNetworkingSend_Reliable);
+    // Uncounted frame queued behind the stream's data
+    void sendControl(const std::string& id, uint32_t type, const void* payload, size_t len);
+    void countReceived(const std::string& id, bool urgent);
+    void flushDelayedAcks();
+    void handleSessionFrame(const std::string& id, const char* data, size_t len);
+    void handleResume(const std::string& id, uint64_t peerCount);
+    void finishResume(const std::string& id);
+    void resetAllStreams();
+};
@@ -0,0 +1,249 @@
+#include "port_mapping.h"
+#include <algorithm>
+#include <cctype>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+
+namespace
+{
+    const char *kTableHeader = "# ConnectTool port mappings v1";
+
+    bool parseClass(const std::string &text, TrafficClass &out)
+    {
+        if (text == "auto")
+        {
+            out = TrafficClass::Auto;
+        }
+        else if (text == "interactive")
+        {
+            out = TrafficClass::Interactive;
+        }
+        else if (text == "bulk")
+        {
+            out = TrafficClass::Bulk;
+        }
+        else
+        {
+            return false;
+        }
+        return true;
+    }
+
+    bool validPort(int port, bool allowZero)
+    {
+        return (allowZero && port == 0) || (port > 0 && port < 65536);
+    }
+}
+
+PortMappingTable::PortMappingTable(const std::string &path)
+    : path_(path), local_(defaults()) {}
+
+std::vector<PortMapping> PortMappingTable::defaults()
+{
+    PortMapping mapping;
+    mapping.listenPort = kDefaultListenPort;
+    mapping.name = "game";
+    return {mapping};
+}
+
+void PortMappingTable::load()
+{
+    std::ifstream in(path_);
+    if (!in)
+    {
+        return;
+    }
+    std::vector<PortMapping> mappings;
+    std::string line;
+    while (std::getline(in, line) && mappings.size() < kMaxMappings)
+    {
+        if (line.empty() || line[0] == '#')
+        {
+            continue;
+        }
+        // listen target class weight [name [delta]]
+        std::istringstream fields(line);
+        PortMapping mapping;
+        std::string cls, flag;
+        if (fields >> mapping.listenPort >> mapping.targetPort >> cls >> mapping.weight &&
+            validPort(mapping.listenPort, false) && validPort(mapping.targetPort, true) &&
+            parseClass(cls, mapping.trafficClass))
+        {
+            fields >> mapping.name >> flag;
+            if (mapping.name == "-")
+            {
+                mapping.name.clear();
+            }
+            mapping.delta = flag == "delta";
+            mapping.weight = std::max(1, mapping.weight);
+            mappings.push_back(mapping);
+        }
+    }
+    if (!mappings.empty())
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        local_ = std::move(mappings);
+        std::cout << "Loaded " << local_.size() << " port mappings" << std::endl;
+    }
+}
+
+bool PortMappingTable::save() const
+{
+    std::ofstream out(path_, std::ios::trunc);
+    if (!out)
+    {
+        std::cerr << "Failed to write port mappings " << path_ << std::endl;
+        return false;
+    }
+    out << kTableHeader << "\n";
+    for (const auto &m : getLocal())
+    {
+        out << m.listenPort << ' ' << m.targetPort << ' ' << className(m.trafficClass) << ' ' << m.weight;
+        if (!m.name.empty() || m.delta)
+        {
+            out << ' ' << (m.name.empty() ? "-" : m.name);
+        }
+        if (m.delta)
+        {
+            out << " delta";
+        }
+        out << "\n";
+    }
+    return static_cast<bool>(out);
+}
+
+std::vector<PortMapping> PortMappingTable::get() const
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    return remoteActive_ ? remote_ : local_;
+}
+
+std::vector<PortMapping> PortMappingTable::getLocal() const
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    return local_;
+}
+
+void PortMappingTable::setLocal(std::vector<PortMapping> mappings)
+{
+    if (mappings.size() > kMaxMappings)
+    {
+        mappings.resize(kMaxMappings);
+    }
+    for (auto &m : mappings)
+    {
+        // Names travel in lobby data and the table file
+        std::replace_if(m.name.begin(), m.name.end(), [](char c)
+                        { return c == ':' || c == ';' || std::isspace(static_cast<unsigned char>(c)); }, '_');
+        m.weight = std::max(1, m.weight);
+    }
+    std::lock_guard<std::mutex> lock(mutex_);
+    local_ = std::move(mappings);
+}
+
+void PortMappingTable::setRemote(std::vector<PortMapping> mappings)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    remote_ = std::move(mappings);
+    remoteActive_ = true;
+}
+
+void PortMappingTable::clearRemote()
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    remote_.clear();
+    remoteActive_ = false;
+}
+
+bool PortMappingTable::isRemote() const
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    return remoteActive_;
+}
+
+bool PortMappingTable::findTarget(int targetPort, PortMapping &out) const
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    const auto &mappings = remoteActive_ ? remote_ : local_;
+    auto it = std::find_if(mappings.begin(), mappings.end(), [targetPort](const PortMapping &m)
+                           { return m.targetPort == targetPort; });
+    if (it == mappings.end())
+    {
+        return false;
+    }
+    out = *it;
+    return true;
+}
+
+const char *PortMappingTable::className(TrafficClass cls)
+{
+    switch (cls)
+    {
+    case TrafficClass::Interactive:
+        return "interactive";
+    case TrafficClass::Bulk:
+        return "bulk";
+    default:
+        return "auto";
+    }
+}
+
+std::string PortMappingTable::serialize(const std::vector<PortMapping> &mappings)
+{
+    std::ostringstream out;
+    for (size_t i = 0; i < mappings.size(); ++i)
+    {
+        const PortMapping &m = mappings[i];
+        if (i > 0)
+        {
+            out << ';';
+        }
+        out << m.listenPort << ':' << m.targetPort << ':' << className(m.trafficClass) << ':' << m.weight << ':' << m.name;
+        if (m.delta)
+        {
+            // Older clients read it as part of the name
+            out << ":delta";
+        }
+    }
+    return out.str();
+}
+
+bool PortMappingTable::parse(const std::string &text, std::vector<PortMapping> &out)
+{
+    out.clear();
+    std::istringstream entries(text);
+    std::string entry;
+    while (std::getline(entries, entry, ';') && out.size() < kMaxMappings)
+    {
+        std::istringstream fields(entry);
+        std::string listen, target, cls, weight;
+        PortMapping mapping;
+        if (!std::getline(fields, listen, ':') || !std::getline(fields, target, ':') ||
+            !std::getline(fields, cls, ':') || !std::getline(fields, weight, ':'))
+        {
+            return false;
+        }
+        std::string flag;
+        std::getline(fields, mapping.name, ':');
+        std::getline(fields, flag);
+        mapping.delta = flag == "delta";
+        try
+        {
+            mapping.listenPort = std::stoi(listen);
+            mapping.targetPort = std::stoi(target);
+            mapping.weight = std::max(1, std::stoi(weight));
+        }
+        catch (const std::exception &)
+        {
+            return false;
+        }
+        if (!validPort(mapping.listenPort, false) || !validPort(mapping.targetPort, true) ||
+            !parseClass(cls, mapping.trafficClass))
+        {
+            return false;
+        }
+        out.push_back(mapping);
+    }
+    return !out.empty();
+}
@@ -0,0 +1,75 @@
+#pragma once
+
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+#include "send_scheduler.h"
+
+// One forwarded service: connections to listenPort on a client (or on the host
+// itself) reach targetPort on the host. Every mapping shares the one Steam
+// connection; the OPEN frame names the target port (tunnel_protocol.h).
+struct PortMapping
+{
+    int listenPort = 0;
+    int targetPort = 0; // 0 = the host's 本地端口 setting
+    TrafficClass trafficClass = TrafficClass::Auto;
+    int weight = 1;
+    std::string name;
+    bool delta = false; // delta-code the data of its streams (delta_codec.h)
+};
+
+// Traffic of the streams of one target port
+struct PortStats
+{
+    uint64_t opened = 0;
+    int active = 0;
+    uint64_t bytesSent = 0;     // read locally, sent through the tunnel
+    uint64_t bytesReceived = 0; // from the tunnel, written locally
+    // Delta-coded streams: payload read locally and what was sent for it
+    uint64_t deltaRawBytes = 0;
+    uint64_t deltaSentBytes = 0;
+};
+
+// The mapping table. The local table is what the user configured and what a
+// host serves and publishes; a client joining a lobby switches to the host's
+// published table until it leaves. Thread-safe.
+class PortMappingTable
+{
+public:
+    static constexpr int kDefaultListenPort = 8888;
+
+    // Starts with the single default mapping 8888 -> 本地端口
+    explicit PortMappingTable(const std::string &path);
+
+    void load();
+    bool save() const;
+
+    // The table in effect: the host's while joined, else the local one
+    std::vector<PortMapping> get() const;
+    std::vector<PortMapping> getLocal() const;
+    void setLocal(std::vector<PortMapping> mappings);
+    void setRemote(std::vector<PortMapping> mappings);
+    void clearRemote();
+    bool isRemote() const;
+    // Mapping in effect for a target port, for the host's OPEN handling
+    bool findTarget(int targetPort, PortMapping &out) const;
+
+    // Compact form for lobby data: "listen:target:class:weight:name[:delta];..."
+    static std::string serialize(const std::vector<PortMapping> &mappings);
+    static bool parse(const std::string &text, std::vector<PortMapping> &out);
+    static const char *className(TrafficClass cls);
+    // The single 8888 -> 本地端口 mapping, also assumed for hosts that publish no table
+    static std::vector<PortMapping> defaults();
+
+    static constexpr size_t kMaxMappings = 16;
+
+private:
+
+    std::string path_;
+    mutable std::mutex mutex_;
+    std::vector<PortMapping> local_;
+    std::vector<PortMapping> remote_;
+    bool remoteActive_ = false;
+};
@@ -0,0 +1,113 @@
+#include "read_buffer_pool.h"
+#include <iostream>
+#include <map>
+
+namespace
+{
+std::mutex registryMutex;
+std::map<boost::asio::execution_context *, std::shared_ptr<ReadBufferPool>> registry;
+}
+
+void ReadBufferPool::install(boost::asio::io_context &io, size_t slabs)
+{
+#if defined(BOOST_ASIO_HAS_IO_URING) && BOOST_VERSION >= 107900
+    std::shared_ptr<ReadBufferPool> pool;
+    try
+    {
+        pool.reset(new ReadBufferPool(io, slabs));
+    }
+    catch (const std::exception &e)
+    {
+        // Registration can fail under a low RLIMIT_MEMLOCK; reads still work unregistered
+        std::cerr << "Read buffer registration failed: " << e.what() << std::endl;
+        return;
+    }
+    std::lock_guard<std::mutex> lock(registryMutex);
+    registry[&io] = pool;
+#else
+    (void)io;
+    (void)slabs;
+#endif
+}
+
+void ReadBufferPool::uninstall(boost::asio::io_context &io)
+{
+    std::lock_guard<std::mutex> lock(registryMutex);
+    registry.erase(&io);
+}
+
+std::shared_ptr<ReadBufferPool> ReadBufferPool::find(const boost::asio::any_io_executor &executor)
+{
+    std::lock_guard<std::mutex> lock(registryMutex);
+    if (registry.empty())
+    {
+        return nullptr;
+    }
+    auto it = registry.find(&boost::asio::query(executor, boost::asio::execution::context));
+    return it != registry.end() ? it->second : nullptr;
+}
+
+const char *ReadBufferPool::backendName()
+{
+#if defined(BOOST_ASIO_HAS_IO_URING) && defined(BOOST_ASIO_DISABLE_EPOLL)
+    return "io_uring";
+#elif defined(BOOST_ASIO_HAS_EPOLL)
+    return "epoll";
+#else
+    return "default";
+#endif
+}
+
+ReadBufferPool::ReadBufferPool(boost::asio::io_context &io, size_t slabs)
+    : storage_(slabs * kSlabSize)
+{
+    free_.reserve(slabs);
+    for (size_t i = slabs; i > 0; --i)
+    {
+        free_.push_back(static_cast<int>(i - 1));
+    }
+#if defined(BOOST_ASIO_HAS_IO_URING) && BOOST_VERSION >= 107900
+    buffers_.reserve(slabs);
+    for (size_t i = 0; i < slabs; ++i)
+    {
+        buffers_.push_back(boost::asio::buffer(storage_.data() + i * kSlabSize, kSlabSize));
+    }
+    registration_.reset(new boost::asio::buffer_registration<std::vector<boost::asio::mutable_buffer>>(
+        boost::asio::register_buffers(io, buffers_)));
+#else
+    (void)io;
+#endif
+}
+
+ReadBufferPool::~ReadBufferPool() = default;
+
+ReadBufferPool::Slab ReadBufferPool::acquire()
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    Slab slab;
+    if (!free_.empty())
+    {
+        slab.index = free_.back();
+        slab.data = storage_.data() + static_cast<size_t>(slab.index) * kSlabSize;
+        free_.pop_back();
+    }
+    return slab;
+}
+
+void ReadBufferPool::release(Slab &slab)
+{
+    if (slab.index < 0)
+    {
+        return;
+    }
+    std::lock_guard<std::mutex> lock(mutex_);
+    free_.push_back(slab.index);
+    slab = Slab();
+}
+
+#if defined(BOOST_ASIO_HAS_IO_URING) && BOOST_VERSION >= 107900
+boost::asio::mutable_registered_buffer ReadBufferPool::buffer(const Slab &slab, size_t offset, size_t size)
+{
+    return boost::asio::buffer((*registration_)[static_cast<size_t>(slab.index)] + offset, size);
+}
+#endif
@@ -0,0 +1,56 @@
+#pragma once
+
+#include <cstddef>
+#include <memory>
+#include <mutex>
+#include <vector>
+#include <boost/asio.hpp>
+#include <boost/version.hpp>
+
+// Local socket reads under the io_uring backend (CMake option
+// CONNECTTOOL_IO_URING). Each io_context can get a pool of fixed-size read
+// slabs registered with the kernel once, so reads skip pinning the user buffer
+// every time. A StreamPipeline holds one slab while it lives and falls back to
+// its own buffer when the pool is empty. With the default epoll reactor the
+// pool is never created and find() returns null.
+class ReadBufferPool
+{
+public:
+    struct Slab
+    {
+        char *data = nullptr;
+        int index = -1;
+    };
+
+    // Large enough for a tunnel header plus one read
+    static constexpr size_t kSlabSize = 16 * 1024 + 64;
+    static constexpr size_t kDefaultSlabs = 256;
+
+    // Register a pool for io; call before the pipelines on it are created.
+    // No-op unless built with io_uring and registered buffer support.
+    static void install(boost::asio::io_context &io, size_t slabs = kDefaultSlabs);
+    // Drop the pool; call before io is destroyed
+    static void uninstall(boost::asio::io_context &io);
+    static std::shared_ptr<ReadBufferPool> find(const boost::asio::any_io_executor &executor);
+    // "io_uring" or "epoll", depending on how Asio was configured
+    static const char *backendName();
+
+    Slab acquire();
+    void release(Slab &slab);
+#if defined(BOOST_ASIO_HAS_IO_URING) && BOOST_VERSION >= 107900
+    boost::asio::mutable_registered_buffer buffer(const Slab &slab, size_t offset, size_t size);
+#endif
+
+    ~ReadBufferPool();
+
+private:
+    ReadBufferPool(boost::asio::io_context &io, size_t slabs);
+
+    std::mutex mutex_;
+    std::vector<char> storage_;
+    std::vector<int> free_;
+#if defined(BOOST_ASIO_HAS_IO_URING) && BOOST_VERSION >= 107900
+    std::vector<boost::asio::mutable_buffer> buffers_;
+    std::unique_ptr<boost::asio::buffer_registration<std::vector<boost::asio::mutable_buffer>>> registration_;
+#endif
+};
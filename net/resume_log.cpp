@@ -0,0 +1,176 @@
+#include "resume_log.h"
+
+void ResumeLog::open(const std::string &id)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    streams_.emplace(id, Stream());
+}
+
+void ResumeLog::close(const std::string &id)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = streams_.find(id);
+    if (it != streams_.end())
+    {
+        it->second.closed = true;
+        eraseIfDone(it);
+    }
+}
+
+void ResumeLog::forget(const std::string &id)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = streams_.find(id);
+    if (it != streams_.end())
+    {
+        for (const auto &frame : it->second.unacked)
+        {
+            retained_ -= frame.size();
+        }
+        streams_.erase(it);
+    }
+}
+
+void ResumeLog::clear()
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    streams_.clear();
+    retained_ = 0;
+}
+
+void ResumeLog::eraseIfDone(std::unordered_map<std::string, Stream>::iterator it)
+{
+    if (it->second.closed && it->second.unacked.empty())
+    {
+        streams_.erase(it);
+    }
+}
+
+void ResumeLog::sent(const std::string &id, const char *frame, size_t len)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = streams_.find(id);
+    if (it == streams_.end())
+    {
+        return;
+    }
+    it->second.unacked.emplace_back(frame, frame + len);
+    retained_ += len;
+}
+
+bool ResumeLog::received(const std::string &id, bool urgent, uint64_t &ackCount)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = streams_.find(id);
+    if (it == streams_.end())
+    {
+        return false;
+    }
+    Stream &s = it->second;
+    s.receivedCount++;
+    if (!urgent && s.receivedCount - s.receivedAcked < kAckEvery)
+    {
+        return false;
+    }
+    s.receivedAcked = s.receivedCount;
+    ackCount = s.receivedCount;
+    return true;
+}
+
+void ResumeLog::acknowledge(const std::string &id, uint64_t count)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = streams_.find(id);
+    if (it == streams_.end())
+    {
+        return;
+    }
+    Stream &s = it->second;
+    while (s.ackedCount < count && !s.unacked.empty())
+    {
+        retained_ -= s.unacked.front().size();
+        s.unacked.pop_front();
+        s.ackedCount++;
+    }
+    eraseIfDone(it);
+}
+
+std::vector<std::pair<std::string, uint64_t>> ResumeLog::takePendingAcks()
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    std::vector<std::pair<std::string, uint64_t>> acks;
+    for (auto &pair : streams_)
+    {
+        Stream &s = pair.second;
+        if (s.receivedCount > s.receivedAcked)
+        {
+            s.receivedAcked = s.receivedCount;
+            acks.emplace_back(pair.first, s.receivedCount);
+        }
+    }
+    return acks;
+}
+
+std::vector<std::vector<char>> ResumeLog::rewind(const std::string &id, uint64_t count)
+{
+    std::vector<std::vector<char>> missing;
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = streams_.find(id);
+    if (it == streams_.end())
+    {
+        return missing;
+    }
+    Stream &s = it->second;
+    // The peer's count doubles as an acknowledgement
+    while (s.ackedCount < count && !s.unacked.empty())
+    {
+        retained_ -= s.unacked.front().size();
+        s.unacked.pop_front();
+        s.ackedCount++;
+    }
+    for (auto &frame : s.unacked)
+    {
+        retained_ -= frame.size();
+        missing.push_back(std::move(frame));
+    }
+    s.unacked.clear();
+    return missing;
+}
+
+bool ResumeLog::contains(const std::string &id)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    return streams_.count(id) > 0;
+}
+
+uint64_t ResumeLog::receivedCount(const std::string &id)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = streams_.find(id);
+    return it != streams_.end() ? it->second.receivedCount : 0;
+}
+
+bool ResumeLog::isClosed(const std::string &id)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = streams_.find(id);
+    return it != streams_.end() && it->second.closed;
+}
+
+std::vector<std::pair<std::string, uint64_t>> ResumeLog::receivedCounts()
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    std::vector<std::pair<std::string, uint64_t>> counts;
+    counts.reserve(streams_.size());
+    for (const auto &pair : streams_)
+    {
+        counts.emplace_back(pair.first, pair.second.receivedCount);
+    }
+    return counts;
+}
+
+size_t ResumeLog::retainedBytes()
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    return retained_;
+}
@@ -0,0 +1,66 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+// Per-connection bookkeeping for session resumption (see tunnel_protocol.h):
+// the counted frames sent on each stream that the peer has not acknowledged
+// yet, and how many counted frames arrived from the peer. Thread-safe.
+class ResumeLog
+{
+public:
+    // Start tracking a stream, both counts at zero
+    void open(const std::string &id);
+    // Stream ended locally; it is forgotten once the peer has every frame
+    void close(const std::string &id);
+    void forget(const std::string &id);
+    void clear();
+
+    // A counted frame went to the link; ignored for unknown streams
+    void sent(const std::string &id, const char *frame, size_t len);
+    // A counted frame arrived. Returns true, with the count to send, when an
+    // ACK is due: every kAckEvery frames, or right away if urgent.
+    bool received(const std::string &id, bool urgent, uint64_t &ackCount);
+    // Peer holds the first count frames of the stream
+    void acknowledge(const std::string &id, uint64_t count);
+    // Streams with frames not acknowledged yet, marked as acknowledged now
+    std::vector<std::pair<std::string, uint64_t>> takePendingAcks();
+    // After a reconnect: returns the frames the peer is missing beyond count,
+    // in order. They count as unsent again and are logged when resent.
+    std::vector<std::vector<char>> rewind(const std::string &id, uint64_t count);
+
+    bool contains(const std::string &id);
+    uint64_t receivedCount(const std::string &id);
+    bool isClosed(const std::string &id);
+    // Every tracked stream with its received count, for RESUME frames
+    std::vector<std::pair<std::string, uint64_t>> receivedCounts();
+    size_t retainedBytes();
+
+    static constexpr uint64_t kAckEvery = 16;
+    // Longest a received frame waits for its ACK while the link is up
+    static constexpr std::chrono::milliseconds kAckDelay{20};
+    // Unacknowledged data allowed per connection before sending stalls
+    static constexpr size_t kMaxRetainedBytes = 8 * 1024 * 1024;
+
+private:
+    struct Stream
+    {
+        std::deque<std::vector<char>> unacked;
+        uint64_t ackedCount = 0; // sequence number of unacked.front()
+        uint64_t receivedCount = 0;
+        uint64_t receivedAcked = 0;
+        bool closed = false;
+    };
+
+    void eraseIfDone(std::unordered_map<std::string, Stream>::iterator it);
+
+    std::mutex mutex_;
+    std::unordered_map<std::string, Stream> streams_;
+    size_t retained_ = 0;
+};
@@ -0,0 +1,271 @@
+#include "send_scheduler.h"
+#include "trace.h"
+#include <algorithm>
+
+SendScheduler::SendScheduler(SendFunc send, LinkStateFunc linkState, ResumeFunc resume)
+    : send_(std::move(send)), linkState_(std::move(linkState)), resume_(std::move(resume)), totalQueued_(0) {}
+
+bool SendScheduler::isInteractive(const StreamQueue &q) const
+{
+    switch (q.configured)
+    {
+    case TrafficClass::Interactive:
+        return true;
+    case TrafficClass::Bulk:
+        return false;
+    default:
+        // 自动识别：平均帧较小的流视为交互流
+        return q.avgFrameSize > 0 && q.avgFrameSize < kInteractiveFrameMax / 2;
+    }
+}
+
+void SendScheduler::push(const std::string &id, const char *frame, size_t len, bool control, Clock::time_point readAt)
+{
+    StreamQueue &q = streams_[id];
+    q.frames.push_back(Frame{std::vector<char>(frame, frame + len), FrameTimes{readAt, Clock::now()}, control});
+    q.queuedBytes += len;
+    totalQueued_ += len;
+    if (!control)
+    {
+        q.avgFrameSize = q.avgFrameSize == 0 ? static_cast<double>(len) : q.avgFrameSize * 0.875 + len * 0.125;
+    }
+    if (!q.active)
+    {
+        q.active = true;
+        activeList_.push_back(id);
+    }
+}
+
+bool SendScheduler::enqueue(const std::string &id, const char *frame, size_t len, Clock::time_point readAt)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    push(id, frame, len, false, readAt);
+    StreamQueue &q = streams_[id];
+    if (q.queuedBytes > kStreamHighWater)
+    {
+        q.throttled = true;
+        return false;
+    }
+    return true;
+}
+
+void SendScheduler::enqueueControl(const std::string &id, const char *frame, size_t len)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    push(id, frame, len, true, Clock::time_point());
+}
+
+void SendScheduler::requeue(const std::string &id, std::vector<std::vector<char>> frames)
+{
+    if (frames.empty())
+    {
+        return;
+    }
+    std::lock_guard<std::mutex> lock(mutex_);
+    StreamQueue &q = streams_[id];
+    auto now = Clock::now();
+    for (auto it = frames.rbegin(); it != frames.rend(); ++it)
+    {
+        size_t len = it->size();
+        q.frames.push_front(Frame{std::move(*it), FrameTimes{Clock::time_point(), now}, false});
+        q.queuedBytes += len;
+        totalQueued_ += len;
+    }
+    if (!q.active)
+    {
+        q.active = true;
+        activeList_.push_back(id);
+    }
+}
+
+void SendScheduler::setStreamClass(const std::string &id, TrafficClass cls, int weight)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    StreamQueue &q = streams_[id];
+    q.configured = cls;
+    q.weight = weight < 1 ? 1 : weight;
+}
+
+void SendScheduler::removeStream(const std::string &id)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = streams_.find(id);
+    if (it == streams_.end())
+    {
+        return;
+    }
+    // Whatever is still queued (including the close frame) drains first
+    it->second.removed = true;
+    dropIfDone(id);
+}
+
+void SendScheduler::discardStream(const std::string &id)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = streams_.find(id);
+    if (it == streams_.end())
+    {
+        return;
+    }
+    totalQueued_ -= it->second.queuedBytes;
+    if (it->second.active)
+    {
+        activeList_.remove(id);
+    }
+    streams_.erase(it);
+}
+
+void SendScheduler::clear()
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    streams_.clear();
+    activeList_.clear();
+    totalQueued_ = 0;
+}
+
+void SendScheduler::dropIfDone(const std::string &id)
+{
+    auto it = streams_.find(id);
+    if (it != streams_.end() && it->second.removed && it->second.frames.empty() && !it->second.active)
+    {
+        streams_.erase(it);
+    }
+}
+
+bool SendScheduler::sendHead(const std::string &id, StreamQueue &q, int &budget, std::vector<std::string> &resumed)
+{
+    Frame &frame = q.frames.front();
+    if (!send_(frame.data.data(), frame.data.size(), frame.times))
+    {
+        // Link is full; keep the frame and try again on the next flush
+        budget = 0;
+        return false;
+    }
+    size_t len = frame.data.size();
+    if (!frame.control)
+    {
+        auto delay = std::chrono::duration_cast<std::chrono::microseconds>(Clock::now() - frame.times.queuedAt).count();
+        ClassStats &cls = isInteractive(q) ? stats_.interactive : stats_.bulk;
+        cls.queueDelay.record(static_cast<uint64_t>(delay));
+        cls.frames++;
+        cls.bytes += len;
+    }
+    q.frames.pop_front();
+    q.queuedBytes -= len;
+    totalQueued_ -= len;
+    budget -= static_cast<int>(len);
+    if (q.throttled && q.queuedBytes < kStreamLowWater)
+    {
+        q.throttled = false;
+        resumed.push_back(id);
+    }
+    return true;
+}
+
+bool SendScheduler::flush()
+{
+    TRACE_SPAN("SendScheduler::flush");
+    std::vector<std::string> resumed;
+    bool pending;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (activeList_.empty())
+        {
+            return false;
+        }
+        LinkState link = linkState_();
+        int limit = static_cast<int>(static_cast<int64_t>(link.sendRate) * kTargetLinkDelayMs / 1000);
+        limit = std::min(std::max(limit, kMinLinkBudget), kMaxLinkBudget);
+        int budget = limit - link.pendingBytes + kPriorityHeadroom;
+
+        // Pass 1: control frames and small interactive frames go out first
+        for (auto it = activeList_.begin(); it != activeList_.end();)
+        {
+            std::string id = *it;
+            StreamQueue &q = streams_[id];
+            bool interactive = isInteractive(q);
+            while (budget > 0 && !q.frames.empty() &&
+                   (q.frames.front().control || (interactive && q.frames.front().data.size() <= kInteractiveFrameMax)))
+            {
+                if (!sendHead(id, q, budget, resumed))
+                {
+                    break;
+                }
+            }
+            if (q.frames.empty())
+            {
+                // Unlinked here too, as pass 2 may not get to it
+                q.deficit = 0;
+                q.active = false;
+                it = activeList_.erase(it);
+                dropIfDone(id);
+            }
+            else
+            {
+                ++it;
+            }
+        }
+
+        // Pass 2: deficit round robin over everything else
+        budget -= kPriorityHeadroom;
+        while (budget > 0 && !activeList_.empty())
+        {
+            std::string id = activeList_.front();
+            StreamQueue &q = streams_[id];
+            if (!q.frames.empty() && q.deficit < q.frames.front().data.size())
+            {
+                q.deficit += kQuantum * static_cast<size_t>(q.weight);
+            }
+            while (budget > 0 && !q.frames.empty() && q.frames.front().data.size() <= q.deficit)
+            {
+                size_t len = q.frames.front().data.size();
+                if (!sendHead(id, q, budget, resumed))
+                {
+                    break;
+                }
+                q.deficit -= len;
+            }
+            if (q.frames.empty())
+            {
+                q.deficit = 0;
+                q.active = false;
+                activeList_.pop_front();
+                dropIfDone(id);
+            }
+            else if (q.deficit < q.frames.front().data.size())
+            {
+                // Used up this round's share, go to the back of the rotation
+                activeList_.splice(activeList_.end(), activeList_, activeList_.begin());
+            }
+            // else the budget ran out mid-turn; keep our place for the next flush
+        }
+        pending = !activeList_.empty();
+        stats_.queuedBytes = totalQueued_;
+        stats_.activeStreams = static_cast<int>(activeList_.size());
+    }
+    for (const auto &id : resumed)
+    {
+        resume_(id);
+    }
+    return pending;
+}
+
+bool SendScheduler::hasPending()
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    return !activeList_.empty();
+}
+
+SendScheduler::Stats SendScheduler::getStats()
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    stats_.queuedBytes = totalQueued_;
+    stats_.activeStreams = static_cast<int>(activeList_.size());
+    return stats_;
+}
+
+void SendScheduler::resetStats()
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    stats_ = Stats();
+}
@@ -0,0 +1,136 @@
+#pragma once
+
+#include <chrono>
+#include <deque>
+#include <functional>
+#include <list>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "latency_histogram.h"
+
+enum class TrafficClass
+{
+    Auto,        // decided from observed frame sizes
+    Interactive, // small frames bypass the round robin
+    Bulk,
+};
+
+// Per-connection send scheduler. Frames are held per stream and released to the
+// link only while its backlog is below a budget, so queueing happens here where
+// we can choose the order instead of in Steam's single FIFO. Control frames go
+// first, then small frames of interactive streams (strict priority), then all
+// other streams share the rest by deficit round robin weighted per stream.
+class SendScheduler
+{
+public:
+    using Clock = std::chrono::steady_clock;
+
+    // When a frame was read from its local socket (zero for frames that were
+    // not, such as control frames and resends) and when it was queued here
+    struct FrameTimes
+    {
+        Clock::time_point readAt;
+        Clock::time_point queuedAt;
+    };
+    // Hands a frame to the link; returns false if the link refused it
+    using SendFunc = std::function<bool(const char *frame, size_t len, const FrameTimes &times)>;
+    struct LinkState
+    {
+        int pendingBytes = 0; // queued inside the link, not on the wire yet
+        int sendRate = 0;     // bytes per second, 0 if unknown
+    };
+    using LinkStateFunc = std::function<LinkState()>;
+    // Called (outside the scheduler lock) when a throttled stream may read again
+    using ResumeFunc = std::function<void(const std::string &id)>;
+
+    struct ClassStats
+    {
+        LatencyHistogram queueDelay;
+        uint64_t frames = 0;
+        uint64_t bytes = 0;
+    };
+
+    struct Stats
+    {
+        ClassStats interactive;
+        ClassStats bulk;
+        size_t queuedBytes = 0;
+        int activeStreams = 0;
+    };
+
+    SendScheduler(SendFunc send, LinkStateFunc linkState, ResumeFunc resume);
+
+    // Queue a data frame. Returns false when the stream should stop reading
+    // until the resume callback fires.
+    bool enqueue(const std::string &id, const char *frame, size_t len, Clock::time_point readAt = Clock::time_point());
+    // Control frames keep their order relative to the stream's data but skip
+    // the fairness accounting.
+    void enqueueControl(const std::string &id, const char *frame, size_t len);
+
+    // Put frames back at the head of a stream's queue, ahead of anything
+    // queued since (frames resent after a reconnect)
+    void requeue(const std::string &id, std::vector<std::vector<char>> frames);
+
+    void setStreamClass(const std::string &id, TrafficClass cls, int weight = 1);
+    void removeStream(const std::string &id);
+    // Drop a stream's queued frames without sending them
+    void discardStream(const std::string &id);
+    void clear();
+
+    // Release as many frames as the link budget allows. Returns true if frames
+    // are still waiting.
+    bool flush();
+    bool hasPending();
+
+    Stats getStats();
+    void resetStats();
+
+    // The link may hold about kTargetLinkDelayMs worth of data, within these bounds
+    static constexpr int kTargetLinkDelayMs = 20;
+    static constexpr int kMinLinkBudget = 32 * 1024;
+    static constexpr int kMaxLinkBudget = 1024 * 1024;
+    // Interactive frames may exceed the budget by this much
+    static constexpr int kPriorityHeadroom = 64 * 1024;
+    static constexpr size_t kQuantum = 16 * 1024;
+    static constexpr size_t kInteractiveFrameMax = 1200;
+    static constexpr size_t kStreamHighWater = 1024 * 1024;
+    static constexpr size_t kStreamLowWater = 256 * 1024;
+
+private:
+    struct Frame
+    {
+        std::vector<char> data;
+        FrameTimes times;
+        bool control;
+    };
+
+    struct StreamQueue
+    {
+        std::deque<Frame> frames;
+        size_t queuedBytes = 0;
+        size_t deficit = 0;
+        int weight = 1;
+        TrafficClass configured = TrafficClass::Auto;
+        double avgFrameSize = 0;
+        bool active = false;
+        bool throttled = false;
+        bool removed = false;
+    };
+
+    bool isInteractive(const StreamQueue &q) const;
+    void push(const std::string &id, const char *frame, size_t len, bool control, Clock::time_point readAt);
+    bool sendHead(const std::string &id, StreamQueue &q, int &budget, std::vector<std::string> &resumed);
+    void dropIfDone(const std::string &id);
+
+    SendFunc send_;
+    LinkStateFunc linkState_;
+    ResumeFunc resume_;
+
+    std::mutex mutex_;
+    std::unordered_map<std::string, StreamQueue> streams_;
+    std::list<std::string> activeList_; // DRR rotation
+    size_t totalQueued_;
+    Stats stats_;
+};
@@ -0,0 +1,490 @@
+#include "speed_test.h"
+#include "tunnel_protocol.h"
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <sstream>
+
+namespace
+{
+    int64_t nowUs()
+    {
+        return std::chrono::duration_cast<std::chrono::microseconds>(SpeedTest::Clock::now().time_since_epoch()).count();
+    }
+
+    std::string jsonEscape(const std::string &text)
+    {
+        std::string out;
+        for (char c : text)
+        {
+            if (c == '"' || c == '\\')
+            {
+                out += '\\';
+                out += c;
+            }
+            else if (static_cast<unsigned char>(c) < 0x20)
+            {
+                char buf[8];
+                std::snprintf(buf, sizeof(buf), "\\u%04x", c);
+                out += buf;
+            }
+            else
+            {
+                out += c;
+            }
+        }
+        return out;
+    }
+
+    const char *kPhaseKeys[] = {"idle", "upload", "download"};
+}
+
+double SpeedTest::PhaseResult::loss() const
+{
+    return pingsSent > 0 ? 1.0 - static_cast<double>(pingsReceived) / pingsSent : 0.0;
+}
+
+SpeedTest::SpeedTest(boost::asio::io_context &io, ControlFunc sendControl, ControlFunc sendPing, DataFunc sendData)
+    : io_(io), sendControl_(std::move(sendControl)), sendPing_(std::move(sendPing)), sendData_(std::move(sendData)),
+      stopped_(false), phaseTimer_(io), pingTimer_(io), sendTimer_(io)
+{
+    // Random filler, so nothing on the path can shrink it
+    filler_.resize(tunnel::kHeaderSize + kChunk);
+    tunnel::writeHeader(filler_.data(), tunnel::kSpeedTestId, tunnel::kFrameSpeedData);
+    std::mt19937 rng(12345);
+    for (size_t i = tunnel::kHeaderSize; i < filler_.size(); ++i)
+    {
+        filler_[i] = static_cast<char>(rng());
+    }
+}
+
+const char *SpeedTest::phaseName(Phase phase)
+{
+    switch (phase)
+    {
+    case kPhaseIdle:
+        return "空载延迟";
+    case kPhaseUpload:
+        return "上传";
+    case kPhaseDownload:
+        return "下载";
+    default:
+        return "收尾";
+    }
+}
+
+const char *SpeedTest::stateName(State state)
+{
+    switch (state)
+    {
+    case State::Running:
+        return "running";
+    case State::Done:
+        return "done";
+    case State::Failed:
+        return "failed";
+    default:
+        return "idle";
+    }
+}
+
+bool SpeedTest::start(int phaseSeconds)
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (result_.state == State::Running)
+        {
+            return false;
+        }
+        result_ = Result();
+        result_.state = State::Running;
+        result_.startedAt = std::time(nullptr);
+        result_.phaseSeconds = std::min(std::max(1, phaseSeconds), kMaxPhaseSeconds);
+    }
+    auto self = shared_from_this();
+    boost::asio::post(io_, [self]()
+                      { self->begin(); });
+    return true;
+}
+
+void SpeedTest::shutdown()
+{
+    stopped_ = true;
+}
+
+SpeedTest::Result SpeedTest::result() const
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    return result_;
+}
+
+void SpeedTest::begin()
+{
+    if (stopped_)
+    {
+        return;
+    }
+    running_ = true;
+    firstSeq_ = nextSeq_;
+    enterPhase(kPhaseIdle);
+    std::cout << "Speed test started" << std::endl;
+    if (!pinging_)
+    {
+        pinging_ = true;
+        schedulePing();
+    }
+    armPhaseTimer(std::chrono::seconds(result().phaseSeconds), &SpeedTest::endIdle);
+}
+
+void SpeedTest::enterPhase(Phase phase)
+{
+    phase_ = phase;
+    std::lock_guard<std::mutex> lock(mutex_);
+    result_.phase = phase;
+}
+
+void SpeedTest::endIdle()
+{
+    if (result().phases[kPhaseIdle].pingsReceived == 0)
+    {
+        fail("对方没有响应 (需要双方都支持测速, 协议版本 5)");
+        return;
+    }
+    enterPhase(kPhaseUpload);
+    auto duration = std::chrono::seconds(result().phaseSeconds);
+    tunnel::SpeedControl begin{tunnel::kSpeedUploadBegin, 0, 0, 0};
+    sendControl_(tunnel::kFrameSpeedControl, &begin, sizeof(begin));
+    startSending(duration, tunnel::kSpeedUploadEnd);
+    // Our queue drains after the last frame, then the peer reports
+    armPhaseTimer(duration + kReplyTimeout, &SpeedTest::timeout);
+}
+
+void SpeedTest::onReport(uint64_t bytes, uint64_t elapsedUs)
+{
+    if (!running_ || phase_ != kPhaseUpload)
+    {
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        PhaseResult &upload = result_.phases[kPhaseUpload];
+        upload.bytes = bytes;
+        upload.bytesPerSec = elapsedUs > 0 ? bytes * 1e6 / elapsedUs : 0.0;
+    }
+    enterPhase(kPhaseDownload);
+    resetReceive();
+    receiving_ = true;
+    int seconds = result().phaseSeconds;
+    tunnel::SpeedControl request{tunnel::kSpeedDownloadRequest, static_cast<uint32_t>(seconds * 1000), 0, 0};
+    sendControl_(tunnel::kFrameSpeedControl, &request, sizeof(request));
+    armPhaseTimer(std::chrono::seconds(seconds) + kReplyTimeout, &SpeedTest::timeout);
+}
+
+void SpeedTest::onDownloadEnd()
+{
+    if (!running_ || phase_ != kPhaseDownload)
+    {
+        return;
+    }
+    receiving_ = false;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        PhaseResult &download = result_.phases[kPhaseDownload];
+        download.bytes = receivedBytes_;
+        download.bytesPerSec = receiveRate();
+    }
+    // Pings still in flight get a moment before they count as lost
+    enterPhase(kPhaseCount);
+    pinging_ = false;
+    armPhaseTimer(kPongGrace, &SpeedTest::finish);
+}
+
+void SpeedTest::finish()
+{
+    running_ = false;
+    Result done;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        result_.state = State::Done;
+        done = result_;
+    }
+    std::cout << std::fixed << std::setprecision(1) << "Speed test done: up "
+              << done.phases[kPhaseUpload].bytesPerSec / 1024.0 << " KB/s, down "
+              << done.phases[kPhaseDownload].bytesPerSec / 1024.0 << " KB/s, idle rtt p50 "
+              << done.phases[kPhaseIdle].rtt.percentile(50) / 1000.0 << " ms" << std::endl;
+}
+
+void SpeedTest::fail(const std::string &error)
+{
+    running_ = false;
+    pinging_ = false;
+    sending_ = false;
+    receiving_ = false;
+    phaseGeneration_++;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        result_.state = State::Failed;
+        result_.error = error;
+    }
+    std::cerr << "Speed test failed: " << error << std::endl;
+}
+
+void SpeedTest::timeout()
+{
+    fail("等待对方超时");
+}
+
+void SpeedTest::armPhaseTimer(Clock::duration after, void (SpeedTest::*then)())
+{
+    // A handler that already fired cannot be cancelled; the generation tells it apart
+    uint64_t generation = ++phaseGeneration_;
+    phaseTimer_.expires_after(after);
+    auto self = shared_from_this();
+    phaseTimer_.async_wait([self, generation, then](const boost::system::error_code &ec)
+                           {
+        if (ec || self->stopped_ || generation != self->phaseGeneration_)
+        {
+            return;
+        }
+        (self.get()->*then)(); });
+}
+
+void SpeedTest::schedulePing()
+{
+    if (!pinging_ || stopped_ || phase_ >= kPhaseCount)
+    {
+        return;
+    }
+    tunnel::SpeedPing ping{nextSeq_++, static_cast<uint32_t>(phase_), static_cast<uint64_t>(nowUs())};
+    sendPing_(tunnel::kFramePing, &ping, sizeof(ping));
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        result_.phases[phase_].pingsSent++;
+    }
+    pingTimer_.expires_after(kPingInterval);
+    auto self = shared_from_this();
+    pingTimer_.async_wait([self](const boost::system::error_code &ec)
+                          {
+        if (!ec)
+        {
+            self->schedulePing();
+        } });
+}
+
+void SpeedTest::handleFrame(uint32_t type, const char *frame, size_t len)
+{
+    if (stopped_)
+    {
+        return;
+    }
+    if (type == tunnel::kFrameSpeedData)
+    {
+        received(len - tunnel::kHeaderSize);
+    }
+    else if (type == tunnel::kFramePing)
+    {
+        // Echo as is; the peer measures with its own clock
+        sendPing_(tunnel::kFramePong, frame + tunnel::kHeaderSize, len - tunnel::kHeaderSize);
+    }
+    else if (type == tunnel::kFramePong)
+    {
+        handlePong(frame, len);
+    }
+    else if (type == tunnel::kFrameSpeedControl)
+    {
+        handleControl(frame, len);
+    }
+}
+
+void SpeedTest::handlePong(const char *frame, size_t len)
+{
+    tunnel::SpeedPing ping;
+    if (!tunnel::readPayload(frame, len, ping) || ping.phase >= kPhaseCount ||
+        ping.seq - firstSeq_ >= nextSeq_ - firstSeq_)
+    {
+        return;
+    }
+    int64_t rtt = nowUs() - static_cast<int64_t>(ping.sentUs);
+    if (rtt < 0)
+    {
+        return;
+    }
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (result_.state != State::Running)
+    {
+        return;
+    }
+    PhaseResult &phase = result_.phases[ping.phase];
+    phase.rtt.record(static_cast<uint64_t>(rtt));
+    if (phase.pingsReceived == 0 || static_cast<uint64_t>(rtt) < phase.minRttUs)
+    {
+        phase.minRttUs = static_cast<uint64_t>(rtt);
+    }
+    phase.pingsReceived++;
+}
+
+void SpeedTest::handleControl(const char *frame, size_t len)
+{
+    tunnel::SpeedControl control;
+    if (!tunnel::readPayload(frame, len, control))
+    {
+        std::cerr << "Invalid speed test frame" << std::endl;
+        return;
+    }
+    switch (control.kind)
+    {
+    case tunnel::kSpeedUploadBegin:
+        // Peer is testing its upload to us
+        resetReceive();
+        receiving_ = true;
+        break;
+    case tunnel::kSpeedUploadEnd:
+    {
+        receiving_ = false;
+        tunnel::SpeedControl report{tunnel::kSpeedReport, 0, receivedBytes_, 0};
+        report.elapsedUs = static_cast<uint64_t>(
+            std::chrono::duration_cast<std::chrono::microseconds>(receiveLast_ - receiveFirst_).count());
+        sendControl_(tunnel::kFrameSpeedControl, &report, sizeof(report));
+        break;
+    }
+    case tunnel::kSpeedReport:
+        onReport(control.bytes, control.elapsedUs);
+        break;
+    case tunnel::kSpeedDownloadRequest:
+    {
+        if (sending_)
+        {
+            break;
+        }
+        auto duration = std::chrono::milliseconds(std::min<uint32_t>(control.durationMs, kMaxPhaseSeconds * 1000));
+        startSending(duration, tunnel::kSpeedDownloadEnd);
+        break;
+    }
+    case tunnel::kSpeedDownloadEnd:
+        onDownloadEnd();
+        break;
+    default:
+        break;
+    }
+}
+
+void SpeedTest::startSending(std::chrono::milliseconds duration, uint32_t endKind)
+{
+    sending_ = true;
+    bytesSent_ = 0;
+    sendTimer_.expires_after(duration);
+    auto self = shared_from_this();
+    sendTimer_.async_wait([self, endKind](const boost::system::error_code &ec)
+                          {
+        if (ec || self->stopped_ || !self->sending_)
+        {
+            return;
+        }
+        self->sending_ = false;
+        // Queued behind the last filler frame
+        tunnel::SpeedControl end{endKind, 0, self->bytesSent_, 0};
+        self->sendControl_(tunnel::kFrameSpeedControl, &end, sizeof(end)); });
+    feed();
+}
+
+void SpeedTest::feed()
+{
+    for (int round = 0; round < kMaxRounds; ++round)
+    {
+        if (!sending_ || stopped_)
+        {
+            return;
+        }
+        bool more = sendData_(filler_.data(), filler_.size());
+        bytesSent_ += kChunk;
+        if (!more)
+        {
+            // Queue full; onWritable() continues once it drains
+            return;
+        }
+    }
+    // A link that takes everything would never give the end timer a turn
+    onWritable();
+}
+
+void SpeedTest::onWritable()
+{
+    // Runs inside the scheduler's flush, which feed() itself may have called
+    auto self = shared_from_this();
+    boost::asio::post(io_, [self]()
+                      { self->feed(); });
+}
+
+void SpeedTest::resetReceive()
+{
+    receiveStarted_ = false;
+    receivedBytes_ = 0;
+    receiveFirst_ = receiveLast_ = Clock::time_point();
+}
+
+void SpeedTest::received(size_t bytes)
+{
+    if (!receiving_)
+    {
+        return;
+    }
+    auto now = Clock::now();
+    if (!receiveStarted_)
+    {
+        // The first frame only starts the clock
+        receiveStarted_ = true;
+        receiveFirst_ = receiveLast_ = now;
+        return;
+    }
+    receivedBytes_ += bytes;
+    receiveLast_ = now;
+}
+
+double SpeedTest::receiveRate() const
+{
+    double seconds = std::chrono::duration<double>(receiveLast_ - receiveFirst_).count();
+    return seconds > 0.0 ? receivedBytes_ / seconds : 0.0;
+}
+
+std::string SpeedTest::toJson(const Result &result, const std::string &peer)
+{
+    auto ms = [](uint64_t usec)
+    { return usec / 1000.0; };
+    std::ostringstream out;
+    out << std::fixed << std::setprecision(3);
+    char started[32] = "";
+    std::strftime(started, sizeof(started), "%Y-%m-%dT%H:%M:%S", std::localtime(&result.startedAt));
+    out << "{\n"
+        << "  \"peer\": \"" << jsonEscape(peer) << "\",\n"
+        << "  \"started\": \"" << started << "\",\n"
+        << "  \"state\": \"" << stateName(result.state) << "\",\n"
+        << "  \"error\": \"" << jsonEscape(result.error) << "\",\n"
+        << "  \"phaseSeconds\": " << result.phaseSeconds << ",\n"
+        << "  \"phases\": {\n";
+    const PhaseResult &idle = result.phases[kPhaseIdle];
+    for (int i = 0; i < kPhaseCount; ++i)
+    {
+        const PhaseResult &p = result.phases[i];
+        out << "    \"" << kPhaseKeys[i] << "\": {\n"
+            << "      \"bytes\": " << p.bytes << ",\n"
+            << "      \"bytesPerSec\": " << p.bytesPerSec << ",\n"
+            << "      \"pingsSent\": " << p.pingsSent << ",\n"
+            << "      \"pingsReceived\": " << p.pingsReceived << ",\n"
+            << "      \"loss\": " << p.loss() << ",\n"
+            << "      \"rttMs\": {\"min\": " << ms(p.minRttUs) << ", \"p50\": " << ms(p.rtt.percentile(50))
+            << ", \"p90\": " << ms(p.rtt.percentile(90)) << ", \"p99\": " << ms(p.rtt.percentile(99))
+            << ", \"max\": " << ms(p.rtt.max()) << ", \"mean\": " << p.rtt.mean() / 1000.0 << "}";
+        if (i != kPhaseIdle)
+        {
+            // Latency under load over the idle baseline
+            double added = ms(p.rtt.percentile(50)) - ms(idle.rtt.percentile(50));
+            out << ",\n      \"addedLatencyMs\": " << std::max(0.0, added);
+        }
+        out << "\n    }" << (i + 1 < kPhaseCount ? "," : "") << "\n";
+    }
+    out << "  }\n}\n";
+    return out.str();
+}
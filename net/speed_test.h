@@ -0,0 +1,149 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <ctime>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <boost/asio.hpp>
+#include "latency_histogram.h"
+
+// Speed test between two peers over their live tunnel connection (frame types
+// in tunnel_protocol.h). The side that starts it runs three phases of
+// phaseSeconds each: idle, upload (it fills the link with filler frames
+// queued like any bulk stream) and download (the peer does). Pings go
+// unreliable the whole time, so each phase gets an RTT distribution and a
+// loss rate; RTT under load minus idle RTT is the queueing the path adds
+// (bufferbloat). Either side answers a test the other one starts.
+// Frames are handled on the io_context thread.
+class SpeedTest : public std::enable_shared_from_this<SpeedTest>
+{
+public:
+    using Clock = std::chrono::steady_clock;
+
+    enum Phase
+    {
+        kPhaseIdle = 0,
+        kPhaseUpload,
+        kPhaseDownload,
+        kPhaseCount,
+    };
+
+    enum class State
+    {
+        Idle,
+        Running,
+        Done,
+        Failed,
+    };
+
+    struct PhaseResult
+    {
+        LatencyHistogram rtt; // ping round trips, microseconds
+        uint64_t minRttUs = 0;
+        uint64_t pingsSent = 0;
+        uint64_t pingsReceived = 0;
+        uint64_t bytes = 0;       // filler delivered, upload and download only
+        double bytesPerSec = 0.0;
+
+        double loss() const;
+    };
+
+    struct Result
+    {
+        State state = State::Idle;
+        Phase phase = kPhaseIdle; // while running
+        std::string error;
+        std::time_t startedAt = 0;
+        int phaseSeconds = 0;
+        PhaseResult phases[kPhaseCount];
+    };
+
+    // Control frames are reliable and stay ordered behind our filler; pings go
+    // unreliable past the scheduler. Filler is queued as a bulk stream and the
+    // function returns false when the sender should wait for onWritable().
+    using ControlFunc = std::function<void(uint32_t type, const void *payload, size_t len)>;
+    using DataFunc = std::function<bool(const char *frame, size_t len)>;
+
+    SpeedTest(boost::asio::io_context &io, ControlFunc sendControl, ControlFunc sendPing, DataFunc sendData);
+
+    // Any thread. Returns false while a test is running.
+    bool start(int phaseSeconds);
+    // Any thread; no callbacks run afterwards (the owner is going away)
+    void shutdown();
+    Result result() const;
+
+    // io thread: SPEED_CONTROL, SPEED_DATA, PING and PONG frames
+    void handleFrame(uint32_t type, const char *frame, size_t len);
+    // Scheduler resume for the speed test stream, any thread
+    void onWritable();
+
+    static const char *phaseName(Phase phase);
+    static const char *stateName(State state);
+    // One result as a JSON object, for recording path quality per session
+    static std::string toJson(const Result &result, const std::string &peer);
+
+    static constexpr int kDefaultPhaseSeconds = 5;
+    static constexpr int kMaxPhaseSeconds = 30;
+    static constexpr std::chrono::milliseconds kPingInterval{20};
+    // After a phase, for the peer's report or the last pongs
+    static constexpr std::chrono::seconds kReplyTimeout{10};
+    static constexpr std::chrono::milliseconds kPongGrace{1000};
+    static constexpr size_t kChunk = 16 * 1024;
+    // Filler frames queued per turn on the io thread
+    static constexpr int kMaxRounds = 64;
+
+private:
+    void begin();
+    void enterPhase(Phase phase);
+    void endIdle();
+    void onReport(uint64_t bytes, uint64_t elapsedUs);
+    void onDownloadEnd();
+    void finish();
+    void fail(const std::string &error);
+    void schedulePing();
+    void armPhaseTimer(Clock::duration after, void (SpeedTest::*then)());
+    void timeout();
+    void handleControl(const char *frame, size_t len);
+    void handlePong(const char *frame, size_t len);
+
+    // Sending side (initiator upload, peer download)
+    void startSending(std::chrono::milliseconds duration, uint32_t endKind);
+    void feed();
+    // Receiving side: the first filler frame starts the clock
+    void resetReceive();
+    void received(size_t bytes);
+    double receiveRate() const;
+
+    boost::asio::io_context &io_;
+    ControlFunc sendControl_;
+    ControlFunc sendPing_;
+    DataFunc sendData_;
+    std::atomic<bool> stopped_;
+
+    mutable std::mutex mutex_;
+    Result result_; // guarded by mutex_
+
+    // io thread only
+    bool running_ = false;
+    Phase phase_ = kPhaseIdle;
+    bool pinging_ = false;
+    uint32_t nextSeq_ = 0;
+    uint32_t firstSeq_ = 0; // pongs from an earlier run are ignored
+    boost::asio::steady_timer phaseTimer_;
+    boost::asio::steady_timer pingTimer_;
+    boost::asio::steady_timer sendTimer_;
+    uint64_t phaseGeneration_ = 0;
+    bool sending_ = false;
+    uint64_t bytesSent_ = 0;
+    std::vector<char> filler_;
+    bool receiving_ = false;
+    bool receiveStarted_ = false;
+    uint64_t receivedBytes_ = 0;
+    Clock::time_point receiveFirst_;
+    Clock::time_point receiveLast_;
+};
@@ -0,0 +1,460 @@
+#include "stream_pipeline.h"
+#include "tunnel_protocol.h"
+#include "trace.h"
+#include "mem_tracker.h"
+#include <iostream>
+
+StreamPipeline::StreamPipeline(const std::string &id, std::shared_ptr<tcp::socket> socket,
+                               SendHandler onSend, FinishHandler onFinished, CloseHandler onClosed)
+    : id_(id), socket_(std::move(socket)), onSend_(std::move(onSend)), onFinished_(std::move(onFinished)),
+      onClosed_(std::move(onClosed)), frameBuffer_(tunnel::kHeaderSize + kReadSize),
+      deadline_(socket_->get_executor()),
+#ifdef STREAM_PIPELINE_COROUTINES
+      readWake_(socket_->get_executor(), boost::asio::steady_timer::time_point::max()),
+      writeWake_(socket_->get_executor(), boost::asio::steady_timer::time_point::max()),
+#endif
+      writing_(false),
+      paused_(false), connecting_(false), readDone_(false), finishPending_(false), writeDone_(false),
+      closed_(false), bytesRead_(0), bytesWritten_(0), bytesDelivered_(0)
+{
+    static_assert(tunnel::kHeaderSize + kReadSize <= ReadBufferPool::kSlabSize, "read slab too small");
+    readPool_ = ReadBufferPool::find(socket_->get_executor());
+}
+
+StreamPipeline::~StreamPipeline()
+{
+    // Not in shutdown(): a cancelled io_uring read may still land in the slab
+    // until its handler has run, and the handler keeps us alive until then
+    if (readPool_)
+    {
+        readPool_->release(slab_);
+    }
+}
+
+void StreamPipeline::start()
+{
+    auto self = shared_from_this();
+#ifdef STREAM_PIPELINE_COROUTINES
+    boost::asio::post(socket_->get_executor(), [self]()
+                      { self->spawnLoops(); });
+#else
+    boost::asio::post(socket_->get_executor(), [self]()
+                      { self->startRead(); });
+#endif
+}
+
+void StreamPipeline::connect(const tcp::endpoint &target, ConnectHandler onConnected)
+{
+    auto self = shared_from_this();
+    boost::asio::post(socket_->get_executor(), [self, target, onConnected]()
+                      {
+        if (self->closed_)
+        {
+            return;
+        }
+#ifdef STREAM_PIPELINE_COROUTINES
+        boost::asio::co_spawn(self->socket_->get_executor(), self->connectLoop(target, onConnected), boost::asio::detached);
+#else
+        self->connecting_ = true;
+        self->armConnectTimeout();
+        self->socket_->async_connect(target, [self, onConnected](const boost::system::error_code &ec)
+                                     {
+            if (self->onConnectDone(ec, onConnected))
+            {
+                self->startRead();
+                if (!self->writing_)
+                {
+                    self->writeNext();
+                }
+            } });
+#endif
+    });
+}
+
+void StreamPipeline::armConnectTimeout()
+{
+    auto self = shared_from_this();
+    deadline_.expires_after(kConnectTimeout);
+    deadline_.async_wait([self](const boost::system::error_code &ec)
+                         {
+        if (!ec && self->connecting_ && !self->closed_)
+        {
+            // Aborts the connect, which then reports the failure
+            std::cerr << "Stream " << self->id_ << " connect timed out" << std::endl;
+            boost::system::error_code ignored;
+            self->socket_->close(ignored);
+        } });
+}
+
+bool StreamPipeline::onConnectDone(const boost::system::error_code &ec, const ConnectHandler &onConnected)
+{
+    connecting_ = false;
+    deadline_.cancel();
+    if (closed_)
+    {
+        return false;
+    }
+    if (ec)
+    {
+        std::cerr << "Stream " << id_ << " connect failed: " << ec.message() << std::endl;
+        closed_ = true;
+        shutdown();
+        onConnected(id_, false);
+        return false;
+    }
+    boost::system::error_code ignored;
+    socket_->set_option(tcp::no_delay(true), ignored);
+    onConnected(id_, true);
+    return true;
+}
+
+void StreamPipeline::close()
+{
+    if (closed_.exchange(true))
+    {
+        return;
+    }
+    auto self = shared_from_this();
+    boost::asio::post(socket_->get_executor(), [self]()
+                      { self->shutdown(); });
+}
+
+void StreamPipeline::resumeRead()
+{
+    auto self = shared_from_this();
+    boost::asio::post(socket_->get_executor(), [self]()
+                      {
+        if (self->paused_)
+        {
+            self->paused_ = false;
+#ifdef STREAM_PIPELINE_COROUTINES
+            self->readWake_.cancel();
+#else
+            self->startRead();
+#endif
+        } });
+}
+
+void StreamPipeline::deliver(const char *data, size_t len)
+{
+    if (closed_ || len == 0)
+    {
+        return;
+    }
+    auto self = shared_from_this();
+    bytesDelivered_ += len;
+    std::vector<char> chunk(data, data + len);
+    boost::asio::post(socket_->get_executor(), [self, chunk = std::move(chunk), at = Clock::now()]() mutable
+                      {
+        self->writeQueue_.push_back(PendingWrite{std::move(chunk), at});
+        self->wakeWriter(); });
+}
+
+void StreamPipeline::finishWrite()
+{
+    auto self = shared_from_this();
+    boost::asio::post(socket_->get_executor(), [self]()
+                      {
+        self->finishPending_ = true;
+        self->wakeWriter(); });
+}
+
+void StreamPipeline::setTransform(std::shared_ptr<StreamTransform> transform)
+{
+    auto self = shared_from_this();
+    boost::asio::post(socket_->get_executor(), [self, transform]()
+                      { self->transform_ = transform; });
+}
+
+void StreamPipeline::setTiming(std::shared_ptr<StreamTiming> timing)
+{
+    auto self = shared_from_this();
+    boost::asio::post(socket_->get_executor(), [self, timing]()
+                      { self->timing_ = timing; });
+}
+
+void StreamPipeline::popWritten(bool ok)
+{
+    if (writeQueue_.empty())
+    {
+        return;
+    }
+    if (ok && timing_)
+    {
+        auto elapsed = Clock::now() - writeQueue_.front().deliveredAt;
+        timing_->record(timing::kWrite, std::chrono::duration_cast<std::chrono::microseconds>(elapsed).count());
+    }
+    writeQueue_.pop_front();
+}
+
+bool StreamPipeline::prepareRead()
+{
+#if defined(BOOST_ASIO_HAS_IO_URING) && BOOST_VERSION >= 107900
+    if (readPool_ && slab_.index < 0)
+    {
+        slab_ = readPool_->acquire();
+    }
+    if (slab_.index >= 0)
+    {
+        return true;
+    }
+#endif
+    // Stage 1: read straight into the payload area of the frame buffer
+    frameBuffer_.resize(tunnel::kHeaderSize + kReadSize);
+    return false;
+}
+
+#ifndef STREAM_PIPELINE_COROUTINES
+void StreamPipeline::startRead()
+{
+    if (closed_)
+    {
+        return;
+    }
+    auto self = shared_from_this();
+    auto handler = [self](const boost::system::error_code &ec, std::size_t bytes)
+    {
+        if (self->consumeRead(ec, bytes))
+        {
+            self->startRead();
+        }
+    };
+#if defined(BOOST_ASIO_HAS_IO_URING) && BOOST_VERSION >= 107900
+    if (prepareRead())
+    {
+        socket_->async_read_some(readPool_->buffer(slab_, tunnel::kHeaderSize, kReadSize), handler);
+        return;
+    }
+#else
+    prepareRead();
+#endif
+    socket_->async_read_some(boost::asio::buffer(frameBuffer_.data() + tunnel::kHeaderSize, kReadSize), handler);
+}
+#endif
+
+bool StreamPipeline::consumeRead(const boost::system::error_code &ec, std::size_t bytes)
+{
+    TRACE_SPAN("StreamPipeline::onRead");
+    // Runs on the TCP server's thread; the stream belongs to the multiplexer
+    MEMTRACK_SCOPE(memtrack::Tag::Multiplex);
+    if (closed_)
+    {
+        return false;
+    }
+    if (ec == boost::asio::error::eof)
+    {
+        // Half-close: keep writing whatever the peer still sends
+        readDone_ = true;
+        onFinished_(id_);
+        finishIfDone();
+        return false;
+    }
+    if (ec)
+    {
+        std::cout << "Stream " << id_ << " read ended: " << ec.message() << std::endl;
+        fail();
+        return false;
+    }
+    if (bytes > 0)
+    {
+        Clock::time_point readAt = Clock::now();
+        bytesRead_ += bytes;
+        // Stage 2: frame
+        char *frame = readBuffer();
+        size_t frameLen = tunnel::kHeaderSize + bytes;
+        tunnel::writeHeader(frame, id_, tunnel::kFrameData);
+        // Stage 3: optional transform
+        if (transform_)
+        {
+            if (frame != frameBuffer_.data())
+            {
+                frameBuffer_.assign(frame, frame + frameLen);
+            }
+            frameBuffer_.resize(frameLen);
+            transform_->apply(id_, frameBuffer_);
+            frame = frameBuffer_.data();
+            frameLen = frameBuffer_.size();
+        }
+        // Stage 4: send
+        if (!onSend_(id_, frame, frameLen, readAt))
+        {
+            // Tunnel backlog for this stream is full; wait for resumeRead()
+            paused_ = true;
+            return false;
+        }
+    }
+    return true;
+}
+
+char *StreamPipeline::readBuffer()
+{
+    return slab_.index >= 0 ? slab_.data : frameBuffer_.data();
+}
+
+void StreamPipeline::wakeWriter()
+{
+#ifdef STREAM_PIPELINE_COROUTINES
+    writeWake_.cancel();
+#else
+    if (!writing_ && !connecting_)
+    {
+        writeNext();
+    }
+#endif
+}
+
+#ifndef STREAM_PIPELINE_COROUTINES
+void StreamPipeline::writeNext()
+{
+    if (writeQueue_.empty() || closed_)
+    {
+        writing_ = false;
+        if (finishPending_ && !writeDone_ && !closed_)
+        {
+            boost::system::error_code ignored;
+            socket_->shutdown(tcp::socket::shutdown_send, ignored);
+            writeDone_ = true;
+            finishIfDone();
+        }
+        return;
+    }
+    writing_ = true;
+    auto self = shared_from_this();
+    boost::asio::async_write(*socket_, boost::asio::buffer(writeQueue_.front().data),
+                             [self](const boost::system::error_code &ec, std::size_t bytes)
+                             {
+        TRACE_SPAN("StreamPipeline::onWrite");
+        self->popWritten(!ec);
+        if (ec)
+        {
+            std::cout << "Stream " << self->id_ << " write failed: " << ec.message() << std::endl;
+            self->writing_ = false;
+            self->fail();
+            return;
+        }
+        self->bytesWritten_ += bytes;
+        self->writeNext(); });
+}
+#endif
+
+void StreamPipeline::fail()
+{
+    if (!closed_.exchange(true))
+    {
+        shutdown();
+        onClosed_(id_, true);
+    }
+}
+
+void StreamPipeline::finishIfDone()
+{
+    if (readDone_ && writeDone_ && !closed_.exchange(true))
+    {
+        shutdown();
+        onClosed_(id_, false);
+    }
+}
+
+void StreamPipeline::shutdown()
+{
+    boost::system::error_code ignored;
+    socket_->shutdown(tcp::socket::shutdown_both, ignored);
+    socket_->close(ignored);
+    writeQueue_.clear();
+    deadline_.cancel();
+#ifdef STREAM_PIPELINE_COROUTINES
+    readWake_.cancel();
+    writeWake_.cancel();
+#endif
+}
+
+#ifdef STREAM_PIPELINE_COROUTINES
+void StreamPipeline::spawnLoops()
+{
+    auto executor = socket_->get_executor();
+    boost::asio::co_spawn(executor, readLoop(), boost::asio::detached);
+    boost::asio::co_spawn(executor, writeLoop(), boost::asio::detached);
+}
+
+boost::asio::awaitable<void> StreamPipeline::connectLoop(tcp::endpoint target, ConnectHandler onConnected)
+{
+    auto self = shared_from_this();
+    connecting_ = true;
+    armConnectTimeout();
+    boost::system::error_code ec;
+    co_await socket_->async_connect(target, boost::asio::redirect_error(boost::asio::use_awaitable, ec));
+    if (onConnectDone(ec, onConnected))
+    {
+        spawnLoops();
+    }
+}
+
+boost::asio::awaitable<void> StreamPipeline::readLoop()
+{
+    auto self = shared_from_this();
+    boost::system::error_code ec;
+    while (!closed_)
+    {
+        if (paused_)
+        {
+            // resumeRead() and shutdown() cancel the wait
+            co_await readWake_.async_wait(boost::asio::redirect_error(boost::asio::use_awaitable, ec));
+            continue;
+        }
+        std::size_t bytes;
+#if defined(BOOST_ASIO_HAS_IO_URING) && BOOST_VERSION >= 107900
+        if (prepareRead())
+        {
+            bytes = co_await socket_->async_read_some(readPool_->buffer(slab_, tunnel::kHeaderSize, kReadSize),
+                                                      boost::asio::redirect_error(boost::asio::use_awaitable, ec));
+        }
+        else
+#else
+        prepareRead();
+#endif
+        {
+            bytes = co_await socket_->async_read_some(boost::asio::buffer(frameBuffer_.data() + tunnel::kHeaderSize, kReadSize),
+                                                      boost::asio::redirect_error(boost::asio::use_awaitable, ec));
+        }
+        if (!consumeRead(ec, bytes) && !paused_)
+        {
+            co_return;
+        }
+    }
+}
+
+boost::asio::awaitable<void> StreamPipeline::writeLoop()
+{
+    auto self = shared_from_this();
+    boost::system::error_code ec;
+    while (!closed_)
+    {
+        if (writeQueue_.empty())
+        {
+            if (finishPending_ && !writeDone_)
+            {
+                socket_->shutdown(tcp::socket::shutdown_send, ec);
+                writeDone_ = true;
+                finishIfDone();
+                co_return;
+            }
+            // deliver(), finishWrite() and shutdown() cancel the wait
+            co_await writeWake_.async_wait(boost::asio::redirect_error(boost::asio::use_awaitable, ec));
+            continue;
+        }
+        writing_ = true;
+        std::size_t bytes = co_await boost::asio::async_write(*socket_, boost::asio::buffer(writeQueue_.front().data),
+                                                              boost::asio::redirect_error(boost::asio::use_awaitable, ec));
+        writing_ = false;
+        TRACE_SPAN("StreamPipeline::onWrite");
+        popWritten(!ec);
+        if (ec)
+        {
+            std::cout << "Stream " << id_ << " write failed: " << ec.message() << std::endl;
+            fail();
+            co_return;
+        }
+        bytesWritten_ += bytes;
+    }
+}
+#endif
@@ -0,0 +1,156 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+#include <boost/asio.hpp>
+#include "read_buffer_pool.h"
+#include "stream_timing.h"
+
+// CMake option CONNECTTOOL_COROUTINES (C++20): the read, write and connect
+// loops run as Asio coroutines instead of completion-handler chains. Both
+// engines share the read/frame/send and connect handling below.
+#if defined(CONNECTTOOL_COROUTINES) && defined(BOOST_ASIO_HAS_CO_AWAIT)
+#define STREAM_PIPELINE_COROUTINES 1
+#include <boost/asio/awaitable.hpp>
+#include <boost/asio/co_spawn.hpp>
+#include <boost/asio/detached.hpp>
+#include <boost/asio/redirect_error.hpp>
+#include <boost/asio/use_awaitable.hpp>
+#endif
+
+using boost::asio::ip::tcp;
+
+// Optional stage between framing and sending. The frame buffer holds the
+// tunnel header followed by the payload; a transform may rewrite or resize it.
+class StreamTransform
+{
+public:
+    virtual ~StreamTransform() = default;
+    virtual void apply(const std::string &id, std::vector<char> &frame) = 0;
+};
+
+// Owns one local TCP socket. It is the only reader and the only writer of that
+// socket: data read locally flows read -> frame -> transform -> send, data
+// coming from the tunnel is queued and written in order on the socket's executor.
+// The two directions end separately: local EOF reports onFinished (the peer gets
+// a FIN), finishWrite() half-closes the socket once queued data is written, and
+// the stream ends cleanly when both are done. Errors reset the whole stream.
+// close() is the per-stream cancellation: it aborts every pending operation.
+// A connect that takes longer than kConnectTimeout fails like a refused one.
+class StreamPipeline : public std::enable_shared_from_this<StreamPipeline>
+{
+public:
+    using Clock = std::chrono::steady_clock;
+    // Returns false when the stream should stop reading until resumeRead();
+    // readAt is when the read that produced the frame completed
+    using SendHandler = std::function<bool(const std::string &id, const char *frame, size_t len, Clock::time_point readAt)>;
+    // Local side reached EOF; nothing more will be read
+    using FinishHandler = std::function<void(const std::string &id)>;
+    // Stream is over: reset is false after both directions finished cleanly
+    using CloseHandler = std::function<void(const std::string &id, bool reset)>;
+    using ConnectHandler = std::function<void(const std::string &id, bool connected)>;
+
+    StreamPipeline(const std::string &id, std::shared_ptr<tcp::socket> socket,
+                   SendHandler onSend, FinishHandler onFinished, CloseHandler onClosed);
+    ~StreamPipeline();
+
+    void start();
+    // Connect the (unopened) socket, then start. Data delivered meanwhile is
+    // written once the connection is up; on failure onConnected(false) is the
+    // only callback.
+    void connect(const tcp::endpoint &target, ConnectHandler onConnected);
+    // Abort both directions without further callbacks
+    void close();
+    void resumeRead();
+
+    // Queue tunnel payload for the local socket. The data is copied.
+    void deliver(const char *data, size_t len);
+    // Peer sent FIN: shut down our write side after the queued data
+    void finishWrite();
+
+    void setTransform(std::shared_ptr<StreamTransform> transform);
+    // Records the write hop (deliver() to write completion) of every chunk
+    // while set; nullptr stops
+    void setTiming(std::shared_ptr<StreamTiming> timing);
+
+    const std::string &id() const { return id_; }
+    std::shared_ptr<tcp::socket> socket() const { return socket_; }
+    uint64_t bytesRead() const { return bytesRead_; }
+    uint64_t bytesWritten() const { return bytesWritten_; }
+    // Bytes delivered but not yet written to the local socket; any thread
+    uint64_t writeBacklog() const
+    {
+        // Written first: it never passes delivered, so the difference cannot wrap
+        uint64_t written = bytesWritten_;
+        return closed_ ? 0 : bytesDelivered_ - written;
+    }
+
+    static constexpr std::chrono::seconds kConnectTimeout{10};
+
+private:
+    // True when the read goes to the registered slab
+    bool prepareRead();
+    // Frames and sends what was read; true to keep reading right away
+    bool consumeRead(const boost::system::error_code &ec, std::size_t bytes);
+    char *readBuffer();
+    void armConnectTimeout();
+    // True when connected and the loops should start
+    bool onConnectDone(const boost::system::error_code &ec, const ConnectHandler &onConnected);
+    void wakeWriter();
+    // Drops the chunk a write just finished with
+    void popWritten(bool ok);
+#ifdef STREAM_PIPELINE_COROUTINES
+    void spawnLoops();
+    boost::asio::awaitable<void> connectLoop(tcp::endpoint target, ConnectHandler onConnected);
+    boost::asio::awaitable<void> readLoop();
+    boost::asio::awaitable<void> writeLoop();
+#else
+    void startRead();
+    void writeNext();
+#endif
+    void shutdown();
+    void fail();
+    void finishIfDone();
+
+    static constexpr size_t kReadSize = 16 * 1024;
+
+    std::string id_;
+    std::shared_ptr<tcp::socket> socket_;
+    SendHandler onSend_;
+    FinishHandler onFinished_;
+    CloseHandler onClosed_;
+    std::shared_ptr<StreamTransform> transform_;
+
+    std::vector<char> frameBuffer_;
+    // Registered read slab under io_uring, otherwise unused
+    std::shared_ptr<ReadBufferPool> readPool_;
+    ReadBufferPool::Slab slab_;
+    struct PendingWrite
+    {
+        std::vector<char> data;
+        Clock::time_point deliveredAt;
+    };
+    std::deque<PendingWrite> writeQueue_;
+    std::shared_ptr<StreamTiming> timing_; // executor only
+    boost::asio::steady_timer deadline_;
+#ifdef STREAM_PIPELINE_COROUTINES
+    // Never expire; cancel() wakes the loop waiting on them
+    boost::asio::steady_timer readWake_;
+    boost::asio::steady_timer writeWake_;
+#endif
+    bool writing_;
+    bool paused_;
+    bool connecting_;
+    bool readDone_;
+    bool finishPending_;
+    bool writeDone_;
+    std::atomic<bool> closed_;
+    std::atomic<uint64_t> bytesRead_;
+    std::atomic<uint64_t> bytesWritten_;
+    std::atomic<uint64_t> bytesDelivered_;
+};
@@ -0,0 +1,74 @@
+#include "stream_timing.h"
+#include <algorithm>
+
+namespace timing
+{
+    const char *hopName(Hop hop)
+    {
+        static const char *const kNames[kHopCount] = {"read", "schedule", "steam queue", "wire", "poll", "write"};
+        return hop >= 0 && hop < kHopCount ? kNames[hop] : "?";
+    }
+
+    int64_t toUs(std::chrono::steady_clock::time_point at)
+    {
+        return std::chrono::duration_cast<std::chrono::microseconds>(at.time_since_epoch()).count();
+    }
+
+    int64_t nowUs()
+    {
+        return toUs(std::chrono::steady_clock::now());
+    }
+}
+
+void StreamTiming::record(timing::Hop hop, int64_t usec)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    // Clock offset error can push a short hop slightly below zero
+    stats_.hops[hop].record(static_cast<uint64_t>(std::max<int64_t>(usec, 0)));
+}
+
+void StreamTiming::countSample()
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    stats_.samples++;
+}
+
+StreamTiming::Snapshot StreamTiming::snapshot() const
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    return stats_;
+}
+
+void ClockEstimator::addSample(int64_t originUs, int64_t receiveUs, int64_t replyUs, int64_t replyReceivedUs)
+{
+    // Round trip without the time the peer held the request
+    int64_t rtt = (replyReceivedUs - originUs) - (replyUs - receiveUs);
+    if (rtt < 0)
+    {
+        return;
+    }
+    // Assumes both directions took equally long
+    int64_t offset = ((receiveUs - originUs) + (replyUs - replyReceivedUs)) / 2;
+    samples_.push_back(Sample{rtt, offset});
+    if (samples_.size() > kWindow)
+    {
+        samples_.pop_front();
+    }
+}
+
+const ClockEstimator::Sample &ClockEstimator::best() const
+{
+    return *std::min_element(samples_.begin(), samples_.end(),
+                             [](const Sample &a, const Sample &b)
+                             { return a.rttUs < b.rttUs; });
+}
+
+int64_t ClockEstimator::offsetUs() const
+{
+    return samples_.empty() ? 0 : best().offsetUs;
+}
+
+int64_t ClockEstimator::rttUs() const
+{
+    return samples_.empty() ? 0 : best().rttUs;
+}
@@ -0,0 +1,89 @@
+#pragma once
+
+#include <array>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include "latency_histogram.h"
+
+// Where a stream's data spends its time on the way from the sender's local
+// socket to the receiver's (tunnel_protocol.h, version 8). The sender stamps
+// sampled frames with its own clock; the receiver adds its side and converts
+// between the clocks with the offset ClockEstimator measured.
+namespace timing
+{
+    enum Hop
+    {
+        kRead = 0,   // sender: read completed -> send scheduler (framing, delta coding)
+        kSchedule,   // sender: send scheduler -> handed to Steam
+        kSteamQueue, // sender: Steam's send queue, by Steam's own estimate
+        kWire,       // the rest of the way to the receiving Steam client
+        kPoll,       // receiver: arrived -> picked up by the poll loop
+        kWrite,      // receiver: handed to the stream -> local write completed
+        kHopCount,
+    };
+
+    const char *hopName(Hop hop);
+
+    // Microseconds on a clock shared by all threads of the process
+    int64_t nowUs();
+    int64_t toUs(std::chrono::steady_clock::time_point at);
+
+    // Peers ask for TIMING frames this often, and the sender stops stamping
+    // when requests stop for kLease
+    constexpr std::chrono::milliseconds kRequestInterval{250};
+    constexpr std::chrono::seconds kLease{3};
+    // At most one stamped frame per stream in this interval
+    constexpr std::chrono::milliseconds kStampInterval{20};
+    // Requests without a reply before the peer is taken for an older version
+    constexpr int kMaxUnansweredRequests = 12;
+}
+
+// Hop histograms of one stream's inbound data; any thread
+class StreamTiming
+{
+public:
+    void record(timing::Hop hop, int64_t usec);
+
+    struct Snapshot
+    {
+        std::array<LatencyHistogram, timing::kHopCount> hops;
+        uint64_t samples = 0; // stamped frames matched
+    };
+    Snapshot snapshot() const;
+    void countSample();
+
+private:
+    mutable std::mutex mutex_;
+    Snapshot stats_;
+};
+
+// Offset between our clock and the peer's from CLOCK request/reply round
+// trips. The exchange with the shortest round trip in the window is the one
+// least skewed by queueing, so its offset is used (as NTP does).
+class ClockEstimator
+{
+public:
+    // Times as in tunnel::ClockSync; replyReceivedUs on our clock
+    void addSample(int64_t originUs, int64_t receiveUs, int64_t replyUs, int64_t replyReceivedUs);
+    bool valid() const { return !samples_.empty(); }
+    // Peer clock minus ours
+    int64_t offsetUs() const;
+    // Round trip of the exchange the offset comes from; half of it bounds the error
+    int64_t rttUs() const;
+    void reset() { samples_.clear(); }
+
+    static constexpr size_t kWindow = 32;
+
+private:
+    struct Sample
+    {
+        int64_t rttUs;
+        int64_t offsetUs;
+    };
+    const Sample &best() const;
+
+    std::deque<Sample> samples_;
+};
@@ -1,33 +1,45 @@
 #include "tcp_server.h"
 #include "../steam/steam_networking_manager.h"
+#include "read_buffer_pool.h"
+#include "trace.h"
+#include "mem_tracker.h"
 #include <iostream>
 #include <algorithm>
 
-TCPServer::TCPServer(int port, SteamNetworkingManager* manager) : port_(port), running_(false), acceptor_(io_context_), work_(boost::asio::make_work_guard(io_context_)), manager_(manager) {}
+namespace {
+// Stripe placement key: the game client's source port, stable for one connection
+unsigned stripeKey(const std::shared_ptr<tcp::socket>& socket) {
+    boost::system::error_code ec;
+    auto endpoint = socket->remote_endpoint(ec);
+    return ec ? 0u : endpoint.port();
+}
+}
+
+TCPServer::TCPServer(const PortMappingTable& mappings, SteamNetworkingManager* manager) : mappings_(mappings), running_(false), work_(boost::asio::make_work_guard(io_context_)), manager_(manager), tunnelReady_(false), heldCount_(0), localStats_(std::make_shared<LocalBridge::Stats>()) {}
 
 TCPServer::~TCPServer() { stop(); }
 
 bool TCPServer::start() {
-    try {
-        tcp::endpoint endpoint(tcp::v4(), port_);
-        acceptor_.open(endpoint.protocol());
-        acceptor_.set_option(tcp::acceptor::reuse_address(true));
-        acceptor_.bind(endpoint);
-        acceptor_.listen();
-
-        running_ = true;
-        serverThread_ = std::thread([this]() { 
-            std::cout << "Server thread started" << std::endl;
-            io_context_.run(); 
-            std::cout << "Server thread stopped" << std::endl;
-        });
-        start_accept();
-        std::cout << "TCP server started on port " << port_ << std::endl;
-        return true;
-    } catch (const std::exception& e) {
-        std::cerr << "Failed to start TCP server: " << e.what() << std::endl;
+    ReadBufferPool::install(io_context_);
+    running_ = true;
+    // Before the io thread runs, so a port in use fails the start
+    applyMappings();
+    // A host whose mappings all target their own port has nothing to bridge
+    if (getPort() == 0 && !manager_->isHost()) {
+        std::cerr << "Failed to start TCP server: no mapped port could be opened" << std::endl;
+        running_ = false;
+        closeListeners();
+        ReadBufferPool::uninstall(io_context_);
         return false;
     }
+    serverThread_ = std::thread([this]() { 
+        std::cout << "Server thread started" << std::endl;
+        trace::setThreadName("tcp-server");
+        memtrack::setThreadTag(memtrack::Tag::TcpServer);
+        io_context_.run(); 
+        std::cout << "Server thread stopped" << std::endl;
+    });
+    return true;
 }
 
 void TCPServer::stop() {
@@ -36,69 +48,239 @@ void TCPServer::stop() {
     if (serverThread_.joinable()) {
         serverThread_.join();
     }
-    acceptor_.close();
+    closeListeners();
+    closeHeld();
+    ReadBufferPool::uninstall(io_context_);
+}
+
+int TCPServer::getPort() const {
+    std::lock_guard<std::mutex> lock(statusMutex_);
+    for (const auto& status : status_) {
+        if (status.listening) {
+            return status.mapping.listenPort;
+        }
+    }
+    return 0;
+}
+
+std::vector<TCPServer::ListenerStatus> TCPServer::getListenerStatus() const {
+    std::lock_guard<std::mutex> lock(statusMutex_);
+    return status_;
+}
+
+void TCPServer::syncMappings() {
+    boost::asio::post(io_context_, [this]() {
+        if (running_) {
+            applyMappings();
+        }
+    });
 }
 
-void TCPServer::sendToAll(const std::string& message, std::shared_ptr<tcp::socket> excludeSocket) {
-    sendToAll(message.c_str(), message.size(), excludeSocket);
+void TCPServer::applyMappings() {
+    auto wanted = mappings_.get();
+    std::vector<std::shared_ptr<Listener>> kept;
+    for (auto& listener : listeners_) {
+        auto it = std::find_if(wanted.begin(), wanted.end(), [&](const PortMapping& m) {
+            return m.listenPort == listener->mapping.listenPort;
+        });
+        if (it == wanted.end() || hostSkips(*it)) {
+            // Connections already accepted stay up; only new ones stop
+            boost::system::error_code ec;
+            listener->acceptor.close(ec);
+            std::cout << "Stopped listening on port " << listener->mapping.listenPort << std::endl;
+        } else {
+            listener->mapping = *it;
+            kept.push_back(listener);
+        }
+    }
+    listeners_ = std::move(kept);
+
+    std::vector<ListenerStatus> status;
+    for (const auto& mapping : wanted) {
+        if (hostSkips(mapping)) {
+            // Not a failure: the game server serves this port itself
+            continue;
+        }
+        ListenerStatus entry;
+        entry.mapping = mapping;
+        auto it = std::find_if(listeners_.begin(), listeners_.end(), [&](const std::shared_ptr<Listener>& l) {
+            return l->mapping.listenPort == mapping.listenPort;
+        });
+        if (it != listeners_.end()) {
+            entry.listening = true;
+        } else {
+            auto listener = std::make_shared<Listener>(io_context_, mapping);
+            if (openListener(*listener, entry.error)) {
+                entry.listening = true;
+                listeners_.push_back(listener);
+#ifdef STREAM_PIPELINE_COROUTINES
+                boost::asio::co_spawn(io_context_, acceptLoop(listener), boost::asio::detached);
+#else
+                start_accept(listener);
+#endif
+            }
+        }
+        status.push_back(entry);
+    }
+    std::lock_guard<std::mutex> lock(statusMutex_);
+    status_ = std::move(status);
 }
 
-void TCPServer::sendToAll(const char* data, size_t size, std::shared_ptr<tcp::socket> excludeSocket) {
-    std::lock_guard<std::mutex> lock(clientsMutex_);
-    for (auto& client : clients_) {
-        if (client != excludeSocket) {
-            boost::asio::async_write(*client, boost::asio::buffer(data, size), [](const boost::system::error_code&, std::size_t) {});
+bool TCPServer::openListener(Listener& listener, std::string& error) {
+    try {
+        // The host bridge serves only the host's own game, and must not take
+        // a port away from anything else bound there
+        bool host = manager_->isHost();
+        auto address = host ? boost::asio::ip::address_v4::loopback() : boost::asio::ip::address_v4::any();
+        tcp::endpoint endpoint(address, static_cast<unsigned short>(listener.mapping.listenPort));
+        listener.acceptor.open(endpoint.protocol());
+        if (!host) {
+            listener.acceptor.set_option(tcp::acceptor::reuse_address(true));
         }
+        listener.acceptor.bind(endpoint);
+        listener.acceptor.listen();
+        std::cout << "TCP server started on port " << listener.mapping.listenPort << std::endl;
+        return true;
+    } catch (const std::exception& e) {
+        std::cerr << "Failed to listen on port " << listener.mapping.listenPort << ": " << e.what() << std::endl;
+        error = e.what();
+        boost::system::error_code ec;
+        listener.acceptor.close(ec);
+        return false;
     }
 }
 
+void TCPServer::closeListeners() {
+    for (auto& listener : listeners_) {
+        boost::system::error_code ec;
+        listener->acceptor.close(ec);
+    }
+    listeners_.clear();
+}
+
+void TCPServer::setTunnelReady(bool ready) {
+    boost::asio::post(io_context_, [this, ready]() {
+        tunnelReady_ = ready;
+        if (ready) {
+            flushHeld();
+        } else {
+            closeHeld();
+        }
+    });
+}
+
+void TCPServer::flushHeld() {
+    if (held_.empty()) {
+        return;
+    }
+    auto now = std::chrono::steady_clock::now();
+    for (auto& client : held_) {
+        std::cout << "Releasing held client after "
+                  << std::chrono::duration_cast<std::chrono::milliseconds>(now - client.acceptedAt).count()
+                  << "ms" << std::endl;
+        if (client.socket->is_open()) {
+            auto conn = manager_->pickConnection(stripeKey(client.socket));
+            manager_->getMessageHandler()->getMultiplexManager(conn)->addClient(client.socket, &client.mapping);
+        }
+    }
+    held_.clear();
+    heldCount_ = 0;
+}
+
+void TCPServer::closeHeld() {
+    for (auto& client : held_) {
+        boost::system::error_code ec;
+        client.socket->close(ec);
+    }
+    held_.clear();
+    heldCount_ = 0;
+}
+
 int TCPServer::getClientCount() {
-    std::lock_guard<std::mutex> lock(clientsMutex_);
-    return clients_.size();
+    if (manager_->isHost()) {
+        return localStats_->active;
+    }
+    if (!manager_->isConnected()) {
+        return heldCount_;
+    }
+    // Streams are spread over the stripes when striping is on
+    int count = heldCount_;
+    for (const auto& stripe : manager_->getStripeHealth()) {
+        if (stripe.connected) {
+            count += manager_->getMessageHandler()->getMultiplexManager(stripe.conn)->getClientCount();
+        }
+    }
+    return count;
+}
+
+void TCPServer::onAccepted(std::shared_ptr<tcp::socket> socket, const PortMapping& mapping) {
+    TRACE_SPAN("TCPServer::accept");
+    if (manager_->isHost()) {
+        bridgeLocal(socket, mapping);
+    } else if (!tunnelReady_) {
+        // The game connected before the tunnel; it sees a normal connect
+        // and its first bytes wait in the socket buffer
+        std::cout << "New client connected, held until the tunnel is up" << std::endl;
+        held_.push_back(HeldClient{socket, mapping, std::chrono::steady_clock::now()});
+        heldCount_ = static_cast<int>(held_.size());
+    } else {
+        std::cout << "New client connected" << std::endl;
+        // The multiplexer's stream pipeline owns the socket from here on
+        auto conn = manager_->pickConnection(stripeKey(socket));
+        manager_->getMessageHandler()->getMultiplexManager(conn)->addClient(socket, &mapping);
+    }
 }
 
-void TCPServer::start_accept() {
+#ifdef STREAM_PIPELINE_COROUTINES
+boost::asio::awaitable<void> TCPServer::acceptLoop(std::shared_ptr<Listener> listener) {
+    while (running_) {
+        auto socket = std::make_shared<tcp::socket>(io_context_);
+        boost::system::error_code ec;
+        co_await listener->acceptor.async_accept(*socket, boost::asio::redirect_error(boost::asio::use_awaitable, ec));
+        if (ec == boost::asio::error::operation_aborted) {
+            co_return;
+        }
+        if (!ec) {
+            onAccepted(socket, listener->mapping);
+        }
+    }
+}
+#else
+void TCPServer::start_accept(std::shared_ptr<Listener> listener) {
     auto socket = std::make_shared<tcp::socket>(io_context_);
-    acceptor_.async_accept(*socket, [this, socket](const boost::system::error_code& error) {
+    listener->acceptor.async_accept(*socket, [this, socket, listener](const boost::system::error_code& error) {
+        if (error == boost::asio::error::operation_aborted || !listener->acceptor.is_open()) {
+            return;
+        }
         if (!error) {
-            std::cout << "New client connected" << std::endl;
-            auto multiplexManager = manager_->getMessageHandler()->getMultiplexManager(manager_->getConnection());
-            std::string id = multiplexManager->addClient(socket);
-            {
-                std::lock_guard<std::mutex> lock(clientsMutex_);
-                clients_.push_back(socket);
-            }
-            start_read(socket, id);
+            onAccepted(socket, listener->mapping);
         }
         if (running_) {
-            start_accept();
+            start_accept(listener);
         }
     });
 }
+#endif
 
-void TCPServer::start_read(std::shared_ptr<tcp::socket> socket, std::string id) {
-    auto buffer = std::make_shared<std::vector<char>>(1024);
-    socket->async_read_some(boost::asio::buffer(*buffer), [this, socket, buffer, id](const boost::system::error_code& error, std::size_t bytes_transferred) {
-        if (!error) {
-            if (manager_->isConnected()) {
-                auto multiplexManager = manager_->getMessageHandler()->getMultiplexManager(manager_->getConnection());
-                multiplexManager->sendTunnelPacket(id, buffer->data(), bytes_transferred, 0);
-            } else {
-                std::cout << "Not connected to Steam, skipping forward" << std::endl;
-            }
-            sendToAll(buffer->data(), bytes_transferred, socket);
-            start_read(socket, id);
-        } else {
-            std::cout << "TCP client " << id << " disconnected or error: " << error.message() << std::endl;
-            // Send disconnect packet
-            if (manager_->isConnected()) {
-                auto multiplexManager = manager_->getMessageHandler()->getMultiplexManager(manager_->getConnection());
-                multiplexManager->sendTunnelPacket(id, nullptr, 0, 1);
-                // Remove client
-                multiplexManager->removeClient(id);
-            }
-            std::lock_guard<std::mutex> lock(clientsMutex_);
-            clients_.erase(std::remove(clients_.begin(), clients_.end(), socket), clients_.end());
-        }
-    });
-}
\ No newline at end of file
+int TCPServer::hostTarget(const PortMapping& mapping) const {
+    int* localPort = manager_->getLocalPort();
+    return mapping.targetPort != 0 ? mapping.targetPort : (localPort ? *localPort : 0);
+}
+
+bool TCPServer::hostSkips(const PortMapping& mapping) const {
+    return manager_->isHost() && hostTarget(mapping) == mapping.listenPort;
+}
+
+void TCPServer::bridgeLocal(std::shared_ptr<tcp::socket> socket, const PortMapping& mapping) {
+    int target = hostTarget(mapping);
+    if (target <= 0 || target == mapping.listenPort) {
+        std::cerr << "Host-local client rejected: game port " << target << " is not usable" << std::endl;
+        boost::system::error_code ec;
+        socket->close(ec);
+        return;
+    }
+    std::cout << "Host-local client connected, bridged to port " << target
+              << " (" << LocalBridge::mechanism() << ")" << std::endl;
+    auto bridge = std::make_shared<LocalBridge>(socket, localStats_);
+    bridge->start(tcp::endpoint(boost::asio::ip::address_v4::loopback(), static_cast<unsigned short>(target)));
+}
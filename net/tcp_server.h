@@ -1,6 +1,8 @@
 #pragma once
 
 #include <boost/asio.hpp>
+#include <atomic>
+#include <chrono>
 #include <memory>
 #include <vector>
 #include <string>
@@ -11,34 +13,89 @@
 #include <isteamnetworkingutils.h>
 #include <steamnetworkingtypes.h>
 #include "multiplex_manager.h"
+#include "local_bridge.h"
 
 class SteamNetworkingManager;
 
 using boost::asio::ip::tcp;
 
-// TCP Server class
+// TCP Server class. Started when a join begins, so it listens while the lobby
+// join and P2P handshake run; connections accepted before the tunnel is up are
+// held and handed to the multiplexer once setTunnelReady(true) is called.
+// It listens on every port of the mapping table in effect, and each stream it
+// opens carries its mapping's target port. On the host it also listens, for
+// the host's own game client: those connections are bridged straight to the
+// target port and bypass the tunnel. Host listeners bind loopback only and skip
+// mappings whose target is the listen port, which the game server itself holds.
 class TCPServer {
 public:
-    TCPServer(int port, SteamNetworkingManager* manager);
+    struct ListenerStatus {
+        PortMapping mapping;
+        bool listening = false;
+        std::string error;
+    };
+
+    TCPServer(const PortMappingTable& mappings, SteamNetworkingManager* manager);
     ~TCPServer();
 
     bool start();
     void stop();
-    void sendToAll(const std::string& message, std::shared_ptr<tcp::socket> excludeSocket = nullptr);
-    void sendToAll(const char* data, size_t size, std::shared_ptr<tcp::socket> excludeSocket = nullptr);
     int getClientCount();
+    int getHeldCount() const { return heldCount_; }
+    // First listening port, for display
+    int getPort() const;
+    std::vector<ListenerStatus> getListenerStatus() const;
+    const LocalBridge::Stats& getLocalStats() const { return *localStats_; }
+
+    // Thread-safe; true flushes held connections, false closes them
+    void setTunnelReady(bool ready);
+    // Thread-safe; open and close listeners to match the table in effect
+    void syncMappings();
 
 private:
-    void start_accept();
-    void start_read(std::shared_ptr<tcp::socket> socket, std::string id);
+    struct Listener {
+        Listener(boost::asio::io_context& io, const PortMapping& mapping) : mapping(mapping), acceptor(io) {}
+        PortMapping mapping;
+        tcp::acceptor acceptor;
+    };
+
+    struct HeldClient {
+        std::shared_ptr<tcp::socket> socket;
+        PortMapping mapping;
+        std::chrono::steady_clock::time_point acceptedAt;
+    };
 
-    int port_;
+#ifdef STREAM_PIPELINE_COROUTINES
+    boost::asio::awaitable<void> acceptLoop(std::shared_ptr<Listener> listener);
+#else
+    void start_accept(std::shared_ptr<Listener> listener);
+#endif
+    void applyMappings();
+    bool openListener(Listener& listener, std::string& error);
+    void onAccepted(std::shared_ptr<tcp::socket> socket, const PortMapping& mapping);
+    void flushHeld();
+    void closeHeld();
+    void closeListeners();
+    void bridgeLocal(std::shared_ptr<tcp::socket> socket, const PortMapping& mapping);
+    // Port a host-local connection on this mapping is bridged to, 0 if none
+    int hostTarget(const PortMapping& mapping) const;
+    bool hostSkips(const PortMapping& mapping) const;
+
+    const PortMappingTable& mappings_;
     bool running_;
     boost::asio::io_context io_context_;
     boost::asio::executor_work_guard<boost::asio::io_context::executor_type> work_;
-    tcp::acceptor acceptor_;
-    std::vector<std::shared_ptr<tcp::socket>> clients_;
-    std::mutex clientsMutex_;
+    // io thread only once started
+    std::vector<std::shared_ptr<Listener>> listeners_;
+    mutable std::mutex statusMutex_;
+    std::vector<ListenerStatus> status_;
     std::thread serverThread_;
     SteamNetworkingManager* manager_;
+
+    // io thread only, except the count
+    bool tunnelReady_;
+    std::vector<HeldClient> held_;
+    std::atomic<int> heldCount_;
+    // Host-local connections; outlives the bridges still queued on io_context_
+    std::shared_ptr<LocalBridge::Stats> localStats_;
 };
\ No newline at end of file
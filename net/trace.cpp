@@ -0,0 +1,198 @@
+#include "trace.h"
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace trace
+{
+    std::atomic<bool> g_enabled{false};
+
+    namespace
+    {
+        struct Event
+        {
+            const char *name;
+            int64_t ts;
+            int64_t value; // duration for spans, value for counters
+            char phase;    // 'X' span, 'C' counter, 'i' instant
+        };
+
+        // Written only by its thread; the mutex is uncontended except while dumping
+        struct ThreadRing
+        {
+            std::mutex mutex;
+            std::vector<Event> events;
+            uint64_t written = 0;
+            uint32_t tid = 0;
+            std::string name;
+        };
+
+        std::mutex g_registryMutex;
+        std::vector<std::shared_ptr<ThreadRing>> g_rings;
+        const std::chrono::steady_clock::time_point g_epoch = std::chrono::steady_clock::now();
+
+        // Created on the thread's first event, so idle threads cost nothing.
+        // Rings outlive their threads so a dump still sees their events.
+        thread_local std::shared_ptr<ThreadRing> t_ring;
+        thread_local const char *t_threadName = nullptr;
+
+        ThreadRing &localRing()
+        {
+            if (!t_ring)
+            {
+                auto ring = std::make_shared<ThreadRing>();
+                ring->events.resize(kRingSize);
+                if (t_threadName)
+                {
+                    ring->name = t_threadName;
+                }
+                std::lock_guard<std::mutex> lock(g_registryMutex);
+                ring->tid = static_cast<uint32_t>(g_rings.size() + 1);
+                g_rings.push_back(ring);
+                t_ring = ring;
+            }
+            return *t_ring;
+        }
+
+        void record(const char *name, int64_t ts, int64_t value, char phase)
+        {
+            ThreadRing &ring = localRing();
+            std::lock_guard<std::mutex> lock(ring.mutex);
+            ring.events[ring.written % kRingSize] = Event{name, ts, value, phase};
+            ring.written++;
+        }
+
+        void writeEscaped(std::ostream &out, const std::string &text)
+        {
+            for (char c : text)
+            {
+                if (c == '"' || c == '\\')
+                {
+                    out << '\\';
+                }
+                out << c;
+            }
+        }
+    }
+
+    void setEnabled(bool on)
+    {
+        g_enabled.store(on, std::memory_order_relaxed);
+    }
+
+    int64_t now()
+    {
+        return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - g_epoch).count();
+    }
+
+    void complete(const char *name, int64_t start, int64_t duration)
+    {
+        record(name, start, duration, 'X');
+    }
+
+    void counter(const char *name, int64_t value)
+    {
+        record(name, now(), value, 'C');
+    }
+
+    void instant(const char *name)
+    {
+        record(name, now(), 0, 'i');
+    }
+
+    void setThreadName(const char *name)
+    {
+        t_threadName = name;
+        if (t_ring)
+        {
+            std::lock_guard<std::mutex> lock(t_ring->mutex);
+            t_ring->name = name;
+        }
+    }
+
+    size_t eventCount()
+    {
+        std::lock_guard<std::mutex> lock(g_registryMutex);
+        size_t total = 0;
+        for (auto &ring : g_rings)
+        {
+            std::lock_guard<std::mutex> ringLock(ring->mutex);
+            total += static_cast<size_t>(std::min<uint64_t>(ring->written, kRingSize));
+        }
+        return total;
+    }
+
+    bool writeChromeTrace(const std::string &path)
+    {
+        std::vector<std::shared_ptr<ThreadRing>> rings;
+        {
+            std::lock_guard<std::mutex> lock(g_registryMutex);
+            rings = g_rings;
+        }
+
+        std::ofstream out(path, std::ios::trunc);
+        if (!out)
+        {
+            return false;
+        }
+        out << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n";
+        bool first = true;
+        auto separator = [&]()
+        {
+            if (!first)
+            {
+                out << ",\n";
+            }
+            first = false;
+        };
+        for (auto &ring : rings)
+        {
+            // Copy out under the lock so the owning thread is blocked only briefly
+            std::vector<Event> events;
+            std::string threadName;
+            {
+                std::lock_guard<std::mutex> lock(ring->mutex);
+                uint64_t count = std::min<uint64_t>(ring->written, kRingSize);
+                events.reserve(static_cast<size_t>(count));
+                for (uint64_t i = ring->written - count; i < ring->written; ++i)
+                {
+                    events.push_back(ring->events[i % kRingSize]);
+                }
+                threadName = ring->name;
+            }
+            if (!threadName.empty())
+            {
+                separator();
+                out << "{\"ph\":\"M\",\"name\":\"thread_name\",\"pid\":1,\"tid\":" << ring->tid
+                    << ",\"args\":{\"name\":\"";
+                writeEscaped(out, threadName);
+                out << "\"}}";
+            }
+            for (const Event &e : events)
+            {
+                separator();
+                out << "{\"ph\":\"" << e.phase << "\",\"name\":\"";
+                writeEscaped(out, e.name);
+                out << "\",\"pid\":1,\"tid\":" << ring->tid << ",\"ts\":" << e.ts;
+                if (e.phase == 'X')
+                {
+                    out << ",\"dur\":" << e.value;
+                }
+                else if (e.phase == 'C')
+                {
+                    out << ",\"args\":{\"value\":" << e.value << "}";
+                }
+                else
+                {
+                    out << ",\"s\":\"t\"";
+                }
+                out << "}";
+            }
+        }
+        out << "\n]}\n";
+        return static_cast<bool>(out);
+    }
+}
@@ -0,0 +1,70 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+
+// Opt-in event tracing for the tunnel hot paths. Spans, counters and instant
+// events go into a fixed-size ring buffer per thread; writeChromeTrace() dumps
+// the most recent events as Chrome trace JSON, which chrome://tracing and
+// ui.perfetto.dev both open. When tracing is off every macro costs one relaxed
+// atomic load. Event names must be string literals (only the pointer is kept).
+namespace trace
+{
+    extern std::atomic<bool> g_enabled;
+
+    inline bool enabled() { return g_enabled.load(std::memory_order_relaxed); }
+    void setEnabled(bool on);
+
+    // Microseconds since the trace clock started
+    int64_t now();
+
+    void complete(const char *name, int64_t start, int64_t duration);
+    void counter(const char *name, int64_t value);
+    void instant(const char *name);
+    // Names the calling thread in the trace viewer (name must outlive the thread)
+    void setThreadName(const char *name);
+
+    // Write the buffered events of all threads; returns false if the file
+    // could not be written
+    bool writeChromeTrace(const std::string &path);
+    size_t eventCount();
+
+    // Events kept per thread; older ones are overwritten
+    constexpr size_t kRingSize = 64 * 1024;
+
+    class Span
+    {
+    public:
+        explicit Span(const char *name) : name_(name), start_(enabled() ? now() : -1) {}
+        ~Span()
+        {
+            if (start_ >= 0)
+            {
+                complete(name_, start_, now() - start_);
+            }
+        }
+        Span(const Span &) = delete;
+        Span &operator=(const Span &) = delete;
+
+    private:
+        const char *name_;
+        int64_t start_;
+    };
+}
+
+#define TRACE_CONCAT_INNER(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT_INNER(a, b)
+#define TRACE_SPAN(name) trace::Span TRACE_CONCAT(traceSpan_, __LINE__)(name)
+#define TRACE_COUNTER(name, value)                    \
+    do                                                \
+    {                                                 \
+        if (trace::enabled())                         \
+            trace::counter(name, static_cast<int64_t>(value)); \
+    } while (0)
+#define TRACE_INSTANT(name)         \
+    do                              \
+    {                               \
+        if (trace::enabled())       \
+            trace::instant(name);   \
+    } while (0)
@@ -0,0 +1,184 @@
+#include "tunnel_capture.h"
+#include "mapped_file.h"
+#include "tunnel_protocol.h"
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <ctime>
+#include <iostream>
+#include <mutex>
+
+namespace capture
+{
+    namespace detail
+    {
+        std::atomic<bool> g_active{false};
+    }
+
+    namespace
+    {
+        const char *const kKindNames[static_cast<size_t>(Kind::Count)] = {
+            "frame_in", "frame_out", "stream_accepted", "stream_connected", "stream_closed", "link_down", "link_up"};
+
+        std::mutex g_mutex;
+        MappedFile g_file;
+        size_t g_used = 0;
+        uint64_t g_records = 0;
+        bool g_headersOnly = false;
+        bool g_full = false;
+        std::string g_path;
+        std::chrono::steady_clock::time_point g_start;
+
+        // Caller holds g_mutex
+        void closeLocked()
+        {
+            detail::g_active = false;
+            g_file.close(g_used);
+        }
+
+        // Caller holds g_mutex; false once the capture had to stop
+        bool reserve(size_t need)
+        {
+            if (g_used + need <= g_file.size())
+            {
+                return true;
+            }
+            size_t size = g_file.size();
+            while (size < g_used + need)
+            {
+                size += std::min(size, kMaxGrowStep);
+            }
+            if (size > kMaxFileBytes || !g_file.grow(size))
+            {
+                std::cerr << "Capture " << g_path << " stopped at " << g_used / (1024 * 1024) << " MB" << std::endl;
+                g_full = true;
+                closeLocked();
+                return false;
+            }
+            return true;
+        }
+
+        void append(Kind kind, uint32_t conn, const void *data, size_t originalLength, bool isFrame)
+        {
+            std::lock_guard<std::mutex> lock(g_mutex);
+            if (!g_file.isOpen())
+            {
+                return;
+            }
+            size_t length = isFrame && g_headersOnly ? std::min(originalLength, tunnel::kHeaderSize) : originalLength;
+            size_t padded = (sizeof(RecordHeader) + length + 7) & ~static_cast<size_t>(7);
+            if (!reserve(padded))
+            {
+                return;
+            }
+            RecordHeader record = {};
+            record.timeUs = static_cast<uint64_t>(
+                std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - g_start)
+                    .count());
+            record.conn = conn;
+            record.kind = static_cast<uint16_t>(kind);
+            record.length = static_cast<uint32_t>(length);
+            record.originalLength = static_cast<uint32_t>(originalLength);
+            char *out = g_file.data() + g_used;
+            std::memcpy(out, &record, sizeof(record));
+            if (length > 0)
+            {
+                std::memcpy(out + sizeof(record), data, length);
+            }
+            std::memset(out + sizeof(record) + length, 0, padded - sizeof(record) - length);
+            g_used += padded;
+            g_records++;
+            FileHeader *header = reinterpret_cast<FileHeader *>(g_file.data());
+            header->records = g_records;
+            header->bytes = g_used - sizeof(FileHeader);
+        }
+    }
+
+    const char *kindName(Kind kind)
+    {
+        size_t index = static_cast<size_t>(kind);
+        return index < static_cast<size_t>(Kind::Count) ? kKindNames[index] : "?";
+    }
+
+    bool start(const std::string &path, bool isHost, bool headersOnly)
+    {
+        std::string name = path;
+        if (name.empty())
+        {
+            char buffer[64];
+            std::time_t now = std::time(nullptr);
+            std::strftime(buffer, sizeof(buffer), "connecttool-capture-%Y%m%d-%H%M%S.ctcap", std::localtime(&now));
+            name = buffer;
+        }
+        std::lock_guard<std::mutex> lock(g_mutex);
+        closeLocked();
+        g_path = name;
+        g_used = 0;
+        g_records = 0;
+        g_full = false;
+        if (!g_file.create(name, kInitialFileSize))
+        {
+            std::cerr << "Cannot create capture file " << name << std::endl;
+            return false;
+        }
+        FileHeader header = {};
+        std::memcpy(header.magic, kMagic, sizeof(header.magic));
+        header.version = kVersion;
+        header.flags = (isHost ? kFlagHost : 0) | (headersOnly ? kFlagHeadersOnly : 0);
+        header.recordHeaderSize = sizeof(RecordHeader);
+        header.startUnixUs =
+            std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::system_clock::now().time_since_epoch())
+                .count();
+        std::memcpy(g_file.data(), &header, sizeof(header));
+        g_used = sizeof(header);
+        g_headersOnly = headersOnly;
+        g_start = std::chrono::steady_clock::now();
+        detail::g_active = true;
+        std::cout << "Capturing tunnel traffic to " << name << std::endl;
+        return true;
+    }
+
+    void stop()
+    {
+        std::lock_guard<std::mutex> lock(g_mutex);
+        if (g_file.isOpen())
+        {
+            std::cout << "Capture " << g_path << ": " << g_records << " records, " << g_used / 1024 << " KB"
+                      << std::endl;
+        }
+        closeLocked();
+    }
+
+    Status status()
+    {
+        std::lock_guard<std::mutex> lock(g_mutex);
+        Status status;
+        status.active = g_file.isOpen();
+        status.full = g_full;
+        status.path = g_path;
+        status.records = g_records;
+        status.bytes = g_used;
+        return status;
+    }
+
+    void frame(Kind kind, uint32_t conn, const char *data, size_t len)
+    {
+        if (!active())
+        {
+            return;
+        }
+        append(kind, conn, data, len, true);
+    }
+
+    void event(Kind kind, uint32_t conn, const std::string &id, uint32_t value)
+    {
+        if (!active())
+        {
+            return;
+        }
+        Event payload = {};
+        std::memcpy(payload.id, id.data(), std::min(id.size(), sizeof(payload.id) - 1));
+        payload.value = value;
+        append(kind, conn, &payload, sizeof(payload), false);
+    }
+}
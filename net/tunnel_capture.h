@@ -0,0 +1,104 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+// Opt-in recording of tunnel traffic, for replaying real sessions through
+// tools/tunnel_replay.cpp. SteamMessageHandler records every frame it
+// receives and MultiplexManager every frame it hands to a connection, along
+// with stream and link lifecycle events, each with a timestamp and the
+// connection handle. Records are appended to a .ctcap file through a memory
+// mapping that grows as needed; the header's counts are updated with every
+// record, so a capture cut short by a crash can still be read.
+namespace capture
+{
+    enum class Kind : uint16_t
+    {
+        FrameIn = 0,     // frame received from the peer
+        FrameOut,        // frame handed to the connection
+        StreamAccepted,  // local connection accepted; value: target port
+        StreamConnected, // host side reached the game; value: 1 if connected
+        StreamClosed,    // stream ended locally; value: 1 if reset
+        LinkDown,        // session suspended
+        LinkUp,          // session attached to a new connection
+        Count,
+    };
+
+    const char *kindName(Kind kind);
+
+    struct Status
+    {
+        bool active = false;
+        bool full = false; // stopped at kMaxFileBytes or when the file could not grow
+        std::string path;
+        uint64_t records = 0;
+        uint64_t bytes = 0;
+    };
+
+    // Starts capturing into path, or connecttool-capture-<time>.ctcap in the
+    // working directory if empty; false if the file cannot be created.
+    // headersOnly keeps just the frame headers and payload lengths, enough
+    // to replay sizes and timing of long sessions.
+    bool start(const std::string &path, bool isHost, bool headersOnly);
+    void stop();
+    Status status();
+
+    namespace detail
+    {
+        extern std::atomic<bool> g_active;
+    }
+    // Checked on the hot paths before building a record
+    inline bool active()
+    {
+        return detail::g_active.load(std::memory_order_relaxed);
+    }
+
+    // Any thread; nothing happens unless a capture runs
+    void frame(Kind kind, uint32_t conn, const char *data, size_t len);
+    void event(Kind kind, uint32_t conn, const std::string &id, uint32_t value = 0);
+
+    constexpr size_t kInitialFileSize = 16 * 1024 * 1024;
+    constexpr size_t kMaxGrowStep = 256 * 1024 * 1024;
+    constexpr uint64_t kMaxFileBytes = 2ull * 1024 * 1024 * 1024;
+
+    // File: FileHeader, then records, each a RecordHeader followed by length
+    // bytes and padded to a multiple of 8; little endian
+    constexpr char kMagic[4] = {'C', 'T', 'C', 'P'};
+    constexpr uint32_t kVersion = 1;
+
+    // FileHeader::flags
+    constexpr uint32_t kFlagHost = 1;        // captured on the host
+    constexpr uint32_t kFlagHeadersOnly = 2; // frames cut after the tunnel header
+
+    struct FileHeader
+    {
+        char magic[4];
+        uint32_t version;
+        uint32_t flags;
+        uint32_t recordHeaderSize;
+        int64_t startUnixUs; // wall clock at record time 0
+        uint64_t records;
+        uint64_t bytes; // of records, after this header
+    };
+
+    struct RecordHeader
+    {
+        uint64_t timeUs; // since the capture started
+        uint32_t conn;
+        uint16_t kind;
+        uint16_t reserved;
+        uint32_t length;         // bytes stored after this header
+        uint32_t originalLength; // frame size before headersOnly cut it
+    };
+    static_assert(sizeof(RecordHeader) == 24, "capture record headers are 24 bytes");
+
+    // Payload of the lifecycle records
+    struct Event
+    {
+        char id[8]; // stream id, null terminated; empty for link events
+        uint32_t value;
+        uint32_t reserved;
+    };
+}
@@ -0,0 +1,224 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <string>
+
+// Tunnel frame layout shared by both peers:
+//   char     id[7];   // 6-char stream id + null terminator
+//   uint32_t type;    // TunnelFrameType
+//   char     payload[]; // only for data frames
+//
+// Stream lifecycle: the client sends OPEN as soon as a local connection is
+// accepted and may follow it with data right away; the host connects to the
+// game in the background, queues data until then and answers OPEN_ACK. FIN
+// closes one direction after all of its data (TCP half-close); a stream ends
+// once both sides have sent FIN. RESET aborts both directions immediately.
+// Hosts still accept data for an unknown id as an implicit OPEN from peers
+// that have never sent OPEN or SESSION (version 1); from anyone else it is
+// late data of a stream that was reset, and is dropped.
+// Since version 4 OPEN may carry a uint32 target port from the host's port
+// mapping table; without it the host connects to its default game port.
+//
+// Session resumption (version 3): the client opens every connection with a
+// SESSION hello carrying a session id; a host that answers keeps the session.
+// Both sides count the stream frames (DATA, OPEN, OPEN_ACK, FIN, RESET) they
+// receive per stream and return the count in ACK frames; the sender keeps
+// every frame until it is acknowledged. When the Steam connection drops, both
+// sides hold their streams for kResumeGrace. The client reconnects and sends
+// SESSION resume, then one RESUME per stream with its received count, then
+// RESUME_DONE. The host answers RESUME with its own count, or RESET for
+// streams it no longer has, drops streams the client did not mention, and
+// ends with RESUME_DONE. Each side then resends its frames from the count the
+// other side reported, so the streams continue where they stopped.
+// ACK, SESSION, RESUME and RESUME_DONE are not counted and never resent.
+//
+// Speed test (version 5, speed_test.h) runs on the reserved stream id
+// kSpeedTestId, which nanoid never generates. SPEED_CONTROL frames carry a
+// SpeedControl; the side under test fills the link with SPEED_DATA while the
+// initiator sends PING frames unreliably and the peer echoes them as PONG, so
+// RTT under load and loss can be measured. None of these frames are counted.
+//
+// Version 6: a stream whose port mapping enables delta coding sends its data
+// as DELTA frames instead of DATA (delta_codec.h). They are counted, resent
+// and acknowledged like DATA; only the sending side needs the setting. The
+// client's SESSION hello carries a SessionFeature mask after its kind, which
+// older hosts ignore; a host sends DELTA only to clients that set
+// kFeatureDelta. A client sees the setting only in a version 6+ host's table.
+//
+// Version 7: backup path. A client may open a second connection to the host
+// (another route, see MultiplexManager) and send SESSION pair on it with the
+// id of its main connection's session; the host answers SESSION paired. From
+// then on both sides copy small DATA/DELTA frames of latency-critical streams
+// onto the backup as DUPLICATE frames, sent unreliable. A DUPLICATE carries
+// the frame's position among the stream's counted frames on the main
+// connection, so the receiver delivers whichever copy comes first and drops
+// the other. Nothing on the backup is counted or acknowledged.
+//
+// Version 8: latency decomposition (stream_timing.h). A side that wants to
+// see where its inbound data spends time sends CLOCK requests (unreliable, on
+// the reserved id kClockId) a few times a second; the peer answers each one
+// with its own receive and send times, which gives the requester the offset
+// between the two clocks. While requests keep coming the peer follows some of
+// its DATA/DELTA frames with a TIMING frame on the same stream, carrying when
+// that frame was read from the local socket, entered the send scheduler and
+// was handed to Steam, and Steam's own estimate of its queueing delay. TIMING
+// describes the stream's previous data frame; neither frame is counted.
+namespace tunnel
+{
+    // Advertised in lobby data so clients can tell what a host supports
+    constexpr int kProtocolVersion = 8;
+    constexpr const char *kCapabilities = "mux,drr,lifecycle,resume,ports,speedtest,delta,dual,timing";
+
+    constexpr size_t kIdLength = 6;
+    constexpr size_t kIdFieldSize = kIdLength + 1;
+    constexpr size_t kHeaderSize = kIdFieldSize + sizeof(uint32_t);
+
+    enum FrameType : uint32_t
+    {
+        kFrameData = 0,
+        kFrameReset = 1, // "close" in version 1, which also dropped in-flight data
+        kFrameOpen = 2,       // payload (optional): uint32 target port
+        kFrameOpenAck = 3,
+        kFrameFin = 4,
+        kFrameAck = 5,        // payload: uint64 frames received on this stream
+        kFrameSession = 6,    // id: session id, payload: uint32 SessionKind
+        kFrameResume = 7,     // payload: uint64 frames received on this stream
+        kFrameResumeDone = 8, // id: session id
+        kFrameSpeedControl = 9, // payload: SpeedControl
+        kFrameSpeedData = 10,   // payload: filler
+        kFramePing = 11,        // payload: SpeedPing, sent unreliable
+        kFramePong = 12,        // payload: the SpeedPing echoed
+        kFrameDelta = 13,       // payload: delta-coded data (delta_codec.h)
+        kFrameDuplicate = 14,   // backup path only; payload: uint64 position, the frame
+        kFrameTiming = 15,      // payload: TimingStamp for the stream's previous data frame
+        kFrameClock = 16,       // id: kClockId, payload: ClockSync, sent unreliable
+    };
+
+    enum SessionKind : uint32_t
+    {
+        kSessionHello = 0,    // client: new session
+        kSessionHelloAck = 1, // host: session kept, resumption enabled
+        kSessionResume = 2,   // client: continue this session
+        kSessionResumed = 3,  // host: found it, RESUME frames follow
+        kSessionUnknown = 4,  // host: no such session, start over
+        kSessionPair = 5,     // client, on a backup connection: carries copies for this session
+        kSessionPaired = 6,   // host: backup accepted
+    };
+
+    // SESSION hello payload from version 6; earlier clients send the kind alone
+    struct SessionHello
+    {
+        uint32_t kind;
+        uint32_t features; // SessionFeature
+    };
+
+    enum SessionFeature : uint32_t
+    {
+        kFeatureDelta = 1, // decodes DELTA frames
+    };
+
+    constexpr const char *kSpeedTestId = "~speed";
+
+    enum SpeedControlKind : uint32_t
+    {
+        kSpeedUploadBegin = 0,     // initiator: SPEED_DATA follows
+        kSpeedUploadEnd = 1,       // initiator: after the last SPEED_DATA
+        kSpeedReport = 2,          // peer: bytes and elapsedUs it received
+        kSpeedDownloadRequest = 3, // initiator: send to me for durationMs
+        kSpeedDownloadEnd = 4,     // peer: after the last SPEED_DATA
+    };
+
+    struct SpeedControl
+    {
+        uint32_t kind;
+        uint32_t durationMs;
+        uint64_t bytes;
+        uint64_t elapsedUs;
+    };
+
+    struct SpeedPing
+    {
+        uint32_t seq;
+        uint32_t phase;
+        uint64_t sentUs; // initiator's clock
+    };
+
+    constexpr const char *kClockId = "~clock";
+
+    enum ClockSyncKind : uint32_t
+    {
+        kClockRequest = 0, // also asks the peer to send TIMING frames for a while
+        kClockReply = 1,
+    };
+
+    // Times in microseconds of the clock of the side that took them
+    struct ClockSync
+    {
+        uint32_t kind;
+        uint32_t reserved;
+        int64_t originUs;  // requester: request sent
+        int64_t receiveUs; // peer: request received
+        int64_t replyUs;   // peer: reply sent
+    };
+
+    // Sender's clock, microseconds
+    struct TimingStamp
+    {
+        int64_t readUs;       // read from the local socket
+        int64_t queuedUs;     // entered the send scheduler
+        int64_t sentUs;       // handed to the connection
+        int64_t steamQueueUs; // connection's estimate of the wait before the wire
+    };
+
+    // Frames that take part in the per-stream count
+    inline bool isCountedFrame(uint32_t type)
+    {
+        return type <= kFrameFin || type == kFrameDelta;
+    }
+
+    // DATA or DELTA: stream payload, subject to the resume window
+    inline bool isDataFrame(uint32_t type)
+    {
+        return type == kFrameData || type == kFrameDelta;
+    }
+
+    // How long a dropped session is kept for the client to come back
+    constexpr std::chrono::seconds kResumeGrace{30};
+    // How long a client waits for the host to answer SESSION hello before it
+    // takes the host for one without resumption (version 2 or older)
+    constexpr std::chrono::seconds kSessionAnswerTimeout{3};
+
+    inline void writeHeader(char *out, const std::string &id, uint32_t type)
+    {
+        std::memset(out, 0, kIdFieldSize);
+        std::memcpy(out, id.data(), std::min(id.size(), kIdLength));
+        std::memcpy(out + kIdFieldSize, &type, sizeof(type));
+    }
+
+    inline uint32_t readType(const char *frame)
+    {
+        uint32_t type;
+        std::memcpy(&type, frame + kIdFieldSize, sizeof(type));
+        return type;
+    }
+
+    inline std::string readId(const char *frame)
+    {
+        return std::string(frame, kIdLength);
+    }
+
+    // Fixed-size payload after the header; false if the frame is too short
+    template <typename T>
+    inline bool readPayload(const char *frame, size_t len, T &out)
+    {
+        if (len < kHeaderSize + sizeof(T))
+        {
+            return false;
+        }
+        std::memcpy(&out, frame + kHeaderSize, sizeof(T));
+        return true;
+    }
+}
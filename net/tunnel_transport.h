@@ -0,0 +1,28 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <steamnetworkingtypes.h>
+
+// Message transport underneath MultiplexManager and SteamMessageHandler.
+// SteamTunnelTransport forwards to ISteamNetworkingSockets; EmulatedTransport
+// stands in for it in headless benchmarks.
+class TunnelTransport
+{
+public:
+    using MessageHandler = std::function<void(const char *data, size_t len)>;
+
+    virtual ~TunnelTransport() = default;
+
+    virtual EResult sendMessage(HSteamNetConnection conn, const void *data, uint32 len, int sendFlags) = 0;
+    // Hands up to maxMessages received messages to handler; returns how many
+    virtual int receiveMessages(HSteamNetConnection conn, int maxMessages, const MessageHandler &handler) = 0;
+    virtual bool getRealTimeStatus(HSteamNetConnection conn, SteamNetConnectionRealTimeStatus_t &status) = 0;
+    // While a receiveMessages() handler runs: how long its message had waited
+    // to be picked up, in microseconds; -1 if the transport cannot tell
+    virtual int64_t receivedAgeUs() const { return -1; }
+    // SteamID of the peer at the other end of conn, 0 if unknown. Emulated
+    // links all have the same peer.
+    virtual uint64 remotePeer(HSteamNetConnection conn) { return 0; }
+};
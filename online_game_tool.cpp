@@ -1,18 +1,29 @@
-﻿#include "steam/steam_networking_manager.h"
+﻿#include "steam/steam_network_thread.h"
+#include "steam/steam_networking_manager.h"
 #include "steam/steam_room_manager.h"
-#include "steam/steam_utils.h"
+#include "read_buffer_pool.h"
 #include "tcp_server.h"
+#include "trace.h"
+#include "mem_tracker.h"
+#include "flight_recorder.h"
+#include "tunnel_capture.h"
 #include <GLFW/glfw3.h>
 #include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <ctime>
 #include <boost/asio.hpp>
 #include <cstring>
 #include <filesystem>
+#include <future>
 #include <fstream>
+#include <iomanip>
 #include <imgui.h>
 #include <imgui_impl_glfw.h>
 #include <imgui_impl_opengl3.h>
 #include <iostream>
 #include <map>
+#include <sstream>
 #include <memory>
 #include <mutex>
 #include <string>
@@ -31,11 +42,11 @@
 
 using boost::asio::ip::tcp;
 
-// New variables for multiple connections and TCP clients
-std::vector<HSteamNetConnection> connections;
-std::mutex connectionsMutex; // Add mutex for connections
+// TCP forwarding state; the server is created and destroyed on the network thread
 int localPort = 0;
 std::unique_ptr<TCPServer> server;
+// Listen port -> host port table, edited in the UI and published by hosts
+PortMappingTable portMappings("port_mappings.txt");
 
 #ifdef _WIN32
 // Windows implementation using mutex and shared memory
@@ -175,38 +186,142 @@ void cleanupSingleInstance() {
 }
 #endif
 
+using StartupClock = std::chrono::steady_clock;
+
+// Startup timing breakdown, printed as each step finishes (steps may run on
+// different threads)
+struct StartupTimer {
+  StartupClock::time_point origin = StartupClock::now();
+
+  // Logs the step that began at 'begin'; returns now for the next step
+  StartupClock::time_point step(const char *name,
+                                StartupClock::time_point begin) const {
+    auto now = StartupClock::now();
+    auto ms = [](StartupClock::duration d) {
+      return std::chrono::duration<double, std::milli>(d).count();
+    };
+    std::ostringstream line;
+    line << std::fixed << std::setprecision(1) << "[startup] " << name << ": "
+         << ms(now - begin) << " ms (at " << ms(now - origin) << " ms)";
+    std::cout << line.str() << std::endl;
+    return now;
+  }
+};
+
+// Loads font.ttf into a standalone atlas off the main thread, before any ImGui
+// context exists. With ImGui 1.92+ glyphs are rasterized lazily as they are
+// first drawn, so only the file is read here; older versions bake the whole
+// Simplified Chinese range now, in parallel with Steam and window setup.
+ImFontAtlas *buildFontAtlas() {
+  ImFontAtlas *atlas = IM_NEW(ImFontAtlas)();
+  std::ifstream file("font.ttf", std::ios::binary | std::ios::ate);
+  std::streamsize size = file ? static_cast<std::streamsize>(file.tellg()) : 0;
+  if (size <= 0) {
+    std::cerr << "font.ttf not found, using the default font" << std::endl;
+    atlas->AddFontDefault();
+    return atlas;
+  }
+  // The atlas takes ownership of the buffer
+  void *data = IM_ALLOC(static_cast<size_t>(size));
+  file.seekg(0);
+  file.read(static_cast<char *>(data), size);
+#if IMGUI_VERSION_NUM >= 19200
+  atlas->AddFontFromMemoryTTF(data, static_cast<int>(size), 18.0f);
+#else
+  atlas->AddFontFromMemoryTTF(data, static_cast<int>(size), 18.0f, nullptr,
+                              atlas->GetGlyphRangesChineseSimplifiedCommon());
+  atlas->Build();
+#endif
+  return atlas;
+}
+
 int main() {
+  StartupTimer startup;
+  auto stepBegin = startup.origin;
+
   // Check for single instance
   if (!checkSingleInstance()) {
     std::cout << "另一个实例已在运行，正在激活该窗口..." << std::endl;
     return 0;
   }
 
-  // Initialize Steam API first
-  if (!SteamAPI_Init()) {
-    std::cerr << "Failed to initialize Steam API" << std::endl;
-    return 1;
-  }
+  stepBegin = startup.step("single instance check", stepBegin);
 
-  boost::asio::io_context io_context;
-  auto work_guard = boost::asio::make_work_guard(io_context);
-  std::thread io_thread([&io_context]() { io_context.run(); });
+  // CONNECTTOOL_TRACE=1 starts recording before anything else runs
+  const char *traceEnv = std::getenv("CONNECTTOOL_TRACE");
+  if (traceEnv && std::strcmp(traceEnv, "0") != 0) {
+    trace::setEnabled(true);
+  }
+  trace::setThreadName("render");
+  memtrack::setThreadTag(memtrack::Tag::Ui);
+  // Before the font atlas starts allocating on its own thread
+  if (memtrack::available()) {
+    ImGui::SetAllocatorFunctions(
+        [](size_t size, void *) {
+          return memtrack::allocate(size, memtrack::Tag::Ui);
+        },
+        [](void *ptr, void *) { memtrack::release(ptr); });
+  }
 
-  // Initialize Steam Networking Manager
+  // Steam init and the font atlas do not depend on the window or on each
+  // other, so they run in the background while GLFW sets up
   SteamNetworkingManager steamManager;
-  if (!steamManager.initialize()) {
-    std::cerr << "Failed to initialize Steam Networking Manager" << std::endl;
-    SteamAPI_Shutdown();
-    return 1;
-  }
+  std::unique_ptr<SteamRoomManager> roomManagerOwner;
+  std::future<bool> steamReady = std::async(std::launch::async, [&]() {
+    auto begin = StartupClock::now();
+    if (!SteamAPI_Init()) {
+      std::cerr << "Failed to initialize Steam API" << std::endl;
+      return false;
+    }
+    begin = startup.step("SteamAPI_Init", begin);
+    // Initialize Steam Networking Manager
+    if (!steamManager.initialize()) {
+      std::cerr << "Failed to initialize Steam Networking Manager" << std::endl;
+      SteamAPI_Shutdown();
+      return false;
+    }
+    // Initialize Steam Room Manager
+    roomManagerOwner = std::make_unique<SteamRoomManager>(&steamManager);
+    startup.step("Steam networking", begin);
+    return true;
+  });
+  std::future<ImFontAtlas *> fontReady =
+      std::async(std::launch::async, [&startup]() {
+        auto begin = StartupClock::now();
+        ImFontAtlas *atlas = buildFontAtlas();
+        startup.step("font atlas", begin);
+        return atlas;
+      });
 
-  // Initialize Steam Room Manager
-  SteamRoomManager roomManager(&steamManager);
+  boost::asio::io_context io_context;
+  auto work_guard = boost::asio::make_work_guard(io_context);
+  ReadBufferPool::install(io_context);
+  std::cout << "Local socket backend: " << ReadBufferPool::backendName()
+            << std::endl;
+  std::thread io_thread([&io_context]() {
+    trace::setThreadName("io");
+    memtrack::setThreadTag(memtrack::Tag::Multiplex);
+    io_context.run();
+  });
+  // Stop io_context and join thread; also used by the early-exit paths below,
+  // since a still-joinable std::thread would terminate on return
+  auto stopIoThread = [&]() {
+    work_guard.reset();
+    io_context.stop();
+    if (io_thread.joinable()) {
+      io_thread.join();
+    }
+    ReadBufferPool::uninstall(io_context);
+  };
 
   // Initialize GLFW
   if (!glfwInit()) {
     std::cerr << "Failed to initialize GLFW" << std::endl;
-    steamManager.shutdown();
+    if (steamReady.get()) {
+      steamManager.shutdown();
+    }
+    IM_DELETE(fontReady.get());
+    stopIoThread();
     return -1;
   }
 
@@ -216,6 +331,8 @@ int main() {
   glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE); // 3.2+ only
   glfwWindowHint(GLFW_OPENGL_FORWARD_COMPAT, GL_TRUE); // Required on Mac
 #endif
+  // Shown once Steam is up, so a failed start never flashes a window
+  glfwWindowHint(GLFW_VISIBLE, GLFW_FALSE);
 
   // Create window
   GLFWwindow *window =
@@ -224,7 +341,11 @@ int main() {
     std::cerr << "Failed to create GLFW window" << std::endl;
     glfwTerminate();
     cleanupSingleInstance();
-    SteamAPI_Shutdown();
+    if (steamReady.get()) {
+      SteamAPI_Shutdown();
+    }
+    IM_DELETE(fontReady.get());
+    stopIoThread();
     return -1;
   }
   glfwMakeContextCurrent(window);
@@ -232,16 +353,15 @@ int main() {
 
   // Store window handle for single instance activation
   storeWindowHandle(window);
+  stepBegin = startup.step("window", stepBegin);
 
-  // Initialize ImGui
+  // Initialize ImGui on the prebuilt atlas. The context does not own a shared
+  // atlas, so it is deleted after DestroyContext.
+  ImFontAtlas *fontAtlas = fontReady.get();
   IMGUI_CHECKVERSION();
-  ImGui::CreateContext();
+  ImGui::CreateContext(fontAtlas);
   ImGuiIO &io = ImGui::GetIO();
   (void)io;
-  // Load Chinese font
-  io.Fonts->AddFontFromFileTTF(
-      "font.ttf", 18.0f, nullptr,
-      io.Fonts->GetGlyphRangesChineseSimplifiedCommon());
   ImGui::StyleColorsDark();
 
   // Initialize ImGui backends
@@ -251,56 +371,117 @@ int main() {
   glsl_version = "#version 150";
 #endif
   ImGui_ImplOpenGL3_Init(glsl_version);
+  stepBegin = startup.step("ImGui", stepBegin);
+
+  if (!steamReady.get()) {
+    ImGui_ImplOpenGL3_Shutdown();
+    ImGui_ImplGlfw_Shutdown();
+    ImGui::DestroyContext();
+    IM_DELETE(fontAtlas);
+    glfwDestroyWindow(window);
+    glfwTerminate();
+    cleanupSingleInstance();
+    stopIoThread();
+    return 1;
+  }
+  SteamRoomManager &roomManager = *roomManagerOwner;
+  stepBegin = startup.step("wait for Steam", stepBegin);
+  glfwShowWindow(window);
 
   // Set message handler dependencies
-  steamManager.setMessageHandlerDependencies(io_context, server, localPort);
+  portMappings.load();
+  steamManager.setMessageHandlerDependencies(io_context, server, localPort,
+                                             portMappings);
   steamManager.startMessageHandler();
 
-  // Steam Networking variables
-  bool isHost = false;
-  bool isClient = false;
+  // All Steam calls from here on happen on the network thread
+  SteamNetworkThread netThread(&steamManager, &roomManager);
+  netThread.start();
+
+  // UI state
   char joinBuffer[256] = "";
   char filterBuffer[256] = "";
+  int lobbyMaxPing = 0;
 
-  // Lambda to get connection info for a member
-  auto getMemberConnectionInfo =
-      [&](const CSteamID &memberID,
-          const CSteamID &hostSteamID) -> std::pair<int, std::string> {
-    int ping = 0;
-    std::string relayInfo = "-";
-
-    if (steamManager.isHost()) {
-      // Find connection for this member
-      std::lock_guard<std::mutex> lockConn(connectionsMutex);
-      for (const auto &conn : steamManager.getConnections()) {
-        SteamNetConnectionInfo_t info;
-        if (steamManager.getInterface()->GetConnectionInfo(conn, &info)) {
-          if (info.m_identityRemote.GetSteamID() == memberID) {
-            ping = steamManager.getConnectionPing(conn);
-            relayInfo = steamManager.getConnectionRelayInfo(conn);
-            break;
-          }
+  // Format one path measurement for the room status window
+  auto formatPath = [](const PathMeasurement &m) -> std::string {
+    if (!m.valid()) {
+      return "-";
+    }
+    char buf[64];
+    std::snprintf(buf, sizeof(buf), "%dms/%.1f%%%s", m.ping, m.loss * 100.0f,
+                  m.estimated ? "(估)" : "");
+    return buf;
+  };
+
+  // One line of join phase times (ms since the join click)
+  auto renderJoinPhases = [](const JoinPhases &phases) {
+    auto phase = [](int ms) {
+      return ms >= 0 ? std::to_string(ms) : std::string("-");
+    };
+    ImGui::Text("监听 %s / 进入大厅 %s / 发起连接 %s / 寻路 %s / 建立连接 %s ms",
+                phase(phases.listenerReadyMs).c_str(),
+                phase(phases.lobbyEnteredMs).c_str(),
+                phase(phases.connectStartedMs).c_str(),
+                phase(phases.findingRouteMs).c_str(),
+                phase(phases.connectedMs).c_str());
+  };
+
+  // Lambda to render the lobby browser, ranked by estimated host ping
+  auto renderLobbyBrowser = [&](const NetworkSnapshot &snap) {
+    if (ImGui::Button("搜索房间")) {
+      netThread.post([&roomManager]() { roomManager.searchLobbies(true); });
+    }
+    ImGui::SameLine();
+    if (ImGui::Button("加入最低延迟房间")) {
+      netThread.post([&roomManager]() { roomManager.joinBestLobby(); });
+    }
+    if (ImGui::SliderInt("最大延迟 (ms, 0=不限)", &lobbyMaxPing, 0, 500)) {
+      int maxPing = lobbyMaxPing;
+      netThread.post([&roomManager, maxPing]() {
+        roomManager.setMaxPing(maxPing);
+        roomManager.searchLobbies();
+      });
+    }
+    if (snap.lobbies.empty()) {
+      ImGui::TextDisabled("没有找到房间");
+      return;
+    }
+    if (ImGui::BeginTable("LobbyTable", 3,
+                          ImGuiTableFlags_Borders | ImGuiTableFlags_RowBg)) {
+      ImGui::TableSetupColumn("主持");
+      ImGui::TableSetupColumn("预估延迟 (ms)");
+      ImGui::TableSetupColumn("");
+      ImGui::TableHeadersRow();
+      for (const auto &lobby : snap.lobbies) {
+        ImGui::TableNextRow();
+        ImGui::TableNextColumn();
+        ImGui::Text("%s", lobby.hostName.empty() ? "?" : lobby.hostName.c_str());
+        ImGui::TableNextColumn();
+        if (lobby.estimatedPing >= 0) {
+          ImGui::Text("%d", lobby.estimatedPing);
+        } else {
+          ImGui::Text("-");
         }
-      }
-    } else {
-      // Client only shows ping to host, not to other clients
-      if (memberID == hostSteamID) {
-        ping = steamManager.getHostPing();
-        if (steamManager.getConnection() != k_HSteamNetConnection_Invalid) {
-          relayInfo =
-              steamManager.getConnectionRelayInfo(steamManager.getConnection());
+        ImGui::TableNextColumn();
+        ImGui::PushID(static_cast<int>(lobby.lobbyID.ConvertToUint64()));
+        if (ImGui::Button("加入")) {
+          CSteamID lobbyID = lobby.lobbyID;
+          netThread.post([&roomManager, lobbyID]() {
+            roomManager.joinLobby(lobbyID);
+          });
         }
+        ImGui::PopID();
       }
+      ImGui::EndTable();
     }
-
-    return {ping, relayInfo};
   };
 
   // Lambda to render invite friends UI
-  auto renderInviteFriends = [&]() {
+  auto renderInviteFriends = [&](const NetworkSnapshot &snap) {
     ImGui::InputText("过滤朋友", filterBuffer, IM_ARRAYSIZE(filterBuffer));
     ImGui::Text("朋友:");
-    for (const auto &friendPair : SteamUtils::getFriendsList()) {
+    for (const auto &friendPair : snap.friends) {
       std::string nameStr = friendPair.second;
       std::string filterStr(filterBuffer);
       // Convert to lowercase for case-insensitive search
@@ -312,25 +493,434 @@ int main() {
         ImGui::PushID(friendPair.first.ConvertToUint64());
         if (ImGui::Button(("邀请 " + friendPair.second).c_str())) {
           // Send invite via Steam to lobby
-          if (SteamMatchmaking()) {
-            SteamMatchmaking()->InviteUserToLobby(roomManager.getCurrentLobby(),
-                                                  friendPair.first);
-            std::cout << "Sent lobby invite to " << friendPair.second
-                      << std::endl;
-          } else {
-            std::cerr << "SteamMatchmaking() is null! Cannot send invite."
-                      << std::endl;
-          }
+          CSteamID friendID = friendPair.first;
+          std::string friendName = friendPair.second;
+          netThread.post([&roomManager, friendID, friendName]() {
+            if (SteamMatchmaking()) {
+              SteamMatchmaking()->InviteUserToLobby(
+                  roomManager.getCurrentLobby(), friendID);
+              std::cout << "Sent lobby invite to " << friendName << std::endl;
+            } else {
+              std::cerr << "SteamMatchmaking() is null! Cannot send invite."
+                        << std::endl;
+            }
+          });
         }
         ImGui::PopID();
       }
     }
   };
 
+  // Port mapping editor rows; copied into the table on apply
+  struct MappingRow {
+    int listen;
+    int target;
+    int cls;
+    int weight;
+    char name[32];
+    bool delta;
+  };
+  std::vector<MappingRow> mappingRows;
+  for (const auto &m : portMappings.getLocal()) {
+    MappingRow row{m.listenPort, m.targetPort, static_cast<int>(m.trafficClass),
+                   m.weight, {}, m.delta};
+    std::snprintf(row.name, sizeof(row.name), "%s", m.name.c_str());
+    mappingRows.push_back(row);
+  }
+  std::string mappingStatus;
+
+  int stripeCount = 1;
+  int stripePolicy = static_cast<int>(StripePolicy::Load);
+  auto renderStriping = [&](const NetworkSnapshot &snap) {
+    const char *policyNames[] = {"按负载", "按来源端口"};
+    bool changed = ImGui::SliderInt("连接数", &stripeCount, 1,
+                                    StripeSet::kMaxStripes);
+    changed |= ImGui::Combo("分配方式", &stripePolicy, policyNames,
+                            IM_ARRAYSIZE(policyNames));
+    if (changed) {
+      int count = stripeCount;
+      StripePolicy policy = static_cast<StripePolicy>(stripePolicy);
+      netThread.post([&steamManager, count, policy]() {
+        steamManager.setStriping(count, policy);
+      });
+    }
+    ImGui::TextDisabled("加入房间时与房主建立多条连接，新的游戏连接分散到各条上;"
+                        " 已有的游戏连接留在原来的连接上");
+    if (snap.isHost || snap.stripes.size() <= 1) {
+      return;
+    }
+    if (ImGui::BeginTable("StripeTable", 8,
+                          ImGuiTableFlags_Borders | ImGuiTableFlags_RowBg)) {
+      ImGui::TableSetupColumn("虚拟端口");
+      ImGui::TableSetupColumn("状态");
+      ImGui::TableSetupColumn("延迟 (ms)");
+      ImGui::TableSetupColumn("排队 (ms)");
+      ImGui::TableSetupColumn("待发 (KB)");
+      ImGui::TableSetupColumn("丢包");
+      ImGui::TableSetupColumn("连接数 / 累计");
+      ImGui::TableSetupColumn("原因");
+      ImGui::TableHeadersRow();
+      for (const auto &stripe : snap.stripes) {
+        ImGui::TableNextRow();
+        ImGui::TableNextColumn();
+        ImGui::Text("%d", stripe.virtualPort);
+        ImGui::TableNextColumn();
+        if (!stripe.connected) {
+          ImGui::TextDisabled("未连接");
+        } else if (stripe.healthy) {
+          ImGui::Text("正常");
+        } else {
+          ImGui::TextColored(ImVec4(1.0f, 0.6f, 0.2f, 1.0f), "避开");
+        }
+        ImGui::TableNextColumn();
+        ImGui::Text("%d", stripe.ping);
+        ImGui::TableNextColumn();
+        ImGui::Text("%d", stripe.queueMs);
+        ImGui::TableNextColumn();
+        ImGui::Text("%.1f", stripe.pendingBytes / 1024.0);
+        ImGui::TableNextColumn();
+        ImGui::Text("%.1f%%", (1.0f - stripe.quality) * 100.0f);
+        ImGui::TableNextColumn();
+        ImGui::Text("%d / %llu", stripe.streams,
+                    static_cast<unsigned long long>(stripe.assigned));
+        ImGui::TableNextColumn();
+        ImGui::TextUnformatted(stripe.reason.empty() ? "-"
+                                                     : stripe.reason.c_str());
+      }
+      ImGui::EndTable();
+    }
+  };
+
+  bool backupPath = false;
+  auto renderBackupPath = [&](const NetworkSnapshot &snap) {
+    if (ImGui::Checkbox("启用双路发送", &backupPath)) {
+      bool enabled = backupPath;
+      netThread.post(
+          [&steamManager, enabled]() { steamManager.setBackupPath(enabled); });
+    }
+    ImGui::TextDisabled("加入房间时另建一条经中继的连接，流量类型为\"交互\"的映射的"
+                        "小数据包同时经两条连接发送，先到者生效。可消除丢包重传"
+                        "造成的延迟尖峰，代价是额外流量（需双方均为协议版本 7）");
+    const BackupPathStatus &backup = snap.backupPath;
+    if (snap.isHost || !backup.enabled) {
+      return;
+    }
+    if (backup.connected) {
+      ImGui::Text("备用连接: %s, 延迟 %d ms", backup.relayed ? "中继" : "直连",
+                  backup.ping);
+    } else if (backup.failures >= StripeSet::kMaxFailures) {
+      ImGui::TextColored(ImVec4(1.0f, 0.6f, 0.2f, 1.0f),
+                         "备用连接: 无法建立（房主版本过旧?）");
+    } else {
+      ImGui::TextDisabled("备用连接: 未连接");
+    }
+    const MultiplexManager::BackupStats &stats = backup.stats;
+    double overhead = stats.mainBytesSent > 0
+                          ? 100.0 * stats.bytesSent / stats.mainBytesSent
+                          : 0.0;
+    ImGui::Text("已复制 %llu 个包, 额外流量 %.1f KB (主连接的 %.1f%%)",
+                static_cast<unsigned long long>(stats.framesSent),
+                stats.bytesSent / 1024.0, overhead);
+    double first = stats.framesReceived > 0
+                       ? 100.0 * stats.usedFirst / stats.framesReceived
+                       : 0.0;
+    ImGui::Text("收到副本 %llu 个, 先于主连接 %llu 个 (%.1f%%), 晚到 %llu, 跳过 %llu",
+                static_cast<unsigned long long>(stats.framesReceived),
+                static_cast<unsigned long long>(stats.usedFirst), first,
+                static_cast<unsigned long long>(stats.late),
+                static_cast<unsigned long long>(stats.ahead));
+  };
+
+  auto renderTiming = [&](const NetworkSnapshot &snap) {
+    bool enabled = snap.timingEnabled;
+    if (ImGui::Checkbox("分解收到数据的延迟", &enabled)) {
+      netThread.post([&steamManager, enabled]() {
+        steamManager.getMessageHandler()->setTimingEnabled(enabled);
+      });
+    }
+    ImGui::SameLine();
+    if (ImGui::Button("清零")) {
+      netThread.post([&steamManager]() {
+        steamManager.getMessageHandler()->resetTimingStats();
+      });
+    }
+    ImGui::TextDisabled("对方抽样标记发出的数据，按环节统计从对方读到数据到本机写完的"
+                        "耗时 (p50 / p99 ms)。需双方均为协议版本 8；"
+                        "对方也开启才能看到反方向");
+    const char *hopLabels[timing::kHopCount] = {"读取", "调度",   "Steam 排队",
+                                                "线路", "轮询", "写入"};
+    auto hopCells = [&](const StreamTiming::Snapshot &stats) {
+      ImGui::TableNextColumn();
+      ImGui::Text("%llu", static_cast<unsigned long long>(stats.samples));
+      for (int hop = 0; hop < timing::kHopCount; ++hop) {
+        ImGui::TableNextColumn();
+        const LatencyHistogram &h = stats.hops[hop];
+        if (h.count() == 0) {
+          ImGui::TextDisabled("-");
+        } else {
+          ImGui::Text("%.1f / %.1f", h.percentile(50) / 1000.0,
+                      h.percentile(99) / 1000.0);
+        }
+      }
+    };
+    for (const auto &peer : snap.timing) {
+      const MultiplexManager::TimingStats &stats = peer.stats;
+      std::string name = std::to_string(peer.steamID.ConvertToUint64());
+      for (const auto &member : snap.members) {
+        if (member.steamID == peer.steamID) {
+          name = member.name;
+        }
+      }
+      ImGui::PushID(name.c_str());
+      ImGui::Separator();
+      if (stats.peerSilent) {
+        ImGui::TextColored(ImVec4(1.0f, 0.6f, 0.2f, 1.0f),
+                           "%s: 对方未应答（版本过旧?）", name.c_str());
+      } else if (!stats.clockSynced) {
+        ImGui::Text("%s: 正在对时...", name.c_str());
+      } else {
+        ImGui::Text("%s: 时钟差 %.2f ms (误差 < %.2f ms)", name.c_str(),
+                    stats.clockOffsetUs / 1000.0, stats.clockRttUs / 2000.0);
+      }
+      if (ImGui::BeginTable("TimingTable", 2 + timing::kHopCount,
+                            ImGuiTableFlags_Borders | ImGuiTableFlags_RowBg)) {
+        ImGui::TableSetupColumn("流");
+        ImGui::TableSetupColumn("样本");
+        for (const char *label : hopLabels) {
+          ImGui::TableSetupColumn(label);
+        }
+        ImGui::TableHeadersRow();
+        ImGui::TableNextRow();
+        ImGui::TableNextColumn();
+        ImGui::TextUnformatted("全部");
+        hopCells(stats.total);
+        for (const auto &stream : stats.streams) {
+          ImGui::TableNextRow();
+          ImGui::TableNextColumn();
+          ImGui::TextUnformatted(stream.first.c_str());
+          hopCells(stream.second);
+        }
+        ImGui::EndTable();
+      }
+      ImGui::PopID();
+    }
+  };
+
+  auto renderPortMappings = [&](const NetworkSnapshot &snap) {
+    auto findListener = [&](int listenPort) -> const TCPServer::ListenerStatus * {
+      for (const auto &l : snap.listeners) {
+        if (l.mapping.listenPort == listenPort) {
+          return &l;
+        }
+      }
+      return nullptr;
+    };
+    auto renderStats = [&](int listenPort, int targetPort) {
+      const TCPServer::ListenerStatus *listener = findListener(listenPort);
+      if (snap.serverRunning && listener && !listener->listening) {
+        ImGui::TextColored(ImVec4(1.0f, 0.4f, 0.4f, 1.0f), "监听失败");
+        if (ImGui::IsItemHovered()) {
+          ImGui::SetTooltip("%s", listener->error.c_str());
+        }
+        return;
+      }
+      auto it = snap.ports.find(targetPort);
+      if (it == snap.ports.end()) {
+        ImGui::TextDisabled(listener ? "监听中" : "-");
+        return;
+      }
+      ImGui::Text("%d 活动 / %llu 累计, 发 %.1f MB 收 %.1f MB",
+                  it->second.active,
+                  static_cast<unsigned long long>(it->second.opened),
+                  it->second.bytesSent / (1024.0 * 1024.0),
+                  it->second.bytesReceived / (1024.0 * 1024.0));
+      if (it->second.deltaRawBytes > 0) {
+        ImGui::SameLine();
+        ImGui::Text("差分节省 %.0f%%",
+                    100.0 * (1.0 - static_cast<double>(it->second.deltaSentBytes) /
+                                       it->second.deltaRawBytes));
+      }
+    };
+    const char *classNames[] = {"自动", "交互", "批量"};
+
+    // A joined client listens on the host's table, which it cannot edit
+    if (!snap.isHost && snap.isConnected) {
+      ImGui::Text("使用房主的端口映射:");
+      for (const auto &l : snap.listeners) {
+        ImGui::BulletText("%s  本地 %d -> 房主 %s%s", l.mapping.name.c_str(),
+                          l.mapping.listenPort,
+                          l.mapping.targetPort == 0
+                              ? "本地端口"
+                              : std::to_string(l.mapping.targetPort).c_str(),
+                          l.mapping.delta ? " (差分)" : "");
+        ImGui::SameLine();
+        renderStats(l.mapping.listenPort, l.mapping.targetPort);
+      }
+      return;
+    }
+
+    if (ImGui::BeginTable("PortMappingTable", 8,
+                          ImGuiTableFlags_Borders | ImGuiTableFlags_RowBg)) {
+      ImGui::TableSetupColumn("本地监听");
+      ImGui::TableSetupColumn("房主端口");
+      ImGui::TableSetupColumn("类型");
+      ImGui::TableSetupColumn("权重");
+      ImGui::TableSetupColumn("差分");
+      ImGui::TableSetupColumn("名称");
+      ImGui::TableSetupColumn("状态");
+      ImGui::TableSetupColumn("");
+      ImGui::TableHeadersRow();
+      int removeAt = -1;
+      for (size_t i = 0; i < mappingRows.size(); ++i) {
+        MappingRow &row = mappingRows[i];
+        ImGui::PushID(static_cast<int>(i));
+        ImGui::TableNextRow();
+        ImGui::TableSetColumnIndex(0);
+        ImGui::SetNextItemWidth(90);
+        ImGui::InputInt("##listen", &row.listen, 0);
+        ImGui::TableSetColumnIndex(1);
+        ImGui::SetNextItemWidth(90);
+        ImGui::InputInt("##target", &row.target, 0);
+        if (row.target == 0 && ImGui::IsItemHovered()) {
+          ImGui::SetTooltip("0 = 使用本地端口设置");
+        }
+        ImGui::TableSetColumnIndex(2);
+        ImGui::SetNextItemWidth(70);
+        ImGui::Combo("##class", &row.cls, classNames,
+                     IM_ARRAYSIZE(classNames));
+        ImGui::TableSetColumnIndex(3);
+        ImGui::SetNextItemWidth(60);
+        ImGui::InputInt("##weight", &row.weight, 0);
+        ImGui::TableSetColumnIndex(4);
+        ImGui::Checkbox("##delta", &row.delta);
+        if (ImGui::IsItemHovered()) {
+          ImGui::SetTooltip("只发送与最近几次数据的差异，适合周期性的状态快照;"
+                            " 对方需为协议版本 6");
+        }
+        ImGui::TableSetColumnIndex(5);
+        ImGui::SetNextItemWidth(100);
+        ImGui::InputText("##name", row.name, sizeof(row.name));
+        ImGui::TableSetColumnIndex(6);
+        renderStats(row.listen, row.target);
+        ImGui::TableSetColumnIndex(7);
+        if (ImGui::SmallButton("删除")) {
+          removeAt = static_cast<int>(i);
+        }
+        ImGui::PopID();
+      }
+      ImGui::EndTable();
+      if (removeAt >= 0) {
+        mappingRows.erase(mappingRows.begin() + removeAt);
+      }
+    }
+    if (mappingRows.size() < PortMappingTable::kMaxMappings &&
+        ImGui::Button("添加映射")) {
+      int next = mappingRows.empty() ? PortMappingTable::kDefaultListenPort
+                                     : mappingRows.back().listen + 1;
+      mappingRows.push_back(MappingRow{next, next, 0, 1, {}, false});
+    }
+    ImGui::SameLine();
+    if (ImGui::Button("保存并应用")) {
+      std::vector<PortMapping> mappings;
+      for (const auto &row : mappingRows) {
+        if (row.listen <= 0 || row.listen > 65535 || row.target < 0 ||
+            row.target > 65535) {
+          continue;
+        }
+        PortMapping m;
+        m.listenPort = row.listen;
+        m.targetPort = row.target;
+        m.trafficClass = static_cast<TrafficClass>(row.cls);
+        m.weight = row.weight;
+        m.name = row.name;
+        m.delta = row.delta;
+        mappings.push_back(m);
+      }
+      portMappings.setLocal(mappings);
+      mappingStatus = portMappings.save() ? "已保存" : "保存失败";
+      netThread.post([&roomManager]() {
+        if (server) {
+          server->syncMappings();
+        }
+        roomManager.publishPortMappings();
+      });
+    }
+    if (!mappingStatus.empty()) {
+      ImGui::SameLine();
+      ImGui::TextUnformatted(mappingStatus.c_str());
+    }
+    ImGui::TextDisabled("所有映射共用一条 Steam 连接; 加入的朋友使用房主的映射表");
+  };
+
+  // Results of the speed tests started from the room status window
+  std::string speedTestStatus;
+  auto renderSpeedTests = [&](const NetworkSnapshot &snap) {
+    bool header = false;
+    for (const auto &member : snap.members) {
+      const SpeedTest::Result &result = member.speedTest;
+      if (result.state == SpeedTest::State::Idle ||
+          result.state == SpeedTest::State::Running) {
+        continue;
+      }
+      if (!header) {
+        header = true;
+        ImGui::Separator();
+        ImGui::Text("测速结果 (每阶段 %d 秒):", result.phaseSeconds);
+      }
+      ImGui::PushID(member.name.c_str());
+      if (result.state == SpeedTest::State::Failed) {
+        ImGui::Text("%s: 失败, %s", member.name.c_str(), result.error.c_str());
+      } else {
+        const SpeedTest::PhaseResult &idle =
+            result.phases[SpeedTest::kPhaseIdle];
+        const SpeedTest::PhaseResult &up =
+            result.phases[SpeedTest::kPhaseUpload];
+        const SpeedTest::PhaseResult &down =
+            result.phases[SpeedTest::kPhaseDownload];
+        ImGui::Text("%s: 上传 %.0f KB/s, 下载 %.0f KB/s", member.name.c_str(),
+                    up.bytesPerSec / 1024.0, down.bytesPerSec / 1024.0);
+        for (int i = 0; i < SpeedTest::kPhaseCount; ++i) {
+          const SpeedTest::PhaseResult &phase = result.phases[i];
+          ImGui::Text("  %s: 延迟 p50 %.1f / p99 %.1f / 最大 %.1f ms, 丢包 "
+                      "%.1f%%",
+                      SpeedTest::phaseName(static_cast<SpeedTest::Phase>(i)),
+                      phase.rtt.percentile(50) / 1000.0,
+                      phase.rtt.percentile(99) / 1000.0,
+                      phase.rtt.max() / 1000.0, phase.loss() * 100.0);
+        }
+        // Queueing the path adds under load (bufferbloat)
+        ImGui::Text("  负载下增加的延迟: 上传 %.1f ms, 下载 %.1f ms",
+                    (static_cast<double>(up.rtt.percentile(50)) -
+                     idle.rtt.percentile(50)) / 1000.0,
+                    (static_cast<double>(down.rtt.percentile(50)) -
+                     idle.rtt.percentile(50)) / 1000.0);
+      }
+      ImGui::SameLine();
+      if (ImGui::SmallButton("导出 JSON")) {
+        char name[64];
+        std::strftime(name, sizeof(name),
+                      "connecttool-speedtest-%Y%m%d-%H%M%S.json",
+                      std::localtime(&result.startedAt));
+        std::ofstream out(name, std::ios::trunc);
+        out << SpeedTest::toJson(result, member.name);
+        speedTestStatus = out ? std::string("已保存 ") + name
+                              : std::string("保存失败 ") + name;
+      }
+      ImGui::PopID();
+    }
+    if (header && !speedTestStatus.empty()) {
+      ImGui::TextUnformatted(speedTestStatus.c_str());
+    }
+  };
+
   // Frame rate limiting
   const double targetFrameTimeForeground = 1.0 / 60.0; // 60 FPS when focused
   const double targetFrameTimeBackground = 1.0; // 1 FPS when in background
   double lastFrameTime = glfwGetTime();
+  std::string traceStatus;
+  std::string memoryStatus;
+  bool captureHeadersOnly = false;
+  bool firstFrame = true;
 
   // Main loop
   while (!glfwWindowShouldClose(window)) {
@@ -346,14 +936,16 @@ int main() {
           std::chrono::duration<double>(targetFrameTime - deltaTime));
     }
     lastFrameTime = glfwGetTime();
+    TRACE_SPAN("frame");
 
     // Poll events
-    glfwPollEvents();
-
-    SteamAPI_RunCallbacks();
+    {
+      TRACE_SPAN("glfwPollEvents");
+      glfwPollEvents();
+    }
 
-    // Update Steam networking info
-    steamManager.update();
+    // Network state for this frame; never blocks on the network thread
+    std::shared_ptr<const NetworkSnapshot> snap = netThread.snapshot();
 
     // Start ImGui frame
     ImGui_ImplOpenGL3_NewFrame();
@@ -362,125 +954,366 @@ int main() {
 
     // Create a window for online game tool
     ImGui::Begin("在线游戏工具");
-    if (server) {
-      ImGui::Text("TCP服务器监听端口8888");
-      ImGui::Text("已连接客户端: %d", server->getClientCount());
+    if (snap->serverRunning) {
+      ImGui::Text("TCP服务器监听端口%d", snap->serverPort);
+      ImGui::Text("已连接客户端: %d", snap->localClients);
+      if (snap->heldClients > 0) {
+        ImGui::Text("等待隧道建立的连接: %d", snap->heldClients);
+      }
+      if (snap->isHost && snap->hostLocalOpened > 0) {
+        ImGui::Text("本机直连(不经隧道): 累计 %llu 个连接, %.1f MB",
+                    static_cast<unsigned long long>(snap->hostLocalOpened),
+                    snap->hostLocalBytes / (1024.0 * 1024.0));
+      }
+    }
+    if (snap->readiness.relay == k_ESteamNetworkingAvailability_Current) {
+      ImGui::Text("Steam 中继: 就绪 (%d ms)", snap->readiness.relayReadyMs);
+    } else {
+      ImGui::Text("Steam 中继: 准备中");
+    }
+    ImGui::SameLine();
+    ImGui::Text(snap->readiness.pingLocationReady ? "延迟位置: 就绪"
+                                                  : "延迟位置: 计算中");
+    if (snap->join.joining) {
+      ImGui::Text("正在连接... %d ms", snap->join.elapsedMs);
+    } else if (snap->join.lastJoinMs >= 0) {
+      ImGui::Text("上次加入耗时: %d ms%s", snap->join.lastJoinMs,
+                  snap->join.usedCachedPath ? " (使用缓存路径)" : "");
+    }
+    if (snap->join.joining || snap->join.lastJoinMs >= 0) {
+      renderJoinPhases(snap->join.phases);
+    }
+    bool reconnecting = snap->reconnectRemainingMs >= 0;
+    if (reconnecting) {
+      ImGui::Text("与房主的连接中断，正在重连 (剩余 %d 秒)，游戏连接保持中",
+                  (snap->reconnectRemainingMs + 999) / 1000);
+    }
+    if (snap->isHost && snap->suspendedSessions > 0) {
+      ImGui::Text("等待重连的客户端: %d", snap->suspendedSessions);
     }
     ImGui::Separator();
 
-    if (!steamManager.isHost() && !steamManager.isConnected()) {
+    if (!snap->isHost && !snap->isConnected && !reconnecting) {
       if (ImGui::Button("主持游戏房间")) {
-        roomManager.startHosting();
+        netThread.post([&roomManager]() { roomManager.startHosting(); });
       }
       ImGui::InputText("房间ID", joinBuffer, IM_ARRAYSIZE(joinBuffer));
       if (ImGui::Button("加入游戏房间")) {
-        uint64 hostID = std::stoull(joinBuffer);
-        if (steamManager.joinHost(hostID)) {
-          // Start TCP Server
-          server = std::make_unique<TCPServer>(8888, &steamManager);
-          if (!server->start()) {
-            std::cerr << "Failed to start TCP server" << std::endl;
-          }
-        }
+        uint64 hostID = std::strtoull(joinBuffer, nullptr, 10);
+        netThread.post([&steamManager, hostID]() {
+          // Starts the local TCP server before the P2P handshake
+          steamManager.markJoinRequested();
+          steamManager.joinHost(hostID);
+        });
       }
+      ImGui::Separator();
+      renderLobbyBrowser(*snap);
     }
-    if (steamManager.isHost() || steamManager.isConnected()) {
-      ImGui::Text(steamManager.isHost() ? "正在主持游戏房间。邀请朋友!"
-                                        : "已连接到游戏房间。邀请朋友!");
+    if (snap->isHost || snap->isConnected || reconnecting) {
+      ImGui::Text(snap->isHost ? "正在主持游戏房间。邀请朋友!"
+                               : "已连接到游戏房间。邀请朋友!");
       ImGui::Separator();
       if (ImGui::Button("断开连接")) {
-        roomManager.leaveLobby();
-        steamManager.disconnect();
-        if (server) {
-          server->stop();
-          server.reset();
-        }
+        netThread.post([&roomManager, &steamManager]() {
+          roomManager.leaveLobby();
+          steamManager.disconnect();
+          if (server) {
+            server->stop();
+            server.reset();
+          }
+        });
       }
-      if (steamManager.isHost()) {
+      if (snap->isHost) {
         ImGui::InputInt("本地端口", &localPort);
       }
       ImGui::Separator();
-      renderInviteFriends();
+      renderInviteFriends(*snap);
+    }
+
+    if (ImGui::CollapsingHeader("端口映射")) {
+      renderPortMappings(*snap);
+    }
+
+    if (ImGui::CollapsingHeader("并行连接")) {
+      renderStriping(*snap);
+    }
+
+    if (ImGui::CollapsingHeader("双路发送")) {
+      renderBackupPath(*snap);
+    }
+
+    if (ImGui::CollapsingHeader("延迟分解")) {
+      renderTiming(*snap);
+    }
+
+    if (ImGui::CollapsingHeader("性能追踪")) {
+      bool tracing = trace::enabled();
+      if (ImGui::Checkbox("记录追踪事件", &tracing)) {
+        trace::setEnabled(tracing);
+      }
+      ImGui::SameLine();
+      if (ImGui::Button("保存追踪文件")) {
+        char name[64];
+        std::time_t now = std::time(nullptr);
+        std::strftime(name, sizeof(name), "connecttool-trace-%Y%m%d-%H%M%S.json",
+                      std::localtime(&now));
+        traceStatus = trace::writeChromeTrace(name)
+                          ? std::string("已保存 ") + name
+                          : std::string("保存失败 ") + name;
+      }
+      ImGui::Text("缓冲事件: %zu", trace::eventCount());
+      if (!traceStatus.empty()) {
+        ImGui::TextUnformatted(traceStatus.c_str());
+      }
+      ImGui::TextDisabled("用 chrome://tracing 或 ui.perfetto.dev 打开");
+
+      ImGui::Separator();
+      flight::Status flightStatus = flight::status();
+      bool autoDump = flightStatus.autoDump;
+      if (ImGui::Checkbox("卡顿时自动保存", &autoDump)) {
+        flight::setAutoDump(autoDump);
+      }
+      ImGui::SameLine();
+      if (ImGui::Button("保存最近记录")) {
+        flight::dumpNow("manual");
+      }
+      flight::Thresholds limits = flight::thresholds();
+      bool limitsChanged = false;
+      auto limitInput = [&limitsChanged](const char *label, int *value) {
+        ImGui::SetNextItemWidth(120);
+        if (ImGui::InputInt(label, value)) {
+          *value = std::max(*value, 0);
+          limitsChanged = true;
+        }
+      };
+      limitInput("延迟阈值 (ms)", &limits.pingMs);
+      limitInput("发送排队阈值 (ms)", &limits.queueTimeMs);
+      limitInput("轮询间隔阈值 (ms)", &limits.pollGapMs);
+      limitInput("帧时间阈值 (ms)", &limits.frameTimeMs);
+      limitInput("写入积压阈值 (KB)", &limits.writeBacklogKB);
+      if (limitsChanged) {
+        flight::setThresholds(limits);
+      }
+      ImGui::Text("卡顿记录: %llu 个采样, 已保存 %d 次",
+                  static_cast<unsigned long long>(flightStatus.samples),
+                  flightStatus.dumps);
+      if (!flightStatus.lastFile.empty()) {
+        ImGui::Text("最近: %s (%s)", flightStatus.lastFile.c_str(),
+                    flightStatus.lastReason.c_str());
+      }
+      ImGui::TextDisabled("超过阈值时保存前 %d 秒的记录，阈值为 0 则不检查；"
+                          "用 FlightDump 转换",
+                          flight::kDumpSeconds);
+
+      ImGui::Separator();
+      capture::Status captureStatus = capture::status();
+      if (captureStatus.active) {
+        if (ImGui::Button("停止抓包")) {
+          capture::stop();
+        }
+      } else {
+        if (ImGui::Button("开始抓包")) {
+          capture::start("", snap->isHost, captureHeadersOnly);
+        }
+        ImGui::SameLine();
+        ImGui::Checkbox("仅记录包头", &captureHeadersOnly);
+      }
+      if (!captureStatus.path.empty()) {
+        ImGui::Text("%s%s: %llu 条记录, %.1f MB",
+                    captureStatus.active ? "抓包中 " : "",
+                    captureStatus.path.c_str(),
+                    static_cast<unsigned long long>(captureStatus.records),
+                    captureStatus.bytes / (1024.0 * 1024.0));
+        if (captureStatus.full) {
+          ImGui::TextColored(ImVec4(1.0f, 0.6f, 0.2f, 1.0f),
+                             "文件已满或无法扩展，抓包已停止");
+        }
+      }
+      ImGui::TextDisabled("记录隧道帧与连接事件，用 TunnelReplay 回放");
+    }
+
+    if (ImGui::CollapsingHeader("内存")) {
+      if (snap->memory.empty()) {
+        ImGui::TextDisabled("需以 CONNECTTOOL_MEMTRACK=ON 构建");
+      } else {
+        if (ImGui::BeginTable("MemoryTable", 6,
+                              ImGuiTableFlags_Borders |
+                                  ImGuiTableFlags_RowBg)) {
+          ImGui::TableSetupColumn("模块");
+          ImGui::TableSetupColumn("当前 (KB)");
+          ImGui::TableSetupColumn("峰值 (KB)");
+          ImGui::TableSetupColumn("未释放块");
+          ImGui::TableSetupColumn("分配/秒");
+          ImGui::TableSetupColumn("KB/秒");
+          ImGui::TableHeadersRow();
+          for (const auto &m : snap->memory) {
+            ImGui::TableNextRow();
+            ImGui::TableNextColumn();
+            ImGui::TextUnformatted(memtrack::tagName(m.tag));
+            ImGui::TableNextColumn();
+            ImGui::Text("%.1f", m.liveBytes / 1024.0);
+            ImGui::TableNextColumn();
+            ImGui::Text("%.1f", m.peakBytes / 1024.0);
+            ImGui::TableNextColumn();
+            ImGui::Text("%llu",
+                        static_cast<unsigned long long>(m.allocs - m.frees));
+            ImGui::TableNextColumn();
+            ImGui::Text("%.0f", m.allocsPerSec);
+            ImGui::TableNextColumn();
+            ImGui::Text("%.1f", m.bytesPerSec / 1024.0);
+          }
+          ImGui::EndTable();
+        }
+        if (ImGui::Button("保存内存报告")) {
+          char name[64];
+          std::time_t now = std::time(nullptr);
+          std::strftime(name, sizeof(name),
+                        "connecttool-memory-%Y%m%d-%H%M%S.csv",
+                        std::localtime(&now));
+          memoryStatus = memtrack::writeReport(name)
+                             ? std::string("已保存 ") + name
+                             : std::string("保存失败 ") + name;
+        }
+        ImGui::SameLine();
+        if (ImGui::Button("重置峰值")) {
+          memtrack::resetPeaks();
+        }
+        if (!memoryStatus.empty()) {
+          ImGui::TextUnformatted(memoryStatus.c_str());
+        }
+        ImGui::TextDisabled("报告含每分钟的当前占用，用于检查长时间运行是否增长");
+      }
     }
 
     ImGui::End();
 
     // Room status window - only show when hosting or connected
-    if ((steamManager.isHost() || steamManager.isConnected()) &&
-        roomManager.getCurrentLobby().IsValid()) {
+    if ((snap->isHost || snap->isConnected) && snap->currentLobby.IsValid()) {
       ImGui::Begin("房间状态");
       ImGui::Text("用户列表:");
-      if (ImGui::BeginTable("UserTable", 3,
+      if (ImGui::BeginTable("UserTable", 8,
                             ImGuiTableFlags_Borders | ImGuiTableFlags_RowBg)) {
         ImGui::TableSetupColumn("名称");
         ImGui::TableSetupColumn("延迟 (ms)");
         ImGui::TableSetupColumn("连接类型");
+        ImGui::TableSetupColumn("路径策略");
+        ImGui::TableSetupColumn("直连 / 中继");
+        ImGui::TableSetupColumn("排队 p99 (交互/批量 ms)");
+        ImGui::TableSetupColumn("瓶颈带宽 / 发送速率");
+        ImGui::TableSetupColumn("测速");
         ImGui::TableHeadersRow();
-        {
-          std::vector<CSteamID> members = roomManager.getLobbyMembers();
-          CSteamID mySteamID = SteamUser()->GetSteamID();
-          CSteamID hostSteamID = steamManager.getHostSteamID();
-          for (const auto &memberID : members) {
-            ImGui::TableNextRow();
-            ImGui::TableNextColumn();
-            const char *name = SteamFriends()->GetFriendPersonaName(memberID);
-            ImGui::Text("%s", name);
-            ImGui::TableNextColumn();
-
-            if (memberID == mySteamID) {
+        for (const auto &member : snap->members) {
+          ImGui::TableNextRow();
+          ImGui::TableNextColumn();
+          ImGui::Text("%s", member.name.c_str());
+          ImGui::TableNextColumn();
+          if (member.isSelf || !member.hasConnection) {
+            for (int col = 0; col < 6; ++col) {
               ImGui::Text("-");
               ImGui::TableNextColumn();
-              ImGui::Text("-");
+            }
+            ImGui::Text("-");
+          } else {
+            ImGui::Text("%d", member.ping);
+            ImGui::TableNextColumn();
+            ImGui::Text("%s", member.relayed ? "中继" : "直连");
+            ImGui::TableNextColumn();
+            const char *preference =
+                member.path.preference == PathPreference::PreferDirect ? "偏好直连"
+                : member.path.preference == PathPreference::PreferRelay
+                    ? "偏好中继"
+                    : "自动";
+            ImGui::Text("%s (%s)", preference, member.path.reason.c_str());
+            ImGui::TableNextColumn();
+            ImGui::Text("%s | %s", formatPath(member.path.direct).c_str(),
+                        formatPath(member.path.relay).c_str());
+            ImGui::TableNextColumn();
+            ImGui::Text(
+                "%.1f / %.1f",
+                member.scheduler.interactive.queueDelay.percentile(99) / 1000.0,
+                member.scheduler.bulk.queueDelay.percentile(99) / 1000.0);
+            ImGui::TableNextColumn();
+            const BandwidthEstimator::State &bw = member.bandwidth;
+            ImGui::Text("%.0f / %.0f KB/s (%s)", bw.bottleneck / 1024.0,
+                        bw.sendRate / 1024.0,
+                        BandwidthEstimator::modeName(bw.mode));
+            if (ImGui::IsItemHovered()) {
+              ImGui::SetTooltip("最小延迟 %d ms, 丢包 %.1f%%, 增益 %.2f%s",
+                                bw.minRttMs, bw.loss * 100.0f, bw.gain,
+                                bw.appLimited ? ", 发送量不足以测满" : "");
+            }
+            ImGui::TableNextColumn();
+            if (member.speedTest.state == SpeedTest::State::Running) {
+              ImGui::Text("%s...", SpeedTest::phaseName(member.speedTest.phase));
             } else {
-              auto [ping, relayInfo] =
-                  getMemberConnectionInfo(memberID, hostSteamID);
-
-              if (relayInfo != "-") {
-                ImGui::Text("%d", ping);
-              } else {
-                ImGui::Text("-");
+              ImGui::PushID(member.name.c_str());
+              if (ImGui::SmallButton("测速")) {
+                CSteamID peer = member.steamID;
+                netThread.post([&steamManager, peer]() {
+                  steamManager.startSpeedTest(peer,
+                                              SpeedTest::kDefaultPhaseSeconds);
+                });
               }
-              ImGui::TableNextColumn();
-              ImGui::Text("%s", relayInfo.c_str());
+              ImGui::PopID();
             }
           }
         }
         ImGui::EndTable();
       }
+      renderSpeedTests(*snap);
       ImGui::End();
     }
 
     // Rendering
-    ImGui::Render();
-    int display_w, display_h;
-    glfwGetFramebufferSize(window, &display_w, &display_h);
-    glViewport(0, 0, display_w, display_h);
-    glClearColor(0.45f, 0.55f, 0.60f, 1.00f);
-    glClear(GL_COLOR_BUFFER_BIT);
-    ImGui_ImplOpenGL3_RenderDrawData(ImGui::GetDrawData());
+    {
+      TRACE_SPAN("render");
+      ImGui::Render();
+      int display_w, display_h;
+      glfwGetFramebufferSize(window, &display_w, &display_h);
+      glViewport(0, 0, display_w, display_h);
+      glClearColor(0.45f, 0.55f, 0.60f, 1.00f);
+      glClear(GL_COLOR_BUFFER_BIT);
+      ImGui_ImplOpenGL3_RenderDrawData(ImGui::GetDrawData());
+    }
 
     // Swap buffers
-    glfwSwapBuffers(window);
+    {
+      TRACE_SPAN("glfwSwapBuffers");
+      glfwSwapBuffers(window);
+    }
+    // Time the frame kept the render thread busy, without the frame-rate sleep
+    flight::record(flight::Metric::FrameTime, 0,
+                   static_cast<int64_t>((glfwGetTime() - lastFrameTime) * 1e6));
+
+    if (firstFrame) {
+      firstFrame = false;
+      startup.step("first frame", stepBegin);
+#if IMGUI_VERSION_NUM < 19200
+      // The atlas texture is on the GPU now; drop its CPU copy and the TTF data
+      io.Fonts->ClearTexData();
+      io.Fonts->ClearInputData();
+#endif
+    }
   }
 
+  // Stop the network thread first so nothing else touches Steam
+  netThread.stop();
+
   // Stop message handler
   steamManager.stopMessageHandler();
+  capture::stop();
 
   // Cleanup
   if (server) {
     server->stop();
   }
 
-  // Stop io_context and join thread
-  work_guard.reset();
-  io_context.stop();
-  if (io_thread.joinable()) {
-    io_thread.join();
-  }
+  stopIoThread();
 
   ImGui_ImplOpenGL3_Shutdown();
   ImGui_ImplGlfw_Shutdown();
   ImGui::DestroyContext();
+  IM_DELETE(fontAtlas);
   glfwDestroyWindow(window);
   glfwTerminate();
   steamManager.shutdown();
@@ -0,0 +1,85 @@
+#include "steam_host_cache.h"
+#include <algorithm>
+#include <ctime>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+
+namespace
+{
+    const char *kCacheHeader = "# ConnectTool host path cache v1";
+}
+
+HostPathCache::HostPathCache(const std::string &path)
+    : path_(path) {}
+
+void HostPathCache::load()
+{
+    std::ifstream in(path_);
+    if (!in)
+    {
+        return;
+    }
+    std::string line;
+    while (std::getline(in, line))
+    {
+        if (line.empty() || line[0] == '#')
+        {
+            continue;
+        }
+        // steamid relayed directPing relayPing connectMs lastSeen
+        std::istringstream fields(line);
+        HostPathRecord record;
+        int relayed = 0;
+        if (fields >> record.steamID >> relayed >> record.directPing >> record.relayPing >> record.connectMs >> record.lastSeen)
+        {
+            record.relayed = relayed != 0;
+            records_[record.steamID] = record;
+        }
+    }
+    std::cout << "Loaded " << records_.size() << " cached host paths" << std::endl;
+}
+
+bool HostPathCache::save() const
+{
+    std::ofstream out(path_, std::ios::trunc);
+    if (!out)
+    {
+        std::cerr << "Failed to write host path cache " << path_ << std::endl;
+        return false;
+    }
+    out << kCacheHeader << "\n";
+    for (const auto &pair : records_)
+    {
+        const HostPathRecord &r = pair.second;
+        out << r.steamID << ' ' << (r.relayed ? 1 : 0) << ' ' << r.directPing << ' ' << r.relayPing << ' '
+            << r.connectMs << ' ' << r.lastSeen << "\n";
+    }
+    return static_cast<bool>(out);
+}
+
+bool HostPathCache::lookup(uint64 steamID, HostPathRecord &out) const
+{
+    auto it = records_.find(steamID);
+    if (it == records_.end())
+    {
+        return false;
+    }
+    out = it->second;
+    return true;
+}
+
+void HostPathCache::remember(const HostPathRecord &record)
+{
+    HostPathRecord stored = record;
+    stored.lastSeen = static_cast<int64_t>(std::time(nullptr));
+    records_[stored.steamID] = stored;
+
+    // Forget the least recently seen hosts
+    while (records_.size() > kMaxEntries)
+    {
+        auto oldest = std::min_element(records_.begin(), records_.end(), [](const auto &a, const auto &b)
+                                       { return a.second.lastSeen < b.second.lastSeen; });
+        records_.erase(oldest);
+    }
+}
@@ -0,0 +1,41 @@
+#ifndef STEAM_HOST_CACHE_H
+#define STEAM_HOST_CACHE_H
+
+#include <cstdint>
+#include <map>
+#include <string>
+#include <steam_api.h>
+
+// What we learned about reaching one host, kept across launches so the next
+// join can start with the right path preference instead of rediscovering it
+struct HostPathRecord
+{
+    uint64 steamID = 0;
+    bool relayed = false;  // path in use when last seen
+    int directPing = -1;   // -1 if a direct path never came up
+    int relayPing = -1;
+    int connectMs = -1;    // join click to connected
+    int64_t lastSeen = 0;  // unix seconds
+};
+
+// Small text file of HostPathRecords, most recent kMaxEntries hosts.
+// Used from the network thread only.
+class HostPathCache
+{
+public:
+    explicit HostPathCache(const std::string &path);
+
+    void load();
+    bool save() const;
+
+    bool lookup(uint64 steamID, HostPathRecord &out) const;
+    void remember(const HostPathRecord &record);
+
+    static constexpr size_t kMaxEntries = 64;
+
+private:
+    std::string path_;
+    std::map<uint64, HostPathRecord> records_;
+};
+
+#endif // STEAM_HOST_CACHE_H
@@ -1,12 +1,16 @@
 #include "steam_message_handler.h"
+#include "../net/trace.h"
+#include "../net/mem_tracker.h"
+#include "../net/flight_recorder.h"
+#include "../net/tunnel_capture.h"
+#include "../net/tunnel_protocol.h"
 #include <iostream>
 #include <cstring>
 #include <chrono>
-#include <steam_api.h>
-#include <isteamnetworkingsockets.h>
+#include <algorithm>
 
-SteamMessageHandler::SteamMessageHandler(boost::asio::io_context& io_context, ISteamNetworkingSockets* interface, std::vector<HSteamNetConnection>& connections, std::mutex& connectionsMutex, bool& g_isHost, int& localPort)
-    : io_context_(io_context), m_pInterface_(interface), connections_(connections), connectionsMutex_(connectionsMutex), g_isHost_(g_isHost), localPort_(localPort), running_(false), currentPollInterval_(0) {}
+SteamMessageHandler::SteamMessageHandler(boost::asio::io_context& io_context, TunnelTransport* transport, std::vector<HSteamNetConnection>& connections, std::mutex& connectionsMutex, bool& g_isHost, int& localPort)
+    : io_context_(io_context), transport_(transport), connections_(connections), connectionsMutex_(connectionsMutex), g_isHost_(g_isHost), localPort_(localPort), running_(false), currentPollInterval_(0) {}
 
 SteamMessageHandler::~SteamMessageHandler() {
     stop();
@@ -28,18 +32,327 @@ void SteamMessageHandler::stop() {
 }
 
 std::shared_ptr<MultiplexManager> SteamMessageHandler::getMultiplexManager(HSteamNetConnection conn) {
+    // Called from the TCP server and UI threads as well as the poll loop
+    std::lock_guard<std::mutex> lock(managersMutex_);
+    auto backup = backups_.find(conn);
+    if (backup != backups_.end()) {
+        return backup->second;
+    }
     if (multiplexManagers_.find(conn) == multiplexManagers_.end()) {
-        multiplexManagers_[conn] = std::make_shared<MultiplexManager>(m_pInterface_, conn, io_context_, g_isHost_, localPort_);
+        auto manager = std::make_shared<MultiplexManager>(transport_, conn, io_context_, g_isHost_, localPort_);
+        manager->setPortMappings(portMappings_);
+        manager->setTimingEnabled(timingEnabled_);
+        manager->setOwner(transport_->remotePeer(conn));
+        multiplexManagers_[conn] = manager;
     }
     return multiplexManagers_[conn];
 }
 
+std::map<int, PortStats> SteamMessageHandler::getPortStats() {
+    std::vector<std::shared_ptr<MultiplexManager>> managers;
+    {
+        std::lock_guard<std::mutex> lock(managersMutex_);
+        for (const auto& pair : multiplexManagers_) {
+            managers.push_back(pair.second);
+        }
+    }
+    std::map<int, PortStats> total;
+    for (const auto& manager : managers) {
+        for (const auto& pair : manager->getPortStats()) {
+            PortStats& stats = total[pair.first];
+            stats.opened += pair.second.opened;
+            stats.active += pair.second.active;
+            stats.bytesSent += pair.second.bytesSent;
+            stats.bytesReceived += pair.second.bytesReceived;
+        }
+    }
+    return total;
+}
+
+void SteamMessageHandler::setTimingEnabled(bool enabled) {
+    std::vector<std::shared_ptr<MultiplexManager>> managers;
+    {
+        std::lock_guard<std::mutex> lock(managersMutex_);
+        timingEnabled_ = enabled;
+        for (const auto& pair : multiplexManagers_) {
+            managers.push_back(pair.second);
+        }
+        for (const auto& pair : suspended_) {
+            managers.push_back(pair.second.manager);
+        }
+    }
+    for (const auto& manager : managers) {
+        manager->setTimingEnabled(enabled);
+    }
+}
+
+void SteamMessageHandler::resetTimingStats() {
+    std::vector<std::shared_ptr<MultiplexManager>> managers;
+    {
+        std::lock_guard<std::mutex> lock(managersMutex_);
+        for (const auto& pair : multiplexManagers_) {
+            managers.push_back(pair.second);
+        }
+    }
+    for (const auto& manager : managers) {
+        manager->resetTimingStats();
+    }
+}
+
+std::vector<std::pair<HSteamNetConnection, MultiplexManager::TimingStats>> SteamMessageHandler::getTimingStats() {
+    std::vector<std::pair<HSteamNetConnection, std::shared_ptr<MultiplexManager>>> managers;
+    {
+        std::lock_guard<std::mutex> lock(managersMutex_);
+        managers.assign(multiplexManagers_.begin(), multiplexManagers_.end());
+    }
+    std::vector<std::pair<HSteamNetConnection, MultiplexManager::TimingStats>> stats;
+    for (const auto& pair : managers) {
+        stats.emplace_back(pair.first, pair.second->getTimingStats());
+    }
+    return stats;
+}
+
+bool SteamMessageHandler::suspendSession(HSteamNetConnection conn) {
+    std::shared_ptr<MultiplexManager> manager;
+    {
+        std::lock_guard<std::mutex> lock(managersMutex_);
+        auto backup = backups_.find(conn);
+        if (backup != backups_.end()) {
+            // Only the copies are lost; the session goes on without them
+            backup->second->dropBackupLink(conn);
+            backups_.erase(backup);
+            return false;
+        }
+        auto it = multiplexManagers_.find(conn);
+        if (it == multiplexManagers_.end()) {
+            return false;
+        }
+        manager = it->second;
+        multiplexManagers_.erase(it);
+        if (manager->isResumable()) {
+            suspended_[manager->getSessionId()] = SuspendedSession{manager, std::chrono::steady_clock::now() + tunnel::kResumeGrace};
+        }
+    }
+    if (!manager->isResumable()) {
+        // Last reference: the destructor closes the local sockets
+        return false;
+    }
+    manager->suspend();
+    return true;
+}
+
+std::string SteamMessageHandler::getSessionId(HSteamNetConnection conn) {
+    std::shared_ptr<MultiplexManager> manager;
+    {
+        std::lock_guard<std::mutex> lock(managersMutex_);
+        auto it = multiplexManagers_.find(conn);
+        if (it == multiplexManagers_.end()) {
+            return std::string();
+        }
+        manager = it->second;
+    }
+    return manager->getSessionId();
+}
+
+void SteamMessageHandler::startSession(HSteamNetConnection conn) {
+    getMultiplexManager(conn)->startSession();
+}
+
+bool SteamMessageHandler::resumeSession(HSteamNetConnection conn, const std::string& sessionId) {
+    std::shared_ptr<MultiplexManager> manager;
+    {
+        std::lock_guard<std::mutex> lock(managersMutex_);
+        // Without striping a client has one session, with the host it reconnects to
+        auto it = sessionId.empty() ? suspended_.begin() : suspended_.find(sessionId);
+        if (it != suspended_.end()) {
+            manager = it->second.manager;
+            suspended_.erase(it);
+            multiplexManagers_[conn] = manager;
+        }
+    }
+    if (!manager) {
+        startSession(conn);
+        return false;
+    }
+    manager->attach(conn);
+    manager->requestResume();
+    return true;
+}
+
+std::shared_ptr<MultiplexManager> SteamMessageHandler::adoptSession(HSteamNetConnection conn, std::shared_ptr<MultiplexManager> current, const char* data, size_t size) {
+    uint32_t kind;
+    if (!tunnel::readPayload(data, size, kind) || kind != tunnel::kSessionResume) {
+        return current;
+    }
+    std::string sessionId = tunnel::readId(data);
+    // The session id alone is no proof; a guessed one must not hand over
+    // another player's streams
+    uint64 peer = transport_->remotePeer(conn);
+    std::shared_ptr<MultiplexManager> adopted;
+    {
+        std::lock_guard<std::mutex> lock(managersMutex_);
+        auto it = suspended_.find(sessionId);
+        if (it != suspended_.end() && it->second.manager->getOwner() == peer) {
+            adopted = it->second.manager;
+            suspended_.erase(it);
+        } else if (it == suspended_.end()) {
+            // The client noticed the drop first; our old connection has not
+            // been reported closed yet
+            for (auto& pair : multiplexManagers_) {
+                if (pair.first != conn && pair.second->isResumable() && pair.second->getSessionId() == sessionId &&
+                    pair.second->getOwner() == peer) {
+                    adopted = pair.second;
+                    multiplexManagers_.erase(pair.first);
+                    break;
+                }
+            }
+        }
+        if (!adopted) {
+            // current answers the frame with kSessionUnknown
+            return current;
+        }
+        multiplexManagers_[conn] = adopted;
+    }
+    adopted->suspend();
+    adopted->attach(conn);
+    std::cout << "Connection " << conn << " resumes session " << sessionId << std::endl;
+    return adopted;
+}
+
+void SteamMessageHandler::pairBackup(HSteamNetConnection backup, HSteamNetConnection main) {
+    std::shared_ptr<MultiplexManager> owner = getMultiplexManager(main);
+    {
+        std::lock_guard<std::mutex> lock(managersMutex_);
+        multiplexManagers_.erase(backup);
+        backups_[backup] = owner;
+    }
+    owner->pairBackupLink(backup);
+}
+
+MultiplexManager::BackupStats SteamMessageHandler::getBackupStats(HSteamNetConnection main) {
+    std::shared_ptr<MultiplexManager> manager;
+    {
+        std::lock_guard<std::mutex> lock(managersMutex_);
+        auto it = multiplexManagers_.find(main);
+        if (it == multiplexManagers_.end()) {
+            return MultiplexManager::BackupStats();
+        }
+        manager = it->second;
+    }
+    return manager->getBackupStats();
+}
+
+bool SteamMessageHandler::acceptBackup(HSteamNetConnection conn, const char* data, size_t size) {
+    uint32_t kind;
+    if (!tunnel::readPayload(data, size, kind) || kind != tunnel::kSessionPair) {
+        return false;
+    }
+    std::string sessionId = tunnel::readId(data);
+    uint64 peer = transport_->remotePeer(conn);
+    std::shared_ptr<MultiplexManager> owner;
+    {
+        std::lock_guard<std::mutex> lock(managersMutex_);
+        for (auto& pair : multiplexManagers_) {
+            if (pair.first != conn && pair.second->isResumable() && pair.second->getSessionId() == sessionId &&
+                pair.second->getOwner() == peer) {
+                owner = pair.second;
+                break;
+            }
+        }
+        if (!owner) {
+            std::cerr << "Backup connection " << conn << " names unknown session " << sessionId << std::endl;
+            return true;
+        }
+        // The connection's own manager never carried a stream
+        multiplexManagers_.erase(conn);
+        backups_[conn] = owner;
+    }
+    owner->acceptBackupLink(conn);
+    return true;
+}
+
+std::shared_ptr<MultiplexManager> SteamMessageHandler::backupOwner(HSteamNetConnection conn) {
+    std::lock_guard<std::mutex> lock(managersMutex_);
+    auto it = backups_.find(conn);
+    return it != backups_.end() ? it->second : nullptr;
+}
+
+void SteamMessageHandler::expireSessions() {
+    std::vector<std::shared_ptr<MultiplexManager>> expired;
+    {
+        std::lock_guard<std::mutex> lock(managersMutex_);
+        if (suspended_.empty()) {
+            return;
+        }
+        auto now = std::chrono::steady_clock::now();
+        for (auto it = suspended_.begin(); it != suspended_.end();) {
+            if (now >= it->second.deadline) {
+                std::cout << "Session " << it->first << " was not resumed in time, closing its streams" << std::endl;
+                expired.push_back(it->second.manager);
+                for (auto backup = backups_.begin(); backup != backups_.end();) {
+                    backup = backup->second == it->second.manager ? backups_.erase(backup) : std::next(backup);
+                }
+                it = suspended_.erase(it);
+            } else {
+                ++it;
+            }
+        }
+    }
+    // Destroyed outside the lock
+}
+
+void SteamMessageHandler::dropSuspendedSessions() {
+    std::map<std::string, SuspendedSession> dropped;
+    {
+        std::lock_guard<std::mutex> lock(managersMutex_);
+        dropped.swap(suspended_);
+        for (auto backup = backups_.begin(); backup != backups_.end();) {
+            backup = dropped.count(backup->second->getSessionId()) ? backups_.erase(backup) : std::next(backup);
+        }
+    }
+}
+
+int SteamMessageHandler::getSuspendedCount() {
+    std::lock_guard<std::mutex> lock(managersMutex_);
+    return static_cast<int>(suspended_.size());
+}
+
+void SteamMessageHandler::sampleFlight(int messages) {
+    auto now = std::chrono::steady_clock::now();
+    if (lastPoll_ != std::chrono::steady_clock::time_point()) {
+        int64_t gap = std::chrono::duration_cast<std::chrono::microseconds>(now - lastPoll_).count();
+        maxPollGapUs_ = std::max(maxPollGapUs_, gap);
+    }
+    lastPoll_ = now;
+    flightMessages_ += messages;
+    if (now - lastFlightSample_ < std::chrono::milliseconds(flight::kSampleIntervalMs)) return;
+    lastFlightSample_ = now;
+
+    flight::record(flight::Metric::PollGap, 0, maxPollGapUs_);
+    flight::record(flight::Metric::PollMessages, 0, flightMessages_);
+    maxPollGapUs_ = 0;
+    flightMessages_ = 0;
+    std::vector<std::shared_ptr<MultiplexManager>> managers;
+    {
+        std::lock_guard<std::mutex> lock(managersMutex_);
+        for (auto& pair : multiplexManagers_) {
+            managers.push_back(pair.second);
+        }
+    }
+    for (auto& manager : managers) {
+        for (auto& backlog : manager->getWriteBacklogs()) {
+            flight::record(flight::Metric::WriteBacklog, flight::streamSource(backlog.first),
+                           static_cast<int64_t>(backlog.second));
+        }
+    }
+}
+
 void SteamMessageHandler::startAsyncPoll() {
     if (!running_) return;
+    TRACE_SPAN("startAsyncPoll");
+    MEMTRACK_SCOPE(memtrack::Tag::MessageHandler);
     
-    // Poll networking callbacks
-    m_pInterface_->RunCallbacks();
-    
+    // Connection status callbacks are dispatched by SteamNetworkThread
     // Receive messages and check if any were received
     int totalMessages = 0;
     std::vector<HSteamNetConnection> currentConnections;
@@ -48,25 +361,59 @@ void SteamMessageHandler::startAsyncPoll() {
         currentConnections = connections_;
     }
     for (auto conn : currentConnections) {
-        ISteamNetworkingMessage* pIncomingMsgs[10];
-        int numMsgs = m_pInterface_->ReceiveMessagesOnConnection(conn, pIncomingMsgs, 10);
-        totalMessages += numMsgs;
-        for (int i = 0; i < numMsgs; ++i) {
-            ISteamNetworkingMessage* pIncomingMsg = pIncomingMsgs[i];
-            const char* data = (const char*)pIncomingMsg->m_pData;
-            size_t size = pIncomingMsg->m_cbSize;
-            // Handle tunnel packets with multiplexing
-            if (multiplexManagers_.find(conn) == multiplexManagers_.end()) {
-                multiplexManagers_[conn] = std::make_shared<MultiplexManager>(m_pInterface_, conn, io_context_, g_isHost_, localPort_);
-            }
-            multiplexManagers_[conn]->handleTunnelPacket(data, size);
-            pIncomingMsg->Release();
+        if (auto owner = backupOwner(conn)) {
+            totalMessages += transport_->receiveMessages(conn, 10, [&](const char* data, size_t size) {
+                if (capture::active()) capture::frame(capture::Kind::FrameIn, conn, data, size);
+                owner->handleBackupPacket(data, size);
+            });
+            continue;
         }
+        // Handle tunnel packets with multiplexing
+        auto multiplexManager = getMultiplexManager(conn);
+        bool paired = false;
+        totalMessages += transport_->receiveMessages(conn, 10, [&](const char* data, size_t size) {
+            if (capture::active()) capture::frame(capture::Kind::FrameIn, conn, data, size);
+            if (paired) {
+                // Copies behind the pairing frame, in the same batch
+                multiplexManager->handleBackupPacket(data, size);
+                return;
+            }
+            if (g_isHost_ && size >= tunnel::kHeaderSize && tunnel::readType(data) == tunnel::kFrameSession) {
+                if (acceptBackup(conn, data, size)) {
+                    paired = true;
+                    multiplexManager = backupOwner(conn);
+                    if (!multiplexManager) {
+                        // Unknown session: the connection stays unpaired and idle
+                        multiplexManager = getMultiplexManager(conn);
+                        paired = false;
+                    }
+                    return;
+                }
+                multiplexManager = adoptSession(conn, multiplexManager, data, size);
+            }
+            multiplexManager->handleTunnelPacket(data, size);
+        });
     }
+    expireSessions();
     
+    // Drain per-connection send schedulers that are waiting for Steam's queue to empty
+    bool sendPending = false;
+    {
+        std::lock_guard<std::mutex> lock(managersMutex_);
+        for (auto& pair : multiplexManagers_) {
+            sendPending = pair.second->flushSendQueue() || sendPending;
+        }
+    }
+
+    TRACE_COUNTER("poll.messages", totalMessages);
+    sampleFlight(totalMessages);
+
     // Adaptive polling: if messages received, poll immediately; otherwise increase interval
     if (totalMessages > 0) {
         currentPollInterval_ = 0; // 有消息，立即轮询
+    } else if (sendPending) {
+        // 发送队列未清空，保持 1ms 轮询
+        currentPollInterval_ = 1;
     } else {
         // 无消息，逐渐增加间隔，最大10ms
         currentPollInterval_ = std::min(currentPollInterval_ + 1, 10);
@@ -3,39 +3,103 @@
 
 #include <vector>
 #include <map>
+#include <chrono>
+#include <string>
 #include <mutex>
 #include <thread>
 #include <memory>
+#include <atomic>
 #include <boost/asio.hpp>
 #include <steamnetworkingtypes.h>
 #include "../net/tcp_server.h"
 #include "../net/multiplex_manager.h"
+#include "../net/tunnel_transport.h"
 
 class SteamMessageHandler {
 public:
-    SteamMessageHandler(boost::asio::io_context& io_context, ISteamNetworkingSockets* interface, std::vector<HSteamNetConnection>& connections, std::mutex& connectionsMutex, bool& g_isHost, int& localPort);
+    SteamMessageHandler(boost::asio::io_context& io_context, TunnelTransport* transport, std::vector<HSteamNetConnection>& connections, std::mutex& connectionsMutex, bool& g_isHost, int& localPort);
     ~SteamMessageHandler();
 
     void start();
     void stop();
 
     std::shared_ptr<MultiplexManager> getMultiplexManager(HSteamNetConnection conn);
+    // Given to every multiplexer, for the target ports a host accepts
+    void setPortMappings(const PortMappingTable* mappings) { portMappings_ = mappings; }
+    // Per target port, summed over the live connections
+    std::map<int, PortStats> getPortStats();
+
+    // Session resumption. A dropped connection's manager is kept for
+    // tunnel::kResumeGrace if its session can be resumed (returns true),
+    // otherwise its streams are closed. Hosts pick it up again when a client
+    // names the session; clients call resumeSession() on their new connection.
+    bool suspendSession(HSteamNetConnection conn);
+    void startSession(HSteamNetConnection conn);
+    // sessionId picks the session when a client has several (striping);
+    // empty takes any
+    bool resumeSession(HSteamNetConnection conn, const std::string& sessionId = std::string());
+    // Session of a live connection, empty if none
+    std::string getSessionId(HSteamNetConnection conn);
+    void dropSuspendedSessions();
+    int getSuspendedCount();
+
+    // Backup path (MultiplexManager::pairBackupLink). The client pairs its
+    // backup connection with the session of its main connection; the host
+    // pairs a connection once its SESSION pair frame arrives. Messages on a
+    // paired connection go to the owning session's manager, and
+    // suspendSession() on it just unpairs.
+    void pairBackup(HSteamNetConnection backup, HSteamNetConnection main);
+    MultiplexManager::BackupStats getBackupStats(HSteamNetConnection main);
+
+    // Latency decomposition (MultiplexManager::setTimingEnabled) on every
+    // connection, and on the ones opened later
+    void setTimingEnabled(bool enabled);
+    bool isTimingEnabled() const { return timingEnabled_; }
+    void resetTimingStats();
+    // Per live connection
+    std::vector<std::pair<HSteamNetConnection, MultiplexManager::TimingStats>> getTimingStats();
 
 private:
     void startAsyncPoll();
+    // Host: swap in the suspended manager a SESSION resume frame names
+    std::shared_ptr<MultiplexManager> adoptSession(HSteamNetConnection conn, std::shared_ptr<MultiplexManager> current, const char* data, size_t size);
+    void expireSessions();
+    // Host: pair conn with the session a SESSION pair frame names; false if
+    // the frame is something else
+    bool acceptBackup(HSteamNetConnection conn, const char* data, size_t size);
+    std::shared_ptr<MultiplexManager> backupOwner(HSteamNetConnection conn);
+    // Feeds the flight recorder every flight::kSampleIntervalMs: the longest
+    // gap between polls, messages received, streams behind on their writes
+    void sampleFlight(int messages);
+
+    struct SuspendedSession {
+        std::shared_ptr<MultiplexManager> manager;
+        std::chrono::steady_clock::time_point deadline;
+    };
 
     boost::asio::io_context& io_context_;
-    ISteamNetworkingSockets* m_pInterface_;
+    TunnelTransport* transport_;
     std::vector<HSteamNetConnection>& connections_;
     std::mutex& connectionsMutex_;
     bool& g_isHost_;
     int& localPort_;
+    const PortMappingTable* portMappings_ = nullptr;
+    std::atomic<bool> timingEnabled_{false};
 
     std::map<HSteamNetConnection, std::shared_ptr<MultiplexManager>> multiplexManagers_;
+    std::map<std::string, SuspendedSession> suspended_; // by session id
+    std::map<HSteamNetConnection, std::shared_ptr<MultiplexManager>> backups_; // backup connection -> owner
+    std::mutex managersMutex_;
 
     std::unique_ptr<boost::asio::steady_timer> timer_;
     bool running_;
     int currentPollInterval_; // 当前轮询间隔（毫秒）
+
+    // Flight recorder sampling; poll thread only
+    std::chrono::steady_clock::time_point lastPoll_;
+    std::chrono::steady_clock::time_point lastFlightSample_;
+    int64_t maxPollGapUs_ = 0;
+    int flightMessages_ = 0;
 };
 
 #endif // STEAM_MESSAGE_HANDLER_H
\ No newline at end of file
@@ -0,0 +1,183 @@
+#include "steam_network_thread.h"
+#include "steam_networking_manager.h"
+#include "steam_room_manager.h"
+#include "steam_utils.h"
+#include "../net/tcp_server.h"
+#include "../net/trace.h"
+#include "../net/mem_tracker.h"
+#include "../net/flight_recorder.h"
+#include <iostream>
+
+SteamNetworkThread::SteamNetworkThread(SteamNetworkingManager *manager, SteamRoomManager *roomManager)
+    : manager_(manager), roomManager_(roomManager), running_(false),
+      snapshot_(std::make_shared<NetworkSnapshot>()), sequence_(0) {}
+
+SteamNetworkThread::~SteamNetworkThread()
+{
+    stop();
+}
+
+void SteamNetworkThread::start()
+{
+    if (running_)
+        return;
+    running_ = true;
+    thread_ = std::thread([this]()
+                          { run(); });
+    std::cout << "Steam network thread started" << std::endl;
+}
+
+void SteamNetworkThread::stop()
+{
+    if (!running_)
+        return;
+    running_ = false;
+    if (thread_.joinable())
+    {
+        thread_.join();
+    }
+    // Tasks posted after the last tick would otherwise be lost (e.g. disconnect on exit)
+    runPostedTasks();
+    std::cout << "Steam network thread stopped" << std::endl;
+}
+
+void SteamNetworkThread::post(std::function<void()> task)
+{
+    std::lock_guard<std::mutex> lock(tasksMutex_);
+    tasks_.push_back(std::move(task));
+}
+
+std::shared_ptr<const NetworkSnapshot> SteamNetworkThread::snapshot() const
+{
+    return std::atomic_load(&snapshot_);
+}
+
+void SteamNetworkThread::runPostedTasks()
+{
+    std::vector<std::function<void()>> tasks;
+    {
+        std::lock_guard<std::mutex> lock(tasksMutex_);
+        tasks.swap(tasks_);
+    }
+    for (auto &task : tasks)
+    {
+        task();
+    }
+}
+
+void SteamNetworkThread::run()
+{
+    trace::setThreadName("steam-network");
+    auto nextTick = std::chrono::steady_clock::now();
+    auto lastSnapshot = nextTick - kSnapshotInterval;
+    while (running_)
+    {
+        auto now = std::chrono::steady_clock::now();
+        {
+            TRACE_SPAN("SteamNetworkThread::tick");
+            runPostedTasks();
+
+            // Lobby/friends callbacks and connection status callbacks
+            SteamAPI_RunCallbacks();
+            manager_->runCallbacks();
+            manager_->update();
+            roomManager_->update();
+            memtrack::tick();
+            flight::tick();
+
+            now = std::chrono::steady_clock::now();
+            if (now - lastSnapshot >= kSnapshotInterval)
+            {
+                publishSnapshot();
+                lastSnapshot = now;
+            }
+        }
+
+        nextTick += kTickInterval;
+        if (nextTick < now)
+        {
+            nextTick = now;
+        }
+        std::this_thread::sleep_until(nextTick);
+    }
+}
+
+void SteamNetworkThread::publishSnapshot()
+{
+    // Build the back buffer, then swap it in for readers
+    auto snap = std::make_shared<NetworkSnapshot>();
+    snap->sequence = ++sequence_;
+    snap->isHost = manager_->isHost();
+    snap->isConnected = manager_->isConnected();
+    snap->hostPing = manager_->getHostPing();
+    snap->hostSteamID = manager_->getHostSteamID();
+    snap->selfID = SteamUser()->GetSteamID();
+    snap->currentLobby = roomManager_->getCurrentLobby();
+    snap->readiness = manager_->getReadiness();
+    snap->join = manager_->getJoinTiming();
+    snap->reconnectRemainingMs = manager_->getReconnectRemainingMs();
+    snap->stripes = manager_->getStripeHealth();
+    snap->stripePolicy = manager_->getStripePolicy();
+    snap->backupPath = manager_->getBackupPathStatus();
+    snap->memory = memtrack::stats();
+    if (manager_->getMessageHandler())
+    {
+        snap->suspendedSessions = manager_->getMessageHandler()->getSuspendedCount();
+        snap->ports = manager_->getMessageHandler()->getPortStats();
+        snap->timingEnabled = manager_->getMessageHandler()->isTimingEnabled();
+        snap->timing = manager_->getPeerTiming();
+    }
+
+    auto now = std::chrono::steady_clock::now();
+    if (friendsCache_.empty() || now - lastFriendsRefresh_ >= kFriendsInterval)
+    {
+        friendsCache_ = SteamUtils::getFriendsList();
+        lastFriendsRefresh_ = now;
+    }
+    snap->friends = friendsCache_;
+    snap->lobbies = roomManager_->getLobbies();
+    snap->lobbyMaxPing = roomManager_->getMaxPing();
+
+    std::vector<PeerStatus> peers = manager_->collectPeerStatus();
+    for (const auto &memberID : roomManager_->getLobbyMembers())
+    {
+        MemberSnapshot member;
+        member.steamID = memberID;
+        member.name = SteamFriends()->GetFriendPersonaName(memberID);
+        member.isSelf = memberID == snap->selfID;
+        if (!member.isSelf)
+        {
+            for (const auto &peer : peers)
+            {
+                // Host sees every client; a client only has a connection to the host
+                if (peer.steamID == memberID)
+                {
+                    member.hasConnection = true;
+                    member.ping = peer.ping;
+                    member.relayed = peer.relayed;
+                    member.scheduler = peer.scheduler;
+                    member.path = peer.path;
+                    member.bandwidth = peer.bandwidth;
+                    member.speedTest = peer.speedTest;
+                    break;
+                }
+            }
+        }
+        snap->members.push_back(std::move(member));
+    }
+
+    std::unique_ptr<TCPServer> *server = manager_->getServer();
+    if (server && *server)
+    {
+        snap->serverRunning = true;
+        snap->serverPort = (*server)->getPort();
+        snap->localClients = (*server)->getClientCount();
+        snap->heldClients = (*server)->getHeldCount();
+        const LocalBridge::Stats &local = (*server)->getLocalStats();
+        snap->hostLocalOpened = local.opened;
+        snap->hostLocalBytes = local.bytes;
+        snap->listeners = (*server)->getListenerStatus();
+    }
+
+    std::atomic_store(&snapshot_, std::shared_ptr<const NetworkSnapshot>(std::move(snap)));
+}
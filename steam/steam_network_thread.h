@@ -0,0 +1,115 @@
+#ifndef STEAM_NETWORK_THREAD_H
+#define STEAM_NETWORK_THREAD_H
+
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include <steam_api.h>
+#include "../net/send_scheduler.h"
+#include "../net/mem_tracker.h"
+#include "steam_room_manager.h"
+#include "steam_path_policy.h"
+#include "steam_networking_manager.h"
+
+class SteamNetworkingManager;
+class SteamRoomManager;
+
+// Per-member row of the room status window
+struct MemberSnapshot {
+    CSteamID steamID;
+    std::string name;
+    bool isSelf = false;
+    bool hasConnection = false;
+    int ping = 0;
+    bool relayed = false;
+    SendScheduler::Stats scheduler;
+    PathPolicyState path;
+    BandwidthEstimator::State bandwidth;
+    SpeedTest::Result speedTest; // last test against this member
+};
+
+// Immutable view of everything the UI shows. Built on the network thread and
+// swapped in whole, so the render thread never touches Steam or its locks.
+struct NetworkSnapshot {
+    bool isHost = false;
+    bool isConnected = false;
+    int hostPing = 0;
+    CSteamID selfID;
+    CSteamID hostSteamID;
+    CSteamID currentLobby;
+    std::vector<MemberSnapshot> members;
+    std::vector<std::pair<CSteamID, std::string>> friends;
+    std::vector<LobbyInfo> lobbies; // ranked by estimated ping
+    int lobbyMaxPing = 0;
+    bool serverRunning = false;
+    int serverPort = 0;
+    int localClients = 0;
+    int heldClients = 0; // accepted before the tunnel was up
+    // Host: the host's own game connections, bridged without the tunnel
+    uint64_t hostLocalOpened = 0;
+    uint64_t hostLocalBytes = 0;
+    std::vector<TCPServer::ListenerStatus> listeners;
+    std::map<int, PortStats> ports; // by target port
+    NetworkReadiness readiness;
+    JoinTiming join;
+    int reconnectRemainingMs = -1; // client lost the host and is reconnecting
+    int suspendedSessions = 0;     // host: dropped clients that may come back
+    // Client: connection striping, one entry per stripe
+    std::vector<StripeHealth> stripes;
+    StripePolicy stripePolicy = StripePolicy::Load;
+    BackupPathStatus backupPath; // client
+    // Latency decomposition; empty while off
+    bool timingEnabled = false;
+    std::vector<PeerTiming> timing;
+    // Allocation accounting; empty unless built with CONNECTTOOL_MEMTRACK
+    std::vector<memtrack::TagStats> memory;
+    uint64_t sequence = 0;
+};
+
+// Owns every Steam API interaction. Runs Steam callbacks and connection
+// updates at a fixed rate independent of the render loop, executes commands
+// posted from the UI, and publishes NetworkSnapshot for the UI to read.
+class SteamNetworkThread {
+public:
+    SteamNetworkThread(SteamNetworkingManager* manager, SteamRoomManager* roomManager);
+    ~SteamNetworkThread();
+
+    void start();
+    void stop();
+
+    // Run a task on the network thread (UI button actions and the like)
+    void post(std::function<void()> task);
+
+    std::shared_ptr<const NetworkSnapshot> snapshot() const;
+
+    static constexpr std::chrono::milliseconds kTickInterval{5};
+    static constexpr std::chrono::milliseconds kSnapshotInterval{50};
+    static constexpr std::chrono::milliseconds kFriendsInterval{2000};
+
+private:
+    void run();
+    void runPostedTasks();
+    void publishSnapshot();
+
+    SteamNetworkingManager* manager_;
+    SteamRoomManager* roomManager_;
+
+    std::thread thread_;
+    std::atomic<bool> running_;
+
+    std::mutex tasksMutex_;
+    std::vector<std::function<void()>> tasks_;
+
+    std::shared_ptr<const NetworkSnapshot> snapshot_;
+    uint64_t sequence_;
+    std::vector<std::pair<CSteamID, std::string>> friendsCache_;
+    std::chrono::steady_clock::time_point lastFriendsRefresh_;
+};
+
+#endif // STEAM_NETWORK_THREAD_H
@@ -1,4 +1,7 @@
 #include "steam_networking_manager.h"
+#include "../net/tcp_server.h"
+#include "../net/tunnel_protocol.h"
+#include "../net/flight_recorder.h"
 #include <iostream>
 #include <algorithm>
 
@@ -16,7 +19,7 @@ void SteamNetworkingManager::OnSteamNetConnectionStatusChanged(SteamNetConnectio
 SteamNetworkingManager::SteamNetworkingManager()
     : m_pInterface(nullptr), hListenSock(k_HSteamListenSocket_Invalid), g_isHost(false), g_isClient(false), g_isConnected(false),
       g_hConnection(k_HSteamNetConnection_Invalid),
-      io_context_(nullptr), server_(nullptr), localPort_(nullptr), messageHandler_(nullptr), hostPing_(0)
+      io_context_(nullptr), server_(nullptr), localPort_(nullptr), portMappings_(nullptr), messageHandler_(nullptr), hostPing_(0)
 {
 }
 
@@ -63,16 +66,8 @@ bool SteamNetworkingManager::initialize()
         k_ESteamNetworkingConfig_Int32,
         &nIceEnable);
 
-    // 2. (可选) 极度排斥中继
-    // 如果你铁了心不想走中继，可以给中继路径增加巨大的虚拟延迟惩罚
-    // 这样只有在直连完全打不通（比如防火墙太严格）时，Steam 才会无奈选择中继
-    int32 nSdrPenalty = 10000; // 10000ms 惩罚
-    SteamNetworkingUtils()->SetConfigValue(
-        k_ESteamNetworkingConfig_P2P_Transport_SDR_Penalty,
-        k_ESteamNetworkingConfig_Global,
-        0,
-        k_ESteamNetworkingConfig_Int32,
-        &nSdrPenalty);
+    // 2. 中继惩罚不再固定为 10000ms，由 PathPolicy 按连接实测结果动态调整
+    PathPolicy::applyGlobalDefaults();
 
     // Allow connections from IPs without authentication
     int32 allowWithoutAuth = 2;
@@ -84,7 +79,12 @@ bool SteamNetworkingManager::initialize()
         &allowWithoutAuth);
 
     // Create callbacks after Steam API init
+    // Warm up relay access and our ping location now, so the first join does
+    // not pay for relay discovery; update() tracks when both are ready
+    initializedAt_ = std::chrono::steady_clock::now();
     SteamNetworkingUtils()->InitRelayNetworkAccess();
+    SteamNetworkingUtils()->CheckPingDataUpToDate(60.0f);
+    hostCache_.load();
     SteamNetworkingUtils()->SetGlobalCallback_SteamNetConnectionStatusChanged(OnSteamNetConnectionStatusChanged);
 
     m_pInterface = SteamNetworkingSockets();
@@ -105,6 +105,7 @@ void SteamNetworkingManager::shutdown()
     {
         m_pInterface->CloseListenSocket(hListenSock);
     }
+    closeStripeListeners();
     SteamAPI_Shutdown();
 }
 
@@ -116,23 +117,280 @@ bool SteamNetworkingManager::joinHost(uint64 hostID)
     SteamNetworkingIdentity identity;
     identity.SetSteamID(hostSteamID);
 
-    g_hConnection = m_pInterface->ConnectP2P(identity, 0, 0, nullptr);
+    if (!joining_)
+    {
+        markJoinRequested();
+    }
+    if (readiness_.relay != k_ESteamNetworkingAvailability_Current)
+    {
+        std::cout << "Relay network not ready yet, connection setup may be slower" << std::endl;
+    }
+
+    // Start from the path that worked last time: a host we only ever reached
+    // through the relay gets no SDR penalty, so Steam does not hold off on it
+    // waiting for a direct route
+    std::vector<SteamNetworkingConfigValue_t> options;
+    HostPathRecord cached;
+    joinUsedCache_ = hostCache_.lookup(hostID, cached);
+    if (joinUsedCache_)
+    {
+        std::cout << "Cached path for host: " << (cached.relayed ? "relay" : "direct")
+                  << ", direct " << cached.directPing << "ms, relay " << cached.relayPing << "ms" << std::endl;
+        if (cached.relayed && cached.directPing < 0)
+        {
+            SteamNetworkingConfigValue_t option;
+            option.SetInt32(k_ESteamNetworkingConfig_P2P_Transport_SDR_Penalty, 0);
+            options.push_back(option);
+        }
+    }
+
+    g_hConnection = m_pInterface->ConnectP2P(identity, 0, static_cast<int>(options.size()), options.empty() ? nullptr : options.data());
+    stripes_.reset();
+    stripes_.setConnection(0, g_hConnection);
 
     if (g_hConnection != k_HSteamNetConnection_Invalid)
     {
+        markPhase(joinPhases_.connectStartedMs, "connect started");
         std::cout << "Attempting to connect to host " << hostSteamID.ConvertToUint64() << " with virtual port " << 0 << std::endl;
         return true;
     }
     else
     {
         std::cerr << "Failed to initiate connection" << std::endl;
+        markJoinFailed();
         return false;
     }
 }
 
+int SteamNetworkingManager::getReconnectRemainingMs() const
+{
+    if (!reconnecting_)
+    {
+        return -1;
+    }
+    auto remaining = reconnectStarted_ + tunnel::kResumeGrace - std::chrono::steady_clock::now();
+    return std::max(0, static_cast<int>(std::chrono::duration_cast<std::chrono::milliseconds>(remaining).count()));
+}
+
+void SteamNetworkingManager::updateReconnect()
+{
+    if (!reconnecting_)
+    {
+        return;
+    }
+    std::lock_guard<std::mutex> lock(connectionsMutex);
+    auto now = std::chrono::steady_clock::now();
+    if (now >= reconnectStarted_ + tunnel::kResumeGrace)
+    {
+        // The host has dropped the session by now as well
+        std::cout << "Could not reconnect to host, giving up" << std::endl;
+        reconnecting_ = false;
+        if (g_hConnection != k_HSteamNetConnection_Invalid)
+        {
+            m_pInterface->CloseConnection(g_hConnection, 0, nullptr, false);
+            g_hConnection = k_HSteamNetConnection_Invalid;
+        }
+        // Stripes that survived go too; their streams cannot outlive the session
+        for (const auto &stripe : stripes_.health())
+        {
+            if (stripe.virtualPort > 0 && stripe.conn != k_HSteamNetConnection_Invalid)
+            {
+                m_pInterface->CloseConnection(stripe.conn, 0, nullptr, false);
+                connections.erase(std::remove(connections.begin(), connections.end(), stripe.conn), connections.end());
+            }
+        }
+        stripes_.reset();
+        if (messageHandler_)
+        {
+            messageHandler_->dropSuspendedSessions();
+        }
+        if (server_ && *server_)
+        {
+            (*server_)->setTunnelReady(false);
+        }
+        return;
+    }
+    if (g_hConnection != k_HSteamNetConnection_Invalid || now < nextReconnectAttempt_)
+    {
+        return;
+    }
+    SteamNetworkingIdentity identity;
+    identity.SetSteamID(g_hostSteamID);
+    g_hConnection = m_pInterface->ConnectP2P(identity, 0, 0, nullptr);
+    stripes_.setConnection(0, g_hConnection);
+    nextReconnectAttempt_ = now + kReconnectInterval;
+    std::cout << "Reconnect attempt to host " << g_hostSteamID.ConvertToUint64() << std::endl;
+}
+
+void SteamNetworkingManager::markJoinRequested()
+{
+    joinRequestedAt_ = std::chrono::steady_clock::now();
+    joining_ = true;
+    joinPhases_ = JoinPhases();
+    prepareLocalServer();
+}
+
+std::unique_ptr<TCPServer> SteamNetworkingManager::markJoinFailed()
+{
+    joining_ = false;
+    if (g_isHost || !server_)
+    {
+        return nullptr;
+    }
+    // Its destructor closes the held connections along with the listeners
+    return std::move(*server_);
+}
+
+void SteamNetworkingManager::markLobbyEntered()
+{
+    if (joining_)
+    {
+        markPhase(joinPhases_.lobbyEnteredMs, "lobby entered");
+    }
+}
+
+int SteamNetworkingManager::sinceJoinRequested() const
+{
+    return static_cast<int>(std::chrono::duration_cast<std::chrono::milliseconds>(
+                                std::chrono::steady_clock::now() - joinRequestedAt_)
+                                .count());
+}
+
+void SteamNetworkingManager::markPhase(int &phase, const char *name)
+{
+    phase = sinceJoinRequested();
+    std::cout << "[join] " << name << ": " << phase << " ms" << std::endl;
+}
+
+void SteamNetworkingManager::prepareLocalServer()
+{
+    if (!server_ || *server_)
+    {
+        // Still listening from an earlier attempt
+        if (server_ && *server_)
+        {
+            joinPhases_.listenerReadyMs = 0;
+        }
+        return;
+    }
+    if (startLocalListener())
+    {
+        markPhase(joinPhases_.listenerReadyMs, "listener ready");
+    }
+}
+
+bool SteamNetworkingManager::startLocalListener()
+{
+    if (!server_ || !portMappings_)
+    {
+        return false;
+    }
+    if (*server_)
+    {
+        return true;
+    }
+    *server_ = std::make_unique<TCPServer>(*portMappings_, this);
+    if (!(*server_)->start())
+    {
+        std::cerr << "Failed to start TCP server" << std::endl;
+        server_->reset();
+        return false;
+    }
+    return true;
+}
+
+JoinTiming SteamNetworkingManager::getJoinTiming() const
+{
+    JoinTiming timing;
+    timing.joining = joining_;
+    if (joining_)
+    {
+        timing.elapsedMs = sinceJoinRequested();
+    }
+    timing.lastJoinMs = lastJoinMs_;
+    timing.usedCachedPath = joinUsedCache_;
+    timing.phases = joinPhases_;
+    return timing;
+}
+
+void SteamNetworkingManager::updateReadiness()
+{
+    auto sinceInit = [this]()
+    {
+        return static_cast<int>(std::chrono::duration_cast<std::chrono::milliseconds>(
+                                    std::chrono::steady_clock::now() - initializedAt_)
+                                    .count());
+    };
+    ESteamNetworkingAvailability relay = SteamNetworkingUtils()->GetRelayNetworkStatus(nullptr);
+    if (relay != readiness_.relay)
+    {
+        readiness_.relay = relay;
+        if (relay == k_ESteamNetworkingAvailability_Current && readiness_.relayReadyMs < 0)
+        {
+            readiness_.relayReadyMs = sinceInit();
+            std::cout << "Relay network ready after " << readiness_.relayReadyMs << "ms" << std::endl;
+        }
+        else if (relay < 0)
+        {
+            std::cerr << "Relay network unavailable (" << relay << ")" << std::endl;
+        }
+    }
+    if (!readiness_.pingLocationReady)
+    {
+        SteamNetworkingPingLocation_t location;
+        if (SteamNetworkingUtils()->GetLocalPingLocation(location) >= 0.0f)
+        {
+            readiness_.pingLocationReady = true;
+            readiness_.pingLocationReadyMs = sinceInit();
+            std::cout << "Ping location ready after " << readiness_.pingLocationReadyMs << "ms" << std::endl;
+        }
+    }
+}
+
+void SteamNetworkingManager::rememberHostPath()
+{
+    if (!g_isClient || g_hConnection == k_HSteamNetConnection_Invalid)
+    {
+        return;
+    }
+    auto policy = pathPolicies_.find(g_hConnection);
+    if (policy == pathPolicies_.end())
+    {
+        return;
+    }
+    HostPathRecord record;
+    hostCache_.lookup(g_hostSteamID.ConvertToUint64(), record);
+    record.steamID = g_hostSteamID.ConvertToUint64();
+    const PathPolicyState &state = policy->second.state();
+    record.relayed = state.relayed;
+    // Only measured values replace what we knew before
+    if (state.direct.valid() && !state.direct.estimated)
+    {
+        record.directPing = state.direct.ping;
+    }
+    if (state.relay.valid() && !state.relay.estimated)
+    {
+        record.relayPing = state.relay.ping;
+    }
+    if (lastJoinMs_ >= 0)
+    {
+        record.connectMs = lastJoinMs_;
+    }
+    hostCache_.remember(record);
+}
+
 void SteamNetworkingManager::disconnect()
 {
     std::lock_guard<std::mutex> lock(connectionsMutex);
+    rememberHostPath();
+    hostCache_.save();
+    joining_ = false;
+    reconnecting_ = false;
+    if (messageHandler_)
+    {
+        messageHandler_->dropSuspendedSessions();
+    }
+    closeBackupPath();
     
     // Close client connection
     if (g_hConnection != k_HSteamNetConnection_Invalid)
@@ -154,6 +412,8 @@ void SteamNetworkingManager::disconnect()
         m_pInterface->CloseListenSocket(hListenSock);
         hListenSock = k_HSteamListenSocket_Invalid;
     }
+    closeStripeListeners();
+    stripes_.reset();
     
     // Reset state
     g_isHost = false;
@@ -164,12 +424,15 @@ void SteamNetworkingManager::disconnect()
     std::cout << "Disconnected from network" << std::endl;
 }
 
-void SteamNetworkingManager::setMessageHandlerDependencies(boost::asio::io_context &io_context, std::unique_ptr<TCPServer> &server, int &localPort)
+void SteamNetworkingManager::setMessageHandlerDependencies(boost::asio::io_context &io_context, std::unique_ptr<TCPServer> &server, int &localPort, PortMappingTable &portMappings)
 {
     io_context_ = &io_context;
     server_ = &server;
     localPort_ = &localPort;
-    messageHandler_ = new SteamMessageHandler(io_context, m_pInterface, connections, connectionsMutex, g_isHost, localPort);
+    portMappings_ = &portMappings;
+    transport_ = std::make_unique<SteamTunnelTransport>(m_pInterface);
+    messageHandler_ = new SteamMessageHandler(io_context, transport_.get(), connections, connectionsMutex, g_isHost, localPort);
+    messageHandler_->setPortMappings(&portMappings);
 }
 
 void SteamNetworkingManager::startMessageHandler()
@@ -189,17 +452,512 @@ void SteamNetworkingManager::stopMessageHandler()
 }
 
 void SteamNetworkingManager::update()
+{
+    std::vector<HSteamNetConnection> conns;
+    {
+        std::lock_guard<std::mutex> lock(connectionsMutex);
+        // Update ping to host/client connection
+        if (g_hConnection != k_HSteamNetConnection_Invalid)
+        {
+            SteamNetConnectionRealTimeStatus_t status;
+            if (m_pInterface->GetConnectionRealTimeStatus(g_hConnection, &status, 0, nullptr) == k_EResultOK)
+            {
+                hostPing_ = status.m_nPing;
+            }
+        }
+        conns = connections;
+        if (g_hConnection != k_HSteamNetConnection_Invalid &&
+            std::find(conns.begin(), conns.end(), g_hConnection) == conns.end())
+        {
+            conns.push_back(g_hConnection);
+        }
+    }
+
+    updateReadiness();
+    updateReconnect();
+
+    auto now = std::chrono::steady_clock::now();
+    if (now - lastPathUpdate_ >= std::chrono::seconds(1))
+    {
+        lastPathUpdate_ = now;
+        updatePathPolicies(conns);
+    }
+    if (now - lastRateUpdate_ >= BandwidthEstimator::kSampleInterval)
+    {
+        lastRateUpdate_ = now;
+        updateRateControl(conns);
+    }
+    if (now - lastStripeUpdate_ >= BandwidthEstimator::kSampleInterval)
+    {
+        lastStripeUpdate_ = now;
+        updateStripes(conns);
+        updateBackupPath();
+    }
+    if (now - lastFlightSample_ >= std::chrono::milliseconds(flight::kSampleIntervalMs))
+    {
+        lastFlightSample_ = now;
+        sampleFlight(conns);
+    }
+}
+
+void SteamNetworkingManager::sampleFlight(const std::vector<HSteamNetConnection>& conns)
+{
+    for (HSteamNetConnection conn : conns)
+    {
+        SteamNetConnectionRealTimeStatus_t status;
+        if (m_pInterface->GetConnectionRealTimeStatus(conn, &status, 0, nullptr) != k_EResultOK)
+        {
+            continue;
+        }
+        flight::record(flight::Metric::Ping, conn, status.m_nPing);
+        flight::record(flight::Metric::QueueTime, conn, status.m_usecQueueTime);
+        flight::record(flight::Metric::PendingReliable, conn, status.m_cbPendingReliable);
+    }
+}
+
+void SteamNetworkingManager::setStriping(int count, StripePolicy policy)
+{
+    stripes_.configure(count, policy);
+    std::cout << "Connection striping: " << stripes_.count() << " connections, "
+              << (policy == StripePolicy::Hash ? "hash" : "load") << " placement" << std::endl;
+}
+
+HSteamNetConnection SteamNetworkingManager::pickConnection(unsigned hashKey)
+{
+    if (g_isClient)
+    {
+        HSteamNetConnection conn = stripes_.pick(hashKey);
+        if (conn != k_HSteamNetConnection_Invalid)
+        {
+            return conn;
+        }
+    }
+    return g_hConnection;
+}
+
+void SteamNetworkingManager::openStripeListeners()
+{
+    // Cheap to keep open; clients decide how many stripes they use
+    for (int port = 1; port < StripeSet::kMaxStripes; ++port)
+    {
+        HSteamListenSocket sock = m_pInterface->CreateListenSocketP2P(port, 0, nullptr);
+        if (sock == k_HSteamListenSocket_Invalid)
+        {
+            std::cerr << "Failed to listen for stripes on virtual port " << port << std::endl;
+            continue;
+        }
+        stripeListenSocks_.push_back(sock);
+    }
+    HSteamListenSocket backup = m_pInterface->CreateListenSocketP2P(kBackupVirtualPort, 0, nullptr);
+    if (backup == k_HSteamListenSocket_Invalid)
+    {
+        std::cerr << "Failed to listen for backup paths on virtual port " << kBackupVirtualPort << std::endl;
+        return;
+    }
+    stripeListenSocks_.push_back(backup);
+}
+
+void SteamNetworkingManager::closeStripeListeners()
+{
+    for (auto sock : stripeListenSocks_)
+    {
+        m_pInterface->CloseListenSocket(sock);
+    }
+    stripeListenSocks_.clear();
+}
+
+void SteamNetworkingManager::updateStripes(const std::vector<HSteamNetConnection> &conns)
+{
+    if (!g_isClient)
+    {
+        return;
+    }
+    auto now = std::chrono::steady_clock::now();
+    for (auto conn : conns)
+    {
+        int index = stripes_.indexOf(conn);
+        SteamNetConnectionRealTimeStatus_t status;
+        if (index < 0 || m_pInterface->GetConnectionRealTimeStatus(conn, &status, 0, nullptr) != k_EResultOK)
+        {
+            continue;
+        }
+        int streams = messageHandler_ ? messageHandler_->getMultiplexManager(conn)->getClientCount() : 0;
+        stripes_.sample(index, status, streams, now);
+    }
+    // More stripes only next to a working main connection
+    if (!g_isConnected || reconnecting_ || g_hConnection == k_HSteamNetConnection_Invalid)
+    {
+        return;
+    }
+    SteamNetworkingIdentity identity;
+    identity.SetSteamID(g_hostSteamID);
+    for (int index : stripes_.dueForConnect(now))
+    {
+        HSteamNetConnection conn = m_pInterface->ConnectP2P(identity, index, 0, nullptr);
+        if (conn == k_HSteamNetConnection_Invalid)
+        {
+            stripes_.markClosed(index, std::string(), kReconnectInterval);
+            continue;
+        }
+        stripes_.setConnection(index, conn);
+        std::cout << "Opening stripe " << index << " to host on virtual port " << index << std::endl;
+    }
+}
+
+bool SteamNetworkingManager::handleStripeStatus(SteamNetConnectionStatusChangedCallback_t *pInfo)
+{
+    // Caller holds connectionsMutex
+    int index = stripes_.indexOf(pInfo->m_hConn);
+    if (index <= 0)
+    {
+        return false;
+    }
+    HSteamNetConnection conn = pInfo->m_hConn;
+    ESteamNetworkingConnectionState state = pInfo->m_info.m_eState;
+    if (pInfo->m_eOldState == k_ESteamNetworkingConnectionState_None && state == k_ESteamNetworkingConnectionState_Connecting)
+    {
+        // Polled by the message handler like the main connection
+        connections.push_back(conn);
+    }
+    else if (state == k_ESteamNetworkingConnectionState_Connected)
+    {
+        stripes_.markConnected(index);
+        std::string session = stripes_.takeSession(index);
+        bool resumed = false;
+        if (messageHandler_ && !session.empty())
+        {
+            resumed = messageHandler_->resumeSession(conn, session);
+        }
+        else if (messageHandler_)
+        {
+            messageHandler_->startSession(conn);
+        }
+        std::cout << "Stripe " << index << " connected" << (resumed ? ", resuming its session" : "") << std::endl;
+    }
+    else if (state == k_ESteamNetworkingConnectionState_ClosedByPeer || state == k_ESteamNetworkingConnectionState_ProblemDetectedLocally)
+    {
+        std::string session = messageHandler_ ? messageHandler_->getSessionId(conn) : std::string();
+        bool suspended = messageHandler_ && messageHandler_->suspendSession(conn);
+        stripes_.markClosed(index, suspended ? session : std::string(),
+                            suspended ? std::chrono::steady_clock::duration::zero() : std::chrono::steady_clock::duration(kReconnectInterval));
+        m_pInterface->CloseConnection(conn, 0, nullptr, false);
+        connections.erase(std::remove(connections.begin(), connections.end(), conn), connections.end());
+        std::cout << "Stripe " << index << " closed: " << pInfo->m_info.m_szEndDebug << std::endl;
+    }
+    return true;
+}
+
+void SteamNetworkingManager::setBackupPath(bool enabled)
 {
     std::lock_guard<std::mutex> lock(connectionsMutex);
-    // Update ping to host/client connection
-    if (g_hConnection != k_HSteamNetConnection_Invalid)
+    backupEnabled_ = enabled;
+    backupFailures_ = 0;
+    nextBackupAttempt_ = std::chrono::steady_clock::time_point();
+    if (!enabled)
+    {
+        closeBackupPath();
+    }
+    std::cout << "Backup path " << (enabled ? "enabled" : "disabled") << std::endl;
+}
+
+BackupPathStatus SteamNetworkingManager::getBackupPathStatus()
+{
+    BackupPathStatus status;
+    HSteamNetConnection main;
+    {
+        std::lock_guard<std::mutex> lock(connectionsMutex);
+        status.enabled = backupEnabled_;
+        status.connected = backupConnected_;
+        status.failures = backupFailures_;
+        main = g_hConnection;
+        if (backupConnected_)
+        {
+            SteamNetConnectionInfo_t info;
+            if (m_pInterface->GetConnectionInfo(backupConn_, &info))
+            {
+                status.relayed = (info.m_nFlags & k_nSteamNetworkConnectionInfoFlags_Relayed) != 0;
+            }
+            status.ping = getConnectionPing(backupConn_);
+        }
+    }
+    if (messageHandler_ && g_isClient && main != k_HSteamNetConnection_Invalid)
+    {
+        status.stats = messageHandler_->getBackupStats(main);
+    }
+    return status;
+}
+
+void SteamNetworkingManager::updateBackupPath()
+{
+    std::lock_guard<std::mutex> lock(connectionsMutex);
+    if (!g_isClient || !backupEnabled_ || backupConn_ != k_HSteamNetConnection_Invalid)
+    {
+        return;
+    }
+    // Next to a working main connection only, like the stripes; an old host
+    // does not listen on the port, so give up after a few attempts
+    auto now = std::chrono::steady_clock::now();
+    if (!g_isConnected || reconnecting_ || g_hConnection == k_HSteamNetConnection_Invalid ||
+        backupFailures_ >= StripeSet::kMaxFailures || now < nextBackupAttempt_)
+    {
+        return;
+    }
+    SteamNetworkingIdentity identity;
+    identity.SetSteamID(g_hostSteamID);
+    // Relay only: a direct main connection and this one share no hop but the
+    // last mile. With a relayed main connection both use relays.
+    SteamNetworkingConfigValue_t option;
+    option.SetInt32(k_ESteamNetworkingConfig_P2P_Transport_ICE_Enable, k_nSteamNetworkingConfig_P2P_Transport_ICE_Enable_Disable);
+    backupConn_ = m_pInterface->ConnectP2P(identity, kBackupVirtualPort, 1, &option);
+    nextBackupAttempt_ = now + kReconnectInterval;
+    if (backupConn_ == k_HSteamNetConnection_Invalid)
+    {
+        backupFailures_++;
+        return;
+    }
+    std::cout << "Opening backup path to host on virtual port " << kBackupVirtualPort << std::endl;
+}
+
+void SteamNetworkingManager::closeBackupPath()
+{
+    if (backupConn_ == k_HSteamNetConnection_Invalid)
+    {
+        return;
+    }
+    if (messageHandler_)
+    {
+        messageHandler_->suspendSession(backupConn_);
+    }
+    m_pInterface->CloseConnection(backupConn_, 0, nullptr, false);
+    connections.erase(std::remove(connections.begin(), connections.end(), backupConn_), connections.end());
+    backupConn_ = k_HSteamNetConnection_Invalid;
+    backupConnected_ = false;
+}
+
+bool SteamNetworkingManager::handleBackupStatus(SteamNetConnectionStatusChangedCallback_t *pInfo)
+{
+    // Caller holds connectionsMutex
+    if (backupConn_ == k_HSteamNetConnection_Invalid || pInfo->m_hConn != backupConn_)
+    {
+        return false;
+    }
+    ESteamNetworkingConnectionState state = pInfo->m_info.m_eState;
+    if (pInfo->m_eOldState == k_ESteamNetworkingConnectionState_None && state == k_ESteamNetworkingConnectionState_Connecting)
+    {
+        connections.push_back(backupConn_);
+    }
+    else if (state == k_ESteamNetworkingConnectionState_Connected)
+    {
+        backupConnected_ = true;
+        backupFailures_ = 0;
+        if (messageHandler_ && g_hConnection != k_HSteamNetConnection_Invalid)
+        {
+            messageHandler_->pairBackup(backupConn_, g_hConnection);
+        }
+        std::cout << "Backup path connected" << std::endl;
+    }
+    else if (state == k_ESteamNetworkingConnectionState_ClosedByPeer || state == k_ESteamNetworkingConnectionState_ProblemDetectedLocally)
+    {
+        if (!backupConnected_)
+        {
+            backupFailures_++;
+        }
+        std::cout << "Backup path closed: " << pInfo->m_info.m_szEndDebug << std::endl;
+        closeBackupPath();
+        nextBackupAttempt_ = std::chrono::steady_clock::now() + kReconnectInterval;
+    }
+    return true;
+}
+
+void SteamNetworkingManager::updatePathPolicies(const std::vector<HSteamNetConnection> &conns)
+{
+    // Forget policies of closed connections
+    for (auto it = pathPolicies_.begin(); it != pathPolicies_.end();)
+    {
+        if (std::find(conns.begin(), conns.end(), it->first) == conns.end())
+        {
+            it = pathPolicies_.erase(it);
+        }
+        else
+        {
+            ++it;
+        }
+    }
+    for (auto conn : conns)
+    {
+        auto it = pathPolicies_.find(conn);
+        if (it == pathPolicies_.end())
+        {
+            it = pathPolicies_.emplace(conn, PathPolicy(conn)).first;
+            HostPathRecord cached;
+            if (g_isClient && conn == g_hConnection && hostCache_.lookup(g_hostSteamID.ConvertToUint64(), cached))
+            {
+                it->second.seed(cached.directPing, cached.relayPing);
+            }
+        }
+        SteamNetConnectionInfo_t info;
+        SteamNetworkingPingLocation_t location;
+        bool haveLocation = pingLocationProvider_ && m_pInterface->GetConnectionInfo(conn, &info) &&
+                            pingLocationProvider_(info.m_identityRemote.GetSteamID(), location);
+        it->second.update(m_pInterface, haveLocation ? &location : nullptr);
+    }
+    rememberHostPath();
+}
+
+void SteamNetworkingManager::updateRateControl(const std::vector<HSteamNetConnection> &conns)
+{
+    for (auto it = rateEstimators_.begin(); it != rateEstimators_.end();)
+    {
+        if (std::find(conns.begin(), conns.end(), it->first) == conns.end())
+        {
+            it = rateEstimators_.erase(it);
+        }
+        else
+        {
+            ++it;
+        }
+    }
+    auto now = std::chrono::steady_clock::now();
+    for (auto conn : conns)
     {
         SteamNetConnectionRealTimeStatus_t status;
-        if (m_pInterface->GetConnectionRealTimeStatus(g_hConnection, &status, 0, nullptr))
+        if (m_pInterface->GetConnectionRealTimeStatus(conn, &status, 0, nullptr) != k_EResultOK)
         {
-            hostPing_ = status.m_nPing;
+            continue;
+        }
+        BandwidthEstimator &estimator = rateEstimators_[conn];
+        if (!estimator.update(status, now))
+        {
+            continue;
+        }
+        // Steam sends at a fixed rate between the two bounds; pin both to the estimate
+        const BandwidthEstimator::State &state = estimator.state();
+        SteamNetworkingUtils()->SetConnectionConfigValueInt32(conn, k_ESteamNetworkingConfig_SendRateMin, state.sendRate);
+        SteamNetworkingUtils()->SetConnectionConfigValueInt32(conn, k_ESteamNetworkingConfig_SendRateMax, state.sendRate);
+        std::cout << "Send rate for connection " << conn << ": " << state.sendRate / 1024 << " KB/s ("
+                  << BandwidthEstimator::modeName(state.mode) << ", bottleneck " << static_cast<int>(state.bottleneck / 1024)
+                  << " KB/s, min rtt " << state.minRttMs << " ms, loss " << state.loss * 100.0f << "%)" << std::endl;
+    }
+}
+
+void SteamNetworkingManager::runCallbacks()
+{
+    if (m_pInterface)
+    {
+        m_pInterface->RunCallbacks();
+    }
+}
+
+std::vector<PeerStatus> SteamNetworkingManager::collectPeerStatus()
+{
+    std::vector<HSteamNetConnection> conns;
+    {
+        std::lock_guard<std::mutex> lock(connectionsMutex);
+        conns = connections;
+        if (g_hConnection != k_HSteamNetConnection_Invalid &&
+            std::find(conns.begin(), conns.end(), g_hConnection) == conns.end())
+        {
+            conns.push_back(g_hConnection);
+        }
+    }
+    std::vector<PeerStatus> peers;
+    for (auto conn : conns)
+    {
+        SteamNetConnectionInfo_t info;
+        if (!m_pInterface->GetConnectionInfo(conn, &info))
+        {
+            continue;
+        }
+        PeerStatus peer;
+        peer.steamID = info.m_identityRemote.GetSteamID();
+        peer.conn = conn;
+        peer.ping = getConnectionPing(conn);
+        peer.relayed = (info.m_nFlags & k_nSteamNetworkConnectionInfoFlags_Relayed) != 0;
+        if (messageHandler_)
+        {
+            auto manager = messageHandler_->getMultiplexManager(conn);
+            peer.scheduler = manager->getSchedulerStats();
+            peer.speedTest = manager->getSpeedTestResult();
         }
+        auto policy = pathPolicies_.find(conn);
+        if (policy != pathPolicies_.end())
+        {
+            peer.path = policy->second.state();
+        }
+        auto estimator = rateEstimators_.find(conn);
+        if (estimator != rateEstimators_.end())
+        {
+            peer.bandwidth = estimator->second.state();
+        }
+        peers.push_back(peer);
     }
+    return peers;
+}
+
+std::vector<PeerTiming> SteamNetworkingManager::getPeerTiming()
+{
+    std::vector<PeerTiming> peers;
+    if (!messageHandler_ || !messageHandler_->isTimingEnabled())
+    {
+        return peers;
+    }
+    for (auto &entry : messageHandler_->getTimingStats())
+    {
+        SteamNetConnectionInfo_t info;
+        if (!m_pInterface->GetConnectionInfo(entry.first, &info))
+        {
+            continue;
+        }
+        CSteamID steamID = info.m_identityRemote.GetSteamID();
+        MultiplexManager::TimingStats &stats = entry.second;
+        auto peer = std::find_if(peers.begin(), peers.end(), [&](const PeerTiming &p)
+                                 { return p.steamID == steamID; });
+        if (peer == peers.end())
+        {
+            peers.push_back(PeerTiming{steamID, std::move(stats)});
+            continue;
+        }
+        // Another stripe to the same peer
+        MultiplexManager::TimingStats &merged = peer->stats;
+        if (stats.clockSynced && (!merged.clockSynced || stats.clockRttUs < merged.clockRttUs))
+        {
+            merged.clockOffsetUs = stats.clockOffsetUs;
+            merged.clockRttUs = stats.clockRttUs;
+        }
+        merged.clockSynced = merged.clockSynced || stats.clockSynced;
+        merged.peerSilent = merged.peerSilent && stats.peerSilent;
+        for (int hop = 0; hop < timing::kHopCount; ++hop)
+        {
+            merged.total.hops[hop].merge(stats.total.hops[hop]);
+        }
+        merged.total.samples += stats.total.samples;
+        merged.streams.insert(merged.streams.end(), stats.streams.begin(), stats.streams.end());
+    }
+    return peers;
+}
+
+bool SteamNetworkingManager::startSpeedTest(CSteamID peer, int phaseSeconds)
+{
+    if (!messageHandler_)
+    {
+        return false;
+    }
+    std::vector<HSteamNetConnection> conns;
+    {
+        std::lock_guard<std::mutex> lock(connectionsMutex);
+        conns = connections;
+        conns.push_back(g_hConnection);
+    }
+    for (auto conn : conns)
+    {
+        SteamNetConnectionInfo_t info;
+        if (conn != k_HSteamNetConnection_Invalid && m_pInterface->GetConnectionInfo(conn, &info) &&
+            info.m_identityRemote.GetSteamID() == peer)
+        {
+            return messageHandler_->getMultiplexManager(conn)->startSpeedTest(phaseSeconds);
+        }
+    }
+    return false;
 }
 
 int SteamNetworkingManager::getConnectionPing(HSteamNetConnection conn) const
@@ -232,12 +990,19 @@ std::string SteamNetworkingManager::getConnectionRelayInfo(HSteamNetConnection c
 
 void SteamNetworkingManager::handleConnectionStatusChanged(SteamNetConnectionStatusChangedCallback_t *pInfo)
 {
+    // Declared before the lock, so a failed join's listener is stopped after
+    // connectionsMutex is released
+    std::unique_ptr<TCPServer> failedServer;
     std::lock_guard<std::mutex> lock(connectionsMutex);
     std::cout << "Connection status changed: " << pInfo->m_info.m_eState << " for connection " << pInfo->m_hConn << std::endl;
     if (pInfo->m_info.m_eState == k_ESteamNetworkingConnectionState_ProblemDetectedLocally)
     {
         std::cout << "Connection failed: " << pInfo->m_info.m_szEndDebug << std::endl;
     }
+    if (handleStripeStatus(pInfo) || handleBackupStatus(pInfo))
+    {
+        return;
+    }
     if (pInfo->m_eOldState == k_ESteamNetworkingConnectionState_None && pInfo->m_info.m_eState == k_ESteamNetworkingConnectionState_Connecting)
     {
         m_pInterface->AcceptConnection(pInfo->m_hConn);
@@ -253,10 +1018,45 @@ void SteamNetworkingManager::handleConnectionStatusChanged(SteamNetConnectionSta
             std::cout << "Incoming connection details: ping=" << status.m_nPing << "ms, relay=" << (info.m_idPOPRelay != 0 ? "yes" : "no") << std::endl;
         }
     }
-    else if (pInfo->m_eOldState == k_ESteamNetworkingConnectionState_Connecting && pInfo->m_info.m_eState == k_ESteamNetworkingConnectionState_Connected)
+    else if (pInfo->m_info.m_eState == k_ESteamNetworkingConnectionState_FindingRoute)
+    {
+        if (joining_ && pInfo->m_hConn == g_hConnection)
+        {
+            markPhase(joinPhases_.findingRouteMs, "finding route");
+        }
+    }
+    // P2P connections usually pass through FindingRoute on the way
+    else if ((pInfo->m_eOldState == k_ESteamNetworkingConnectionState_Connecting || pInfo->m_eOldState == k_ESteamNetworkingConnectionState_FindingRoute) && pInfo->m_info.m_eState == k_ESteamNetworkingConnectionState_Connected)
     {
         g_isConnected = true;
         std::cout << "Connected to host" << std::endl;
+        if (joining_)
+        {
+            joining_ = false;
+            markPhase(joinPhases_.connectedMs, "connected");
+            lastJoinMs_ = joinPhases_.connectedMs;
+            std::cout << "Join took " << lastJoinMs_ << "ms" << (joinUsedCache_ ? " (cached path)" : "") << std::endl;
+        }
+        if (g_isClient && pInfo->m_hConn == g_hConnection)
+        {
+            stripes_.markConnected(0);
+            if (messageHandler_ && reconnecting_)
+            {
+                reconnecting_ = false;
+                auto downFor = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - reconnectStarted_).count();
+                bool resumed = messageHandler_->resumeSession(pInfo->m_hConn, primarySession_);
+                std::cout << "Reconnected to host after " << downFor << "ms" << (resumed ? ", resuming session" : ", session expired") << std::endl;
+            }
+            else if (messageHandler_)
+            {
+                messageHandler_->startSession(pInfo->m_hConn);
+            }
+            if (server_ && *server_)
+            {
+                // Hand over the game connections accepted during the join
+                (*server_)->setTunnelReady(true);
+            }
+        }
         // Log connection info
         SteamNetConnectionInfo_t info;
         SteamNetConnectionRealTimeStatus_t status;
@@ -268,6 +1068,46 @@ void SteamNetworkingManager::handleConnectionStatusChanged(SteamNetConnectionSta
     }
     else if (pInfo->m_info.m_eState == k_ESteamNetworkingConnectionState_ClosedByPeer || pInfo->m_info.m_eState == k_ESteamNetworkingConnectionState_ProblemDetectedLocally)
     {
+        if (joining_ && pInfo->m_hConn == g_hConnection)
+        {
+            std::cout << "Join failed" << std::endl;
+            failedServer = markJoinFailed();
+        }
+        if (g_isClient && pInfo->m_hConn == g_hConnection && messageHandler_)
+        {
+            // Stripes have sessions of their own; the reconnect resumes this one
+            primarySession_ = messageHandler_->getSessionId(pInfo->m_hConn);
+        }
+        if (g_isClient && pInfo->m_hConn == g_hConnection)
+        {
+            // Paired with the old connection; reopened once the session is back
+            closeBackupPath();
+        }
+        // Streams of a resumable session are kept for tunnel::kResumeGrace
+        bool suspended = messageHandler_ && messageHandler_->suspendSession(pInfo->m_hConn);
+        if (pInfo->m_hConn == g_hConnection)
+        {
+            stripes_.markClosed(0, std::string(), std::chrono::steady_clock::duration::zero());
+            rememberHostPath();
+            hostCache_.save();
+            if (g_isClient && server_ && *server_)
+            {
+                // New game connections wait for the reconnect
+                (*server_)->setTunnelReady(false);
+            }
+            if (g_isClient && (suspended || reconnecting_))
+            {
+                if (!reconnecting_)
+                {
+                    reconnecting_ = true;
+                    reconnectStarted_ = std::chrono::steady_clock::now();
+                    std::cout << "Connection to host lost, reconnecting" << std::endl;
+                }
+                nextReconnectAttempt_ = std::chrono::steady_clock::now() + (suspended ? std::chrono::seconds(0) : kReconnectInterval);
+            }
+        }
+        // Closed connections keep their handle until released
+        m_pInterface->CloseConnection(pInfo->m_hConn, 0, nullptr, false);
         g_isConnected = false;
         g_hConnection = k_HSteamNetConnection_Invalid;
         // Remove from connections
@@ -5,11 +5,18 @@
 #include <map>
 #include <mutex>
 #include <memory>
+#include <functional>
+#include <chrono>
 #include <steam_api.h>
 #include <isteamnetworkingsockets.h>
 #include <isteamnetworkingutils.h>
 #include <steamnetworkingtypes.h>
 #include "steam_message_handler.h"
+#include "steam_path_policy.h"
+#include "steam_tunnel_transport.h"
+#include "steam_host_cache.h"
+#include "steam_stripe_set.h"
+#include "../net/bandwidth_estimator.h"
 
 // Forward declarations
 class TCPServer;
@@ -23,6 +30,61 @@ struct UserInfo {
     bool isRelay;
 };
 
+// Live state of one Steam connection, collected on the network thread
+struct PeerStatus {
+    CSteamID steamID;
+    HSteamNetConnection conn;
+    int ping;
+    bool relayed;
+    SendScheduler::Stats scheduler;
+    PathPolicyState path;
+    BandwidthEstimator::State bandwidth;
+    SpeedTest::Result speedTest;
+};
+
+// Client: the backup path to the host as the UI shows it
+struct BackupPathStatus {
+    bool enabled = false;
+    bool connected = false;
+    bool relayed = false;
+    int ping = 0;
+    int failures = 0;
+    MultiplexManager::BackupStats stats; // of the main connection's session
+};
+
+// Latency decomposition of the data one peer sends us; a client's stripes
+// to the host are merged
+struct PeerTiming {
+    CSteamID steamID;
+    MultiplexManager::TimingStats stats;
+};
+
+// Relay network and ping location warm-up, tracked from launch
+struct NetworkReadiness {
+    ESteamNetworkingAvailability relay = k_ESteamNetworkingAvailability_Unknown;
+    bool pingLocationReady = false;
+    int relayReadyMs = -1;        // after initialize(), -1 while not ready
+    int pingLocationReadyMs = -1;
+};
+
+// Milliseconds from the join click to each step, -1 if not reached (yet)
+struct JoinPhases {
+    int listenerReadyMs = -1;  // local TCP server listening
+    int lobbyEnteredMs = -1;   // only when joining through a lobby
+    int connectStartedMs = -1; // ConnectP2P issued
+    int findingRouteMs = -1;   // host answered, ICE/relay route search
+    int connectedMs = -1;
+};
+
+// Join click to connected
+struct JoinTiming {
+    bool joining = false;
+    int elapsedMs = 0;    // of the join in progress
+    int lastJoinMs = -1;  // of the last successful join
+    bool usedCachedPath = false;
+    JoinPhases phases;    // of the current or last join
+};
+
 class SteamNetworkingManager {
 public:
     static SteamNetworkingManager* instance;
@@ -35,6 +97,19 @@ public:
     // Joining
     bool joinHost(uint64 hostID);
     void disconnect();
+    // Start the join clock and the local listener; called when the user asks
+    // to join (lobby or ID), so the listener is up before the tunnel is
+    void markJoinRequested();
+    void markLobbyEntered();
+    // Also takes the listener, so game connections held during the join are
+    // closed instead of going to the next host joined. Destroying the result
+    // stops it and joins its thread, so callers holding connectionsMutex keep
+    // it until the lock is released.
+    std::unique_ptr<TCPServer> markJoinFailed();
+    JoinTiming getJoinTiming() const;
+    // Time left to get a dropped connection back, -1 if not reconnecting
+    int getReconnectRemainingMs() const;
+    const NetworkReadiness& getReadiness() const { return readiness_; }
 
     // Getters
     bool isHost() const { return g_isHost; }
@@ -50,12 +125,15 @@ public:
     // For SteamRoomManager access
     std::unique_ptr<TCPServer>*& getServer() { return server_; }
     int*& getLocalPort() { return localPort_; }
+    PortMappingTable* getPortMappings() { return portMappings_; }
     boost::asio::io_context*& getIOContext() { return io_context_; }
     HSteamListenSocket& getListenSock() { return hListenSock; }
     ISteamNetworkingSockets* getInterface() { return m_pInterface; }
     bool& getIsHost() { return g_isHost; }
 
-    void setMessageHandlerDependencies(boost::asio::io_context& io_context, std::unique_ptr<TCPServer>& server, int& localPort);
+    void setMessageHandlerDependencies(boost::asio::io_context& io_context, std::unique_ptr<TCPServer>& server, int& localPort, PortMappingTable& portMappings);
+    // Start the local TCP server if it is not running yet; network thread only
+    bool startLocalListener();
 
     // Message handler
     void startMessageHandler();
@@ -64,6 +142,39 @@ public:
 
     // Update user info (ping, relay status)
     void update();
+    // Dispatch connection status callbacks; called from the network thread only
+    void runCallbacks();
+    // Ping, path and scheduler stats of every open connection
+    std::vector<PeerStatus> collectPeerStatus();
+    // Speed test against a connected peer; false if not connected or already running
+    bool startSpeedTest(CSteamID peer, int phaseSeconds);
+
+    // Connection striping (steam_stripe_set.h). Clients open count-1 extra
+    // connections to the host on virtual ports 1..count-1; hosts listen on all
+    // of them. Takes effect while connected too.
+    void setStriping(int count, StripePolicy policy);
+    std::vector<StripeHealth> getStripeHealth() const { return stripes_.health(); }
+    StripePolicy getStripePolicy() const { return stripes_.policy(); }
+    // Connection a new local stream should use; hashKey feeds StripePolicy::Hash
+    HSteamNetConnection pickConnection(unsigned hashKey);
+    // Host: listen sockets for the extra virtual ports (stripes and the backup path)
+    void openStripeListeners();
+    void closeStripeListeners();
+
+    // Backup path (MultiplexManager::pairBackupLink): the client keeps a
+    // second connection to the host on kBackupVirtualPort, relay only, so it
+    // takes another route than a direct main connection. Small frames of
+    // Interactive mappings are copied onto it.
+    void setBackupPath(bool enabled);
+    BackupPathStatus getBackupPathStatus();
+
+    // Per peer while latency decomposition is on (SteamMessageHandler::setTimingEnabled)
+    std::vector<PeerTiming> getPeerTiming();
+    static constexpr int kBackupVirtualPort = StripeSet::kMaxStripes;
+
+    // Supplies a peer's published ping location for relay path estimates
+    using PingLocationProvider = std::function<bool(CSteamID, SteamNetworkingPingLocation_t&)>;
+    void setPingLocationProvider(PingLocationProvider provider) { pingLocationProvider_ = std::move(provider); }
 
     // For callbacks
     void setHostSteamID(CSteamID id) { g_hostSteamID = id; }
@@ -95,7 +206,66 @@ private:
     boost::asio::io_context* io_context_;
     std::unique_ptr<TCPServer>* server_;
     int* localPort_;
+    PortMappingTable* portMappings_;
     SteamMessageHandler* messageHandler_;
+    std::unique_ptr<SteamTunnelTransport> transport_;
+
+    // Direct-vs-relay policy per connection, evaluated from update()
+    std::map<HSteamNetConnection, PathPolicy> pathPolicies_;
+    PingLocationProvider pingLocationProvider_;
+    std::chrono::steady_clock::time_point lastPathUpdate_;
+    void updatePathPolicies(const std::vector<HSteamNetConnection>& conns);
+    // Per-connection send rate from the bandwidth estimate
+    std::map<HSteamNetConnection, BandwidthEstimator> rateEstimators_;
+    std::chrono::steady_clock::time_point lastRateUpdate_;
+    void updateRateControl(const std::vector<HSteamNetConnection>& conns);
+
+    // Warm-up and join timing, network thread only
+    std::chrono::steady_clock::time_point initializedAt_;
+    NetworkReadiness readiness_;
+    std::chrono::steady_clock::time_point joinRequestedAt_;
+    bool joining_ = false;
+    bool joinUsedCache_ = false;
+    int lastJoinMs_ = -1;
+    JoinPhases joinPhases_;
+    HostPathCache hostCache_{"host_path_cache.txt"};
+    int sinceJoinRequested() const;
+    void markPhase(int& phase, const char* name);
+    void prepareLocalServer();
+    void updateReadiness();
+    void rememberHostPath();
+
+    // Client side of session resumption: after a drop, reconnect to the host
+    // until the session's grace period runs out
+    bool reconnecting_ = false;
+    std::chrono::steady_clock::time_point reconnectStarted_;
+    std::chrono::steady_clock::time_point nextReconnectAttempt_;
+    void updateReconnect();
+    static constexpr std::chrono::seconds kReconnectInterval{2};
+    std::string primarySession_; // session of the dropped main connection
+
+    // Extra connections per peer; the stripes' own reconnects run from update()
+    StripeSet stripes_;
+    std::vector<HSteamListenSocket> stripeListenSocks_;
+    std::chrono::steady_clock::time_point lastStripeUpdate_;
+    void updateStripes(const std::vector<HSteamNetConnection>& conns);
+    // Status callback for stripes 1..n; returns false for other connections
+    bool handleStripeStatus(SteamNetConnectionStatusChangedCallback_t* pInfo);
+
+    // Ping, Steam queue time and pending reliable bytes per connection for
+    // the flight recorder, every flight::kSampleIntervalMs
+    std::chrono::steady_clock::time_point lastFlightSample_;
+    void sampleFlight(const std::vector<HSteamNetConnection>& conns);
+
+    bool backupEnabled_ = false;
+    HSteamNetConnection backupConn_ = k_HSteamNetConnection_Invalid;
+    bool backupConnected_ = false;
+    int backupFailures_ = 0;
+    std::chrono::steady_clock::time_point nextBackupAttempt_;
+    void updateBackupPath();
+    // Caller holds connectionsMutex
+    void closeBackupPath();
+    bool handleBackupStatus(SteamNetConnectionStatusChangedCallback_t* pInfo);
 
     // Callback
     static void OnSteamNetConnectionStatusChanged(SteamNetConnectionStatusChangedCallback_t *pInfo);
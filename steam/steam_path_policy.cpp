@@ -0,0 +1,170 @@
+#include "steam_path_policy.h"
+#include <iostream>
+
+PathPolicy::PathPolicy(HSteamNetConnection conn)
+    : conn_(conn)
+{
+    state_.sdrPenalty = kDefaultSdrPenalty;
+    state_.reason = "默认";
+}
+
+void PathPolicy::applyGlobalDefaults()
+{
+    // 轻微偏好直连，但中继明显更快时仍允许 Steam 选择中继
+    int32 nSdrPenalty = kDefaultSdrPenalty;
+    SteamNetworkingUtils()->SetConfigValue(
+        k_ESteamNetworkingConfig_P2P_Transport_SDR_Penalty,
+        k_ESteamNetworkingConfig_Global,
+        0,
+        k_ESteamNetworkingConfig_Int32,
+        &nSdrPenalty);
+}
+
+void PathPolicy::seed(int directPing, int relayPing)
+{
+    auto now = std::chrono::steady_clock::now();
+    auto seedOne = [now](PathMeasurement &m, int ping)
+    {
+        if (ping >= 0 && !m.valid())
+        {
+            m.ping = ping;
+            m.loss = 0.0f;
+            m.estimated = true;
+            m.at = now;
+        }
+    };
+    seedOne(state_.direct, directPing);
+    seedOne(state_.relay, relayPing);
+    state_.reason = "历史记录";
+}
+
+int PathPolicy::score(const PathMeasurement &m)
+{
+    if (!m.valid())
+    {
+        return -1;
+    }
+    return m.ping + static_cast<int>(m.loss * 100.0f * kLossPenaltyPerPercent);
+}
+
+void PathPolicy::record(PathMeasurement &m, int ping, float loss)
+{
+    if (!m.valid() || m.estimated)
+    {
+        m.ping = ping;
+        m.loss = loss;
+    }
+    else
+    {
+        m.ping = (m.ping * 7 + ping * 3) / 10;
+        m.loss = m.loss * 0.7f + loss * 0.3f;
+    }
+    m.estimated = false;
+    m.at = std::chrono::steady_clock::now();
+}
+
+bool PathPolicy::update(ISteamNetworkingSockets *sockets, const SteamNetworkingPingLocation_t *remoteLocation)
+{
+    SteamNetConnectionInfo_t info;
+    SteamNetConnectionRealTimeStatus_t status;
+    if (!sockets->GetConnectionInfo(conn_, &info) ||
+        sockets->GetConnectionRealTimeStatus(conn_, &status, 0, nullptr) != k_EResultOK ||
+        status.m_eState != k_ESteamNetworkingConnectionState_Connected)
+    {
+        return false;
+    }
+
+    auto now = std::chrono::steady_clock::now();
+    state_.relayed = (info.m_nFlags & k_nSteamNetworkConnectionInfoFlags_Relayed) != 0;
+    float loss = status.m_flConnectionQualityLocal >= 0.0f ? 1.0f - status.m_flConnectionQualityLocal : 0.0f;
+    record(state_.relayed ? state_.relay : state_.direct, status.m_nPing, loss);
+
+    // Paths we are not on age out; the relay side falls back to the ping-location estimate
+    if (state_.direct.valid() && now - state_.direct.at > kMeasurementTtl)
+    {
+        state_.direct = PathMeasurement();
+    }
+    if (remoteLocation && (!state_.relay.valid() || now - state_.relay.at > kMeasurementTtl))
+    {
+        int estimate = SteamNetworkingUtils()->EstimatePingTimeFromLocalHost(*remoteLocation);
+        if (estimate >= 0)
+        {
+            state_.relay.ping = estimate;
+            state_.relay.loss = 0.0f;
+            state_.relay.estimated = true;
+            state_.relay.at = now;
+        }
+    }
+
+    if (now - lastChange_ < kMinDwell)
+    {
+        return false;
+    }
+
+    int direct = score(state_.direct);
+    int relay = score(state_.relay);
+    PathPreference wanted = state_.preference;
+    std::string reason;
+    if (state_.preference == PathPreference::PreferRelay && direct < 0)
+    {
+        // Under the ICE penalty Steam never tries direct again, so no fresh
+        // sample could ever arrive; let it probe the direct route
+        wanted = PathPreference::Auto;
+        reason = "重新探测直连";
+    }
+    else if (direct < 0 || relay < 0)
+    {
+        // The path we steered away from aged out; that is no reason to hand
+        // the choice back to Steam, only a fresh contradicting sample is.
+        // The relay side is re-estimated from the ping location meanwhile.
+        if (state_.preference != PathPreference::Auto)
+        {
+            return false;
+        }
+        wanted = PathPreference::Auto;
+        reason = "测量不足";
+    }
+    else if (direct + kHysteresisMs < relay)
+    {
+        wanted = PathPreference::PreferDirect;
+        reason = "直连更快";
+    }
+    else if (relay + kHysteresisMs < direct)
+    {
+        wanted = PathPreference::PreferRelay;
+        reason = "中继更快";
+    }
+
+    if (wanted == state_.preference)
+    {
+        return false;
+    }
+    apply(wanted, reason);
+    return true;
+}
+
+void PathPolicy::apply(PathPreference preference, const std::string &reason)
+{
+    int sdr = kDefaultSdrPenalty;
+    int ice = 0;
+    if (preference == PathPreference::PreferDirect)
+    {
+        sdr = kSwitchPenalty;
+    }
+    else if (preference == PathPreference::PreferRelay)
+    {
+        sdr = 0;
+        ice = kSwitchPenalty;
+    }
+    SteamNetworkingUtils()->SetConnectionConfigValueInt32(conn_, k_ESteamNetworkingConfig_P2P_Transport_SDR_Penalty, sdr);
+    SteamNetworkingUtils()->SetConnectionConfigValueInt32(conn_, k_ESteamNetworkingConfig_P2P_Transport_ICE_Penalty, ice);
+
+    state_.preference = preference;
+    state_.sdrPenalty = sdr;
+    state_.icePenalty = ice;
+    state_.reason = reason;
+    lastChange_ = std::chrono::steady_clock::now();
+    std::cout << "Path policy for connection " << conn_ << ": " << reason
+              << " (direct=" << score(state_.direct) << "ms, relay=" << score(state_.relay)
+              << "ms, sdrPenalty=" << sdr << ", icePenalty=" << ice << ")" << std::endl;
+}
@@ -0,0 +1,81 @@
+#ifndef STEAM_PATH_POLICY_H
+#define STEAM_PATH_POLICY_H
+
+#include <chrono>
+#include <string>
+#include <isteamnetworkingsockets.h>
+#include <isteamnetworkingutils.h>
+#include <steamnetworkingtypes.h>
+
+// Latest observation of one path type (direct ICE or Steam relay)
+struct PathMeasurement
+{
+    int ping = -1;       // ms, -1 if unknown
+    float loss = 0.0f;   // 0..1
+    bool estimated = false; // from ping locations rather than traffic
+    std::chrono::steady_clock::time_point at;
+
+    bool valid() const { return ping >= 0; }
+};
+
+enum class PathPreference
+{
+    Auto,
+    PreferDirect,
+    PreferRelay,
+};
+
+struct PathPolicyState
+{
+    PathPreference preference = PathPreference::Auto;
+    bool relayed = false;
+    PathMeasurement direct;
+    PathMeasurement relay;
+    int sdrPenalty = 0;
+    int icePenalty = 0;
+    std::string reason;
+};
+
+// Per-connection direct-vs-relay choice. Steam picks the route with the lowest
+// ping plus transport penalty; this feeds it our view of both paths, which
+// also counts loss, by moving the per-connection penalties at runtime.
+class PathPolicy
+{
+public:
+    explicit PathPolicy(HSteamNetConnection conn);
+
+    // Sample the connection and re-evaluate. remoteLocation may be null.
+    // Returns true if the penalties were changed.
+    bool update(ISteamNetworkingSockets *sockets, const SteamNetworkingPingLocation_t *remoteLocation);
+
+    const PathPolicyState &state() const { return state_; }
+
+    // Start from what an earlier session with the same peer measured (-1 = unknown).
+    // Seeded values count as estimates and are replaced by real samples.
+    void seed(int directPing, int relayPing);
+
+    // Ping plus a loss surcharge, -1 if unknown
+    static int score(const PathMeasurement &m);
+    // Global starting point for new connections: a slight preference for direct
+    static void applyGlobalDefaults();
+
+    static constexpr int kDefaultSdrPenalty = 20;
+    static constexpr int kSwitchPenalty = 250;
+    static constexpr int kHysteresisMs = 15;
+    static constexpr int kLossPenaltyPerPercent = 10;
+    static constexpr std::chrono::seconds kMinDwell{10};
+    // A path we are not on is forgotten after this. The decision stays, except
+    // that a forgotten direct path is probed again by handing the choice back
+    // to Steam, which would never leave the relay under the ICE penalty
+    static constexpr std::chrono::seconds kMeasurementTtl{120};
+
+private:
+    void record(PathMeasurement &m, int ping, float loss);
+    void apply(PathPreference preference, const std::string &reason);
+
+    HSteamNetConnection conn_;
+    PathPolicyState state_;
+    std::chrono::steady_clock::time_point lastChange_;
+};
+
+#endif // STEAM_PATH_POLICY_H
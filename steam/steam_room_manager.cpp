@@ -1,7 +1,14 @@
 #include "steam_room_manager.h"
 #include "steam_networking_manager.h"
+#include "../net/tunnel_protocol.h"
 #include <iostream>
 #include <algorithm>
+#include <cstdlib>
+
+namespace
+{
+    const char *kToolName = "ConnectTool";
+}
 
 SteamFriendsCallbacks::SteamFriendsCallbacks(SteamNetworkingManager *manager, SteamRoomManager *roomManager) 
     : manager_(manager), roomManager_(roomManager)
@@ -47,6 +54,9 @@ void SteamMatchmakingCallbacks::OnLobbyCreated(LobbyCreated_t *pCallback, bool b
     {
         roomManager_->setCurrentLobby(pCallback->m_ulSteamIDLobby);
         std::cout << "Lobby created: " << roomManager_->getCurrentLobby().ConvertToUint64() << std::endl;
+
+        // Advertise tool, capabilities and (once known) our ping location
+        roomManager_->update();
         
         // Set Rich Presence to enable invite functionality
         SteamFriends()->SetRichPresence("steam_display", "#Status_InLobby");
@@ -65,12 +75,7 @@ void SteamMatchmakingCallbacks::OnLobbyListReceived(LobbyMatchList_t *pCallback,
         std::cerr << "Failed to receive lobby list - IO Failure" << std::endl;
         return;
     }
-    roomManager_->clearLobbies();
-    for (uint32 i = 0; i < pCallback->m_nLobbiesMatching; ++i)
-    {
-        CSteamID lobbyID = SteamMatchmaking()->GetLobbyByIndex(i);
-        roomManager_->addLobby(lobbyID);
-    }
+    roomManager_->onLobbyList(pCallback->m_nLobbiesMatching);
     std::cout << "Received " << pCallback->m_nLobbiesMatching << " lobbies" << std::endl;
 }
 
@@ -85,37 +90,35 @@ void SteamMatchmakingCallbacks::OnLobbyEntered(LobbyEnter_t *pCallback)
         SteamFriends()->SetRichPresence("steam_display", "#Status_InLobby");
         SteamFriends()->SetRichPresence("connect", std::to_string(pCallback->m_ulSteamIDLobby).c_str());
         
-        // Only join host if not the host
+        // Only join host if not the host; the local TCP server is already
+        // listening since the join was requested
         if (!manager_->isHost())
         {
+            manager_->markLobbyEntered();
+            roomManager_->adoptHostPortMappings();
             CSteamID hostID = SteamMatchmaking()->GetLobbyOwner(pCallback->m_ulSteamIDLobby);
-            if (manager_->joinHost(hostID.ConvertToUint64()))
-            {
-                // Start TCP Server if dependencies are set
-                if (manager_->getServer() && !(*manager_->getServer()))
-                {
-                    *manager_->getServer() = std::make_unique<TCPServer>(8888, manager_);
-                    if (!(*manager_->getServer())->start())
-                    {
-                        std::cerr << "Failed to start TCP server" << std::endl;
-                    }
-                }
-            }
+            manager_->joinHost(hostID.ConvertToUint64());
         }
     }
     else
     {
         std::cerr << "Failed to enter lobby" << std::endl;
+        manager_->markJoinFailed();
     }
 }
 
 SteamRoomManager::SteamRoomManager(SteamNetworkingManager *networkingManager)
     : networkingManager_(networkingManager), currentLobby(k_steamIDNil),
+      metadataPublished_(false), memberLocationPublished_(false), hostLocationPublished_(false),
+      portsPublished_(false), maxPing_(0), distanceFilter_(k_ELobbyDistanceFilterDefault),
       steamFriendsCallbacks(nullptr), steamMatchmakingCallbacks(nullptr)
 {
     steamFriendsCallbacks = new SteamFriendsCallbacks(networkingManager_, this);
     steamMatchmakingCallbacks = new SteamMatchmakingCallbacks(networkingManager_, this);
 
+    networkingManager_->setPingLocationProvider([this](CSteamID member, SteamNetworkingPingLocation_t &location)
+                                                { return getMemberPingLocation(member, location); });
+
     // Clear Rich Presence on initialization to prevent "Invite to game" showing when not in a lobby
     SteamFriends()->ClearRichPresence();
 }
@@ -145,26 +148,251 @@ void SteamRoomManager::leaveLobby()
     {
         SteamMatchmaking()->LeaveLobby(currentLobby);
         currentLobby = k_steamIDNil;
+        metadataPublished_ = false;
+        memberLocationPublished_ = false;
+        hostLocationPublished_ = false;
+        portsPublished_ = false;
+        PortMappingTable *mappings = networkingManager_->getPortMappings();
+        if (mappings && mappings->isRemote())
+        {
+            mappings->clearRemote();
+            std::unique_ptr<TCPServer> *server = networkingManager_->getServer();
+            if (server && *server)
+            {
+                (*server)->syncMappings();
+            }
+        }
         
         // Clear Rich Presence when leaving lobby
         SteamFriends()->ClearRichPresence();
     }
 }
 
-bool SteamRoomManager::searchLobbies()
+bool SteamRoomManager::searchLobbies(bool force)
 {
-    lobbies.clear();
+    auto now = std::chrono::steady_clock::now();
+    if (!force && !lobbyCache_.empty() && now - lastSearch_ < kLobbyCacheTtl)
+    {
+        // Recent results are still good enough
+        rankLobbies();
+        return true;
+    }
+    SteamMatchmaking()->AddRequestLobbyListStringFilter(kLobbyKeyTool, kToolName, k_ELobbyComparisonEqual);
+    SteamMatchmaking()->AddRequestLobbyListDistanceFilter(distanceFilter_);
+    SteamMatchmaking()->AddRequestLobbyListResultCountFilter(50);
     SteamAPICall_t hSteamAPICall = SteamMatchmaking()->RequestLobbyList();
     if (hSteamAPICall == k_uAPICallInvalid)
     {
         std::cerr << "Failed to request lobby list" << std::endl;
         return false;
     }
+    lastSearch_ = now;
     // Register the call result
     steamMatchmakingCallbacks->m_CallResultLobbyMatchList.Set(hSteamAPICall, steamMatchmakingCallbacks, &SteamMatchmakingCallbacks::OnLobbyListReceived);
     return true;
 }
 
+void SteamRoomManager::onLobbyList(uint32 count)
+{
+    auto now = std::chrono::steady_clock::now();
+    SteamNetworkingPingLocation_t localLocation;
+    bool haveLocal = SteamNetworkingUtils()->GetLocalPingLocation(localLocation) >= 0.0f;
+
+    for (uint32 i = 0; i < count; ++i)
+    {
+        CSteamID lobbyID = SteamMatchmaking()->GetLobbyByIndex(i);
+        LobbyInfo info;
+        info.lobbyID = lobbyID;
+        info.fetchedAt = now;
+        info.hostName = SteamMatchmaking()->GetLobbyData(lobbyID, kLobbyKeyHostName);
+        info.capabilities = SteamMatchmaking()->GetLobbyData(lobbyID, kLobbyKeyCapabilities);
+        info.protocolVersion = std::atoi(SteamMatchmaking()->GetLobbyData(lobbyID, kLobbyKeyVersion));
+
+        // Estimate host latency from the two ping locations, no connection needed
+        const char *locationStr = SteamMatchmaking()->GetLobbyData(lobbyID, kLobbyKeyPingLocation);
+        SteamNetworkingPingLocation_t remoteLocation;
+        if (haveLocal && locationStr[0] != '\0' &&
+            SteamNetworkingUtils()->ParsePingLocationString(locationStr, remoteLocation))
+        {
+            int ping = SteamNetworkingUtils()->EstimatePingTimeBetweenTwoLocations(localLocation, remoteLocation);
+            info.estimatedPing = ping >= 0 ? ping : -1;
+        }
+        lobbyCache_[lobbyID.ConvertToUint64()] = info;
+    }
+    rankLobbies();
+}
+
+void SteamRoomManager::rankLobbies()
+{
+    auto now = std::chrono::steady_clock::now();
+    lobbies.clear();
+    for (auto it = lobbyCache_.begin(); it != lobbyCache_.end();)
+    {
+        if (now - it->second.fetchedAt > kLobbyCacheTtl * 4)
+        {
+            it = lobbyCache_.erase(it);
+            continue;
+        }
+        const LobbyInfo &info = it->second;
+        if (maxPing_ <= 0 || info.estimatedPing < 0 || info.estimatedPing <= maxPing_)
+        {
+            lobbies.push_back(info);
+        }
+        ++it;
+    }
+    // Known pings first, lowest first
+    std::sort(lobbies.begin(), lobbies.end(), [](const LobbyInfo &a, const LobbyInfo &b)
+              {
+        if ((a.estimatedPing < 0) != (b.estimatedPing < 0))
+        {
+            return a.estimatedPing >= 0;
+        }
+        return a.estimatedPing < b.estimatedPing; });
+}
+
+bool SteamRoomManager::joinBestLobby()
+{
+    if (lobbies.empty())
+    {
+        std::cerr << "No lobby to join" << std::endl;
+        return false;
+    }
+    const LobbyInfo &best = lobbies.front();
+    std::cout << "Joining lowest latency lobby " << best.lobbyID.ConvertToUint64()
+              << " (estimated " << best.estimatedPing << "ms)" << std::endl;
+    return joinLobby(best.lobbyID);
+}
+
+void SteamRoomManager::update()
+{
+    if (currentLobby == k_steamIDNil)
+    {
+        return;
+    }
+    if (!metadataPublished_ && networkingManager_->isHost())
+    {
+        publishLobbyMetadata();
+        metadataPublished_ = true;
+    }
+    if (!portsPublished_ && networkingManager_->isHost())
+    {
+        // Once per lobby; the UI publishes it again after edits
+        publishPortMappings();
+    }
+    // The ping location takes a few seconds after relay network init; update()
+    // runs every network tick, so look for it about once a second
+    bool hostLocationPending = networkingManager_->isHost() && !hostLocationPublished_;
+    auto now = std::chrono::steady_clock::now();
+    if ((hostLocationPending || !memberLocationPublished_) && now - lastLocationAttempt_ >= kLocationRetryInterval)
+    {
+        lastLocationAttempt_ = now;
+        if (hostLocationPending)
+        {
+            hostLocationPublished_ = publishHostPingLocation();
+        }
+        if (!memberLocationPublished_)
+        {
+            memberLocationPublished_ = publishMemberPingLocation();
+        }
+    }
+}
+
+bool SteamRoomManager::getLocalPingLocationString(std::string &out)
+{
+    // Ping location becomes available a few seconds after relay network init
+    SteamNetworkingPingLocation_t location;
+    if (SteamNetworkingUtils()->GetLocalPingLocation(location) < 0.0f)
+    {
+        return false;
+    }
+    char locationStr[k_cchMaxSteamNetworkingPingLocationString];
+    SteamNetworkingUtils()->ConvertPingLocationToString(location, locationStr, sizeof(locationStr));
+    out = locationStr;
+    return true;
+}
+
+bool SteamRoomManager::publishMemberPingLocation()
+{
+    std::string locationStr;
+    if (!getLocalPingLocationString(locationStr))
+    {
+        return false;
+    }
+    SteamMatchmaking()->SetLobbyMemberData(currentLobby, kLobbyKeyPingLocation, locationStr.c_str());
+    return true;
+}
+
+bool SteamRoomManager::getMemberPingLocation(CSteamID member, SteamNetworkingPingLocation_t &location) const
+{
+    if (currentLobby == k_steamIDNil)
+    {
+        return false;
+    }
+    const char *locationStr = SteamMatchmaking()->GetLobbyMemberData(currentLobby, member, kLobbyKeyPingLocation);
+    if ((!locationStr || locationStr[0] == '\0') && member == SteamMatchmaking()->GetLobbyOwner(currentLobby))
+    {
+        locationStr = SteamMatchmaking()->GetLobbyData(currentLobby, kLobbyKeyPingLocation);
+    }
+    return locationStr && locationStr[0] != '\0' &&
+           SteamNetworkingUtils()->ParsePingLocationString(locationStr, location);
+}
+
+void SteamRoomManager::publishLobbyMetadata()
+{
+    SteamMatchmaking()->SetLobbyData(currentLobby, kLobbyKeyTool, kToolName);
+    SteamMatchmaking()->SetLobbyData(currentLobby, kLobbyKeyVersion, std::to_string(tunnel::kProtocolVersion).c_str());
+    SteamMatchmaking()->SetLobbyData(currentLobby, kLobbyKeyCapabilities, tunnel::kCapabilities);
+    SteamMatchmaking()->SetLobbyData(currentLobby, kLobbyKeyHostName, SteamFriends()->GetPersonaName());
+}
+
+bool SteamRoomManager::publishHostPingLocation()
+{
+    std::string locationStr;
+    if (!getLocalPingLocationString(locationStr))
+    {
+        return false;
+    }
+    SteamMatchmaking()->SetLobbyData(currentLobby, kLobbyKeyPingLocation, locationStr.c_str());
+    std::cout << "Published ping location for lobby " << currentLobby.ConvertToUint64() << std::endl;
+    return true;
+}
+
+void SteamRoomManager::publishPortMappings()
+{
+    PortMappingTable *mappings = networkingManager_->getPortMappings();
+    if (currentLobby == k_steamIDNil || !mappings || !networkingManager_->isHost())
+    {
+        return;
+    }
+    std::string table = PortMappingTable::serialize(mappings->getLocal());
+    SteamMatchmaking()->SetLobbyData(currentLobby, kLobbyKeyPorts, table.c_str());
+    portsPublished_ = true;
+    std::cout << "Published port mappings: " << table << std::endl;
+}
+
+void SteamRoomManager::adoptHostPortMappings()
+{
+    PortMappingTable *mappings = networkingManager_->getPortMappings();
+    if (currentLobby == k_steamIDNil || !mappings)
+    {
+        return;
+    }
+    std::vector<PortMapping> remote;
+    const char *table = SteamMatchmaking()->GetLobbyData(currentLobby, kLobbyKeyPorts);
+    if (!table || !PortMappingTable::parse(table, remote))
+    {
+        // Hosts before protocol version 4 forward only 本地端口, on 8888
+        remote = PortMappingTable::defaults();
+    }
+    mappings->setRemote(remote);
+    std::cout << "Using " << remote.size() << " port mappings from the host" << std::endl;
+    std::unique_ptr<TCPServer> *server = networkingManager_->getServer();
+    if (server && *server)
+    {
+        (*server)->syncMappings();
+    }
+}
+
 bool SteamRoomManager::joinLobby(CSteamID lobbyID)
 {
     if (SteamMatchmaking()->JoinLobby(lobbyID) != k_EResultOK)
@@ -172,6 +400,7 @@ bool SteamRoomManager::joinLobby(CSteamID lobbyID)
         std::cerr << "Failed to join lobby" << std::endl;
         return false;
     }
+    networkingManager_->markJoinRequested();
     // Connection will be handled by callback
     return true;
 }
@@ -189,6 +418,11 @@ bool SteamRoomManager::startHosting()
     {
         networkingManager_->getIsHost() = true;
         std::cout << "Created listen socket for hosting game room" << std::endl;
+        // The host's own game client can use the same address as everyone
+        // else; its connections skip the tunnel
+        networkingManager_->startLocalListener();
+        // Extra connections from clients that stripe
+        networkingManager_->openStripeListeners();
         return true;
     }
     else
@@ -206,6 +440,7 @@ void SteamRoomManager::stopHosting()
         networkingManager_->getInterface()->CloseListenSocket(networkingManager_->getListenSock());
         networkingManager_->getListenSock() = k_HSteamListenSocket_Invalid;
     }
+    networkingManager_->closeStripeListeners();
     leaveLobby();
     networkingManager_->getIsHost() = false;
 }
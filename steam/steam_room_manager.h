@@ -3,6 +3,9 @@
 #include <vector>
 #include <iostream>
 #include <mutex>
+#include <map>
+#include <string>
+#include <chrono>
 
 class SteamNetworkingManager; // Forward declaration
 class SteamRoomManager; // Forward declaration for callbacks
@@ -37,6 +40,17 @@ private:
     STEAM_CALLBACK(SteamMatchmakingCallbacks, OnLobbyEntered, LobbyEnter_t);
 };
 
+// Lobby search result with the host's published metadata
+struct LobbyInfo
+{
+    CSteamID lobbyID;
+    std::string hostName;
+    std::string capabilities;
+    int protocolVersion = 0;
+    int estimatedPing = -1; // ms, -1 if the host published no usable ping location
+    std::chrono::steady_clock::time_point fetchedAt;
+};
+
 class SteamRoomManager
 {
 public:
@@ -45,23 +59,68 @@ public:
 
     bool createLobby();
     void leaveLobby();
-    bool searchLobbies();
+    // Reuses results younger than kLobbyCacheTtl unless forced
+    bool searchLobbies(bool force = false);
     bool joinLobby(CSteamID lobbyID);
+    // Join the reachable lobby with the lowest estimated ping
+    bool joinBestLobby();
     bool startHosting();
     void stopHosting();
 
     CSteamID getCurrentLobby() const { return currentLobby; }
-    const std::vector<CSteamID>& getLobbies() const { return lobbies; }
+    // Ranked by estimated ping, lobbies above the ping limit removed
+    const std::vector<LobbyInfo>& getLobbies() const { return lobbies; }
     std::vector<CSteamID> getLobbyMembers() const;
 
     void setCurrentLobby(CSteamID lobby) { currentLobby = lobby; }
-    void addLobby(CSteamID lobby) { lobbies.push_back(lobby); }
+    void onLobbyList(uint32 count);
     void clearLobbies() { lobbies.clear(); }
 
+    // Lobbies estimated slower than this are hidden (0 = no limit)
+    void setMaxPing(int maxPing) { maxPing_ = maxPing; }
+    int getMaxPing() const { return maxPing_; }
+    void setDistanceFilter(ELobbyDistanceFilter filter) { distanceFilter_ = filter; }
+
+    // Publish our metadata to the hosted lobby (and our member ping location
+    // in any lobby) once the ping location is known; called every network tick
+    void update();
+    // Host: publish the local mapping table again after it was edited
+    void publishPortMappings();
+    // Client: listen on the ports the host forwards; on lobby entry
+    void adoptHostPortMappings();
+
+    // Ping location a lobby member published, for path estimates
+    bool getMemberPingLocation(CSteamID member, SteamNetworkingPingLocation_t &location) const;
+
+    static constexpr std::chrono::seconds kLobbyCacheTtl{15};
+    static constexpr const char *kLobbyKeyTool = "ct_tool";
+    static constexpr const char *kLobbyKeyPingLocation = "ct_ping_loc";
+    static constexpr const char *kLobbyKeyCapabilities = "ct_caps";
+    static constexpr const char *kLobbyKeyVersion = "ct_ver";
+    static constexpr const char *kLobbyKeyHostName = "ct_host";
+    static constexpr const char *kLobbyKeyPorts = "ct_ports";
+    static constexpr std::chrono::seconds kLocationRetryInterval{1};
+
 private:
+    // Host: the keys that do not change, once per lobby
+    void publishLobbyMetadata();
+    bool publishHostPingLocation();
+    bool publishMemberPingLocation();
+    static bool getLocalPingLocationString(std::string &out);
+    void rankLobbies();
+
     SteamNetworkingManager *networkingManager_;
     CSteamID currentLobby;
-    std::vector<CSteamID> lobbies;
+    std::vector<LobbyInfo> lobbies;
+    std::map<uint64, LobbyInfo> lobbyCache_;
+    std::chrono::steady_clock::time_point lastSearch_;
+    bool metadataPublished_;
+    bool memberLocationPublished_;
+    bool hostLocationPublished_;
+    std::chrono::steady_clock::time_point lastLocationAttempt_;
+    bool portsPublished_;
+    int maxPing_;
+    ELobbyDistanceFilter distanceFilter_;
     SteamFriendsCallbacks *steamFriendsCallbacks;
     SteamMatchmakingCallbacks *steamMatchmakingCallbacks;
 };
\ No newline at end of file
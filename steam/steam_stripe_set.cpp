@@ -0,0 +1,260 @@
+#include "steam_stripe_set.h"
+#include <algorithm>
+#include <iostream>
+
+void StripeSet::configure(int count, StripePolicy policy)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    count_ = std::min(std::max(1, count), kMaxStripes);
+    policy_ = policy;
+    while (static_cast<int>(stripes_.size()) < count_)
+    {
+        Stripe stripe;
+        stripe.health.virtualPort = static_cast<int>(stripes_.size());
+        stripes_.push_back(stripe);
+    }
+}
+
+int StripeSet::count() const
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    return count_;
+}
+
+StripePolicy StripeSet::policy() const
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    return policy_;
+}
+
+void StripeSet::reset()
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (size_t i = 0; i < stripes_.size(); ++i)
+    {
+        stripes_[i] = Stripe();
+        stripes_[i].health.virtualPort = static_cast<int>(i);
+    }
+}
+
+int StripeSet::indexOf(HSteamNetConnection conn) const
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (conn == k_HSteamNetConnection_Invalid)
+    {
+        return -1;
+    }
+    for (size_t i = 0; i < stripes_.size(); ++i)
+    {
+        if (stripes_[i].health.conn == conn)
+        {
+            return static_cast<int>(i);
+        }
+    }
+    return -1;
+}
+
+void StripeSet::setConnection(int index, HSteamNetConnection conn)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    Stripe &s = stripes_.at(index);
+    s.health.conn = conn;
+    s.health.connected = false;
+    s.health.healthy = false;
+    s.health.reason = "连接中";
+}
+
+void StripeSet::markConnected(int index)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    Stripe &s = stripes_.at(index);
+    auto now = Clock::now();
+    s.health.connected = true;
+    s.health.healthy = true;
+    s.health.failures = 0;
+    s.health.reason.clear();
+    s.lastProgress = now;
+    s.goodSince = now;
+}
+
+void StripeSet::markClosed(int index, const std::string &session, Clock::duration retryAfter)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    Stripe &s = stripes_.at(index);
+    if (!s.health.connected)
+    {
+        s.health.failures++;
+    }
+    s.health.conn = k_HSteamNetConnection_Invalid;
+    s.health.connected = false;
+    s.health.healthy = false;
+    s.health.streams = 0;
+    s.health.reason = s.health.failures >= kMaxFailures ? "对方不支持" : "已断开";
+    s.session = session;
+    s.nextAttempt = Clock::now() + retryAfter;
+}
+
+std::vector<int> StripeSet::dueForConnect(Clock::time_point now) const
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    std::vector<int> due;
+    for (int i = 1; i < count_; ++i)
+    {
+        const Stripe &s = stripes_[i];
+        if (s.health.conn == k_HSteamNetConnection_Invalid && s.health.failures < kMaxFailures && now >= s.nextAttempt)
+        {
+            due.push_back(i);
+        }
+    }
+    return due;
+}
+
+std::string StripeSet::takeSession(int index)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    std::string session;
+    session.swap(stripes_.at(index).session);
+    return session;
+}
+
+std::string StripeSet::problem(const Stripe &s, Clock::time_point now) const
+{
+    const StripeHealth &h = s.health;
+    if (h.queueMs > kStallQueueMs)
+    {
+        return "发送排队";
+    }
+    if (h.pendingBytes > 0 && now - s.lastProgress > kStallTime)
+    {
+        // Data queued but nothing acknowledged: stuck retransmitting
+        return "重传停滞";
+    }
+    if (h.quality < kMinQuality)
+    {
+        return "丢包";
+    }
+    int fastest = -1;
+    for (int i = 0; i < count_; ++i)
+    {
+        const StripeHealth &other = stripes_[i].health;
+        if (other.connected && (fastest < 0 || other.ping < fastest))
+        {
+            fastest = other.ping;
+        }
+    }
+    if (fastest >= 0 && h.ping > fastest * 2 + kSlowPingMargin)
+    {
+        return "延迟高";
+    }
+    return std::string();
+}
+
+void StripeSet::sample(int index, const SteamNetConnectionRealTimeStatus_t &status, int streams, Clock::time_point now)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (index < 0 || index >= static_cast<int>(stripes_.size()))
+    {
+        return;
+    }
+    Stripe &s = stripes_[index];
+    StripeHealth &h = s.health;
+    h.ping = status.m_nPing;
+    h.queueMs = static_cast<int>(status.m_usecQueueTime / 1000);
+    h.pendingBytes = status.m_cbPendingReliable + status.m_cbPendingUnreliable;
+    h.quality = status.m_flConnectionQualityRemote >= 0.0f ? status.m_flConnectionQualityRemote : 1.0f;
+    h.streams = streams;
+    s.pickedSinceSample = 0;
+    if (h.pendingBytes == 0 || status.m_cbSentUnackedReliable < s.lastUnacked || h.pendingBytes < s.lastPending)
+    {
+        s.lastProgress = now;
+    }
+    s.lastUnacked = status.m_cbSentUnackedReliable;
+    s.lastPending = h.pendingBytes;
+
+    std::string issue = problem(s, now);
+    if (!issue.empty())
+    {
+        if (h.healthy)
+        {
+            std::cout << "Stripe " << index << " unhealthy: " << issue << std::endl;
+        }
+        h.healthy = false;
+        h.reason = issue;
+        s.goodSince = now;
+    }
+    else if (!h.healthy && now - s.goodSince >= kRecoverTime)
+    {
+        std::cout << "Stripe " << index << " healthy again" << std::endl;
+        h.healthy = true;
+        h.reason.clear();
+    }
+}
+
+bool StripeSet::usable(const Stripe &s) const
+{
+    return s.health.connected && s.health.conn != k_HSteamNetConnection_Invalid;
+}
+
+HSteamNetConnection StripeSet::pick(unsigned hashKey)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    std::vector<int> candidates;
+    for (int i = 0; i < count_; ++i)
+    {
+        if (usable(stripes_[i]) && stripes_[i].health.healthy)
+        {
+            candidates.push_back(i);
+        }
+    }
+    if (candidates.empty())
+    {
+        // Everything is struggling: spread anyway rather than pile onto one
+        for (int i = 0; i < count_; ++i)
+        {
+            if (usable(stripes_[i]))
+            {
+                candidates.push_back(i);
+            }
+        }
+    }
+    if (candidates.empty())
+    {
+        return stripes_[0].health.conn;
+    }
+    int chosen = candidates[0];
+    if (policy_ == StripePolicy::Hash)
+    {
+        chosen = candidates[hashKey % candidates.size()];
+    }
+    else
+    {
+        auto load = [this](int i)
+        {
+            const Stripe &s = stripes_[i];
+            // Streams placed since the last sample count too, for bursts of accepts
+            return s.health.streams + s.pickedSinceSample + s.health.pendingBytes / kLoadQuantum;
+        };
+        for (int i : candidates)
+        {
+            if (load(i) < load(chosen))
+            {
+                chosen = i;
+            }
+        }
+    }
+    Stripe &s = stripes_[chosen];
+    s.pickedSinceSample++;
+    s.health.assigned++;
+    return s.health.conn;
+}
+
+std::vector<StripeHealth> StripeSet::health() const
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    std::vector<StripeHealth> out;
+    for (int i = 0; i < count_; ++i)
+    {
+        out.push_back(stripes_[i].health);
+    }
+    return out;
+}
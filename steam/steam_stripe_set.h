@@ -0,0 +1,105 @@
+#ifndef STEAM_STRIPE_SET_H
+#define STEAM_STRIPE_SET_H
+
+#include <chrono>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <steamnetworkingtypes.h>
+
+// How new streams are spread over the stripes
+enum class StripePolicy
+{
+    Load, // fewest streams and least queued data
+    Hash, // by the local connection's source port, stable per game client
+};
+
+// One stripe as the UI shows it
+struct StripeHealth
+{
+    int virtualPort = 0;
+    HSteamNetConnection conn = k_HSteamNetConnection_Invalid;
+    bool connected = false;
+    bool healthy = false;
+    int ping = 0;
+    int queueMs = 0;      // Steam's send queue delay
+    int pendingBytes = 0;
+    float quality = 1.0f; // share of our packets the peer received
+    int streams = 0;
+    uint64_t assigned = 0; // streams placed here so far
+    int failures = 0;     // connect attempts in a row that never connected
+    std::string reason;   // why it is not healthy
+};
+
+// Client side of connection striping: besides the main connection (virtual
+// port 0, stripe 0) a client may open more connections to the same host on
+// virtual ports 1..count-1. Every connection has its own congestion control,
+// send rate and reliable retransmission queue, so a loss stalls only the
+// streams of one stripe. Each stream stays on the stripe it was opened on,
+// since its frames are sequenced by that connection; rebalancing means new
+// streams avoid stripes that are stalled, queueing or losing packets.
+// Thread-safe: pick() runs on the TCP server thread, the rest on the network thread.
+class StripeSet
+{
+public:
+    using Clock = std::chrono::steady_clock;
+
+    void configure(int count, StripePolicy policy);
+    int count() const;
+    StripePolicy policy() const;
+    void reset();
+
+    // -1 if the connection is not one of our stripes
+    int indexOf(HSteamNetConnection conn) const;
+    void setConnection(int index, HSteamNetConnection conn);
+    void markConnected(int index);
+    // Connection gone. Keeps the session id of a suspended session so the
+    // reconnect can resume it; the next attempt is due after retryAfter.
+    void markClosed(int index, const std::string &session, Clock::duration retryAfter);
+    // Stripes (index > 0) due for a connect attempt
+    std::vector<int> dueForConnect(Clock::time_point now) const;
+    std::string takeSession(int index);
+
+    // Health from one real-time status sample
+    void sample(int index, const SteamNetConnectionRealTimeStatus_t &status, int streams, Clock::time_point now);
+
+    // Connection for a new stream; the main connection if no stripe is up
+    HSteamNetConnection pick(unsigned hashKey);
+    std::vector<StripeHealth> health() const;
+
+    static constexpr int kMaxStripes = 4;
+    // A stripe that never connects this often is left alone (old host)
+    static constexpr int kMaxFailures = 3;
+    static constexpr int kStallQueueMs = 500;
+    static constexpr std::chrono::seconds kStallTime{1};
+    static constexpr float kMinQuality = 0.9f;
+    static constexpr int kSlowPingMargin = 50;
+    // Good samples in a row before a stripe takes new streams again
+    static constexpr std::chrono::seconds kRecoverTime{3};
+    // Queued bytes worth one stream when comparing load
+    static constexpr int kLoadQuantum = 64 * 1024;
+
+private:
+    struct Stripe
+    {
+        StripeHealth health;
+        std::string session;
+        Clock::time_point nextAttempt;
+        Clock::time_point lastProgress; // unacked or pending data last moved
+        Clock::time_point goodSince;
+        int lastUnacked = 0;
+        int lastPending = 0;
+        int pickedSinceSample = 0;
+    };
+
+    bool usable(const Stripe &s) const;
+    // Health check on the latest sample; empty if fine
+    std::string problem(const Stripe &s, Clock::time_point now) const;
+
+    mutable std::mutex mutex_;
+    std::vector<Stripe> stripes_{1};
+    int count_ = 1;
+    StripePolicy policy_ = StripePolicy::Load;
+};
+
+#endif // STEAM_STRIPE_SET_H
@@ -0,0 +1,43 @@
+#include "steam_tunnel_transport.h"
+#include <isteamnetworkingutils.h>
+
+EResult SteamTunnelTransport::sendMessage(HSteamNetConnection conn, const void *data, uint32 len, int sendFlags)
+{
+    return sockets_->SendMessageToConnection(conn, data, len, sendFlags, nullptr);
+}
+
+int SteamTunnelTransport::receiveMessages(HSteamNetConnection conn, int maxMessages, const MessageHandler &handler)
+{
+    ISteamNetworkingMessage *pIncomingMsgs[32];
+    if (maxMessages > 32)
+    {
+        maxMessages = 32;
+    }
+    int numMsgs = sockets_->ReceiveMessagesOnConnection(conn, pIncomingMsgs, maxMessages);
+    // m_usecTimeReceived is on Steam's clock, so the age is taken on it too
+    SteamNetworkingMicroseconds now = numMsgs > 0 ? SteamNetworkingUtils()->GetLocalTimestamp() : 0;
+    for (int i = 0; i < numMsgs; ++i)
+    {
+        ISteamNetworkingMessage *pIncomingMsg = pIncomingMsgs[i];
+        receivedAgeUs_ = now - pIncomingMsg->m_usecTimeReceived;
+        handler(static_cast<const char *>(pIncomingMsg->m_pData), static_cast<size_t>(pIncomingMsg->m_cbSize));
+        pIncomingMsg->Release();
+    }
+    receivedAgeUs_ = -1;
+    return numMsgs < 0 ? 0 : numMsgs;
+}
+
+bool SteamTunnelTransport::getRealTimeStatus(HSteamNetConnection conn, SteamNetConnectionRealTimeStatus_t &status)
+{
+    return sockets_->GetConnectionRealTimeStatus(conn, &status, 0, nullptr) == k_EResultOK;
+}
+
+uint64 SteamTunnelTransport::remotePeer(HSteamNetConnection conn)
+{
+    SteamNetConnectionInfo_t info;
+    if (!sockets_->GetConnectionInfo(conn, &info))
+    {
+        return 0;
+    }
+    return info.m_identityRemote.GetSteamID64();
+}
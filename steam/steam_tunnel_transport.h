@@ -0,0 +1,23 @@
+#ifndef STEAM_TUNNEL_TRANSPORT_H
+#define STEAM_TUNNEL_TRANSPORT_H
+
+#include <isteamnetworkingsockets.h>
+#include "../net/tunnel_transport.h"
+
+// TunnelTransport backed by the real Steam networking sockets interface
+class SteamTunnelTransport : public TunnelTransport {
+public:
+    explicit SteamTunnelTransport(ISteamNetworkingSockets* sockets) : sockets_(sockets) {}
+
+    EResult sendMessage(HSteamNetConnection conn, const void* data, uint32 len, int sendFlags) override;
+    int receiveMessages(HSteamNetConnection conn, int maxMessages, const MessageHandler& handler) override;
+    bool getRealTimeStatus(HSteamNetConnection conn, SteamNetConnectionRealTimeStatus_t& status) override;
+    int64_t receivedAgeUs() const override { return receivedAgeUs_; }
+    uint64 remotePeer(HSteamNetConnection conn) override;
+
+private:
+    ISteamNetworkingSockets* sockets_;
+    int64_t receivedAgeUs_ = -1; // poll thread only
+};
+
+#endif // STEAM_TUNNEL_TRANSPORT_H
@@ -0,0 +1,186 @@
+// Reads a flight recorder dump (connecttool-spike-*.ctfr, see
+// net/flight_recorder.h) and prints what the metrics did around the spike.
+//
+// Usage: FlightDump <dump.ctfr> [out.json | out.csv]
+//
+// Without an output file it prints the trigger and, per metric and source,
+// the sample count, mean, p99 and maximum. A .json output is a Chrome trace
+// with one counter track per metric and source, for ui.perfetto.dev or
+// chrome://tracing; a .csv output has one row per sample. Times are
+// milliseconds relative to the trigger (or to the dump for a manual one).
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <ctime>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <string>
+#include <utility>
+#include <vector>
+#include "flight_recorder.h"
+
+namespace
+{
+    bool endsWith(const std::string &text, const std::string &suffix)
+    {
+        return text.size() >= suffix.size() && text.compare(text.size() - suffix.size(), suffix.size(), suffix) == 0;
+    }
+
+    std::string sourceLabel(uint32_t metric, uint64_t source)
+    {
+        switch (static_cast<flight::Metric>(metric))
+        {
+        case flight::Metric::Ping:
+        case flight::Metric::QueueTime:
+        case flight::Metric::PendingReliable:
+            return "conn " + std::to_string(source);
+        case flight::Metric::WriteBacklog:
+            return "stream " + flight::streamName(source);
+        default:
+            return std::string();
+        }
+    }
+
+    std::string trackName(uint32_t metric, uint64_t source)
+    {
+        std::string label = sourceLabel(metric, source);
+        std::string name = flight::metricName(static_cast<flight::Metric>(metric));
+        return label.empty() ? name : name + " (" + label + ")";
+    }
+
+    bool readDump(const std::string &path, flight::FileHeader &header, std::vector<flight::Record> &records)
+    {
+        std::ifstream in(path, std::ios::binary);
+        if (!in.read(reinterpret_cast<char *>(&header), sizeof(header)))
+        {
+            std::cerr << path << ": too short for a dump header" << std::endl;
+            return false;
+        }
+        if (std::memcmp(header.magic, flight::kMagic, sizeof(header.magic)) != 0 ||
+            header.version != flight::kVersion || header.recordSize != sizeof(flight::Record))
+        {
+            std::cerr << path << ": not a version " << flight::kVersion << " flight recorder dump" << std::endl;
+            return false;
+        }
+        header.reason[sizeof(header.reason) - 1] = '\0';
+        records.resize(header.count);
+        if (!in.read(reinterpret_cast<char *>(records.data()), records.size() * sizeof(flight::Record)))
+        {
+            records.resize(static_cast<size_t>(in.gcount() / sizeof(flight::Record)));
+            std::cerr << path << ": truncated, read " << records.size() << " of " << header.count << " samples"
+                      << std::endl;
+        }
+        return true;
+    }
+
+    void printSummary(const flight::FileHeader &header, const std::vector<flight::Record> &records, int64_t originUs)
+    {
+        std::time_t start = static_cast<std::time_t>((header.startUnixUs + originUs) / 1000000);
+        char when[32];
+        std::strftime(when, sizeof(when), "%Y-%m-%d %H:%M:%S", std::localtime(&start));
+        std::cout << "Dump: " << header.reason << " at " << when << std::endl;
+        if (records.empty())
+        {
+            std::cout << "No samples" << std::endl;
+            return;
+        }
+        std::cout << std::fixed << std::setprecision(1) << "Samples: " << records.size() << " from "
+                  << (records.front().timeUs - originUs) / 1000.0 << " to " << (records.back().timeUs - originUs) / 1000.0
+                  << " ms" << std::endl;
+
+        std::map<std::pair<uint32_t, uint64_t>, std::vector<int64_t>> tracks;
+        for (const flight::Record &r : records)
+        {
+            tracks[{r.metric, r.source}].push_back(r.value);
+        }
+        std::cout << std::left << std::setw(48) << "metric" << std::right << std::setw(8) << "count"
+                  << std::setw(14) << "mean" << std::setw(14) << "p99" << std::setw(14) << "max" << std::endl;
+        for (auto &track : tracks)
+        {
+            std::vector<int64_t> &values = track.second;
+            std::sort(values.begin(), values.end());
+            double sum = 0;
+            for (int64_t v : values)
+            {
+                sum += static_cast<double>(v);
+            }
+            size_t p99 = std::min(values.size() - 1, values.size() * 99 / 100);
+            std::cout << std::left << std::setw(48) << trackName(track.first.first, track.first.second) << std::right
+                      << std::setw(8) << values.size() << std::setw(14) << sum / values.size() << std::setw(14)
+                      << values[p99] << std::setw(14) << values.back() << std::endl;
+        }
+    }
+
+    bool writeCsv(const std::string &path, const std::vector<flight::Record> &records, int64_t originUs)
+    {
+        std::ofstream out(path, std::ios::trunc);
+        if (!out)
+        {
+            return false;
+        }
+        out << "time_ms,metric,source,value\n" << std::fixed << std::setprecision(3);
+        for (const flight::Record &r : records)
+        {
+            out << (r.timeUs - originUs) / 1000.0 << ',' << flight::metricName(static_cast<flight::Metric>(r.metric))
+                << ',' << sourceLabel(r.metric, r.source) << ',' << r.value << '\n';
+        }
+        return static_cast<bool>(out);
+    }
+
+    bool writeTrace(const std::string &path, const flight::FileHeader &header,
+                    const std::vector<flight::Record> &records)
+    {
+        std::ofstream out(path, std::ios::trunc);
+        if (!out)
+        {
+            return false;
+        }
+        // Recorder time is the trace time, so the trigger lines up with the samples
+        out << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n";
+        out << "{\"ph\":\"M\",\"name\":\"process_name\",\"pid\":1,\"args\":{\"name\":\"flight recorder\"}}";
+        if (header.triggerUs >= 0)
+        {
+            out << ",\n{\"ph\":\"i\",\"name\":\"trigger\",\"pid\":1,\"tid\":1,\"s\":\"g\",\"ts\":" << header.triggerUs
+                << "}";
+        }
+        for (const flight::Record &r : records)
+        {
+            out << ",\n{\"ph\":\"C\",\"name\":\"" << trackName(r.metric, r.source) << "\",\"pid\":1,\"tid\":1,\"ts\":"
+                << r.timeUs << ",\"args\":{\"value\":" << r.value << "}}";
+        }
+        out << "\n]}\n";
+        return static_cast<bool>(out);
+    }
+}
+
+int main(int argc, char **argv)
+{
+    if (argc < 2 || argc > 3)
+    {
+        std::cerr << "Usage: FlightDump <dump.ctfr> [out.json | out.csv]" << std::endl;
+        return 2;
+    }
+    flight::FileHeader header;
+    std::vector<flight::Record> records;
+    if (!readDump(argv[1], header, records))
+    {
+        return 1;
+    }
+    int64_t originUs = header.triggerUs >= 0 ? header.triggerUs : (records.empty() ? 0 : records.back().timeUs);
+    printSummary(header, records, originUs);
+    if (argc == 3)
+    {
+        std::string path = argv[2];
+        bool ok = endsWith(path, ".csv") ? writeCsv(path, records, originUs) : writeTrace(path, header, records);
+        if (!ok)
+        {
+            std::cerr << "Cannot write " << path << std::endl;
+            return 1;
+        }
+        std::cout << "Wrote " << path << std::endl;
+    }
+    return 0;
+}
@@ -0,0 +1,1272 @@
+// Headless tunnel benchmark: runs a client and a host SteamMessageHandler back to
+// back over EmulatedTransport, so the multiplexer and send scheduler can be
+// measured under scripted network conditions without Steam.
+//
+// Usage: TunnelBench [--trace out.json] [--capture out.ctcap] [scenario-file]
+//
+// Each non-empty line of a scenario file is "<name> key=value ...":
+//   rtt=ms latency=ms(one-way) jitter=ms loss=% reorder=% bandwidth=kbit/s
+//   duration=s interactive=streams interval=ms size=bytes
+//   bulk=streams burst=KB(0 = continuous) gap=ms
+//   connects=new connections per second (request/echo/half-close, for TTFB)
+//   greeting=1 makes the game server speak first, like many login protocols
+//   drop=s cuts the link that many seconds in, for outage=ms (default 2000);
+//   both sides suspend the session and the client resumes it afterwards
+//   speedtest=s runs the peer speed test from the client, s seconds per phase
+//   backup=1 adds a second link as the backup path and marks the interactive
+//   streams latency-critical; backuprtt=ms gives it its own RTT (default the
+//   main link's); its loss is drawn independently
+//   stripes=N opens N connections (up to 4) like connection striping, each its
+//   own link with the conditions above and an independent loss draw; new
+//   streams are placed by StripeSet's load policy as TCPServer does, and the
+//   goodput, interactive RTT p99/max and resends of every stripe are reported.
+//   bandwidth= applies per connection, as Steam's send rate does.
+//   stripeloss=% sets the loss of the last stripe alone (with stripes=1, of the
+//   only link), so a stall on one stripe can be told apart from the others
+//   timing=1 turns on latency decomposition on both sides and reports the
+//   p50/p99 of each hop for client-to-host data, and the clock offset the
+//   host measured (both peers share one clock here, so it should be ~0)
+// Bulk scenarios also report the tunnel thread's CPU per Gbit, syscalls (where perf
+// tracepoints are allowed) and context switches per MB of tunnel traffic and its
+// heap allocations per tunnel frame, to compare the epoll and io_uring
+// (CONNECTTOOL_IO_URING) builds and the callback and coroutine
+// (CONNECTTOOL_COROUTINES) engines; lan-many is the high stream count case.
+// Lines starting with # are ignored. Without a file the built-in set runs.
+// --capture records the tunnel traffic of all scenarios (net/tunnel_capture.h)
+// for TunnelReplay; both ends are in it, the client's as connection 1.
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <cstdlib>
+#include <fstream>
+#include <functional>
+#include <future>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <random>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+#ifdef _WIN32
+#include <malloc.h>
+#endif
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+#endif
+#include <boost/asio.hpp>
+#include "bandwidth_estimator.h"
+#include "emulated_transport.h"
+#include "latency_histogram.h"
+#include "multiplex_manager.h"
+#include "read_buffer_pool.h"
+#include "trace.h"
+#include "tunnel_capture.h"
+#include "steam/steam_message_handler.h"
+#include "steam/steam_stripe_set.h"
+
+using boost::asio::ip::tcp;
+using Clock = std::chrono::steady_clock;
+
+// Heap allocations per thread, to compare the pipeline engines
+thread_local uint64_t threadAllocations = 0;
+
+// Every form is replaced, as in net/mem_tracker.cpp, so all of them are counted
+// and each delete matches its new
+namespace
+{
+void *countedAlloc(std::size_t size) noexcept
+{
+    threadAllocations++;
+    return std::malloc(size ? size : 1);
+}
+
+void *countedAlignedAlloc(std::size_t size, std::align_val_t align) noexcept
+{
+    threadAllocations++;
+    std::size_t alignment = static_cast<std::size_t>(align);
+#ifdef _WIN32
+    return _aligned_malloc(size ? size : 1, alignment);
+#else
+    // aligned_alloc wants a multiple of the alignment
+    return std::aligned_alloc(alignment, ((size ? size : 1) + alignment - 1) / alignment * alignment);
+#endif
+}
+
+void alignedFree(void *p) noexcept
+{
+#ifdef _WIN32
+    _aligned_free(p);
+#else
+    std::free(p);
+#endif
+}
+
+void *orThrow(void *p)
+{
+    if (!p)
+    {
+        throw std::bad_alloc();
+    }
+    return p;
+}
+}
+
+void *operator new(std::size_t size) { return orThrow(countedAlloc(size)); }
+void *operator new[](std::size_t size) { return orThrow(countedAlloc(size)); }
+void *operator new(std::size_t size, std::align_val_t align) { return orThrow(countedAlignedAlloc(size, align)); }
+void *operator new[](std::size_t size, std::align_val_t align) { return orThrow(countedAlignedAlloc(size, align)); }
+void *operator new(std::size_t size, const std::nothrow_t &) noexcept { return countedAlloc(size); }
+void *operator new[](std::size_t size, const std::nothrow_t &) noexcept { return countedAlloc(size); }
+void *operator new(std::size_t size, std::align_val_t align, const std::nothrow_t &) noexcept { return countedAlignedAlloc(size, align); }
+void *operator new[](std::size_t size, std::align_val_t align, const std::nothrow_t &) noexcept { return countedAlignedAlloc(size, align); }
+
+void operator delete(void *p) noexcept { std::free(p); }
+void operator delete[](void *p) noexcept { std::free(p); }
+void operator delete(void *p, std::size_t) noexcept { std::free(p); }
+void operator delete[](void *p, std::size_t) noexcept { std::free(p); }
+void operator delete(void *p, const std::nothrow_t &) noexcept { std::free(p); }
+void operator delete[](void *p, const std::nothrow_t &) noexcept { std::free(p); }
+void operator delete(void *p, std::align_val_t) noexcept { alignedFree(p); }
+void operator delete[](void *p, std::align_val_t) noexcept { alignedFree(p); }
+void operator delete(void *p, std::size_t, std::align_val_t) noexcept { alignedFree(p); }
+void operator delete[](void *p, std::size_t, std::align_val_t) noexcept { alignedFree(p); }
+void operator delete(void *p, std::align_val_t, const std::nothrow_t &) noexcept { alignedFree(p); }
+void operator delete[](void *p, std::align_val_t, const std::nothrow_t &) noexcept { alignedFree(p); }
+
+namespace
+{
+
+struct Scenario
+{
+    std::string name;
+    LinkConditions link;
+    int durationSec = 10;
+    int interactive = 1;
+    int intervalMs = 16;
+    int packetSize = 64;
+    int bulk = 0;
+    int burstKB = 0;
+    int burstGapMs = 100;
+    int connectsPerSec = 0;
+    bool greeting = false;
+    int dropSec = 0;
+    int outageMs = 2000;
+    int speedTestSec = 0;
+    int snapshotChurn = 0; // interactive packets are snapshots changing this many bytes a tick
+    bool delta = false;    // delta-code the streams (both directions)
+    bool backup = false;
+    int backupLatencyMs = -1; // one-way; -1 = same as the main link
+    bool timing = false;
+    int stripes = 1;
+    double stripeLossPercent = -1; // last stripe only; -1 = loss
+};
+
+constexpr size_t kGreetingSize = 4;
+
+const char *kBuiltinScenarios =
+    "lan            rtt=2\n"
+    "relay          rtt=150 jitter=10\n"
+    "relay-bulk     rtt=150 jitter=10 bandwidth=20000 bulk=1\n"
+    "lossy-bulk     rtt=80 jitter=5 loss=2 bandwidth=20000 bulk=1\n"
+    "capped-bursty  rtt=40 bandwidth=5000 bulk=2 burst=512 gap=200\n"
+    "capped         rtt=40 bandwidth=16000\n"
+    "capped-bulk    rtt=40 bandwidth=16000 bulk=1\n"
+    "churn          rtt=80 jitter=5 connects=20\n"
+    "churn-greeting rtt=80 jitter=5 connects=20 greeting=1\n"
+    "relay-drop     rtt=150 jitter=10 bandwidth=20000 bulk=1 drop=4 outage=3000\n"
+    "lan-many       rtt=2 bulk=64 duration=5\n"
+    "relay-speed    rtt=150 jitter=10 loss=1 bandwidth=20000 interactive=0 speedtest=3 duration=14\n"
+    "snapshots      rtt=80 jitter=5 interactive=4 interval=33 size=1200 snapshot=24\n"
+    "snapshots-delta rtt=80 jitter=5 interactive=4 interval=33 size=1200 snapshot=24 delta=1\n"
+    "lossy-interactive rtt=60 jitter=5 loss=2 interactive=4 interval=16 size=200\n"
+    "lossy-backup   rtt=60 jitter=5 loss=2 interactive=4 interval=16 size=200 backup=1 backuprtt=90\n"
+    "relay-timing   rtt=150 jitter=10 bandwidth=20000 bulk=1 timing=1\n"
+    "lossy-striped  rtt=80 jitter=5 bandwidth=20000 interactive=3 interval=16 size=200 bulk=3 stripes=3 stripeloss=3\n";
+
+// CPU time, context switches and heap allocations of the calling thread so far;
+// zero where unsupported
+struct ThreadUsage
+{
+    double cpuMs = 0;
+    uint64_t contextSwitches = 0;
+    uint64_t allocations = 0;
+};
+
+ThreadUsage sampleThreadUsage()
+{
+    ThreadUsage usage;
+    usage.allocations = threadAllocations;
+#ifdef __linux__
+    timespec ts{};
+    if (clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts) == 0)
+    {
+        usage.cpuMs = ts.tv_sec * 1000.0 + ts.tv_nsec / 1e6;
+    }
+    rusage ru{};
+    if (getrusage(RUSAGE_THREAD, &ru) == 0)
+    {
+        usage.contextSwitches = static_cast<uint64_t>(ru.ru_nvcsw + ru.ru_nivcsw);
+    }
+#endif
+    return usage;
+}
+
+// Counts the syscalls of the thread that creates it, through the
+// raw_syscalls:sys_enter tracepoint. Needs tracefs and perf_event_paranoid <= 1
+// (or CAP_PERFMON); otherwise valid() is false and strace -c -f is the fallback.
+class SyscallCounter
+{
+public:
+    SyscallCounter()
+    {
+#ifdef __linux__
+        uint64_t id = 0;
+        for (const char *path : {"/sys/kernel/tracing/events/raw_syscalls/sys_enter/id",
+                                 "/sys/kernel/debug/tracing/events/raw_syscalls/sys_enter/id"})
+        {
+            std::ifstream file(path);
+            if (file >> id)
+            {
+                break;
+            }
+        }
+        if (id == 0)
+        {
+            return;
+        }
+        perf_event_attr attr{};
+        attr.type = PERF_TYPE_TRACEPOINT;
+        attr.size = sizeof(attr);
+        attr.config = id;
+        fd_ = static_cast<int>(syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0));
+#endif
+    }
+    ~SyscallCounter()
+    {
+#ifdef __linux__
+        if (fd_ >= 0)
+        {
+            close(fd_);
+        }
+#endif
+    }
+    SyscallCounter(const SyscallCounter &) = delete;
+    SyscallCounter &operator=(const SyscallCounter &) = delete;
+
+    bool valid() const { return fd_ >= 0; }
+    uint64_t count() const
+    {
+        uint64_t value = 0;
+#ifdef __linux__
+        if (fd_ >= 0 && read(fd_, &value, sizeof(value)) != sizeof(value))
+        {
+            value = 0;
+        }
+#endif
+        return value;
+    }
+
+private:
+    int fd_ = -1;
+};
+
+bool parseScenario(const std::string &line, Scenario &out)
+{
+    std::istringstream in(line);
+    if (!(in >> out.name) || out.name[0] == '#')
+    {
+        return false;
+    }
+    std::string token;
+    while (in >> token)
+    {
+        auto eq = token.find('=');
+        if (eq == std::string::npos)
+        {
+            std::cerr << "Ignoring malformed option '" << token << "' in scenario " << out.name << std::endl;
+            continue;
+        }
+        std::string key = token.substr(0, eq);
+        double value = std::atof(token.c_str() + eq + 1);
+        if (key == "rtt")
+            out.link.latencyMs = static_cast<int>(value / 2);
+        else if (key == "latency")
+            out.link.latencyMs = static_cast<int>(value);
+        else if (key == "jitter")
+            out.link.jitterMs = static_cast<int>(value);
+        else if (key == "loss")
+            out.link.lossPercent = value;
+        else if (key == "reorder")
+            out.link.reorderPercent = value;
+        else if (key == "bandwidth")
+            out.link.bandwidthBytesPerSec = static_cast<int64_t>(value * 1000 / 8);
+        else if (key == "duration")
+            out.durationSec = static_cast<int>(value);
+        else if (key == "interactive")
+            out.interactive = static_cast<int>(value);
+        else if (key == "interval")
+            out.intervalMs = static_cast<int>(value);
+        else if (key == "size")
+            out.packetSize = std::max(16, static_cast<int>(value));
+        else if (key == "bulk")
+            out.bulk = static_cast<int>(value);
+        else if (key == "burst")
+            out.burstKB = static_cast<int>(value);
+        else if (key == "gap")
+            out.burstGapMs = static_cast<int>(value);
+        else if (key == "connects")
+            out.connectsPerSec = static_cast<int>(value);
+        else if (key == "greeting")
+            out.greeting = value != 0;
+        else if (key == "drop")
+            out.dropSec = static_cast<int>(value);
+        else if (key == "outage")
+            out.outageMs = static_cast<int>(value);
+        else if (key == "speedtest")
+            out.speedTestSec = static_cast<int>(value);
+        else if (key == "snapshot")
+            out.snapshotChurn = static_cast<int>(value);
+        else if (key == "delta")
+            out.delta = value != 0;
+        else if (key == "backup")
+            out.backup = value != 0;
+        else if (key == "backuprtt")
+            out.backupLatencyMs = static_cast<int>(value / 2);
+        else if (key == "timing")
+            out.timing = value != 0;
+        else if (key == "stripes")
+            out.stripes = std::min(std::max(1, static_cast<int>(value)), StripeSet::kMaxStripes);
+        else if (key == "stripeloss")
+            out.stripeLossPercent = value;
+        else
+            std::cerr << "Unknown option '" << key << "' in scenario " << out.name << std::endl;
+    }
+    return true;
+}
+
+std::vector<Scenario> loadScenarios(std::istream &in)
+{
+    std::vector<Scenario> scenarios;
+    std::string line;
+    while (std::getline(in, line))
+    {
+        Scenario s;
+        if (parseScenario(line, s))
+        {
+            scenarios.push_back(s);
+        }
+    }
+    return scenarios;
+}
+
+// Several emulated links behind one transport, by connection handle, as
+// Steam serves every connection of a process through one interface
+class LinkRouter : public TunnelTransport
+{
+public:
+    void add(EmulatedTransport *link) { links_.push_back(link); }
+
+    EResult sendMessage(HSteamNetConnection conn, const void *data, uint32 len, int sendFlags) override
+    {
+        EmulatedTransport *link = find(conn);
+        return link ? link->sendMessage(conn, data, len, sendFlags) : k_EResultNoConnection;
+    }
+    int receiveMessages(HSteamNetConnection conn, int maxMessages, const MessageHandler &handler) override
+    {
+        EmulatedTransport *link = find(conn);
+        receiving_ = link;
+        int count = link ? link->receiveMessages(conn, maxMessages, handler) : 0;
+        receiving_ = nullptr;
+        return count;
+    }
+    bool getRealTimeStatus(HSteamNetConnection conn, SteamNetConnectionRealTimeStatus_t &status) override
+    {
+        EmulatedTransport *link = find(conn);
+        return link && link->getRealTimeStatus(conn, status);
+    }
+    int64_t receivedAgeUs() const override { return receiving_ ? receiving_->receivedAgeUs() : -1; }
+
+private:
+    EmulatedTransport *find(HSteamNetConnection conn) const
+    {
+        for (EmulatedTransport *link : links_)
+        {
+            if (link->connection() == conn)
+            {
+                return link;
+            }
+        }
+        return nullptr;
+    }
+
+    std::vector<EmulatedTransport *> links_;
+    EmulatedTransport *receiving_ = nullptr; // receiving thread only
+};
+
+int64_t nowUsec()
+{
+    return std::chrono::duration_cast<std::chrono::microseconds>(Clock::now().time_since_epoch()).count();
+}
+
+// Stand-in game server on the host side. The first byte of each connection
+// picks the mode: 'I' echoes everything back, 'B' counts and discards. With
+// greeting enabled it first sends kGreetingSize bytes on every new connection.
+class GameServer
+{
+public:
+    GameServer(boost::asio::io_context &io, bool greeting)
+        : acceptor_(io, tcp::endpoint(boost::asio::ip::address_v4::loopback(), 0)), greeting_(greeting) {}
+
+    int port() const { return acceptor_.local_endpoint().port(); }
+    uint64_t sinkBytes() const { return sinkBytes_.load(); }
+
+    void start() { accept(); }
+
+private:
+    struct Session : std::enable_shared_from_this<Session>
+    {
+        Session(tcp::socket s, std::atomic<uint64_t> &sink) : socket(std::move(s)), sinkBytes(sink) {}
+
+        void read()
+        {
+            auto self = shared_from_this();
+            socket.async_read_some(boost::asio::buffer(buffer), [this, self](const boost::system::error_code &ec, size_t n)
+                                   {
+                if (ec)
+                {
+                    return;
+                }
+                size_t offset = 0;
+                if (mode == 0)
+                {
+                    mode = buffer[0];
+                    offset = 1;
+                }
+                if (mode == 'I')
+                {
+                    boost::asio::async_write(socket, boost::asio::buffer(buffer.data() + offset, n - offset),
+                                             [this, self](const boost::system::error_code &ec, size_t)
+                                             {
+                                                 if (!ec)
+                                                 {
+                                                     read();
+                                                 }
+                                             });
+                    return;
+                }
+                sinkBytes += n - offset;
+                read(); });
+        }
+
+        tcp::socket socket;
+        std::atomic<uint64_t> &sinkBytes;
+        std::array<char, 64 * 1024> buffer;
+        char mode = 0;
+    };
+
+    void accept()
+    {
+        acceptor_.async_accept([this](const boost::system::error_code &ec, tcp::socket socket)
+                               {
+            if (ec)
+            {
+                return;
+            }
+            socket.set_option(tcp::no_delay(true));
+            auto session = std::make_shared<Session>(std::move(socket), sinkBytes_);
+            if (greeting_)
+            {
+                boost::asio::async_write(session->socket, boost::asio::buffer("HELO", kGreetingSize),
+                                         [session](const boost::system::error_code &ec, size_t)
+                                         {
+                                             if (!ec)
+                                             {
+                                                 session->read();
+                                             }
+                                         });
+            }
+            else
+            {
+                session->read();
+            }
+            accept(); });
+    }
+
+    tcp::acceptor acceptor_;
+    bool greeting_;
+    std::atomic<uint64_t> sinkBytes_{0};
+};
+
+// Sends small timestamped packets at a fixed interval and measures the echo RTT.
+// With snapshotChurn the packets look like world-state snapshots: random
+// state of which that many bytes change from one tick to the next.
+class InteractiveClient : public std::enable_shared_from_this<InteractiveClient>
+{
+public:
+    InteractiveClient(boost::asio::io_context &io, int intervalMs, int packetSize, int snapshotChurn)
+        : socket_(io), timer_(io), interval_(intervalMs), packet_(packetSize), echo_(packetSize), churn_(snapshotChurn)
+    {
+        if (churn_ > 0)
+        {
+            for (size_t i = kStampSize; i < packet_.size(); ++i)
+            {
+                packet_[i] = static_cast<char>(rng_());
+            }
+        }
+    }
+
+    void start(const tcp::endpoint &target, bool greeting)
+    {
+        socket_.connect(target);
+        socket_.set_option(tcp::no_delay(true));
+        localPort_ = socket_.local_endpoint().port();
+        char mode = 'I';
+        boost::asio::write(socket_, boost::asio::buffer(&mode, 1));
+        tick();
+        if (!greeting)
+        {
+            readEcho();
+            return;
+        }
+        auto self = shared_from_this();
+        boost::asio::async_read(socket_, boost::asio::buffer(echo_.data(), kGreetingSize), [this, self](const boost::system::error_code &ec, size_t)
+                                {
+            if (!ec)
+            {
+                readEcho();
+            } });
+    }
+
+    uint64_t sent() const { return sent_; }
+    uint64_t received() const { return received_; }
+    // Echoes that did not carry the next sequence number (lost or repeated data)
+    uint64_t outOfSequence() const { return outOfSequence_; }
+    const LatencyHistogram &rtt() const { return rtt_; }
+    // Source port the tunnel's listener saw, to find the stripe it went to
+    unsigned short localPort() const { return localPort_; }
+
+private:
+    void tick()
+    {
+        uint32_t seq = sent_++;
+        int64_t stamp = nowUsec();
+        for (int i = 0; i < churn_ && packet_.size() > kStampSize; ++i)
+        {
+            packet_[kStampSize + rng_() % (packet_.size() - kStampSize)] = static_cast<char>(rng_());
+        }
+        std::memcpy(packet_.data(), &seq, sizeof(seq));
+        std::memcpy(packet_.data() + sizeof(seq), &stamp, sizeof(stamp));
+        auto out = std::make_shared<std::vector<char>>(packet_);
+        auto self = shared_from_this();
+        boost::asio::async_write(socket_, boost::asio::buffer(*out), [out, self](const boost::system::error_code &, size_t) {});
+        timer_.expires_after(std::chrono::milliseconds(interval_));
+        timer_.async_wait([this, self](const boost::system::error_code &ec)
+                          {
+            if (!ec)
+            {
+                tick();
+            } });
+    }
+
+    void readEcho()
+    {
+        auto self = shared_from_this();
+        boost::asio::async_read(socket_, boost::asio::buffer(echo_), [this, self](const boost::system::error_code &ec, size_t)
+                                {
+            if (ec)
+            {
+                return;
+            }
+            uint32_t seq;
+            int64_t stamp;
+            std::memcpy(&seq, echo_.data(), sizeof(seq));
+            std::memcpy(&stamp, echo_.data() + sizeof(uint32_t), sizeof(stamp));
+            if (seq != received_)
+            {
+                outOfSequence_++;
+            }
+            rtt_.record(static_cast<uint64_t>(nowUsec() - stamp));
+            received_++;
+            readEcho(); });
+    }
+
+    tcp::socket socket_;
+    boost::asio::steady_timer timer_;
+    int interval_;
+    LatencyHistogram rtt_;
+    unsigned short localPort_ = 0;
+    static constexpr size_t kStampSize = sizeof(uint32_t) + sizeof(int64_t);
+
+    std::vector<char> packet_;
+    std::vector<char> echo_;
+    int churn_;
+    std::minstd_rand rng_;
+    uint64_t sent_ = 0;
+    uint64_t received_ = 0;
+    uint64_t outOfSequence_ = 0;
+};
+
+// Pushes bulk data as fast as the tunnel accepts it, optionally in bursts
+class BulkClient : public std::enable_shared_from_this<BulkClient>
+{
+public:
+    BulkClient(boost::asio::io_context &io, int burstKB, int gapMs)
+        : socket_(io), timer_(io), burstBytes_(static_cast<size_t>(burstKB) * 1024), gapMs_(gapMs), chunk_(64 * 1024, 'x') {}
+
+    void start(const tcp::endpoint &target)
+    {
+        socket_.connect(target);
+        char mode = 'B';
+        boost::asio::write(socket_, boost::asio::buffer(&mode, 1));
+        send();
+    }
+
+private:
+    void send()
+    {
+        auto self = shared_from_this();
+        boost::asio::async_write(socket_, boost::asio::buffer(chunk_), [this, self](const boost::system::error_code &ec, size_t n)
+                                 {
+            if (ec)
+            {
+                return;
+            }
+            inBurst_ += n;
+            if (burstBytes_ == 0 || inBurst_ < burstBytes_)
+            {
+                send();
+                return;
+            }
+            inBurst_ = 0;
+            timer_.expires_after(std::chrono::milliseconds(gapMs_));
+            timer_.async_wait([this, self](const boost::system::error_code &ec)
+                              {
+                if (!ec)
+                {
+                    send();
+                } }); });
+    }
+
+    tcp::socket socket_;
+    boost::asio::steady_timer timer_;
+    size_t burstBytes_;
+    size_t inBurst_ = 0;
+    int gapMs_;
+    std::vector<char> chunk_;
+};
+
+// Opens short-lived connections: one request, one echo, then a half-close that
+// must come back as EOF once the game side has closed too. Time to first byte
+// is measured to the echo, or to the server's greeting when it speaks first.
+class ChurnClient : public std::enable_shared_from_this<ChurnClient>
+{
+public:
+    struct Results
+    {
+        LatencyHistogram firstByte;
+        uint64_t started = 0;
+        uint64_t clean = 0;  // echo received and EOF after half-close
+        uint64_t failed = 0;
+    };
+
+    ChurnClient(boost::asio::io_context &io, int perSecond, int packetSize, bool greeting)
+        : io_(io), timer_(io), intervalUs_(1000000 / std::max(1, perSecond)), packetSize_(packetSize), greeting_(greeting) {}
+
+    void start(const tcp::endpoint &target)
+    {
+        target_ = target;
+        tick();
+    }
+
+    const Results &results() const { return results_; }
+
+private:
+    struct Attempt
+    {
+        explicit Attempt(boost::asio::io_context &io) : socket(io) {}
+        tcp::socket socket;
+        std::vector<char> buffer;
+        std::vector<char> greeting;
+        Clock::time_point started;
+    };
+
+    void tick()
+    {
+        auto self = shared_from_this();
+        auto attempt = std::make_shared<Attempt>(io_);
+        attempt->started = Clock::now();
+        attempt->buffer.assign(packetSize_ + 1, 'c');
+        attempt->buffer[0] = 'I';
+        results_.started++;
+        attempt->socket.async_connect(target_, [this, self, attempt](const boost::system::error_code &ec)
+                                      {
+            if (ec)
+            {
+                results_.failed++;
+                return;
+            }
+            if (!greeting_)
+            {
+                request(attempt);
+                return;
+            }
+            attempt->greeting.resize(kGreetingSize);
+            boost::asio::async_read(attempt->socket, boost::asio::buffer(attempt->greeting), [this, self, attempt](const boost::system::error_code &ec, size_t)
+                                    {
+                if (ec)
+                {
+                    results_.failed++;
+                    return;
+                }
+                recordFirstByte(*attempt);
+                request(attempt); }); });
+
+        timer_.expires_after(std::chrono::microseconds(intervalUs_));
+        timer_.async_wait([this, self](const boost::system::error_code &ec)
+                          {
+            if (!ec)
+            {
+                tick();
+            } });
+    }
+
+    void recordFirstByte(Attempt &attempt)
+    {
+        results_.firstByte.record(std::chrono::duration_cast<std::chrono::microseconds>(Clock::now() - attempt.started).count());
+    }
+
+    void request(std::shared_ptr<Attempt> attempt)
+    {
+        auto self = shared_from_this();
+        boost::asio::async_write(attempt->socket, boost::asio::buffer(attempt->buffer), [this, self, attempt](const boost::system::error_code &ec, size_t)
+                                 {
+            if (ec)
+            {
+                results_.failed++;
+                return;
+            }
+            attempt->buffer.resize(packetSize_);
+            boost::asio::async_read(attempt->socket, boost::asio::buffer(attempt->buffer), [this, self, attempt](const boost::system::error_code &ec, size_t)
+                                    {
+                if (ec)
+                {
+                    results_.failed++;
+                    return;
+                }
+                if (!greeting_)
+                {
+                    recordFirstByte(*attempt);
+                }
+                boost::system::error_code ignored;
+                attempt->socket.shutdown(tcp::socket::shutdown_send, ignored);
+                waitForEof(attempt); }); });
+    }
+
+    void waitForEof(std::shared_ptr<Attempt> attempt)
+    {
+        auto self = shared_from_this();
+        attempt->socket.async_read_some(boost::asio::buffer(attempt->buffer), [this, self, attempt](const boost::system::error_code &ec, size_t)
+                                        {
+            if (ec == boost::asio::error::eof)
+            {
+                results_.clean++;
+            }
+            else if (ec)
+            {
+                results_.failed++;
+            }
+            else
+            {
+                waitForEof(attempt);
+            } });
+    }
+
+    boost::asio::io_context &io_;
+    boost::asio::steady_timer timer_;
+    tcp::endpoint target_;
+    int intervalUs_;
+    int packetSize_;
+    bool greeting_;
+    Results results_;
+};
+
+void runScenario(const Scenario &scenario)
+{
+    // Tunnel side: both handlers and their pipelines, like the app's io_context thread
+    boost::asio::io_context tunnelIo;
+    auto tunnelWork = boost::asio::make_work_guard(tunnelIo);
+    ReadBufferPool::install(tunnelIo);
+    // Application side: game server and traffic generators
+    boost::asio::io_context appIo;
+    auto appWork = boost::asio::make_work_guard(appIo);
+
+    auto stripeConditions = [&](int index)
+    {
+        LinkConditions conditions = scenario.link;
+        if (index == scenario.stripes - 1 && scenario.stripeLossPercent >= 0)
+        {
+            conditions.lossPercent = scenario.stripeLossPercent;
+        }
+        return conditions;
+    };
+    auto link = EmulatedTransport::createPair(stripeConditions(0), stripeConditions(0));
+    EmulatedTransport &clientLink = *link.first;
+    EmulatedTransport &hostLink = *link.second;
+    LinkConditions backupConditions = scenario.link;
+    if (scenario.backupLatencyMs >= 0)
+    {
+        backupConditions.latencyMs = scenario.backupLatencyMs;
+    }
+    auto backupLink = EmulatedTransport::createPair(backupConditions, backupConditions, 7, 3);
+    LinkRouter clientTransport, hostTransport;
+    clientTransport.add(&clientLink);
+    hostTransport.add(&hostLink);
+    if (scenario.backup)
+    {
+        clientTransport.add(backupLink.first.get());
+        hostTransport.add(backupLink.second.get());
+    }
+    // Stripe 0 is the main link; the others get links of their own after the backup's handles
+    std::vector<std::pair<EmulatedTransport *, EmulatedTransport *>> stripeLinks{{&clientLink, &hostLink}};
+    std::vector<std::pair<std::unique_ptr<EmulatedTransport>, std::unique_ptr<EmulatedTransport>>> extraLinks;
+    for (int i = 1; i < scenario.stripes; ++i)
+    {
+        extraLinks.push_back(EmulatedTransport::createPair(stripeConditions(i), stripeConditions(i), 11 + i, 3 + 2 * i));
+        stripeLinks.emplace_back(extraLinks.back().first.get(), extraLinks.back().second.get());
+        clientTransport.add(extraLinks.back().first.get());
+        hostTransport.add(extraLinks.back().second.get());
+    }
+
+    GameServer gameServer(appIo, scenario.greeting);
+    gameServer.start();
+
+    bool clientIsHost = false;
+    bool hostIsHost = true;
+    int clientPort = 0;
+    int hostPort = gameServer.port();
+    // One mapping to the default port, as a client gets it from the host's table
+    PortMapping mapping = PortMappingTable::defaults().front();
+    mapping.delta = scenario.delta;
+    if (scenario.backup)
+    {
+        mapping.trafficClass = TrafficClass::Interactive;
+    }
+    PortMappingTable hostMappings("");
+    hostMappings.setLocal({mapping});
+
+    std::vector<HSteamNetConnection> clientConns, hostConns;
+    for (const auto &stripe : stripeLinks)
+    {
+        clientConns.push_back(stripe.first->connection());
+        hostConns.push_back(stripe.second->connection());
+    }
+    std::mutex clientConnsMutex, hostConnsMutex;
+
+    auto clientHandler = std::make_unique<SteamMessageHandler>(tunnelIo, &clientTransport, clientConns, clientConnsMutex, clientIsHost, clientPort);
+    auto hostHandler = std::make_unique<SteamMessageHandler>(tunnelIo, &hostTransport, hostConns, hostConnsMutex, hostIsHost, hostPort);
+    hostHandler->setPortMappings(&hostMappings);
+    clientHandler->setTimingEnabled(scenario.timing);
+    hostHandler->setTimingEnabled(scenario.timing);
+    clientHandler->start();
+    hostHandler->start();
+    // Every stripe has a session of its own, as SteamNetworkingManager starts them
+    StripeSet stripes;
+    stripes.configure(scenario.stripes, StripePolicy::Load);
+    for (int i = 0; i < scenario.stripes; ++i)
+    {
+        HSteamNetConnection conn = stripeLinks[i].first->connection();
+        clientHandler->startSession(conn);
+        stripes.setConnection(i, conn);
+        stripes.markConnected(i);
+    }
+    std::thread tunnelThread([&]()
+                             {
+        trace::setThreadName("tunnel-io");
+        tunnelIo.run(); });
+    if (scenario.backup)
+    {
+        // What SteamNetworkingManager does once the backup connection is up;
+        // the host pairs it only with a confirmed session
+        auto main = clientHandler->getMultiplexManager(clientLink.connection());
+        for (int i = 0; i < 200 && !main->isResumable(); ++i)
+        {
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        }
+        {
+            std::lock_guard<std::mutex> clientLock(clientConnsMutex), hostLock(hostConnsMutex);
+            clientConns.push_back(backupLink.first->connection());
+            hostConns.push_back(backupLink.second->connection());
+        }
+        clientHandler->pairBackup(backupLink.first->connection(), clientLink.connection());
+    }
+
+    // Client-side listener, standing in for TCPServer
+    tcp::acceptor listener(tunnelIo, tcp::endpoint(boost::asio::ip::address_v4::loopback(), 0));
+    std::map<unsigned short, int> stripeOfPort; // game client source port -> stripe
+    std::mutex stripeOfPortMutex;
+    tcp::endpoint listenEndpoint = listener.local_endpoint();
+    std::function<void()> acceptNext = [&]()
+    {
+        auto socket = std::make_shared<tcp::socket>(tunnelIo);
+        listener.async_accept(*socket, [&, socket](const boost::system::error_code &ec)
+                              {
+            if (ec)
+            {
+                return;
+            }
+            socket->set_option(tcp::no_delay(true));
+            unsigned short sourcePort = socket->remote_endpoint().port();
+            HSteamNetConnection conn = stripes.pick(sourcePort);
+            {
+                std::lock_guard<std::mutex> lock(stripeOfPortMutex);
+                stripeOfPort[sourcePort] = stripes.indexOf(conn);
+            }
+            clientHandler->getMultiplexManager(conn)->addClient(socket, &mapping);
+            acceptNext(); });
+    };
+    acceptNext();
+
+    std::thread appThread([&]()
+                          {
+        trace::setThreadName("app-io");
+        appIo.run(); });
+
+    // Cost of the tunnel thread over the run, which is where the local sockets live
+    std::unique_ptr<SyscallCounter> tunnelSyscalls;
+    std::promise<ThreadUsage> usageStart;
+    boost::asio::post(tunnelIo, [&]()
+                      {
+        tunnelSyscalls = std::make_unique<SyscallCounter>();
+        usageStart.set_value(sampleThreadUsage()); });
+    ThreadUsage tunnelUsage = usageStart.get_future().get();
+    uint64_t syscallsStart = tunnelSyscalls->count();
+
+    std::vector<std::shared_ptr<InteractiveClient>> interactive;
+    std::vector<std::shared_ptr<BulkClient>> bulk;
+    std::shared_ptr<ChurnClient> churn;
+    boost::asio::post(appIo, [&]()
+                      {
+        try
+        {
+            for (int i = 0; i < scenario.interactive; ++i)
+            {
+                interactive.push_back(std::make_shared<InteractiveClient>(appIo, scenario.intervalMs, scenario.packetSize, scenario.snapshotChurn));
+                interactive.back()->start(listenEndpoint, scenario.greeting);
+            }
+            for (int i = 0; i < scenario.bulk; ++i)
+            {
+                bulk.push_back(std::make_shared<BulkClient>(appIo, scenario.burstKB, scenario.burstGapMs));
+                bulk.back()->start(listenEndpoint);
+            }
+            if (scenario.connectsPerSec > 0)
+            {
+                churn = std::make_shared<ChurnClient>(appIo, scenario.connectsPerSec, scenario.packetSize, scenario.greeting);
+                churn->start(listenEndpoint);
+            }
+        }
+        catch (const std::exception &e)
+        {
+            std::cerr << "Failed to start generators: " << e.what() << std::endl;
+        } });
+
+    auto started = Clock::now();
+    if (scenario.speedTestSec > 0)
+    {
+        clientHandler->getMultiplexManager(clientLink.connection())->startSpeedTest(scenario.speedTestSec);
+    }
+    if (scenario.dropSec > 0 && scenario.dropSec < scenario.durationSec)
+    {
+        // What SteamNetworkingManager does on ClosedByPeer, then on reconnect
+        std::this_thread::sleep_for(std::chrono::seconds(scenario.dropSec));
+        clientLink.setLinkUp(false);
+        {
+            std::lock_guard<std::mutex> clientLock(clientConnsMutex), hostLock(hostConnsMutex);
+            clientConns.clear();
+            hostConns.clear();
+        }
+        clientHandler->suspendSession(clientLink.connection());
+        hostHandler->suspendSession(hostLink.connection());
+        std::this_thread::sleep_for(std::chrono::milliseconds(scenario.outageMs));
+        clientLink.setLinkUp(true);
+        {
+            std::lock_guard<std::mutex> clientLock(clientConnsMutex), hostLock(hostConnsMutex);
+            clientConns.push_back(clientLink.connection());
+            hostConns.push_back(hostLink.connection());
+        }
+        clientHandler->resumeSession(clientLink.connection());
+    }
+    // Sample the client link the way the network thread does for Steam connections
+    BandwidthEstimator estimator;
+    auto finish = started + std::chrono::seconds(scenario.durationSec);
+    while (Clock::now() + BandwidthEstimator::kSampleInterval < finish)
+    {
+        std::this_thread::sleep_for(BandwidthEstimator::kSampleInterval);
+        SteamNetConnectionRealTimeStatus_t status;
+        if (clientLink.getRealTimeStatus(clientLink.connection(), status))
+        {
+            estimator.update(status, Clock::now());
+        }
+        for (int i = 0; scenario.stripes > 1 && i < scenario.stripes; ++i)
+        {
+            // Stripe health, so streams opened later avoid a stalled stripe
+            EmulatedTransport &stripeLink = *stripeLinks[i].first;
+            if (stripeLink.getRealTimeStatus(stripeLink.connection(), status))
+            {
+                int streams = clientHandler->getMultiplexManager(stripeLink.connection())->getClientCount();
+                stripes.sample(i, status, streams, Clock::now());
+            }
+        }
+    }
+    std::this_thread::sleep_until(finish);
+    double elapsed = std::chrono::duration<double>(Clock::now() - started).count();
+
+    // Snapshot results before tearing down
+    std::promise<void> snapshotDone;
+    uint64_t sent = 0, received = 0, outOfSequence = 0;
+    LatencyHistogram rttSnapshot;
+    std::vector<LatencyHistogram> stripeRtt(scenario.stripes);
+    ChurnClient::Results churnSnapshot;
+    boost::asio::post(appIo, [&]()
+                      {
+        for (auto &c : interactive)
+        {
+            sent += c->sent();
+            received += c->received();
+            outOfSequence += c->outOfSequence();
+            rttSnapshot.merge(c->rtt());
+            std::lock_guard<std::mutex> lock(stripeOfPortMutex);
+            auto stripe = stripeOfPort.find(c->localPort());
+            if (stripe != stripeOfPort.end() && stripe->second >= 0)
+            {
+                stripeRtt[stripe->second].merge(c->rtt());
+            }
+        }
+        if (churn)
+        {
+            churnSnapshot = churn->results();
+        }
+        snapshotDone.set_value(); });
+    snapshotDone.get_future().wait();
+    std::promise<ThreadUsage> usageEnd;
+    boost::asio::post(tunnelIo, [&]()
+                      { usageEnd.set_value(sampleThreadUsage()); });
+    ThreadUsage tunnelEnd = usageEnd.get_future().get();
+    uint64_t syscallsEnd = tunnelSyscalls->count();
+    uint64_t sinkBytes = gameServer.sinkBytes();
+    SendScheduler::Stats sched = clientHandler->getMultiplexManager(clientLink.connection())->getSchedulerStats();
+    EmulatedTransport::Stats linkStats = clientLink.getStats();
+    EmulatedTransport::Stats hostLinkStats = hostLink.getStats();
+    uint64_t tunnelBytes = linkStats.bytesSent + hostLinkStats.bytesSent;
+    MultiplexManager::StreamStats hostStreams = hostHandler->getMultiplexManager(hostLink.connection())->getStreamStats();
+    SpeedTest::Result speedTest = clientHandler->getMultiplexManager(clientLink.connection())->getSpeedTestResult();
+    PortStats clientPort0 = clientHandler->getMultiplexManager(clientLink.connection())->getPortStats()[0];
+    PortStats hostPort0 = hostHandler->getMultiplexManager(hostLink.connection())->getPortStats()[0];
+    MultiplexManager::BackupStats clientBackup = clientHandler->getBackupStats(clientLink.connection());
+    MultiplexManager::BackupStats hostBackup = hostHandler->getBackupStats(hostLink.connection());
+    uint64_t backupBytes = backupLink.first->getStats().bytesSent + backupLink.second->getStats().bytesSent;
+    MultiplexManager::TimingStats hostTiming = hostHandler->getMultiplexManager(hostLink.connection())->getTimingStats();
+    // Per stripe: what the host wrote to the game server, and the client's resends
+    std::vector<uint64_t> stripeBytes, stripeResends;
+    for (const auto &stripe : stripeLinks)
+    {
+        stripeBytes.push_back(hostHandler->getMultiplexManager(stripe.second->connection())->getPortStats()[0].bytesReceived);
+        stripeResends.push_back(stripe.first->getStats().retransmissions);
+    }
+
+    appIo.stop();
+    appThread.join();
+    clientHandler->stop();
+    hostHandler->stop();
+    tunnelIo.stop();
+    tunnelThread.join();
+    ReadBufferPool::uninstall(tunnelIo);
+
+    auto ms = [](uint64_t usec)
+    { return usec / 1000.0; };
+    std::cout << std::fixed << std::setprecision(1)
+              << std::left << std::setw(16) << scenario.name << std::right
+              << " rtt p50 " << std::setw(7) << ms(rttSnapshot.percentile(50))
+              << " p99 " << std::setw(7) << ms(rttSnapshot.percentile(99))
+              << " p99.9 " << std::setw(7) << ms(rttSnapshot.percentile(99.9))
+              << " max " << std::setw(7) << ms(rttSnapshot.max()) << " ms"
+              << " | echoes " << received << "/" << sent
+              << " | goodput " << std::setw(8) << (sinkBytes / elapsed / 1024.0) << " KB/s"
+              << " | queue p99 int " << ms(sched.interactive.queueDelay.percentile(99))
+              << " bulk " << ms(sched.bulk.queueDelay.percentile(99)) << " ms"
+              << " | resends " << linkStats.retransmissions;
+    if (scenario.connectsPerSec > 0)
+    {
+        std::cout << " | ttfb p50 " << ms(churnSnapshot.firstByte.percentile(50))
+                  << " p99 " << ms(churnSnapshot.firstByte.percentile(99)) << " ms"
+                  << " clean " << churnSnapshot.clean << "/" << churnSnapshot.started
+                  << " failed " << churnSnapshot.failed;
+    }
+    if (scenario.bulk > 0 && tunnelBytes > 0)
+    {
+        double mb = tunnelBytes / 1e6;
+        std::cout << " | tunnel cpu " << (tunnelEnd.cpuMs - tunnelUsage.cpuMs) / (mb * 8 / 1000) << " ms/Gbit";
+        if (tunnelSyscalls->valid())
+        {
+            std::cout << " syscalls " << (syscallsEnd - syscallsStart) / mb << "/MB";
+        }
+        std::cout << " ctxsw " << (tunnelEnd.contextSwitches - tunnelUsage.contextSwitches) / mb << "/MB";
+        uint64_t frames = linkStats.messagesSent + hostLinkStats.messagesSent;
+        if (frames > 0)
+        {
+            std::cout << " allocs " << static_cast<double>(tunnelEnd.allocations - tunnelUsage.allocations) / frames << "/frame";
+        }
+        const BandwidthEstimator::State &bw = estimator.state();
+        std::cout << " | bw est " << bw.bottleneck / 1024.0 << " KB/s";
+        if (scenario.link.bandwidthBytesPerSec > 0)
+        {
+            std::cout << " of " << scenario.link.bandwidthBytesPerSec / 1024.0;
+        }
+        std::cout << " rate " << bw.sendRate / 1024 << " KB/s";
+    }
+    if ((scenario.snapshotChurn > 0 || scenario.delta) && tunnelBytes > 0)
+    {
+        // Everything both links carried, headers and acks included
+        std::cout << " | tunnel " << tunnelBytes / elapsed / 1024.0 << " KB/s";
+        uint64_t raw = clientPort0.deltaRawBytes + hostPort0.deltaRawBytes;
+        if (raw > 0)
+        {
+            uint64_t coded = clientPort0.deltaSentBytes + hostPort0.deltaSentBytes;
+            std::cout << " delta " << raw / 1024 << " -> " << coded / 1024 << " KB (saved "
+                      << 100.0 * (1.0 - static_cast<double>(coded) / raw) << "%)";
+        }
+    }
+    if (scenario.backup)
+    {
+        // Extra traffic against what the main link carried; "first" counts
+        // the copies that arrived before their frame on the main link
+        uint64_t copies = clientBackup.framesReceived + hostBackup.framesReceived;
+        std::cout << " | backup " << (clientBackup.active ? "up" : "down")
+                  << " +" << backupBytes / 1024 << " KB (" << (tunnelBytes ? 100.0 * backupBytes / tunnelBytes : 0.0) << "%)"
+                  << " first " << clientBackup.usedFirst + hostBackup.usedFirst << "/" << copies;
+    }
+    if (scenario.stripes > 1)
+    {
+        // Goodput above is the sum over all stripes; a stall on one stripe
+        // should show in that stripe's p99 only
+        std::cout << " | stripes";
+        for (int i = 0; i < scenario.stripes; ++i)
+        {
+            std::cout << " #" << i << " " << stripeBytes[i] / elapsed / 1024.0 << " KB/s p99 "
+                      << ms(stripeRtt[i].percentile(99)) << " max " << ms(stripeRtt[i].max()) << " ms resends "
+                      << stripeResends[i];
+        }
+    }
+    if (scenario.timing)
+    {
+        // Client-to-host data as the host decomposed it
+        std::cout << " | timing " << hostTiming.total.samples << " stamps";
+        for (int hop = 0; hop < timing::kHopCount; ++hop)
+        {
+            const LatencyHistogram &h = hostTiming.total.hops[hop];
+            std::cout << " " << timing::hopName(static_cast<timing::Hop>(hop)) << " " << ms(h.percentile(50)) << "/"
+                      << ms(h.percentile(99));
+        }
+        std::cout << " ms, clock offset " << hostTiming.clockOffsetUs / 1000.0 << " ms";
+    }
+    if (scenario.dropSec > 0)
+    {
+        std::cout << " | resumed " << hostStreams.resumed << " streams, reset " << hostStreams.reset
+                  << ", out of sequence " << outOfSequence;
+    }
+    if (scenario.speedTestSec > 0)
+    {
+        std::cout << " | speedtest " << SpeedTest::stateName(speedTest.state);
+        if (speedTest.state == SpeedTest::State::Done)
+        {
+            const SpeedTest::PhaseResult &idle = speedTest.phases[SpeedTest::kPhaseIdle];
+            const SpeedTest::PhaseResult &up = speedTest.phases[SpeedTest::kPhaseUpload];
+            const SpeedTest::PhaseResult &down = speedTest.phases[SpeedTest::kPhaseDownload];
+            std::cout << " up " << up.bytesPerSec / 1024.0 << " down " << down.bytesPerSec / 1024.0 << " KB/s"
+                      << " rtt p50 idle " << ms(idle.rtt.percentile(50)) << " up " << ms(up.rtt.percentile(50))
+                      << " down " << ms(down.rtt.percentile(50)) << " ms"
+                      << " loss " << idle.loss() * 100 << "/" << up.loss() * 100 << "/" << down.loss() * 100 << "%";
+        }
+        else if (!speedTest.error.empty())
+        {
+            std::cout << " (" << speedTest.error << ")";
+        }
+    }
+    std::cout << std::endl;
+}
+
+} // namespace
+
+int main(int argc, char *argv[])
+{
+    std::string tracePath;
+    std::string capturePath;
+    std::string scenarioPath;
+    for (int i = 1; i < argc; ++i)
+    {
+        std::string arg = argv[i];
+        if (arg == "--trace" && i + 1 < argc)
+        {
+            tracePath = argv[++i];
+        }
+        else if (arg == "--capture" && i + 1 < argc)
+        {
+            capturePath = argv[++i];
+        }
+        else
+        {
+            scenarioPath = arg;
+        }
+    }
+    trace::setEnabled(!tracePath.empty());
+
+    std::vector<Scenario> scenarios;
+    if (!scenarioPath.empty())
+    {
+        std::ifstream file(scenarioPath);
+        if (!file)
+        {
+            std::cerr << "Cannot open scenario file " << scenarioPath << std::endl;
+            return 1;
+        }
+        scenarios = loadScenarios(file);
+    }
+    else
+    {
+        std::istringstream builtin(kBuiltinScenarios);
+        scenarios = loadScenarios(builtin);
+    }
+
+    if (!capturePath.empty() && !capture::start(capturePath, false, false))
+    {
+        return 1;
+    }
+    std::cout << "Local socket backend: " << ReadBufferPool::backendName() << std::endl;
+    for (const auto &scenario : scenarios)
+    {
+        runScenario(scenario);
+    }
+    capture::stop();
+
+    if (!tracePath.empty())
+    {
+        if (!trace::writeChromeTrace(tracePath))
+        {
+            std::cerr << "Cannot write trace to " << tracePath << std::endl;
+            return 1;
+        }
+        std::cout << "Trace written to " << tracePath << std::endl;
+    }
+    return 0;
+}
@@ -0,0 +1,904 @@
+// Replays a tunnel capture (connecttool-capture-*.ctcap, see
+// net/tunnel_capture.h) through a client and a host SteamMessageHandler over
+// EmulatedTransport, with local TCP sockets on both ends, so a recorded game
+// session becomes a repeatable throughput and latency benchmark.
+//
+// Usage: TunnelReplay [--info] <capture.ctcap> [key=value ...]
+//   speed=x   time scale: 1 keeps the recorded pace (default), 4 runs four
+//             times faster, 0 sends everything as fast as the tunnel takes it
+//   rtt=ms latency=ms(one-way) jitter=ms loss=% reorder=% bandwidth=kbit/s
+//             the emulated link, as in TunnelBench (default: no delay)
+//   delta=1   delta-code the replayed streams
+//   drain=s   how long to wait for data still in flight after the last
+//             recorded event (default 10)
+//   seed=n    seed of the link's loss and jitter (default 1)
+//   conn=n    only the records of this connection handle; TunnelBench
+//             --capture records both ends, the client's as connection 1
+// --info only prints what the capture holds.
+//
+// Each recorded stream is rebuilt from its DATA/DELTA frames. What the client
+// side sent is written by a stand-in game client into the tunnel's client
+// listener at its recorded time, what the host side sent by a stand-in game
+// server behind the host; FIN and RESET end the streams where the recorded
+// ones ended. Captures from either side work. Target ports are not replayed:
+// every stream goes to the one game server. Frames resent after a reconnect
+// are replayed once. Latency is from when a chunk was written into one
+// socket to when its last byte came out of the other.
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <ctime>
+#include <deque>
+#include <fstream>
+#include <future>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <string>
+#include <thread>
+#include <vector>
+#include <boost/asio.hpp>
+#include "delta_codec.h"
+#include "emulated_transport.h"
+#include "latency_histogram.h"
+#include "multiplex_manager.h"
+#include "read_buffer_pool.h"
+#include "tunnel_capture.h"
+#include "tunnel_protocol.h"
+#include "steam/steam_message_handler.h"
+
+using boost::asio::ip::tcp;
+using Clock = std::chrono::steady_clock;
+
+namespace
+{
+
+enum Direction
+{
+    kUp = 0,   // client side -> host side
+    kDown = 1, // host side -> client side
+};
+
+const char *directionName(int dir)
+{
+    return dir == kUp ? "up" : "down";
+}
+
+struct Chunk
+{
+    int64_t atUs;
+    std::vector<char> data;
+};
+
+struct StreamPlan
+{
+    std::string id;
+    int64_t openUs = 0;
+    std::vector<Chunk> chunks[2];
+    int64_t finUs[2] = {-1, -1};
+    int64_t resetUs = -1;
+    uint64_t bytes[2] = {0, 0};
+};
+
+struct Capture
+{
+    capture::FileHeader header;
+    std::vector<StreamPlan> streams; // by open time
+    uint64_t kinds[static_cast<size_t>(capture::Kind::Count)] = {};
+    std::set<uint32_t> connections;
+    int64_t durationUs = 0;
+    uint64_t resent = 0;      // frames sent again after a reconnect, skipped
+    uint64_t undecodable = 0; // DELTA frames without the history to decode them
+};
+
+struct Options
+{
+    double speed = 1.0;
+    LinkConditions link;
+    bool delta = false;
+    int drainSec = 10;
+    unsigned seed = 1;
+    uint32_t conn = 0; // 0: all
+};
+
+bool parseOption(const std::string &arg, Options &out)
+{
+    size_t eq = arg.find('=');
+    if (eq == std::string::npos)
+    {
+        return false;
+    }
+    std::string key = arg.substr(0, eq);
+    double value = std::atof(arg.c_str() + eq + 1);
+    if (key == "speed")
+        out.speed = std::max(0.0, value);
+    else if (key == "rtt")
+        out.link.latencyMs = static_cast<int>(value / 2);
+    else if (key == "latency")
+        out.link.latencyMs = static_cast<int>(value);
+    else if (key == "jitter")
+        out.link.jitterMs = static_cast<int>(value);
+    else if (key == "loss")
+        out.link.lossPercent = value;
+    else if (key == "reorder")
+        out.link.reorderPercent = value;
+    else if (key == "bandwidth")
+        out.link.bandwidthBytesPerSec = static_cast<int64_t>(value * 1000 / 8);
+    else if (key == "delta")
+        out.delta = value != 0;
+    else if (key == "drain")
+        out.drainSec = static_cast<int>(value);
+    else if (key == "seed")
+        out.seed = static_cast<unsigned>(value);
+    else if (key == "conn")
+        out.conn = static_cast<uint32_t>(value);
+    else
+        return false;
+    return true;
+}
+
+bool loadCapture(const std::string &path, uint32_t onlyConn, Capture &out)
+{
+    std::ifstream in(path, std::ios::binary);
+    capture::FileHeader &header = out.header;
+    if (!in.read(reinterpret_cast<char *>(&header), sizeof(header)))
+    {
+        std::cerr << path << ": too short for a capture header" << std::endl;
+        return false;
+    }
+    if (std::memcmp(header.magic, capture::kMagic, sizeof(header.magic)) != 0 || header.version != capture::kVersion ||
+        header.recordHeaderSize != sizeof(capture::RecordHeader))
+    {
+        std::cerr << path << ": not a version " << capture::kVersion << " tunnel capture" << std::endl;
+        return false;
+    }
+    std::vector<char> body(static_cast<size_t>(header.bytes));
+    if (!in.read(body.data(), body.size()))
+    {
+        body.resize(static_cast<size_t>(in.gcount()));
+        std::cerr << path << ": truncated, read " << body.size() << " of " << header.bytes << " bytes" << std::endl;
+    }
+    bool host = (header.flags & capture::kFlagHost) != 0;
+    bool headersOnly = (header.flags & capture::kFlagHeadersOnly) != 0;
+
+    std::map<std::string, size_t> index;
+    auto streamFor = [&](const std::string &id, int64_t timeUs) -> StreamPlan &
+    {
+        auto it = index.find(id);
+        if (it == index.end())
+        {
+            it = index.emplace(id, out.streams.size()).first;
+            out.streams.emplace_back();
+            out.streams.back().id = id;
+            out.streams.back().openUs = timeUs;
+        }
+        return out.streams[it->second];
+    };
+    // Counted frames we sent per stream, and the count the peer reported in
+    // RESUME; frames below the highest count sent so far are resends
+    struct Sent
+    {
+        uint64_t next = 0;
+        uint64_t highest = 0;
+    };
+    std::map<std::string, Sent> sent;
+    std::map<std::pair<std::string, int>, DeltaDecoder> decoders;
+    std::set<std::pair<std::string, int>> broken;
+    std::vector<char> decoded;
+
+    size_t pos = 0;
+    while (pos + sizeof(capture::RecordHeader) <= body.size())
+    {
+        capture::RecordHeader record;
+        std::memcpy(&record, body.data() + pos, sizeof(record));
+        if (pos + sizeof(record) + record.length > body.size() ||
+            record.kind >= static_cast<uint16_t>(capture::Kind::Count))
+        {
+            break;
+        }
+        const char *payload = body.data() + pos + sizeof(record);
+        pos += (sizeof(record) + record.length + 7) & ~static_cast<size_t>(7);
+        if (onlyConn != 0 && record.conn != onlyConn)
+        {
+            continue;
+        }
+        int64_t timeUs = static_cast<int64_t>(record.timeUs);
+        capture::Kind kind = static_cast<capture::Kind>(record.kind);
+        out.kinds[record.kind]++;
+        out.durationUs = std::max(out.durationUs, timeUs);
+        out.connections.insert(record.conn);
+
+        if (kind == capture::Kind::StreamAccepted && record.length >= sizeof(capture::Event))
+        {
+            capture::Event event;
+            std::memcpy(&event, payload, sizeof(event));
+            event.id[sizeof(event.id) - 1] = '\0';
+            streamFor(event.id, timeUs);
+            continue;
+        }
+        if ((kind != capture::Kind::FrameIn && kind != capture::Kind::FrameOut) || record.length < tunnel::kHeaderSize)
+        {
+            continue;
+        }
+        bool outgoing = kind == capture::Kind::FrameOut;
+        std::string id = tunnel::readId(payload);
+        uint32_t type = tunnel::readType(payload);
+        if (type == tunnel::kFrameResume && !outgoing)
+        {
+            uint64_t count;
+            if (tunnel::readPayload(payload, record.length, count))
+            {
+                sent[id].next = count;
+            }
+            continue;
+        }
+        if (!tunnel::isCountedFrame(type))
+        {
+            continue; // acks, sessions, speed tests, backup copies, timing
+        }
+        if (outgoing)
+        {
+            Sent &s = sent[id];
+            bool resend = s.next < s.highest;
+            s.next++;
+            s.highest = std::max(s.highest, s.next);
+            if (resend)
+            {
+                out.resent++;
+                continue;
+            }
+        }
+        // The client side's frames go up whichever side captured them
+        int dir = outgoing != host ? kUp : kDown;
+        StreamPlan &stream = streamFor(id, timeUs);
+        if (type == tunnel::kFrameFin)
+        {
+            stream.finUs[dir] = timeUs;
+        }
+        else if (type == tunnel::kFrameReset)
+        {
+            if (stream.resetUs < 0)
+            {
+                stream.resetUs = timeUs;
+            }
+        }
+        else if (tunnel::isDataFrame(type))
+        {
+            Chunk chunk;
+            chunk.atUs = timeUs;
+            const char *data = payload + tunnel::kHeaderSize;
+            size_t stored = record.length - tunnel::kHeaderSize;
+            auto key = std::make_pair(id, dir);
+            if (headersOnly || broken.count(key))
+            {
+                // Sizes only; a DELTA frame's size is its coded one
+                chunk.data.assign(record.originalLength - tunnel::kHeaderSize, '\0');
+            }
+            else if (type == tunnel::kFrameDelta)
+            {
+                if (!decoders[key].decode(data, stored, decoded))
+                {
+                    // Stream was running before the capture started
+                    out.undecodable++;
+                    broken.insert(key);
+                    chunk.data.assign(stored, '\0');
+                }
+                else
+                {
+                    chunk.data = decoded;
+                }
+            }
+            else
+            {
+                chunk.data.assign(data, data + stored);
+            }
+            if (chunk.data.empty())
+            {
+                continue;
+            }
+            stream.bytes[dir] += chunk.data.size();
+            stream.chunks[dir].push_back(std::move(chunk));
+        }
+    }
+    std::stable_sort(out.streams.begin(), out.streams.end(),
+                     [](const StreamPlan &a, const StreamPlan &b)
+                     { return a.openUs < b.openUs; });
+    return true;
+}
+
+void printCapture(const std::string &path, const Capture &capture)
+{
+    const capture::FileHeader &header = capture.header;
+    std::time_t start = static_cast<std::time_t>(header.startUnixUs / 1000000);
+    char when[32];
+    std::strftime(when, sizeof(when), "%Y-%m-%d %H:%M:%S", std::localtime(&start));
+    std::cout << std::fixed << std::setprecision(1) << "Capture: " << path << ", taken on the "
+              << ((header.flags & capture::kFlagHost) ? "host" : "client") << " at " << when << ", "
+              << capture.durationUs / 1e6 << " s, " << header.records << " records on " << capture.connections.size()
+              << " connection(s)" << ((header.flags & capture::kFlagHeadersOnly) ? ", headers only" : "")
+              << std::endl;
+    std::cout << " ";
+    for (size_t i = 0; i < static_cast<size_t>(capture::Kind::Count); ++i)
+    {
+        std::cout << " " << capture::kindName(static_cast<capture::Kind>(i)) << " " << capture.kinds[i];
+    }
+    std::cout << std::endl;
+    uint64_t bytes[2] = {0, 0}, chunks[2] = {0, 0};
+    int finished = 0, reset = 0;
+    for (const StreamPlan &stream : capture.streams)
+    {
+        for (int dir = kUp; dir <= kDown; ++dir)
+        {
+            bytes[dir] += stream.bytes[dir];
+            chunks[dir] += stream.chunks[dir].size();
+        }
+        reset += stream.resetUs >= 0;
+        finished += stream.resetUs < 0 && stream.finUs[kUp] >= 0 && stream.finUs[kDown] >= 0;
+    }
+    std::cout << "  streams " << capture.streams.size() << " (" << finished << " finished, " << reset << " reset)"
+              << ", up " << bytes[kUp] / 1024.0 << " KB in " << chunks[kUp] << " chunks, down "
+              << bytes[kDown] / 1024.0 << " KB in " << chunks[kDown] << " chunks";
+    if (capture.resent > 0)
+    {
+        std::cout << ", " << capture.resent << " resent frames skipped";
+    }
+    if (capture.undecodable > 0)
+    {
+        std::cout << ", " << capture.undecodable << " delta frames replayed by size only";
+    }
+    std::cout << std::endl;
+}
+
+// One recorded stream on the application side: a game client socket into the
+// tunnel's listener and the game server's socket it came out as. Lives on the
+// application io_context.
+struct ReplayStream
+{
+    struct Side
+    {
+        std::shared_ptr<tcp::socket> socket;
+        bool ready = false; // connected (client) or matched (server)
+        bool writing = false;
+        std::deque<const Chunk *> queue; // nullptr: FIN
+        std::array<char, 16 * 1024> buffer;
+    };
+
+    const StreamPlan *plan;
+    Side sides[2]; // kUp: game client, writes up; kDown: game server, writes down
+    unsigned short clientPort = 0;
+    bool reset = false;
+    uint64_t due[2] = {0, 0}; // bytes written into the sending socket so far
+    uint64_t received[2] = {0, 0};
+    std::deque<std::pair<uint64_t, Clock::time_point>> inFlight[2]; // chunk end, when written
+};
+
+struct Action
+{
+    enum Type
+    {
+        Open,
+        Send,
+        Fin,
+        Reset,
+    };
+    int64_t atUs;
+    size_t stream;
+    Type type;
+    int dir;
+    const Chunk *chunk;
+};
+
+class Replayer
+{
+public:
+    Replayer(const Capture &capture, const Options &options, boost::asio::io_context &appIo,
+             boost::asio::io_context &tunnelIo, tcp::endpoint listener)
+        : options_(options), appIo_(appIo), tunnelIo_(tunnelIo), listener_(listener), timer_(appIo),
+          server_(appIo, tcp::endpoint(boost::asio::ip::address_v4::loopback(), 0)), matchTimer_(appIo)
+    {
+        int64_t origin = capture.streams.empty() ? 0 : capture.streams.front().openUs;
+        for (const StreamPlan &plan : capture.streams)
+        {
+            size_t index = streams_.size();
+            streams_.push_back(std::make_unique<ReplayStream>());
+            streams_.back()->plan = &plan;
+            actions_.push_back(Action{plan.openUs - origin, index, Action::Open, kUp, nullptr});
+            for (int dir = kUp; dir <= kDown; ++dir)
+            {
+                for (const Chunk &chunk : plan.chunks[dir])
+                {
+                    actions_.push_back(Action{chunk.atUs - origin, index, Action::Send, dir, &chunk});
+                }
+                if (plan.finUs[dir] >= 0)
+                {
+                    actions_.push_back(Action{plan.finUs[dir] - origin, index, Action::Fin, dir, nullptr});
+                }
+            }
+            if (plan.resetUs >= 0)
+            {
+                actions_.push_back(Action{plan.resetUs - origin, index, Action::Reset, kUp, nullptr});
+            }
+        }
+        std::stable_sort(actions_.begin(), actions_.end(),
+                         [](const Action &a, const Action &b)
+                         { return a.atUs < b.atUs; });
+    }
+
+    unsigned short serverPort() const { return server_.local_endpoint().port(); }
+
+    // Client side of the tunnel: stream id for the game client's local port
+    void addClientId(unsigned short port, const std::string &id)
+    {
+        std::lock_guard<std::mutex> lock(idsMutex_);
+        idsByPort_[port] = id;
+    }
+
+    void setHostManager(std::shared_ptr<MultiplexManager> manager) { hostManager_ = std::move(manager); }
+
+    void start()
+    {
+        started_ = Clock::now();
+        acceptNext();
+        runActions();
+    }
+
+    // Application thread: every action done and everything due arrived
+    bool finished() const
+    {
+        if (next_ < actions_.size())
+        {
+            return false;
+        }
+        for (const auto &stream : streams_)
+        {
+            if (!stream->reset && (stream->received[kUp] < stream->due[kUp] || stream->received[kDown] < stream->due[kDown]))
+            {
+                return false;
+            }
+        }
+        return true;
+    }
+    bool actionsDone() const { return next_ >= actions_.size(); }
+
+    void report(double elapsed, const EmulatedTransport::Stats &up, const EmulatedTransport::Stats &down) const
+    {
+        auto ms = [](uint64_t usec)
+        { return usec / 1000.0; };
+        std::cout << std::fixed << std::setprecision(1) << "Replay at "
+                  << (options_.speed > 0 ? std::to_string(options_.speed).substr(0, 4) + "x" : std::string("full speed"))
+                  << " over rtt " << options_.link.latencyMs * 2 << " ms, jitter " << options_.link.jitterMs
+                  << " ms, loss " << options_.link.lossPercent << "%";
+        if (options_.link.bandwidthBytesPerSec > 0)
+        {
+            std::cout << ", " << options_.link.bandwidthBytesPerSec * 8 / 1000 << " kbit/s";
+        }
+        std::cout << (options_.delta ? ", delta coded" : "") << ": " << elapsed << " s" << std::endl;
+        for (int dir = kUp; dir <= kDown; ++dir)
+        {
+            uint64_t due = 0, received = 0;
+            for (const auto &stream : streams_)
+            {
+                due += stream->due[dir];
+                received += stream->received[dir];
+            }
+            const LatencyHistogram &h = latency_[dir];
+            std::cout << "  " << std::left << std::setw(5) << directionName(dir) << std::right << std::setw(10)
+                      << received / 1024.0 << " of " << due / 1024.0 << " KB, " << received / elapsed / 1024.0
+                      << " KB/s, latency p50 " << ms(h.percentile(50)) << " p99 " << ms(h.percentile(99))
+                      << " p99.9 " << ms(h.percentile(99.9)) << " max " << ms(h.max()) << " ms over " << h.count()
+                      << " chunks" << std::endl;
+        }
+        int reset = 0;
+        for (const auto &stream : streams_)
+        {
+            reset += stream->reset;
+        }
+        std::cout << "  streams " << streams_.size() << ", reset " << reset << ", failed " << failed_
+                  << " | tunnel " << (up.bytesSent + down.bytesSent) / 1024 << " KB, resends "
+                  << up.retransmissions + down.retransmissions << " | schedule lag max " << ms(maxLagUs_) << " ms"
+                  << std::endl;
+    }
+
+private:
+    void runActions()
+    {
+        while (next_ < actions_.size())
+        {
+            const Action &action = actions_[next_];
+            auto due = started_ + std::chrono::microseconds(
+                                      options_.speed > 0 ? static_cast<int64_t>(action.atUs / options_.speed) : 0);
+            auto now = Clock::now();
+            if (due > now)
+            {
+                timer_.expires_at(due);
+                timer_.async_wait([this](const boost::system::error_code &ec)
+                                  {
+                    if (!ec)
+                    {
+                        runActions();
+                    } });
+                return;
+            }
+            maxLagUs_ = std::max<uint64_t>(maxLagUs_, std::chrono::duration_cast<std::chrono::microseconds>(now - due).count());
+            perform(action);
+            next_++;
+        }
+    }
+
+    void perform(const Action &action)
+    {
+        ReplayStream &stream = *streams_[action.stream];
+        if (stream.reset)
+        {
+            return;
+        }
+        switch (action.type)
+        {
+        case Action::Open:
+            open(action.stream);
+            break;
+        case Action::Send:
+            stream.due[action.dir] += action.chunk->data.size();
+            stream.inFlight[action.dir].emplace_back(stream.due[action.dir], Clock::now());
+            stream.sides[action.dir].queue.push_back(action.chunk);
+            flush(stream, action.dir);
+            break;
+        case Action::Fin:
+            stream.sides[action.dir].queue.push_back(nullptr);
+            flush(stream, action.dir);
+            break;
+        case Action::Reset:
+            stream.reset = true;
+            for (auto &side : stream.sides)
+            {
+                if (side.socket)
+                {
+                    boost::system::error_code ignored;
+                    side.socket->close(ignored);
+                }
+            }
+            break;
+        }
+    }
+
+    void open(size_t index)
+    {
+        ReplayStream &stream = *streams_[index];
+        auto socket = std::make_shared<tcp::socket>(appIo_);
+        stream.sides[kUp].socket = socket;
+        socket->async_connect(listener_, [this, index, socket](const boost::system::error_code &ec)
+                              {
+            ReplayStream &stream = *streams_[index];
+            if (ec || stream.reset)
+            {
+                failed_ += ec ? 1 : 0;
+                return;
+            }
+            boost::system::error_code ignored;
+            socket->set_option(tcp::no_delay(true), ignored);
+            stream.clientPort = socket->local_endpoint(ignored).port();
+            stream.sides[kUp].ready = true;
+            read(stream, kUp);
+            flush(stream, kUp); });
+    }
+
+    // The socket of side dir reads what the other side sends
+    void read(ReplayStream &stream, int dir)
+    {
+        ReplayStream::Side &side = stream.sides[dir];
+        int incoming = dir == kUp ? kDown : kUp;
+        side.socket->async_read_some(boost::asio::buffer(side.buffer), [this, &stream, dir, incoming, socket = side.socket](const boost::system::error_code &ec, size_t n)
+                                     {
+            if (ec)
+            {
+                return;
+            }
+            stream.received[incoming] += n;
+            auto now = Clock::now();
+            auto &inFlight = stream.inFlight[incoming];
+            while (!inFlight.empty() && inFlight.front().first <= stream.received[incoming])
+            {
+                latency_[incoming].record(std::chrono::duration_cast<std::chrono::microseconds>(now - inFlight.front().second).count());
+                inFlight.pop_front();
+            }
+            read(stream, dir); });
+    }
+
+    void flush(ReplayStream &stream, int dir)
+    {
+        ReplayStream::Side &side = stream.sides[dir];
+        if (!side.ready || side.writing || side.queue.empty() || stream.reset)
+        {
+            return;
+        }
+        const Chunk *chunk = side.queue.front();
+        side.queue.pop_front();
+        if (!chunk)
+        {
+            boost::system::error_code ignored;
+            side.socket->shutdown(tcp::socket::shutdown_send, ignored);
+            return;
+        }
+        side.writing = true;
+        boost::asio::async_write(*side.socket, boost::asio::buffer(chunk->data), [this, &stream, dir, socket = side.socket](const boost::system::error_code &ec, size_t)
+                                 {
+            stream.sides[dir].writing = false;
+            if (!ec)
+            {
+                flush(stream, dir);
+            } });
+    }
+
+    void acceptNext()
+    {
+        auto socket = std::make_shared<tcp::socket>(appIo_);
+        server_.async_accept(*socket, [this, socket](const boost::system::error_code &ec)
+                             {
+            if (ec)
+            {
+                return;
+            }
+            boost::system::error_code ignored;
+            socket->set_option(tcp::no_delay(true), ignored);
+            unmatched_.push_back(socket);
+            match();
+            acceptNext(); });
+    }
+
+    // Pairs the game server's accepted sockets with their streams: the host
+    // pipeline of the stream the game client opened connects from the port
+    // the accepted socket sees as its peer
+    void match()
+    {
+        if (unmatched_.empty() || matching_)
+        {
+            return;
+        }
+        std::vector<std::pair<size_t, unsigned short>> candidates;
+        for (size_t i = 0; i < streams_.size(); ++i)
+        {
+            if (streams_[i]->clientPort != 0 && !streams_[i]->sides[kDown].ready && !streams_[i]->reset)
+            {
+                candidates.emplace_back(i, streams_[i]->clientPort);
+            }
+        }
+        std::vector<std::pair<std::shared_ptr<tcp::socket>, unsigned short>> accepted;
+        for (const auto &socket : unmatched_)
+        {
+            boost::system::error_code ec;
+            accepted.emplace_back(socket, socket->remote_endpoint(ec).port());
+        }
+        matching_ = true;
+        boost::asio::post(tunnelIo_, [this, candidates, accepted]()
+                          {
+            // Host pipelines live on the tunnel thread
+            std::vector<std::pair<size_t, std::shared_ptr<tcp::socket>>> found;
+            for (const auto &candidate : candidates)
+            {
+                std::string id;
+                {
+                    std::lock_guard<std::mutex> lock(idsMutex_);
+                    auto it = idsByPort_.find(candidate.second);
+                    if (it == idsByPort_.end())
+                    {
+                        continue;
+                    }
+                    id = it->second;
+                }
+                auto pipeline = hostManager_->getClient(id);
+                boost::system::error_code ec;
+                unsigned short port = pipeline ? pipeline->socket()->local_endpoint(ec).port() : 0;
+                for (const auto &socket : accepted)
+                {
+                    if (port != 0 && !ec && socket.second == port)
+                    {
+                        found.emplace_back(candidate.first, socket.first);
+                    }
+                }
+            }
+            boost::asio::post(appIo_, [this, found]()
+                              { attach(found); }); });
+    }
+
+    void attach(const std::vector<std::pair<size_t, std::shared_ptr<tcp::socket>>> &found)
+    {
+        matching_ = false;
+        for (const auto &entry : found)
+        {
+            ReplayStream &stream = *streams_[entry.first];
+            unmatched_.erase(std::remove(unmatched_.begin(), unmatched_.end(), entry.second), unmatched_.end());
+            if (stream.reset)
+            {
+                continue;
+            }
+            stream.sides[kDown].socket = entry.second;
+            stream.sides[kDown].ready = true;
+            read(stream, kDown);
+            flush(stream, kDown);
+        }
+        if (!unmatched_.empty())
+        {
+            // The game client's connect handler has not run yet; try again shortly
+            matchTimer_.expires_after(std::chrono::milliseconds(1));
+            matchTimer_.async_wait([this](const boost::system::error_code &ec)
+                                   {
+                if (!ec)
+                {
+                    match();
+                } });
+        }
+    }
+
+    const Options &options_;
+    boost::asio::io_context &appIo_;
+    boost::asio::io_context &tunnelIo_;
+    tcp::endpoint listener_;
+    boost::asio::steady_timer timer_;
+    tcp::acceptor server_;
+    boost::asio::steady_timer matchTimer_;
+    std::shared_ptr<MultiplexManager> hostManager_;
+
+    std::vector<std::unique_ptr<ReplayStream>> streams_;
+    std::vector<Action> actions_;
+    size_t next_ = 0;
+    Clock::time_point started_;
+    std::vector<std::shared_ptr<tcp::socket>> unmatched_;
+    bool matching_ = false;
+    std::mutex idsMutex_;
+    std::map<unsigned short, std::string> idsByPort_;
+
+    LatencyHistogram latency_[2];
+    uint64_t maxLagUs_ = 0;
+    int failed_ = 0;
+};
+
+void replay(const Capture &capture, const Options &options)
+{
+    // Same threading as TunnelBench: the tunnel's io_context and the
+    // application's, each on its own thread
+    boost::asio::io_context tunnelIo;
+    auto tunnelWork = boost::asio::make_work_guard(tunnelIo);
+    ReadBufferPool::install(tunnelIo);
+    boost::asio::io_context appIo;
+    auto appWork = boost::asio::make_work_guard(appIo);
+
+    auto link = EmulatedTransport::createPair(options.link, options.link, options.seed);
+    EmulatedTransport &clientLink = *link.first;
+    EmulatedTransport &hostLink = *link.second;
+
+    tcp::acceptor listener(tunnelIo, tcp::endpoint(boost::asio::ip::address_v4::loopback(), 0));
+    Replayer replayer(capture, options, appIo, tunnelIo, listener.local_endpoint());
+
+    bool clientIsHost = false;
+    bool hostIsHost = true;
+    int clientPort = 0;
+    int hostPort = replayer.serverPort();
+    PortMapping mapping = PortMappingTable::defaults().front();
+    mapping.delta = options.delta;
+    PortMappingTable hostMappings("");
+    hostMappings.setLocal({mapping});
+
+    std::vector<HSteamNetConnection> clientConns{clientLink.connection()};
+    std::vector<HSteamNetConnection> hostConns{hostLink.connection()};
+    std::mutex clientConnsMutex, hostConnsMutex;
+    auto clientHandler = std::make_unique<SteamMessageHandler>(tunnelIo, &clientLink, clientConns, clientConnsMutex, clientIsHost, clientPort);
+    auto hostHandler = std::make_unique<SteamMessageHandler>(tunnelIo, &hostLink, hostConns, hostConnsMutex, hostIsHost, hostPort);
+    hostHandler->setPortMappings(&hostMappings);
+    replayer.setHostManager(hostHandler->getMultiplexManager(hostLink.connection()));
+    clientHandler->start();
+    hostHandler->start();
+    clientHandler->startSession(clientLink.connection());
+
+    std::function<void()> acceptNext = [&]()
+    {
+        auto socket = std::make_shared<tcp::socket>(tunnelIo);
+        listener.async_accept(*socket, [&, socket](const boost::system::error_code &ec)
+                              {
+            if (ec)
+            {
+                return;
+            }
+            socket->set_option(tcp::no_delay(true));
+            boost::system::error_code ignored;
+            unsigned short port = socket->remote_endpoint(ignored).port();
+            replayer.addClientId(port, clientHandler->getMultiplexManager(clientLink.connection())->addClient(socket, &mapping));
+            acceptNext(); });
+    };
+    acceptNext();
+
+    std::thread tunnelThread([&]()
+                             { tunnelIo.run(); });
+    std::thread appThread([&]()
+                          { appIo.run(); });
+    auto started = Clock::now();
+    boost::asio::post(appIo, [&]()
+                      { replayer.start(); });
+
+    // Wait for the last event, then for the data still in flight
+    auto ask = [&](bool drained)
+    {
+        std::promise<bool> answer;
+        boost::asio::post(appIo, [&]()
+                          { answer.set_value(drained ? replayer.finished() : replayer.actionsDone()); });
+        return answer.get_future().get();
+    };
+    while (!ask(false))
+    {
+        std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    }
+    auto drainUntil = Clock::now() + std::chrono::seconds(options.drainSec);
+    while (!ask(true) && Clock::now() < drainUntil)
+    {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    double elapsed = std::chrono::duration<double>(Clock::now() - started).count();
+
+    std::promise<void> reported;
+    boost::asio::post(appIo, [&]()
+                      {
+        replayer.report(elapsed, clientLink.getStats(), hostLink.getStats());
+        reported.set_value(); });
+    reported.get_future().wait();
+
+    appIo.stop();
+    appThread.join();
+    clientHandler->stop();
+    hostHandler->stop();
+    tunnelIo.stop();
+    tunnelThread.join();
+    ReadBufferPool::uninstall(tunnelIo);
+}
+
+} // namespace
+
+int main(int argc, char *argv[])
+{
+    bool infoOnly = false;
+    std::string path;
+    Options options;
+    for (int i = 1; i < argc; ++i)
+    {
+        std::string arg = argv[i];
+        if (arg == "--info")
+        {
+            infoOnly = true;
+        }
+        else if (arg.find('=') != std::string::npos)
+        {
+            if (!parseOption(arg, options))
+            {
+                std::cerr << "Unknown option '" << arg << "'" << std::endl;
+                return 2;
+            }
+        }
+        else
+        {
+            path = arg;
+        }
+    }
+    if (path.empty())
+    {
+        std::cerr << "Usage: TunnelReplay [--info] <capture.ctcap> [speed=x] [rtt=ms] [jitter=ms] [loss=%] "
+                     "[bandwidth=kbit/s] [delta=1] [drain=s] [seed=n] [conn=n]"
+                  << std::endl;
+        return 2;
+    }
+    Capture capture;
+    if (!loadCapture(path, options.conn, capture))
+    {
+        return 1;
+    }
+    printCapture(path, capture);
+    if (infoOnly || capture.streams.empty())
+    {
+        return 0;
+    }
+    replay(capture, options);
+    return 0;
+}